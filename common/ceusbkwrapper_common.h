@@ -55,7 +55,9 @@ static const GUID ceusbkwrapper_guid = DEVCLASS_CEUSBKWRAPPER_GUID;
  * only be filled with as many devices as it can hold.
  */
 #define IOCTL_UKW_GET_DEVICES								USBKWRAPPER_CTL_CODE(0)
-/* Releases references to a list of USB devices, presented as UKW_USB_DEVICE elements. */
+/* Releases references to a list of USB devices, presented as UKW_USB_DEVICE elements.
+   If an output buffer is provided it receives a DWORD error code for each element,
+   ERROR_SUCCESS if it was released or ERROR_INVALID_HANDLE if it wasn't valid. */
 #define IOCTL_UKW_PUT_DEVICES								USBKWRAPPER_CTL_CODE(1)
 /* Retrieves the device UKWD_USB_DEVICE_INFO for the provided UKWD_USB_DEVICE. */
 #define IOCTL_UKW_GET_DEVICE_INFO						USBKWRAPPER_CTL_CODE(2)
@@ -94,12 +96,80 @@ static const GUID ceusbkwrapper_guid = DEVCLASS_CEUSBKWRAPPER_GUID;
 #define IOCTL_UKW_IS_PIPE_HALTED					USBKWRAPPER_CTL_CODE(18)
 /* Clears stall (device side) condition of an endpoint in the provided UKWD_ENDPOINT_INFO */
 #define IOCTL_UKW_CLEAR_HALT_DEVICE					USBKWRAPPER_CTL_CODE(19)
+/* Issues a batch of transfer requests using the provided UKWD_SUBMIT_BATCH_INFO. The output
+   buffer receives a DWORD error code for each entry, ERROR_SUCCESS if the entry was started. */
+#define IOCTL_UKW_SUBMIT_BATCH						USBKWRAPPER_CTL_CODE(20)
+/* Enables the completion queue for this handle. After this call every asynchronous transfer
+   is added to the queue on completion, in addition to completing its OVERLAPPED. */
+#define IOCTL_UKW_ENABLE_COMPLETION_QUEUE			USBKWRAPPER_CTL_CODE(21)
+/* Waits for completed transfers using the provided UKWD_REAP_COMPLETIONS_INFO. The output
+   buffer is filled with up to dwCount UKWD_COMPLETION elements. */
+#define IOCTL_UKW_REAP_COMPLETIONS					USBKWRAPPER_CTL_CODE(22)
+/* Sets up shared submission and completion rings using the provided UKWD_SETUP_RINGS_INFO.
+   Passing a NULL lpRegion removes any rings previously set up on this handle. */
+#define IOCTL_UKW_SETUP_RINGS						USBKWRAPPER_CTL_CODE(23)
+/* Starts all transfers queued on the submission ring, then waits for completions using the
+   provided UKWD_RING_DOORBELL_INFO. Returns the number of submissions consumed as a DWORD. */
+#define IOCTL_UKW_RING_DOORBELL						USBKWRAPPER_CTL_CODE(24)
+/* Retrieves transfer pool statistics for this handle as a UKWD_TRANSFER_POOL_STATS. */
+#define IOCTL_UKW_GET_TRANSFER_POOL_STATS			USBKWRAPPER_CTL_CODE(25)
+/* Maps a user buffer for use by later transfers using the provided UKWD_REGISTER_BUFFER_INFO.
+   Returns the buffer id as a DWORD. */
+#define IOCTL_UKW_REGISTER_BUFFER					USBKWRAPPER_CTL_CODE(26)
+/* Unmaps a buffer registered with IOCTL_UKW_REGISTER_BUFFER, taking the buffer id as a DWORD. */
+#define IOCTL_UKW_UNREGISTER_BUFFER					USBKWRAPPER_CTL_CODE(27)
+/* Duplicates an event handle, provided as a HANDLE, so that transfers using it as their
+   OVERLAPPED event don't need to duplicate it again. */
+#define IOCTL_UKW_REGISTER_EVENT					USBKWRAPPER_CTL_CODE(28)
+/* Closes an event handle, provided as a HANDLE, registered with IOCTL_UKW_REGISTER_EVENT. */
+#define IOCTL_UKW_UNREGISTER_EVENT					USBKWRAPPER_CTL_CODE(29)
+/* Starts keeping bulk transfers queued on an endpoint using the provided UKWD_START_STREAM_INFO.
+   Returns the stream id as a DWORD. */
+#define IOCTL_UKW_START_STREAM						USBKWRAPPER_CTL_CODE(30)
+/* Stops a stream started with IOCTL_UKW_START_STREAM, taking the stream id as a DWORD. */
+#define IOCTL_UKW_STOP_STREAM						USBKWRAPPER_CTL_CODE(31)
+/* Reads data received on an IN stream using the provided UKWD_STREAM_IO_INFO. Returns the
+   number of bytes read as a DWORD. */
+#define IOCTL_UKW_STREAM_READ						USBKWRAPPER_CTL_CODE(32)
+/* Queues data to be sent on an OUT stream using the provided UKWD_STREAM_IO_INFO. Returns the
+   number of bytes queued as a DWORD. */
+#define IOCTL_UKW_STREAM_WRITE						USBKWRAPPER_CTL_CODE(33)
+/* Sets how asynchronous bulk transfers on this handle are split into chunks using the provided
+   UKWD_TRANSFER_SPLIT_INFO. */
+#define IOCTL_UKW_SET_TRANSFER_SPLIT				USBKWRAPPER_CTL_CODE(34)
+/* Issues an Interrupt transfer request using data inside the provided UKWD_BULK_TRANSFER_INFO */
+#define IOCTL_UKW_ISSUE_INTERRUPT_TRANSFER			USBKWRAPPER_CTL_CODE(35)
+/* Issues an Isochronous transfer request using data inside the provided UKWD_ISOCH_TRANSFER_INFO */
+#define IOCTL_UKW_ISSUE_ISOCH_TRANSFER				USBKWRAPPER_CTL_CODE(36)
+/* Cancels all pending transfers matching the provided UKWD_CANCEL_ALL_INFO. Returns the number cancelled in the DWORD in output. */
+#define IOCTL_UKW_CANCEL_ALL						USBKWRAPPER_CTL_CODE(37)
+/* Synchronously issues a small Control transfer described by the provided UKWD_INLINE_CONTROL_TRANSFER_INFO,
+   with the data carried in the IOCTL buffers. Returns the number of bytes transferred as the output length. */
+#define IOCTL_UKW_ISSUE_INLINE_CONTROL_TRANSFER		USBKWRAPPER_CTL_CODE(38)
+/* Retrieves a UKWD_DEVICE_LIST holding a UKWD_USB_DEVICE_ENTRY for all currently connected USB devices,
+   in the same way as IOCTL_UKW_GET_DEVICES but including the information for each device and the
+   device list generation the list was taken at. */
+#define IOCTL_UKW_GET_DEVICES_WITH_INFO				USBKWRAPPER_CTL_CODE(39)
+/* Waits for device attach and detach events using the provided UKWD_WAIT_DEVICE_EVENTS_INFO. The output
+   buffer receives a UKWD_DEVICE_EVENTS holding as many events as fit. */
+#define IOCTL_UKW_WAIT_DEVICE_EVENTS				USBKWRAPPER_CTL_CODE(40)
+/* Reads the interface filters from the registry again and uses them for devices attached from
+   then on. If an output buffer is provided, the number of filters read is returned in it as a DWORD. */
+#define IOCTL_UKW_RELOAD_INTERFACE_FILTERS			USBKWRAPPER_CTL_CODE(42)
 
 // Used as a configuration index when the current active configuration is desired.
 #define UKWD_ACTIVE_CONFIGURATION        -1
 
+// Opaque handle to a device, only valid with the driver handle which
+// returned it and until it has been released with IOCTL_UKW_PUT_DEVICES.
 typedef LPVOID UKWD_USB_DEVICE;
 
+// Checks if a structure starting with a dwCount holding its size is large
+// enough to include field f, so that fields can be added to the end of a
+// structure without breaking older callers.
+#define UKWD_HAS_FIELD(p, type, f) \
+	((p)->dwCount >= FIELD_OFFSET(type, f) + sizeof((p)->f))
+
 typedef struct _UKWD_USB_DEVICE_INFO {
 	DWORD dwCount;
 	unsigned char Bus;
@@ -108,6 +178,56 @@ typedef struct _UKWD_USB_DEVICE_INFO {
 	USB_DEVICE_DESCRIPTOR Descriptor;
 } UKWD_USB_DEVICE_INFO, * PUKWD_USB_DEVICE_INFO, * LPUKWD_USB_DEVICE_INFO;
 
+// Values for UKWD_DEVICE_EVENT.dwType
+#define UKWD_DEVICE_EVENT_ATTACHED       1
+#define UKWD_DEVICE_EVENT_DETACHED       2
+
+// Maximum number of device events queued for each handle, once
+// full the oldest events are dropped.
+#define UKWD_MAX_DEVICE_EVENTS           32
+
+// The device list generation increases by one for every attach or
+// detach, dwGeneration is the generation reached by this event.
+typedef struct _UKWD_DEVICE_EVENT {
+	DWORD dwType;
+	DWORD dwGeneration;
+	UKWD_USB_DEVICE_INFO Info;
+} UKWD_DEVICE_EVENT, * PUKWD_DEVICE_EVENT, * LPUKWD_DEVICE_EVENT;
+
+typedef struct _UKWD_WAIT_DEVICE_EVENTS_INFO {
+	DWORD dwCount;
+	DWORD dwTimeout; // In milliseconds, can be INFINITE
+} UKWD_WAIT_DEVICE_EVENTS_INFO, * PUKWD_WAIT_DEVICE_EVENTS_INFO, * LPUKWD_WAIT_DEVICE_EVENTS_INFO;
+
+// Set in UKWD_DEVICE_EVENTS.dwFlags if events were dropped since the last wait
+#define UKWD_DEVICE_EVENTS_OVERFLOW      0x00000001
+
+typedef struct _UKWD_DEVICE_EVENTS {
+	DWORD dwGeneration; // Generation reached once these events are applied
+	DWORD dwFlags;
+	DWORD dwEvents;
+	UKWD_DEVICE_EVENT Events[1]; // Actually dwEvents long
+} UKWD_DEVICE_EVENTS, * PUKWD_DEVICE_EVENTS, * LPUKWD_DEVICE_EVENTS;
+
+// Size in bytes of a UKWD_DEVICE_EVENTS holding n events
+#define UKWD_DEVICE_EVENTS_SIZE(n) \
+	(FIELD_OFFSET(UKWD_DEVICE_EVENTS, Events) + (n) * sizeof(UKWD_DEVICE_EVENT))
+
+typedef struct _UKWD_USB_DEVICE_ENTRY {
+	UKWD_USB_DEVICE lpDevice;
+	UKWD_USB_DEVICE_INFO Info;
+} UKWD_USB_DEVICE_ENTRY, * PUKWD_USB_DEVICE_ENTRY, * LPUKWD_USB_DEVICE_ENTRY;
+
+typedef struct _UKWD_DEVICE_LIST {
+	DWORD dwGeneration; // Generation of the device list when it was read
+	DWORD dwDevices;
+	UKWD_USB_DEVICE_ENTRY Entries[1]; // Actually dwDevices long
+} UKWD_DEVICE_LIST, * PUKWD_DEVICE_LIST, * LPUKWD_DEVICE_LIST;
+
+// Size in bytes of a UKWD_DEVICE_LIST holding n devices
+#define UKWD_DEVICE_LIST_SIZE(n) \
+	(FIELD_OFFSET(UKWD_DEVICE_LIST, Entries) + (n) * sizeof(UKWD_USB_DEVICE_ENTRY))
+
 typedef struct _UKWD_CONTROL_TRANSFER_INFO {
 	DWORD dwCount;
 	UKWD_USB_DEVICE lpDevice;
@@ -117,8 +237,41 @@ typedef struct _UKWD_CONTROL_TRANSFER_INFO {
 	DWORD dwDataBufferSize;
 	LPDWORD pBytesTransferred;
 	LPOVERLAPPED lpOverlapped;
+	DWORD dwBufferId; // 0, or a registered buffer to use instead of lpDataBuffer
+	DWORD dwBufferOffset; // Offset into the registered buffer
+	DWORD dwTimeoutMs; // 0 or INFINITE for no timeout
 } UKWD_CONTROL_TRANSFER_INFO, * PUKWD_CONTROL_TRANSFER_INFO, * LPUKWD_CONTROL_TRANSFER_INFO;
 
+// Smallest dwCount accepted for a UKWD_CONTROL_TRANSFER_INFO, which is the
+// size of the structure before dwBufferId was added.
+#define UKWD_CONTROL_TRANSFER_INFO_MIN_SIZE \
+	FIELD_OFFSET(UKWD_CONTROL_TRANSFER_INFO, dwBufferId)
+
+// Maximum data size of a control transfer issued with IOCTL_UKW_ISSUE_INLINE_CONTROL_TRANSFER
+#define UKWD_MAX_INLINE_CONTROL_DATA     256
+
+// For OUT transfers the Header.wLength bytes of data immediately follow this
+// structure in the input buffer. For IN transfers the data is returned in the
+// output buffer, which must be at least Header.wLength bytes.
+typedef struct _UKWD_INLINE_CONTROL_TRANSFER_INFO {
+	DWORD dwCount;
+	UKWD_USB_DEVICE lpDevice;
+	DWORD dwFlags; // Using flags from Usbtypes.h
+	USB_DEVICE_REQUEST Header;
+} UKWD_INLINE_CONTROL_TRANSFER_INFO, * PUKWD_INLINE_CONTROL_TRANSFER_INFO, * LPUKWD_INLINE_CONTROL_TRANSFER_INFO;
+
+// Maximum number of segments in a vectored bulk transfer
+#define UKWD_MAX_BULK_SEGMENTS           16
+
+// Maximum total size of the segments in a vectored bulk transfer, as the
+// driver gathers them into a single buffer of this size.
+#define UKWD_MAX_BULK_SEGMENTS_SIZE      (1024 * 1024)
+
+typedef struct _UKWD_BUFFER_SEGMENT {
+	LPVOID lpBuffer;
+	DWORD dwBufferSize;
+} UKWD_BUFFER_SEGMENT, * PUKWD_BUFFER_SEGMENT, * LPUKWD_BUFFER_SEGMENT;
+
 typedef struct _UKWD_BULK_TRANSFER_INFO {
 	DWORD dwCount;
 	UKWD_USB_DEVICE lpDevice;
@@ -128,8 +281,20 @@ typedef struct _UKWD_BULK_TRANSFER_INFO {
 	DWORD dwDataBufferSize;
 	LPDWORD pBytesTransferred;
 	LPOVERLAPPED lpOverlapped;
+	DWORD dwBufferId; // 0, or a registered buffer to use instead of lpDataBuffer
+	DWORD dwBufferOffset; // Offset into the registered buffer
+	// If dwSegments isn't 0 then the data is gathered from, or scattered to,
+	// lpSegments instead of using lpDataBuffer and dwDataBufferSize.
+	LPUKWD_BUFFER_SEGMENT lpSegments;
+	DWORD dwSegments;
+	DWORD dwTimeoutMs; // 0 or INFINITE for no timeout
 } UKWD_BULK_TRANSFER_INFO, * PUKWD_BULK_TRANSFER_INFO, * LPUKWD_BULK_TRANSFER_INFO;
 
+// Smallest dwCount accepted for a UKWD_BULK_TRANSFER_INFO, which is the
+// size of the structure before dwBufferId was added.
+#define UKWD_BULK_TRANSFER_INFO_MIN_SIZE \
+	FIELD_OFFSET(UKWD_BULK_TRANSFER_INFO, dwBufferId)
+
 typedef struct _UKWD_CANCEL_TRANSFER_INFO {
 	DWORD dwCount;
 	UKWD_USB_DEVICE lpDevice;
@@ -137,6 +302,20 @@ typedef struct _UKWD_CANCEL_TRANSFER_INFO {
 	DWORD dwFlags;
 } UKWD_CANCEL_TRANSFER_INFO, * PUKWD_CANCEL_TRANSFER_INFO, * LPUKWD_CANCEL_TRANSFER_INFO;
 
+// Scopes for UKWD_CANCEL_ALL_INFO
+#define UKWD_CANCEL_SCOPE_DEVICE         0 // Every transfer on lpDevice
+#define UKWD_CANCEL_SCOPE_INTERFACE      1 // Transfers on endpoints of dwInterface
+#define UKWD_CANCEL_SCOPE_ENDPOINT       2 // Transfers on Endpoint, 0 for control transfers
+
+typedef struct _UKWD_CANCEL_ALL_INFO {
+	DWORD dwCount;
+	UKWD_USB_DEVICE lpDevice;
+	DWORD dwScope;
+	DWORD dwInterface;
+	UCHAR Endpoint;
+	DWORD dwFlags;
+} UKWD_CANCEL_ALL_INFO, * PUKWD_CANCEL_ALL_INFO, * LPUKWD_CANCEL_ALL_INFO;
+
 typedef struct _UKWD_GET_CONFIG_DESC_INFO {
 	DWORD dwCount;
 	UKWD_USB_DEVICE lpDevice;
@@ -170,4 +349,203 @@ typedef struct _UKWD_SET_ALTSETTING_INFO {
 	DWORD dwAlternateSetting;
 } UKWD_SET_ALTSETTING_INFO, * PUKWD_SET_ALTSETTING_INFO, * LPUKWD_SET_ALTSETTING_INFO;
 
+// Values for UKWD_BATCH_TRANSFER_ENTRY.dwType
+#define UKWD_BATCH_CONTROL_TRANSFER      0
+#define UKWD_BATCH_BULK_TRANSFER         1
+
+// Maximum number of entries in a single UKWD_SUBMIT_BATCH_INFO
+#define UKWD_MAX_BATCH_ENTRIES           256
+
+// Maps an endpoint address to an index between 0 and UKWD_MAX_ENDPOINT_INDEX - 1
+#define UKWD_MAX_ENDPOINT_INDEX          32
+#define UKWD_ENDPOINT_INDEX(ep)          (((ep) & 0x0F) | (((ep) & 0x80) >> 3))
+
+typedef struct _UKWD_BATCH_TRANSFER_ENTRY {
+	DWORD dwType;
+	union {
+		UKWD_CONTROL_TRANSFER_INFO Control;
+		UKWD_BULK_TRANSFER_INFO Bulk;
+	};
+} UKWD_BATCH_TRANSFER_ENTRY, * PUKWD_BATCH_TRANSFER_ENTRY, * LPUKWD_BATCH_TRANSFER_ENTRY;
+
+// All entries in a batch must be for the same device.
+typedef struct _UKWD_SUBMIT_BATCH_INFO {
+	DWORD dwCount;
+	UKWD_USB_DEVICE lpDevice;
+	DWORD dwEntries;
+	UKWD_BATCH_TRANSFER_ENTRY Entries[1]; // Actually dwEntries long
+} UKWD_SUBMIT_BATCH_INFO, * PUKWD_SUBMIT_BATCH_INFO, * LPUKWD_SUBMIT_BATCH_INFO;
+
+// Size in bytes of a UKWD_SUBMIT_BATCH_INFO holding n entries
+#define UKWD_SUBMIT_BATCH_INFO_SIZE(n) \
+	(FIELD_OFFSET(UKWD_SUBMIT_BATCH_INFO, Entries) + (n) * sizeof(UKWD_BATCH_TRANSFER_ENTRY))
+
+typedef struct _UKWD_REAP_COMPLETIONS_INFO {
+	DWORD dwCount;
+	DWORD dwTimeout; // In milliseconds, can be INFINITE
+} UKWD_REAP_COMPLETIONS_INFO, * PUKWD_REAP_COMPLETIONS_INFO, * LPUKWD_REAP_COMPLETIONS_INFO;
+
+typedef struct _UKWD_COMPLETION {
+	LPOVERLAPPED lpOverlapped; // Unmarshalled pointer provided with the transfer
+	DWORD dwError;
+	DWORD dwBytesTransferred;
+} UKWD_COMPLETION, * PUKWD_COMPLETION, * LPUKWD_COMPLETION;
+
+// Maximum number of entries in either shared ring
+#define UKWD_MAX_RING_ENTRIES            4096
+
+// Ring indices are free running counters, masked by the ring size (a power
+// of two) to find the entry. The producer of a ring owns Tail and the consumer
+// owns Head. They are only accessed with interlocked operations, which also
+// act as memory barriers between the library and the driver.
+typedef struct _UKWD_RING_INDICES {
+	LONG Head;
+	LONG Tail;
+} UKWD_RING_INDICES, * PUKWD_RING_INDICES, * LPUKWD_RING_INDICES;
+
+#define UKWD_RING_READ_INDEX(p)          InterlockedCompareExchange((p), 0, 0)
+#define UKWD_RING_WRITE_INDEX(p, v)      InterlockedExchange((p), (v))
+// Number of entries between two ring indices, which is only valid if no
+// more than the ring size as the other side may have written anything.
+#define UKWD_RING_USED(tail, head)       ((DWORD) ((tail) - (head)))
+// Position in a ring of n entries of the entry at a ring index
+#define UKWD_RING_SLOT(index, n)         ((DWORD) (index) & ((n) - 1))
+// Checks that n is a valid number of entries for a ring
+#define UKWD_RING_VALID_ENTRIES(n) \
+	((n) != 0 && ((n) & ((n) - 1)) == 0 && (n) <= UKWD_MAX_RING_ENTRIES)
+
+// Start of the shared ring region. It is followed by dwSubmissionEntries
+// UKWD_BATCH_TRANSFER_ENTRY elements and then by dwCompletionEntries
+// UKWD_COMPLETION elements. The library produces submissions and the
+// driver produces completions.
+typedef struct _UKWD_RINGS_HEADER {
+	DWORD dwSubmissionEntries;
+	DWORD dwCompletionEntries;
+	UKWD_RING_INDICES Submission;
+	UKWD_RING_INDICES Completion;
+} UKWD_RINGS_HEADER, * PUKWD_RINGS_HEADER, * LPUKWD_RINGS_HEADER;
+
+// Size in bytes of a shared ring region with the given number of entries
+#define UKWD_RINGS_SIZE(s, c) \
+	(sizeof(UKWD_RINGS_HEADER) + \
+	 (s) * sizeof(UKWD_BATCH_TRANSFER_ENTRY) + \
+	 (c) * sizeof(UKWD_COMPLETION))
+
+typedef struct _UKWD_SETUP_RINGS_INFO {
+	DWORD dwCount;
+	LPVOID lpRegion;
+	DWORD dwRegionSize;
+} UKWD_SETUP_RINGS_INFO, * PUKWD_SETUP_RINGS_INFO, * LPUKWD_SETUP_RINGS_INFO;
+
+typedef struct _UKWD_RING_DOORBELL_INFO {
+	DWORD dwCount;
+	DWORD dwMinCompletions; // Can be 0 to not wait at all
+	DWORD dwTimeout; // In milliseconds, can be INFINITE
+} UKWD_RING_DOORBELL_INFO, * PUKWD_RING_DOORBELL_INFO, * LPUKWD_RING_DOORBELL_INFO;
+
+typedef struct _UKWD_TRANSFER_POOL_STATS {
+	DWORD dwCount;
+	DWORD dwInUse; // Transfers currently allocated from the pool
+	DWORD dwHighWaterMark; // Largest value dwInUse has reached
+	DWORD dwFree; // Transfers available for reuse
+	DWORD dwAllocated; // Transfers the pool has had to create
+	DWORD dwOversized; // Transfers too large for the pool
+} UKWD_TRANSFER_POOL_STATS, * PUKWD_TRANSFER_POOL_STATS, * LPUKWD_TRANSFER_POOL_STATS;
+
+// Maximum number of buffers registered on a handle at once
+#define UKWD_MAX_REGISTERED_BUFFERS      64
+
+// Maximum number of events registered on a handle at once
+#define UKWD_MAX_REGISTERED_EVENTS       64
+
+typedef struct _UKWD_REGISTER_BUFFER_INFO {
+	DWORD dwCount;
+	LPVOID lpBuffer;
+	DWORD dwBufferSize;
+} UKWD_REGISTER_BUFFER_INFO, * PUKWD_REGISTER_BUFFER_INFO, * LPUKWD_REGISTER_BUFFER_INFO;
+
+// Maximum number of streams started on a handle at once
+#define UKWD_MAX_STREAMS                 8
+
+// Maximum number of transfers a stream keeps queued
+#define UKWD_MAX_STREAM_TRANSFERS        32
+
+// Maximum size of the buffer owned by a stream
+#define UKWD_MAX_STREAM_BUFFER_SIZE      0x400000
+
+// Flags for the dwFlags field of UKWD_START_STREAM_INFO
+// Queue interrupt transfers instead of bulk transfers. Each read from an
+// IN stream then returns the data of a single transfer.
+#define UKWD_STREAM_INTERRUPT            0x00000001
+
+// The direction of a stream is taken from the endpoint address. The
+// buffer is split into dwBufferSize / dwTransferSize transfers, of
+// which up to dwTransfers are queued on the endpoint at any time.
+typedef struct _UKWD_START_STREAM_INFO {
+	DWORD dwCount;
+	UKWD_USB_DEVICE lpDevice;
+	UCHAR Endpoint;
+	DWORD dwTransferSize;
+	DWORD dwTransfers;
+	DWORD dwBufferSize;
+	DWORD dwFlags;
+} UKWD_START_STREAM_INFO, * PUKWD_START_STREAM_INFO, * LPUKWD_START_STREAM_INFO;
+
+typedef struct _UKWD_STREAM_IO_INFO {
+	DWORD dwCount;
+	DWORD dwStreamId;
+	LPVOID lpBuffer;
+	DWORD dwBufferSize;
+	DWORD dwTimeout; // In milliseconds, can be INFINITE
+} UKWD_STREAM_IO_INFO, * PUKWD_STREAM_IO_INFO, * LPUKWD_STREAM_IO_INFO;
+
+// Maximum number of chunks of a split transfer issued at once
+#define UKWD_MAX_SPLIT_CHUNKS            16
+
+// Chunk sizes must be a multiple of this, so that only the last chunk
+// of a transfer can end with a short packet
+#define UKWD_SPLIT_CHUNK_ALIGNMENT       1024
+
+// Asynchronous bulk transfers larger than dwChunkSize are issued as
+// chunks of dwChunkSize bytes, with up to dwMaxChunks of them queued at
+// once, and complete as a single transfer. A dwChunkSize of 0 disables
+// splitting, which is the default.
+typedef struct _UKWD_TRANSFER_SPLIT_INFO {
+	DWORD dwCount;
+	DWORD dwChunkSize;
+	DWORD dwMaxChunks;
+} UKWD_TRANSFER_SPLIT_INFO, * PUKWD_TRANSFER_SPLIT_INFO, * LPUKWD_TRANSFER_SPLIT_INFO;
+
+// Maximum number of frames in an isochronous transfer
+#define UKWD_MAX_ISOCH_FRAMES            64
+
+// One frame of an isochronous transfer. dwLength is the number of bytes
+// to transfer in the frame, the other fields are set on completion.
+typedef struct _UKWD_ISOCH_FRAME {
+	DWORD dwLength;
+	DWORD dwBytesTransferred;
+	DWORD dwError;
+} UKWD_ISOCH_FRAME, * PUKWD_ISOCH_FRAME, * LPUKWD_ISOCH_FRAME;
+
+// The frames are transferred using consecutive parts of lpDataBuffer.
+// dwStartingFrame is ignored if dwFlags contains USB_START_ISOCH_ASAP.
+typedef struct _UKWD_ISOCH_TRANSFER_INFO {
+	DWORD dwCount;
+	UKWD_USB_DEVICE lpDevice;
+	UCHAR Endpoint;
+	DWORD dwFlags;
+	DWORD dwStartingFrame;
+	LPUKWD_ISOCH_FRAME lpFrames;
+	DWORD dwFrames;
+	LPVOID lpDataBuffer;
+	DWORD dwDataBufferSize;
+	LPDWORD pBytesTransferred;
+	LPOVERLAPPED lpOverlapped;
+} UKWD_ISOCH_TRANSFER_INFO, * PUKWD_ISOCH_TRANSFER_INFO, * LPUKWD_ISOCH_TRANSFER_INFO;
+
+// Smallest dwCount accepted for a UKWD_ISOCH_TRANSFER_INFO, which is the
+// whole structure as no fields have been added to it.
+#define UKWD_ISOCH_TRANSFER_INFO_MIN_SIZE \
+	sizeof(UKWD_ISOCH_TRANSFER_INFO)
+
 #endif // CEUSBKWRAPPER_COMMON_H
@@ -0,0 +1,524 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// BulkStream.cpp : Bulk transfers kept permanently queued on an endpoint
+
+#include "StdAfx.h"
+#include "BulkStream.h"
+#include "UsbDevice.h"
+#include "Transfer.h"
+#include "UserBuffer.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+#include <new>
+
+// States of a BulkStreamSegment
+#define SEGMENT_FREE     0
+// Holds data waiting to be sent on an OUT stream
+#define SEGMENT_QUEUED   1
+// Issued as a bulk transfer
+#define SEGMENT_PENDING  2
+// Holds data received on an IN stream
+#define SEGMENT_RECEIVED 3
+
+// How long Stop() waits for cancelled transfers to complete
+#define STREAM_STOP_TIMEOUT 5000
+
+BulkStream::BulkStream(DevicePtr& device, DWORD dwInterface, LPUKWD_START_STREAM_INFO lpStreamInfo)
+: mRefCount(1)
+, mDevicePtr(device)
+, mInterface(dwInterface)
+, mEndpoint(lpStreamInfo->Endpoint)
+, mIn((lpStreamInfo->Endpoint & 0x80) != 0)
+, mInterrupt((lpStreamInfo->dwFlags & UKWD_STREAM_INTERRUPT) != 0)
+, mTransferSize(lpStreamInfo->dwTransferSize)
+, mMaxTransfers(lpStreamInfo->dwTransfers)
+, mSegmentCount(lpStreamInfo->dwTransferSize ?
+	lpStreamInfo->dwBufferSize / lpStreamInfo->dwTransferSize : 0)
+, mBuffer(NULL)
+, mSegments(NULL)
+, mMutex(NULL)
+, mEvent(NULL)
+, mReadIndex(0)
+, mIssueIndex(0)
+, mFillIndex(0)
+, mTransfersQueued(0)
+, mIssuing(FALSE)
+, mError(ERROR_SUCCESS)
+, mStopping(FALSE)
+{
+}
+
+BulkStream::~BulkStream()
+{
+	delete [] mSegments;
+	delete [] mBuffer;
+	if (mEvent)
+		CloseHandle(mEvent);
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL BulkStream::Init()
+{
+	if (mMaxTransfers == 0 || mMaxTransfers > UKWD_MAX_STREAM_TRANSFERS ||
+		mTransferSize == 0 || mSegmentCount < mMaxTransfers ||
+		mSegmentCount * mTransferSize > UKWD_MAX_STREAM_BUFFER_SIZE) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::Init() - invalid stream of %d transfers of %d bytes in %d segments\r\n"),
+			mMaxTransfers, mTransferSize, mSegmentCount));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	mEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (mEvent == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::Init() - failed to create event\r\n")));
+		return FALSE;
+	}
+	mBuffer = new (std::nothrow) BYTE[mSegmentCount * mTransferSize];
+	mSegments = new (std::nothrow) BulkStreamSegment[mSegmentCount];
+	if (!mBuffer || !mSegments) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::Init() - failed to allocate %d segments\r\n"),
+			mSegmentCount));
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	for (DWORD i = 0; i < mSegmentCount; ++i) {
+		BulkStreamSegment& segment = mSegments[i];
+		segment.mStream = this;
+		segment.mData = mBuffer + i * mTransferSize;
+		segment.mTransfer = NULL;
+		segment.mState = SEGMENT_FREE;
+		segment.mBytes = 0;
+		segment.mOffset = 0;
+		segment.mCompletedEarly = FALSE;
+	}
+	return TRUE;
+}
+
+BOOL BulkStream::Start()
+{
+	MutexLocker lock(mMutex);
+	if (mIn) {
+		IssueSegments(lock);
+		if (mTransfersQueued == 0) {
+			SetLastError(mError);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+BOOL BulkStream::Stop()
+{
+	MutexLocker lock(mMutex);
+	mStopping = TRUE;
+	Signal();
+	// Holding the lock stops the completion callbacks from closing the
+	// transfers, so this mustn't wait for the cancellation to complete.
+	for (DWORD i = mReadIndex; i != mIssueIndex; ++i) {
+		BulkStreamSegment& segment = Segment(i);
+		if (segment.mState == SEGMENT_PENDING && segment.mTransfer)
+			mDevicePtr->CancelTransfer(segment.mTransfer, USB_NO_WAIT);
+	}
+	DWORD startTime = GetTickCount();
+	while (mTransfersQueued > 0) {
+		DWORD elapsed = GetTickCount() - startTime;
+		if (elapsed >= STREAM_STOP_TIMEOUT) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::Stop() - %d transfers on endpoint 0x%02x didn't complete\r\n"),
+				mTransfersQueued, mEndpoint));
+			return FALSE;
+		}
+		ResetEvent(mEvent);
+		lock.unlock();
+		WaitForSingleObject(mEvent, STREAM_STOP_TIMEOUT - elapsed);
+		lock.relock();
+	}
+	return TRUE;
+}
+
+void BulkStream::Abort()
+{
+	MutexLocker lock(mMutex);
+	mStopping = TRUE;
+	Signal();
+}
+
+BOOL BulkStream::Read(LPVOID lpBuffer, DWORD dwSize, LPDWORD lpdwRead, DWORD dwTimeout)
+{
+	*lpdwRead = 0;
+	if (!mIn) {
+		SetLastError(ERROR_INVALID_FUNCTION);
+		return FALSE;
+	}
+	UserBuffer<LPVOID> buffer(UBA_WRITE, lpBuffer, dwSize);
+	if (!buffer.Valid() || !buffer.Ptr()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::Read() - failed to map user buffer\r\n")));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	LPBYTE dest = static_cast<LPBYTE>(buffer.Ptr());
+	DWORD startTime = GetTickCount();
+	MutexLocker lock(mMutex);
+	DWORD read = 0;
+	for (;;) {
+		// Received segments are always read in the order they were issued
+		while (read < dwSize && mReadIndex != mIssueIndex &&
+				Segment(mReadIndex).mState == SEGMENT_RECEIVED) {
+			BulkStreamSegment& segment = Segment(mReadIndex);
+			DWORD count = min(dwSize - read, segment.mBytes - segment.mOffset);
+			memcpy(dest + read, segment.mData + segment.mOffset, count);
+			read += count;
+			segment.mOffset += count;
+			// Interrupt reports aren't split between reads, so any
+			// part which didn't fit is discarded.
+			if (segment.mOffset == segment.mBytes || mInterrupt) {
+				segment.mState = SEGMENT_FREE;
+				++mReadIndex;
+			}
+			// Empty reports are skipped rather than returned
+			if (mInterrupt && count > 0)
+				break;
+		}
+		if (read > 0)
+			break;
+		if (mReadIndex == mIssueIndex && mError != ERROR_SUCCESS) {
+			SetLastError(mError);
+			return FALSE;
+		}
+		// Segments freed above must be queued again before waiting, as
+		// otherwise nothing might complete to wake this thread.
+		IssueSegments(lock);
+		if (!Wait(lock, startTime, dwTimeout))
+			return FALSE;
+	}
+	// Reading may have freed space for more transfers
+	IssueSegments(lock);
+	lock.unlock();
+	buffer.Flush();
+	*lpdwRead = read;
+	return TRUE;
+}
+
+BOOL BulkStream::Write(LPVOID lpBuffer, DWORD dwSize, LPDWORD lpdwWritten, DWORD dwTimeout)
+{
+	*lpdwWritten = 0;
+	if (mIn) {
+		SetLastError(ERROR_INVALID_FUNCTION);
+		return FALSE;
+	}
+	UserBuffer<LPVOID> buffer(UBA_READ, lpBuffer, dwSize);
+	if (!buffer.Valid() || (dwSize > 0 && !buffer.Ptr())) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::Write() - failed to map user buffer\r\n")));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	LPBYTE src = static_cast<LPBYTE>(buffer.Ptr());
+	DWORD startTime = GetTickCount();
+	MutexLocker lock(mMutex);
+	DWORD written = 0;
+	for (;;) {
+		if (mError != ERROR_SUCCESS) {
+			// Data after the failed transfer will never be sent
+			SetLastError(mError);
+			return FALSE;
+		}
+		while (written < dwSize && mFillIndex - mReadIndex < mSegmentCount) {
+			BulkStreamSegment& segment = Segment(mFillIndex);
+			DWORD count = min(dwSize - written, mTransferSize);
+			memcpy(segment.mData, src + written, count);
+			segment.mBytes = count;
+			segment.mState = SEGMENT_QUEUED;
+			written += count;
+			++mFillIndex;
+		}
+		IssueSegments(lock);
+		if (dwSize > 0 ? written == dwSize : mReadIndex == mFillIndex)
+			break;
+		if (!Wait(lock, startTime, dwTimeout)) {
+			if (written > 0 && GetLastError() == ERROR_TIMEOUT)
+				// Report the data which was queued before the timeout
+				break;
+			return FALSE;
+		}
+	}
+	*lpdwWritten = written;
+	return TRUE;
+}
+
+void BulkStream::IncRef()
+{
+	InterlockedIncrement(&mRefCount);
+}
+
+void BulkStream::DecRef()
+{
+	if (InterlockedDecrement(&mRefCount) == 0)
+		delete this;
+}
+
+BulkStreamSegment& BulkStream::Segment(DWORD dwIndex)
+{
+	return mSegments[dwIndex % mSegmentCount];
+}
+
+// Should be called with mMutex held.
+void BulkStream::IssueSegments(MutexLocker& lock)
+{
+	// Only one thread issues transfers at a time, so that they reach the
+	// pipe in order. Any other thread which frees a segment meanwhile
+	// leaves it to the issuing thread.
+	if (mIssuing)
+		return;
+	mIssuing = TRUE;
+	while (!mStopping && mError == ERROR_SUCCESS && mTransfersQueued < mMaxTransfers) {
+		if (mIn ? (mIssueIndex - mReadIndex == mSegmentCount) : (mIssueIndex == mFillIndex))
+			break;
+		BulkStreamSegment& segment = Segment(mIssueIndex);
+		segment.mState = SEGMENT_PENDING;
+		segment.mCompletedEarly = FALSE;
+		if (mIn) {
+			segment.mBytes = 0;
+			segment.mOffset = 0;
+		}
+		++mIssueIndex;
+		++mTransfersQueued;
+		// The lock isn't held while issuing, as the device won't complete
+		// transfers while this thread would be waiting for the lock.
+		lock.unlock();
+		DWORD flags = mIn ? (USB_IN_TRANSFER | USB_SHORT_TRANSFER_OK) : USB_OUT_TRANSFER;
+		DWORD size = mIn ? mTransferSize : segment.mBytes;
+		USB_TRANSFER transfer = mInterrupt ?
+			mDevicePtr->IssueInterruptTransfer(
+				&SegmentNotifyRoutine, &segment,
+				mInterface, mEndpoint, flags, size, segment.mData) :
+			mDevicePtr->IssueBulkTransfer(
+				&SegmentNotifyRoutine, &segment,
+				mInterface, mEndpoint, flags, size, segment.mData);
+		DWORD error = GetLastError();
+		lock.relock();
+		if (!transfer) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::IssueSegments() - failed to issue transfer on endpoint 0x%02x: %d\r\n"),
+				mEndpoint, error));
+			mError = error;
+			--mIssueIndex;
+			--mTransfersQueued;
+			segment.mState = mIn ? SEGMENT_FREE : SEGMENT_QUEUED;
+			Signal();
+			break;
+		}
+		segment.mTransfer = transfer;
+		if (segment.mCompletedEarly)
+			// The callback ran before the handle was known
+			SegmentComplete(segment);
+		else if (mStopping)
+			// Stop() couldn't cancel the transfer without the handle
+			mDevicePtr->CancelTransfer(transfer, USB_NO_WAIT);
+	}
+	mIssuing = FALSE;
+}
+
+DWORD WINAPI BulkStream::SegmentNotifyRoutine(LPVOID lpvNotifyParameter)
+{
+	BulkStreamSegment* segment = static_cast<BulkStreamSegment*>(lpvNotifyParameter);
+	BulkStream* stream = segment->mStream;
+	MutexLocker lock(stream->mMutex);
+	if (!segment->mTransfer) {
+		// IssueSegments() will complete the segment once it has the handle
+		segment->mCompletedEarly = TRUE;
+		return 0;
+	}
+	stream->SegmentComplete(*segment);
+	// Replace the transfer before anything else can run
+	stream->IssueSegments(lock);
+	return 0;
+}
+
+// Should be called with mMutex held.
+void BulkStream::SegmentComplete(BulkStreamSegment& segment)
+{
+	DWORD bytesTransferred = 0, transferError = USB_NO_ERROR;
+	if (!mDevicePtr->GetTransferStatusNoLock(segment.mTransfer, &bytesTransferred, &transferError)) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::SegmentComplete() used invalid transfer handle\r\n")));
+		transferError = USB_CANCELED_ERROR;
+		bytesTransferred = 0;
+	}
+	mDevicePtr->CloseTransfer(segment.mTransfer);
+	segment.mTransfer = NULL;
+	--mTransfersQueued;
+
+	if (transferError != USB_NO_ERROR && mError == ERROR_SUCCESS && !mStopping) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::SegmentComplete() transfer on endpoint 0x%02x failed with USB error %d\r\n"),
+			mEndpoint, transferError));
+		mError = Transfer::TranslateError(transferError, 0, FALSE);
+	}
+	if (mIn) {
+		segment.mBytes = bytesTransferred;
+		segment.mOffset = 0;
+		segment.mState = SEGMENT_RECEIVED;
+		// Empty segments are skipped here so that readers only wake for data
+		while (mReadIndex != mIssueIndex && Segment(mReadIndex).mState == SEGMENT_RECEIVED &&
+				Segment(mReadIndex).mBytes == 0) {
+			Segment(mReadIndex).mState = SEGMENT_FREE;
+			++mReadIndex;
+		}
+	} else {
+		segment.mState = SEGMENT_FREE;
+		while (mReadIndex != mIssueIndex && Segment(mReadIndex).mState == SEGMENT_FREE)
+			++mReadIndex;
+	}
+	Signal();
+}
+
+// Should be called with mMutex held.
+void BulkStream::Signal()
+{
+	SetEvent(mEvent);
+}
+
+// Should be called with mMutex held.
+BOOL BulkStream::Wait(MutexLocker& lock, DWORD dwStartTime, DWORD dwTimeout)
+{
+	if (mStopping) {
+		SetLastError(ERROR_OPERATION_ABORTED);
+		return FALSE;
+	}
+	DWORD waitTime = dwTimeout;
+	if (dwTimeout != INFINITE) {
+		DWORD elapsed = GetTickCount() - dwStartTime;
+		if (elapsed >= dwTimeout) {
+			SetLastError(ERROR_TIMEOUT);
+			return FALSE;
+		}
+		waitTime = dwTimeout - elapsed;
+	}
+	// The caller checks the state again after waking, so any
+	// change made after this point will be seen.
+	ResetEvent(mEvent);
+	lock.unlock();
+	DWORD waitState = WaitForSingleObject(mEvent, waitTime);
+	lock.relock();
+	if (waitState != WAIT_OBJECT_0 && waitState != WAIT_TIMEOUT) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStream::Wait() - wait failed with %d\r\n"),
+			GetLastError()));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BulkStreamTable::BulkStreamTable()
+: mMutex(NULL)
+{
+	memset(mStreams, 0, sizeof(mStreams));
+}
+
+BulkStreamTable::~BulkStreamTable()
+{
+	for (DWORD i = 0; i < UKWD_MAX_STREAMS; ++i) {
+		if (mStreams[i])
+			StopStream(mStreams[i]);
+	}
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL BulkStreamTable::Init()
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkStreamTable::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL BulkStreamTable::Add(BulkStream* lpStream, LPDWORD lpdwStreamId)
+{
+	MutexLocker lock(mMutex);
+	for (DWORD i = 0; i < UKWD_MAX_STREAMS; ++i) {
+		if (!mStreams[i]) {
+			if (!lpStream->Start()) {
+				lock.unlock();
+				StopStream(lpStream);
+				return FALSE;
+			}
+			mStreams[i] = lpStream;
+			*lpdwStreamId = i + 1;
+			return TRUE;
+		}
+	}
+	lock.unlock();
+	ERROR_MSG((TEXT("USBKWrapperDrv!BulkStreamTable::Add() - all %d streams in use\r\n"),
+		UKWD_MAX_STREAMS));
+	lpStream->DecRef();
+	SetLastError(ERROR_TOO_MANY_OPEN_FILES);
+	return FALSE;
+}
+
+BOOL BulkStreamTable::Remove(DWORD dwStreamId)
+{
+	BulkStream* stream = NULL;
+	{
+		MutexLocker lock(mMutex);
+		if (dwStreamId == 0 || dwStreamId > UKWD_MAX_STREAMS ||
+			!mStreams[dwStreamId - 1]) {
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return FALSE;
+		}
+		stream = mStreams[dwStreamId - 1];
+		mStreams[dwStreamId - 1] = NULL;
+	}
+	StopStream(stream);
+	return TRUE;
+}
+
+BulkStream* BulkStreamTable::GetStream(DWORD dwStreamId)
+{
+	if (dwStreamId == 0 || dwStreamId > UKWD_MAX_STREAMS)
+		return NULL;
+	MutexLocker lock(mMutex);
+	BulkStream* stream = mStreams[dwStreamId - 1];
+	if (stream)
+		stream->IncRef();
+	return stream;
+}
+
+void BulkStreamTable::Abort()
+{
+	MutexLocker lock(mMutex);
+	for (DWORD i = 0; i < UKWD_MAX_STREAMS; ++i) {
+		if (mStreams[i])
+			mStreams[i]->Abort();
+	}
+}
+
+void BulkStreamTable::StopStream(BulkStream* lpStream)
+{
+	if (!lpStream->Stop()) {
+		// The completion callbacks still refer to the stream, so
+		// it's safer to leak it than to delete it.
+		return;
+	}
+	// Threads still reading or writing keep the stream until they return
+	lpStream->DecRef();
+}
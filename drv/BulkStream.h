@@ -0,0 +1,137 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// BulkStream.h : Bulk transfers kept permanently queued on an endpoint
+#ifndef BULK_STREAM_H
+#define BULK_STREAM_H
+
+#include "ceusbkwrapper_common.h"
+#include "DevicePtr.h"
+
+class BulkStream;
+class MutexLocker;
+
+// One transfer sized part of the stream buffer
+struct BulkStreamSegment {
+	BulkStream* mStream;
+	LPBYTE mData;
+	USB_TRANSFER mTransfer;
+	DWORD mState;
+	// Bytes received or waiting to be sent
+	DWORD mBytes;
+	// Bytes already read from a received segment
+	DWORD mOffset;
+	// Set if the transfer completed before its handle was stored
+	BOOL mCompletedEarly;
+};
+
+// A stream splits a driver owned buffer into segments and keeps up to a
+// fixed number of them queued as bulk transfers. Each completed transfer
+// is replaced from the completion callback, so the endpoint isn't left
+// idle while waiting for the caller to submit another transfer.
+//
+// A stream of interrupt transfers works in the same way, except that each
+// read from an IN stream returns the data of a single transfer, so that
+// reports are kept separate.
+//
+// Segments are used in order, tracked by three free running counters.
+// [mReadIndex, mIssueIndex) have been issued, including received segments
+// which haven't been read yet. On an OUT stream [mIssueIndex, mFillIndex)
+// hold data waiting to be issued.
+class BulkStream {
+public:
+	BulkStream(DevicePtr& device, DWORD dwInterface, LPUKWD_START_STREAM_INFO lpStreamInfo);
+	BOOL Init();
+	// Queues the first transfers on an IN stream
+	BOOL Start();
+	// Cancels all queued transfers and waits for them to complete.
+	// Returns FALSE if they didn't, in which case the stream must
+	// not be deleted.
+	BOOL Stop();
+	// Causes all current and future calls to Read() and Write() to fail
+	void Abort();
+
+	BOOL Read(LPVOID lpBuffer, DWORD dwSize, LPDWORD lpdwRead, DWORD dwTimeout);
+	// Passing a dwSize of 0 waits for all queued data to be sent
+	BOOL Write(LPVOID lpBuffer, DWORD dwSize, LPDWORD lpdwWritten, DWORD dwTimeout);
+
+	// Streams in use by an IOCTL hold a reference
+	void IncRef();
+	void DecRef();
+
+	// Called by the USB driver when a segment completes
+	static DWORD WINAPI SegmentNotifyRoutine(LPVOID lpvNotifyParameter);
+private:
+	~BulkStream();
+	BulkStreamSegment& Segment(DWORD dwIndex);
+	// Issues queued segments until mMaxTransfers are pending
+	void IssueSegments(MutexLocker& lock);
+	void SegmentComplete(BulkStreamSegment& segment);
+	void Signal();
+	// Waits for the stream to change, returning FALSE with
+	// the last error set if dwTimeout has passed.
+	BOOL Wait(MutexLocker& lock, DWORD dwStartTime, DWORD dwTimeout);
+private:
+	LONG mRefCount;
+	DevicePtr mDevicePtr;
+	const DWORD mInterface;
+	const UCHAR mEndpoint;
+	const BOOL mIn;
+	const BOOL mInterrupt;
+	const DWORD mTransferSize;
+	const DWORD mMaxTransfers;
+	const DWORD mSegmentCount;
+	LPBYTE mBuffer;
+	BulkStreamSegment* mSegments;
+	HANDLE mMutex;
+	// Manual reset event which is signalled whenever the state of the
+	// stream changes. Waiters reset it with mMutex held before checking
+	// the state, so no change can be missed.
+	HANDLE mEvent;
+	DWORD mReadIndex;
+	DWORD mIssueIndex;
+	DWORD mFillIndex;
+	DWORD mTransfersQueued;
+	// Set while a thread is issuing transfers without holding mMutex
+	BOOL mIssuing;
+	// Error which stopped the stream, reported once all data is read
+	DWORD mError;
+	BOOL mStopping;
+};
+
+class BulkStreamTable {
+public:
+	BulkStreamTable();
+	~BulkStreamTable();
+	BOOL Init();
+
+	// Takes ownership of lpStream, starting it once it has an id
+	BOOL Add(BulkStream* lpStream, LPDWORD lpdwStreamId);
+	BOOL Remove(DWORD dwStreamId);
+	// Returns the stream with a reference added, or NULL
+	BulkStream* GetStream(DWORD dwStreamId);
+	// Wakes any threads blocked in streams
+	void Abort();
+private:
+	static void StopStream(BulkStream* lpStream);
+private:
+	HANDLE mMutex;
+	BulkStream* mStreams[UKWD_MAX_STREAMS];
+};
+
+#endif // BULK_STREAM_H
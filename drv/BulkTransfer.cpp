@@ -16,40 +16,145 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-// BulkTransfer.cpp : Represents a pending bulk transfer
+// BulkTransfer.cpp : Represents a pending bulk or interrupt transfer
 
 #include "StdAfx.h"
 #include "BulkTransfer.h"
 #include "OpenContext.h"
 #include "TransferList.h"
+#include "TransferSplitter.h"
 #include "UserBuffer.h"
 #include "UsbDevice.h"
 #include "UsbDeviceList.h"
 #include "drvdbg.h"
 
+#include <new>
+
+static BOOL IsVectored(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo)
+{
+	return UKWD_HAS_FIELD(lpTransferInfo, UKWD_BULK_TRANSFER_INFO, dwSegments) &&
+		lpTransferInfo->dwSegments != 0;
+}
+
 BulkTransfer::BulkTransfer(
 	OpenContext* OpenContext,
 	DevicePtr& device,
 	DWORD dwInterface,
-	LPUKWD_BULK_TRANSFER_INFO lpTransferInfo)
+	LPUKWD_BULK_TRANSFER_INFO lpTransferInfo,
+	BOOL bInterrupt)
 : Transfer(
 	OpenContext,
 	device,
 	lpTransferInfo->dwFlags,
-	lpTransferInfo->lpDataBuffer,
-	lpTransferInfo->dwDataBufferSize,
+	IsVectored(lpTransferInfo) ? NULL : lpTransferInfo->lpDataBuffer,
+	IsVectored(lpTransferInfo) ? 0 : lpTransferInfo->dwDataBufferSize,
+	UKWD_HAS_FIELD(lpTransferInfo, UKWD_BULK_TRANSFER_INFO, dwBufferOffset) ? lpTransferInfo->dwBufferId : 0,
+	lpTransferInfo->dwBufferOffset,
 	lpTransferInfo->pBytesTransferred,
-	lpTransferInfo->lpOverlapped),
+	lpTransferInfo->lpOverlapped,
+	UKWD_HAS_FIELD(lpTransferInfo, UKWD_BULK_TRANSFER_INFO, dwTimeoutMs) ? lpTransferInfo->dwTimeoutMs : 0),
 	mInterface(dwInterface),
-	mTransferInfo(*lpTransferInfo)
+	mInterrupt(bInterrupt),
+	mTransferInfo(*lpTransferInfo),
+	mSegmentCount(0),
+	mGatherBuffer(NULL),
+	mGatherSize(0),
+	mSplitter(NULL)
 {
+	if (!IsVectored(lpTransferInfo)) {
+		mTransferInfo.lpSegments = NULL;
+		mTransferInfo.dwSegments = 0;
+	}
 	TRANSFERLIFETIME_MSG((
 		TEXT("USBKWrapperDrv!BulkTransfer:BulkTransfer() created\r\n")));
 }
 
 BulkTransfer::~BulkTransfer()
 {
-	
+	// All chunks have completed before the last reference is dropped
+	if (mSplitter)
+		mSplitter->DecRef();
+	if (mGatherBuffer) {
+		// The transfer must not use the gather buffer once it's freed
+		CloseTransfer();
+		delete [] mGatherBuffer;
+	}
+	for (DWORD i = 0; i < mSegmentCount; ++i)
+		delete mSegments[i];
+}
+
+BOOL BulkTransfer::MapSegments()
+{
+	if (mTransferInfo.dwSegments > UKWD_MAX_BULK_SEGMENTS || mTransferInfo.dwBufferId) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkTransfer::MapSegments() invalid transfer of %d segments\r\n"),
+			mTransferInfo.dwSegments));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	UserBuffer<LPVOID> segments(UBA_READ, mTransferInfo.lpSegments,
+		mTransferInfo.dwSegments * sizeof(UKWD_BUFFER_SEGMENT));
+	if (!segments.Valid() || !segments.Ptr()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkTransfer::MapSegments() failed to map segment list\r\n")));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	LPUKWD_BUFFER_SEGMENT lpSegments = static_cast<LPUKWD_BUFFER_SEGMENT>(segments.Ptr());
+	DWORD dwAccessFlags = AccessFlagsForUserBuffer(mTransferInfo.dwFlags, mTransferInfo.lpOverlapped, TimeoutMs());
+	DWORD total = 0;
+	for (DWORD i = 0; i < mTransferInfo.dwSegments; ++i) {
+		// Copied as the caller could change the list at any time
+		UKWD_BUFFER_SEGMENT segment = lpSegments[i];
+		if (total + segment.dwBufferSize < total ||
+				total + segment.dwBufferSize > UKWD_MAX_BULK_SEGMENTS_SIZE) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!BulkTransfer::MapSegments() segments exceed %d bytes\r\n"),
+				UKWD_MAX_BULK_SEGMENTS_SIZE));
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return FALSE;
+		}
+		mSegments[i] = new (std::nothrow) UserBuffer<LPVOID>(
+			dwAccessFlags, segment.lpBuffer, segment.dwBufferSize);
+		if (!mSegments[i]) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return FALSE;
+		}
+		++mSegmentCount;
+		if (!mSegments[i]->Valid() || (segment.dwBufferSize > 0 && !mSegments[i]->Ptr())) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!BulkTransfer::MapSegments() failed to map segment %d\r\n"), i));
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return FALSE;
+		}
+		total += segment.dwBufferSize;
+	}
+	mGatherBuffer = new (std::nothrow) BYTE[total > 0 ? total : 1];
+	if (!mGatherBuffer) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	mGatherSize = total;
+	if (!(mTransferInfo.dwFlags & USB_IN_TRANSFER)) {
+		LPBYTE dest = mGatherBuffer;
+		for (DWORD i = 0; i < mSegmentCount; ++i) {
+			memcpy(dest, mSegments[i]->Ptr(), mSegments[i]->Size());
+			dest += mSegments[i]->Size();
+		}
+	}
+	return TRUE;
+}
+
+void BulkTransfer::DataTransferred(DWORD dwBytesTransferred)
+{
+	if (!mGatherBuffer || !(mTransferInfo.dwFlags & USB_IN_TRANSFER))
+		return;
+	// Scatter the received data back into the segments in order
+	LPBYTE src = mGatherBuffer;
+	DWORD remaining = min(dwBytesTransferred, mGatherSize);
+	for (DWORD i = 0; i < mSegmentCount && remaining > 0; ++i) {
+		DWORD count = min(remaining, mSegments[i]->Size());
+		memcpy(mSegments[i]->Ptr(), src, count);
+		mSegments[i]->Flush();
+		src += count;
+		remaining -= count;
+	}
 }
 
 BOOL BulkTransfer::Start()
@@ -57,31 +162,60 @@ BOOL BulkTransfer::Start()
 	if (!Transfer::Validate()) {
 		return FALSE;
 	}
+	if (mTransferInfo.dwSegments && !MapSegments()) {
+		mOverlappedBuffer.Abort();
+		return FALSE;
+	}
 	
-	if (mTransferInfo.lpOverlapped)
+	DWORD size = mGatherBuffer ? mGatherSize : mTransferInfo.dwDataBufferSize;
+	LPVOID data = mGatherBuffer ? mGatherBuffer : DataPtr();
+	if (mTransferInfo.lpOverlapped && !mInterrupt) {
+		DWORD chunkSize, maxChunks;
+		mOpenContext->GetTransferSplit(&chunkSize, &maxChunks);
+		if (chunkSize && size > chunkSize)
+			return StartSplit(data, size, chunkSize, maxChunks);
+	}
+
+	// Synchronous transfers with a timeout also complete through
+	// Transfer::TransferComplete().
+	BOOL completesAsync = mTransferInfo.lpOverlapped || TimedSync();
+	if (completesAsync)
 		// Increment the reference count so that this stays alive
 		// until Transfer::TransferComplete() is called.
 		mOpenContext->GetTransferList()->GetTransfer(this);
 
-	USB_TRANSFER transfer = mDevicePtr->IssueBulkTransfer(
-		mTransferInfo.lpOverlapped ? this : NULL,
-		mInterface,
-		mTransferInfo.Endpoint,
-		mTransferInfo.dwFlags,
-		mTransferInfo.dwDataBufferSize,
-		mUserBuffer.Ptr());
+	USB_TRANSFER transfer;
+	if (mInterrupt)
+		transfer = mDevicePtr->IssueInterruptTransfer(
+			completesAsync ? this : NULL,
+			mInterface,
+			mTransferInfo.Endpoint,
+			mTransferInfo.dwFlags,
+			size,
+			data);
+	else
+		transfer = mDevicePtr->IssueBulkTransfer(
+			completesAsync ? this : NULL,
+			mInterface,
+			mTransferInfo.Endpoint,
+			mTransferInfo.dwFlags,
+			size,
+			data);
 
 	SetTransfer(transfer);
 
 	if (!transfer) {
 		ERROR_MSG((TEXT("USBKWrapperDrv!BulkTransfer::Start failed to issue transfer: %i\r\n"), GetLastError()));
-		if (mTransferInfo.lpOverlapped)
+		if (completesAsync)
 			// Decrement the reference count as Transfer::TransferComplete()
 			// will never be called
 			mOpenContext->GetTransferList()->PutTransfer(this);
 		return FALSE;
 	}
 
+	if (TimedSync())
+		return WaitForCompletion();
+
 	if (!mTransferInfo.lpOverlapped) {
 		DWORD bytesTransferred, transferError;
 		if (!mDevicePtr->GetTransferStatus(transfer, &bytesTransferred, &transferError)) {
@@ -93,9 +227,85 @@ BOOL BulkTransfer::Start()
 			ERROR_MSG((TEXT("USBKWrapperDrv!BulkTransfer::Start transfer failed with USB error %d\r\n"),
 				transferError));
 		}
+		DataTransferred(bytesTransferred);
 		SetLastError(TranslateError(transferError, bytesTransferred, FALSE));
 		SetBytesTransferred(bytesTransferred);
 		return transferError == USB_NO_ERROR;
 	}
+	StartTimeout();
+	return TRUE;
+}
+
+BOOL BulkTransfer::StartSplit(LPVOID lpData, DWORD dwSize, DWORD dwChunkSize, DWORD dwMaxChunks)
+{
+	TransferSplitter* splitter = new (std::nothrow) TransferSplitter(
+		this, mDevicePtr, mInterface, mTransferInfo.Endpoint, mTransferInfo.dwFlags,
+		lpData, dwSize, dwChunkSize, dwMaxChunks);
+	if (!splitter) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkTransfer::StartSplit failed to create splitter\r\n")));
+		mOverlappedBuffer.Abort();
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	if (!splitter->Init()) {
+		splitter->DecRef();
+		mOverlappedBuffer.Abort();
+		return FALSE;
+	}
+	TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!BulkTransfer::StartSplit splitting %d bytes into chunks of %d\r\n"),
+		dwSize, dwChunkSize));
+
+	// Increment the reference count so that this stays alive
+	// until SplitCompleted() is called. This must happen before
+	// mSplitter is set, as Cancel() can complete the transfer
+	// from then on.
+	mOpenContext->GetTransferList()->GetTransfer(this);
+	mSplitter = splitter;
+	if (!mSplitter->Start()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!BulkTransfer::StartSplit failed to issue transfer: %i\r\n"), GetLastError()));
+		// Decrement the reference count as SplitCompleted()
+		// will never be called
+		mOpenContext->GetTransferList()->PutTransfer(this);
+		return FALSE;
+	}
+	StartTimeout();
 	return TRUE;
 }
+
+void BulkTransfer::SplitCompleted(DWORD dwUsbError, DWORD dwIssueError, DWORD dwBytesTransferred)
+{
+	// As with a single transfer, a transfer which ended early after
+	// moving some data is reported as a short transfer.
+	DWORD translatedError = (dwIssueError != ERROR_SUCCESS && dwBytesTransferred == 0) ?
+		dwIssueError : TranslateError(dwUsbError, dwBytesTransferred, Cancelled());
+	TRANSFERLIFETIME_MSG((
+		TEXT("USBKWrapperDrv!BulkTransfer::SplitCompleted() completed (error %d, transferred %d, cancelled %d)\r\n"),
+		translatedError, dwBytesTransferred, Cancelled()));
+	Finish(translatedError, dwBytesTransferred);
+	// Must return immediately as 'this' might have been deleted by Finish().
+	return;
+}
+
+BOOL BulkTransfer::Pending()
+{
+	if (mSplitter)
+		return mSplitter->Pending();
+	return Transfer::Pending();
+}
+
+BOOL BulkTransfer::CancelPending(DWORD dwFlags)
+{
+	if (mSplitter)
+		return mSplitter->Cancel(dwFlags);
+	return Transfer::CancelPending(dwFlags);
+}
+
+BOOL BulkTransfer::IssuedOnEndpoint(UCHAR Endpoint)
+{
+	return mTransferInfo.Endpoint == Endpoint;
+}
+
+BOOL BulkTransfer::IssuedOnInterface(DWORD dwInterface)
+{
+	return mInterface == dwInterface;
+}
@@ -16,7 +16,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-// BulkTransfer.h : Represents a pending bulk transfer
+// BulkTransfer.h : Represents a pending bulk or interrupt transfer
 
 #ifndef BULK_TRANSFER_H
 #define BULK_TRANSFER_H
@@ -28,6 +28,7 @@
 
 class OpenContext;
 class UsbDeviceList;
+class TransferSplitter;
 
 class BulkTransfer : public Transfer {
 public:
@@ -35,12 +36,34 @@ public:
 		OpenContext* OpenContext,
 		DevicePtr& device,
 		DWORD dwInterface,
-		LPUKWD_BULK_TRANSFER_INFO lpTransferInfo);
+		LPUKWD_BULK_TRANSFER_INFO lpTransferInfo,
+		BOOL bInterrupt);
 	virtual ~BulkTransfer();
 	BOOL Start();
+	// Called by the TransferSplitter of a split transfer once all
+	// of its chunks have finished.
+	void SplitCompleted(DWORD dwUsbError, DWORD dwIssueError, DWORD dwBytesTransferred);
+protected:
+	virtual void DataTransferred(DWORD dwBytesTransferred);
+	virtual BOOL Pending();
+	virtual BOOL CancelPending(DWORD dwFlags);
+	virtual BOOL IssuedOnEndpoint(UCHAR Endpoint);
+	virtual BOOL IssuedOnInterface(DWORD dwInterface);
+private:
+	// Maps the segments of a vectored transfer and allocates the
+	// buffer which they are gathered into or scattered from.
+	BOOL MapSegments();
+	BOOL StartSplit(LPVOID lpData, DWORD dwSize, DWORD dwChunkSize, DWORD dwMaxChunks);
 private:
 	DWORD mInterface;
+	// Interrupt transfers use the same fields as bulk transfers
+	const BOOL mInterrupt;
 	UKWD_BULK_TRANSFER_INFO mTransferInfo;
+	DWORD mSegmentCount;
+	UserBuffer<LPVOID>* mSegments[UKWD_MAX_BULK_SEGMENTS];
+	LPBYTE mGatherBuffer;
+	DWORD mGatherSize;
+	TransferSplitter* mSplitter;
 };
 
 
@@ -0,0 +1,243 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// CompletionQueue.cpp : Queue of completed transfers for an open context
+
+#include "StdAfx.h"
+#include "CompletionQueue.h"
+#include "SharedRings.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+#include <new>
+
+// Initial number of entries allocated when the queue is first used
+#define INITIAL_COMPLETION_QUEUE_CAPACITY 32
+
+CompletionQueue::CompletionQueue()
+: mMutex(NULL)
+, mEvent(NULL)
+, mEnabled(FALSE)
+, mAborted(FALSE)
+, mRings(NULL)
+, mEntries(NULL)
+, mCapacity(0)
+, mHead(0)
+, mSize(0)
+{
+}
+
+CompletionQueue::~CompletionQueue()
+{
+	if (mSize > 0) {
+		WARN_MSG((TEXT("USBKWrapperDrv!CompletionQueue::~CompletionQueue() - discarding %d unreaped completions\r\n"),
+			mSize));
+	}
+	delete [] mEntries;
+	if (mEvent)
+		CloseHandle(mEvent);
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL CompletionQueue::Init()
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!CompletionQueue::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	mEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (mEvent == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!CompletionQueue::Init() - failed to create event\r\n")));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void CompletionQueue::Enable()
+{
+	MutexLocker lock(mMutex);
+	mEnabled = TRUE;
+}
+
+BOOL CompletionQueue::Enabled() const
+{
+	return mEnabled;
+}
+
+// Should be called with mMutex held.
+BOOL CompletionQueue::Grow()
+{
+	DWORD newCapacity = mCapacity ? mCapacity * 2 : INITIAL_COMPLETION_QUEUE_CAPACITY;
+	UKWD_COMPLETION* newEntries = new (std::nothrow) UKWD_COMPLETION[newCapacity];
+	if (!newEntries)
+		return FALSE;
+	// Unwrap the existing entries into the start of the new array
+	for (DWORD i = 0; i < mSize; ++i)
+		newEntries[i] = mEntries[(mHead + i) % mCapacity];
+	delete [] mEntries;
+	mEntries = newEntries;
+	mCapacity = newCapacity;
+	mHead = 0;
+	return TRUE;
+}
+
+void CompletionQueue::Push(LPOVERLAPPED lpOverlapped, DWORD dwError, DWORD dwBytesTransferred)
+{
+	// Checking this without the lock is fine, as once enabled
+	// the queue is never disabled.
+	if (!mEnabled || !lpOverlapped)
+		return;
+	MutexLocker lock(mMutex);
+	UKWD_COMPLETION completion;
+	completion.lpOverlapped = lpOverlapped;
+	completion.dwError = dwError;
+	completion.dwBytesTransferred = dwBytesTransferred;
+	// Only post directly to the ring if nothing is already waiting
+	// in the queue, otherwise completions would be reordered.
+	if (mRings && mSize == 0 && mRings->PostCompletion(completion)) {
+		SetEvent(mEvent);
+		return;
+	}
+	if (mSize == mCapacity && !Grow()) {
+		// The OVERLAPPED has still been completed, so the transfer
+		// isn't lost entirely, but it will never be reaped.
+		ERROR_MSG((TEXT("USBKWrapperDrv!CompletionQueue::Push() - failed to grow queue, dropping completion for 0x%08x\r\n"),
+			lpOverlapped));
+		return;
+	}
+	mEntries[(mHead + mSize) % mCapacity] = completion;
+	++mSize;
+	SetEvent(mEvent);
+}
+
+BOOL CompletionQueue::Reap(LPUKWD_COMPLETION lpCompletions, DWORD dwCount, LPDWORD lpdwReaped, DWORD dwTimeout)
+{
+	*lpdwReaped = 0;
+	if (!mEnabled) {
+		SetLastError(ERROR_NOT_READY);
+		return FALSE;
+	}
+	DWORD startTime = GetTickCount();
+	MutexLocker lock(mMutex);
+	while (mSize == 0) {
+		if (mAborted) {
+			SetLastError(ERROR_OPERATION_ABORTED);
+			return FALSE;
+		}
+		DWORD waitTime = dwTimeout;
+		if (dwTimeout != INFINITE) {
+			DWORD elapsed = GetTickCount() - startTime;
+			waitTime = elapsed < dwTimeout ? dwTimeout - elapsed : 0;
+		}
+		lock.unlock();
+		DWORD waitState = WaitForSingleObject(mEvent, waitTime);
+		lock.relock();
+		if (waitState == WAIT_TIMEOUT && mSize == 0) {
+			SetLastError(ERROR_TIMEOUT);
+			return FALSE;
+		}
+		if (waitState != WAIT_OBJECT_0 && waitState != WAIT_TIMEOUT) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!CompletionQueue::Reap() - wait failed with %d\r\n"),
+				GetLastError()));
+			return FALSE;
+		}
+	}
+
+	DWORD reaped = 0;
+	while (reaped < dwCount && mSize > 0) {
+		lpCompletions[reaped] = mEntries[mHead];
+		mHead = (mHead + 1) % mCapacity;
+		--mSize;
+		++reaped;
+	}
+	if (mSize == 0 && !mAborted)
+		ResetEvent(mEvent);
+	*lpdwReaped = reaped;
+	return TRUE;
+}
+
+void CompletionQueue::Abort()
+{
+	MutexLocker lock(mMutex);
+	mAborted = TRUE;
+	SetEvent(mEvent);
+}
+
+void CompletionQueue::AttachRings(SharedRings* lpRings)
+{
+	MutexLocker lock(mMutex);
+	mRings = lpRings;
+	mEnabled = TRUE;
+}
+
+void CompletionQueue::DetachRings()
+{
+	MutexLocker lock(mMutex);
+	mRings = NULL;
+}
+
+// Should be called with mMutex held.
+void CompletionQueue::FlushToRings()
+{
+	while (mRings && mSize > 0 && mRings->PostCompletion(mEntries[mHead])) {
+		mHead = (mHead + 1) % mCapacity;
+		--mSize;
+	}
+}
+
+BOOL CompletionQueue::WaitForRingCompletions(DWORD dwMinCompletions, DWORD dwTimeout)
+{
+	DWORD startTime = GetTickCount();
+	MutexLocker lock(mMutex);
+	for (;;) {
+		if (!mRings) {
+			SetLastError(ERROR_NOT_READY);
+			return FALSE;
+		}
+		FlushToRings();
+		// If completions are still queued then the ring is full
+		if (mSize > 0 || mRings->CompletionsPending() >= dwMinCompletions)
+			return TRUE;
+		if (mAborted) {
+			SetLastError(ERROR_OPERATION_ABORTED);
+			return FALSE;
+		}
+		DWORD waitTime = dwTimeout;
+		if (dwTimeout != INFINITE) {
+			DWORD elapsed = GetTickCount() - startTime;
+			if (elapsed >= dwTimeout) {
+				SetLastError(ERROR_TIMEOUT);
+				return FALSE;
+			}
+			waitTime = dwTimeout - elapsed;
+		}
+		// Any completion pushed after this will set the event again
+		if (mSize == 0)
+			ResetEvent(mEvent);
+		lock.unlock();
+		DWORD waitState = WaitForSingleObject(mEvent, waitTime);
+		lock.relock();
+		if (waitState != WAIT_OBJECT_0 && waitState != WAIT_TIMEOUT) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!CompletionQueue::WaitForRingCompletions() - wait failed with %d\r\n"),
+				GetLastError()));
+			return FALSE;
+		}
+	}
+}
@@ -0,0 +1,67 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// CompletionQueue.h : Queue of completed transfers for an open context
+#ifndef COMPLETION_QUEUE_H
+#define COMPLETION_QUEUE_H
+
+#include "ceusbkwrapper_common.h"
+
+class SharedRings;
+
+class CompletionQueue {
+public:
+	CompletionQueue();
+	~CompletionQueue();
+	BOOL Init();
+
+	// Completions are only queued once the queue has been enabled
+	void Enable();
+	BOOL Enabled() const;
+	void Push(LPOVERLAPPED lpOverlapped, DWORD dwError, DWORD dwBytesTransferred);
+	// Waits for up to dwTimeout ms for completions and copies up
+	// to dwCount of them into lpCompletions.
+	BOOL Reap(LPUKWD_COMPLETION lpCompletions, DWORD dwCount, LPDWORD lpdwReaped, DWORD dwTimeout);
+	// Causes all current and future calls to Reap() to fail
+	void Abort();
+
+	// While rings are attached completions are posted to the shared
+	// completion ring, only using the queue when the ring is full.
+	void AttachRings(SharedRings* lpRings);
+	void DetachRings();
+	// Moves queued completions to the completion ring and then waits
+	// until at least dwMinCompletions are available on the ring.
+	BOOL WaitForRingCompletions(DWORD dwMinCompletions, DWORD dwTimeout);
+private:
+	BOOL Grow();
+	void FlushToRings();
+private:
+	HANDLE mMutex;
+	// Manual reset event which is signalled whenever the queue
+	// isn't empty or has been aborted.
+	HANDLE mEvent;
+	BOOL mEnabled;
+	BOOL mAborted;
+	SharedRings* mRings;
+	UKWD_COMPLETION* mEntries;
+	DWORD mCapacity;
+	DWORD mHead;
+	DWORD mSize;
+};
+
+#endif // COMPLETION_QUEUE_H
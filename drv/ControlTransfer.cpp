@@ -37,8 +37,11 @@ ControlTransfer::ControlTransfer(
 	lpTransferInfo->dwFlags,
 	lpTransferInfo->lpDataBuffer,
 	lpTransferInfo->dwDataBufferSize,
+	UKWD_HAS_FIELD(lpTransferInfo, UKWD_CONTROL_TRANSFER_INFO, dwBufferOffset) ? lpTransferInfo->dwBufferId : 0,
+	lpTransferInfo->dwBufferOffset,
 	lpTransferInfo->pBytesTransferred,
-	lpTransferInfo->lpOverlapped)
+	lpTransferInfo->lpOverlapped,
+	UKWD_HAS_FIELD(lpTransferInfo, UKWD_CONTROL_TRANSFER_INFO, dwTimeoutMs) ? lpTransferInfo->dwTimeoutMs : 0)
 , mTransferInfo(*lpTransferInfo)
 {
 	TRANSFERLIFETIME_MSG((
@@ -55,13 +58,16 @@ BOOL ControlTransfer::Start()
 	if (!Transfer::Validate()) {
 		return FALSE;
 	}
-	if (mTransferInfo.Header.wLength > mUserBuffer.Size()) {
+	if (mTransferInfo.Header.wLength > DataSize()) {
 		ERROR_MSG((TEXT("USBKWrapperDrv!ControlTransfer::Start request size exceeds buffer\r\n")));
 		mOverlappedBuffer.Abort();
 		SetLastError(ERROR_INVALID_PARAMETER);
 		return FALSE;
 	}
-	if (mTransferInfo.lpOverlapped)
+	// Synchronous transfers with a timeout also complete through
+	// Transfer::TransferComplete().
+	BOOL completesAsync = mTransferInfo.lpOverlapped || TimedSync();
+	if (completesAsync)
 		// Increment the reference count so that this stays alive
 		// until Transfer::TransferComplete() is called.
 		mOpenContext->GetTransferList()->GetTransfer(this);
@@ -70,22 +76,25 @@ BOOL ControlTransfer::Start()
 	// control transfers. Given that the API is clearly intended towards vendor transfers,
 	// this behaviour may change in the future.
 	USB_TRANSFER transfer = mDevicePtr->IssueVendorTransfer(
-		mTransferInfo.lpOverlapped ? this : NULL,
+		completesAsync ? this : NULL,
 		mTransferInfo.dwFlags,
 		&mTransferInfo.Header,
-		mUserBuffer.Ptr());
+		DataPtr());
 
 	SetTransfer(transfer);
 
 	if (!transfer) {
 		ERROR_MSG((TEXT("USBKWrapperDrv!ControlTransfer::Start failed to issue transfer\r\n")));
-		if (mTransferInfo.lpOverlapped)
+		if (completesAsync)
 			// Decrement the reference count as Transfer::TransferComplete()
 			// will never be called
 			mOpenContext->GetTransferList()->PutTransfer(this);
 		return FALSE;
 	}
 
+	if (TimedSync())
+		return WaitForCompletion();
+
 	if (!mTransferInfo.lpOverlapped) {
 		DWORD bytesTransferred, transferError;
 		if (!mDevicePtr->GetTransferStatus(transfer, &bytesTransferred, &transferError)) {
@@ -101,5 +110,38 @@ BOOL ControlTransfer::Start()
 		SetBytesTransferred(bytesTransferred);
 		return transferError == USB_NO_ERROR;
 	}
+	StartTimeout();
 	return TRUE;
 }
+
+BOOL ControlTransfer::IssueInline(
+	DevicePtr& device,
+	DWORD dwFlags,
+	LPCUSB_DEVICE_REQUEST lpHeader,
+	LPVOID lpData,
+	LPDWORD lpdwBytesTransferred)
+{
+	*lpdwBytesTransferred = 0;
+	USB_TRANSFER transfer = device->IssueVendorTransfer(
+		NULL, dwFlags & ~USB_NO_WAIT, lpHeader, lpData);
+	if (!transfer) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!ControlTransfer::IssueInline failed to issue transfer\r\n")));
+		return FALSE;
+	}
+
+	DWORD bytesTransferred, transferError;
+	BOOL ret = device->GetTransferStatus(transfer, &bytesTransferred, &transferError);
+	device->CloseTransfer(transfer);
+	if (!ret) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!ControlTransfer::IssueInline used invalid transfer handle\r\n")));
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+	if (transferError != USB_NO_ERROR) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!ControlTransfer::IssueInline transfer failed with USB error %d\r\n"),
+			transferError));
+	}
+	SetLastError(TranslateError(transferError, bytesTransferred, FALSE));
+	*lpdwBytesTransferred = bytesTransferred;
+	return transferError == USB_NO_ERROR;
+}
@@ -37,6 +37,16 @@ public:
 		LPUKWD_CONTROL_TRANSFER_INFO lpTransferInfo);
 	virtual ~ControlTransfer();
 	BOOL Start();
+
+	// Synchronously issues a control transfer directly on lpData, without
+	// creating a Transfer. lpData must stay valid until this returns, as
+	// the IOCTL buffers do.
+	static BOOL IssueInline(
+		DevicePtr& device,
+		DWORD dwFlags,
+		LPCUSB_DEVICE_REQUEST lpHeader,
+		LPVOID lpData,
+		LPDWORD lpdwBytesTransferred);
 private:
 	UKWD_CONTROL_TRANSFER_INFO mTransferInfo;
 };
@@ -20,17 +20,38 @@
 
 #include "StdAfx.h"
 #include "DeviceContext.h"
+#include "TimerWheel.h"
+#include "drvdbg.h"
+
+#include <new>
 
 DeviceContext::DeviceContext(UsbDeviceList* lpDeviceList)
 : mDeviceList(lpDeviceList)
+, mTimerWheel(NULL)
 {
 }
 
 DeviceContext::~DeviceContext()
 {
+	delete mTimerWheel;
+}
+
+BOOL DeviceContext::Init()
+{
+	mTimerWheel = new (std::nothrow) TimerWheel();
+	if ((!mTimerWheel) || (!mTimerWheel->Init())) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!DeviceContext::Init() - failed to create timer wheel\r\n")));
+		return FALSE;
+	}
+	return TRUE;
 }
 
 UsbDeviceList* DeviceContext::GetDeviceList()
 {
 	return mDeviceList;
+}
+
+TimerWheel* DeviceContext::GetTimerWheel()
+{
+	return mTimerWheel;
 }
\ No newline at end of file
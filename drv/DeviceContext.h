@@ -22,14 +22,19 @@
 
 // Forward declarations
 class UsbDeviceList;
+class TimerWheel;
 
 class DeviceContext {
 public:
 	DeviceContext(UsbDeviceList* lpDeviceList);
 	~DeviceContext();
+	BOOL Init();
 	UsbDeviceList* GetDeviceList();
+	// Shared by all open contexts of the driver
+	TimerWheel* GetTimerWheel();
 private:
 	UsbDeviceList* mDeviceList;
+	TimerWheel* mTimerWheel;
 };
 
 #endif // DEVICECONTEXT_H
\ No newline at end of file
@@ -0,0 +1,141 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// DeviceEventQueue.cpp : Queue of device attach and detach events for an open context
+
+#include "StdAfx.h"
+#include "DeviceEventQueue.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+DeviceEventQueue::DeviceEventQueue()
+: mMutex(NULL)
+, mEvent(NULL)
+, mAborted(FALSE)
+, mOverflowed(FALSE)
+, mGeneration(0)
+, mHead(0)
+, mSize(0)
+{
+}
+
+DeviceEventQueue::~DeviceEventQueue()
+{
+	if (mEvent)
+		CloseHandle(mEvent);
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL DeviceEventQueue::Init()
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!DeviceEventQueue::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	mEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (mEvent == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!DeviceEventQueue::Init() - failed to create event\r\n")));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void DeviceEventQueue::SetGeneration(DWORD dwGeneration)
+{
+	MutexLocker lock(mMutex);
+	mGeneration = dwGeneration;
+}
+
+void DeviceEventQueue::Push(const UKWD_DEVICE_EVENT& event)
+{
+	MutexLocker lock(mMutex);
+	if (mSize == UKWD_MAX_DEVICE_EVENTS) {
+		// Nobody is reading the events quickly enough, so drop the oldest
+		// and let the reader know it needs to enumerate the devices again.
+		WARN_MSG((TEXT("USBKWrapperDrv!DeviceEventQueue::Push() - queue full, dropping event %d\r\n"),
+			mEntries[mHead].dwGeneration));
+		mHead = (mHead + 1) % UKWD_MAX_DEVICE_EVENTS;
+		--mSize;
+		mOverflowed = TRUE;
+	}
+	mEntries[(mHead + mSize) % UKWD_MAX_DEVICE_EVENTS] = event;
+	++mSize;
+	mGeneration = event.dwGeneration;
+	SetEvent(mEvent);
+}
+
+BOOL DeviceEventQueue::Wait(LPUKWD_DEVICE_EVENTS lpEvents, DWORD dwCount, DWORD dwTimeout)
+{
+	lpEvents->dwEvents = 0;
+	lpEvents->dwFlags = 0;
+	DWORD startTime = GetTickCount();
+	MutexLocker lock(mMutex);
+	lpEvents->dwGeneration = mGeneration;
+	while (mSize == 0) {
+		if (mAborted) {
+			SetLastError(ERROR_OPERATION_ABORTED);
+			return FALSE;
+		}
+		DWORD waitTime = dwTimeout;
+		if (dwTimeout != INFINITE) {
+			DWORD elapsed = GetTickCount() - startTime;
+			waitTime = elapsed < dwTimeout ? dwTimeout - elapsed : 0;
+		}
+		lock.unlock();
+		DWORD waitState = WaitForSingleObject(mEvent, waitTime);
+		lock.relock();
+		if (waitState == WAIT_TIMEOUT && mSize == 0) {
+			lpEvents->dwGeneration = mGeneration;
+			SetLastError(ERROR_TIMEOUT);
+			return FALSE;
+		}
+		if (waitState != WAIT_OBJECT_0 && waitState != WAIT_TIMEOUT) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!DeviceEventQueue::Wait() - wait failed with %d\r\n"),
+				GetLastError()));
+			return FALSE;
+		}
+	}
+
+	DWORD count = 0;
+	while (count < dwCount && mSize > 0) {
+		lpEvents->Events[count] = mEntries[mHead];
+		mHead = (mHead + 1) % UKWD_MAX_DEVICE_EVENTS;
+		--mSize;
+		++count;
+	}
+	lpEvents->dwEvents = count;
+	// Report the generation which the caller reaches by applying the
+	// returned events, which is older than mGeneration if any remain.
+	lpEvents->dwGeneration = mSize > 0 ? lpEvents->Events[count - 1].dwGeneration : mGeneration;
+	if (mOverflowed) {
+		lpEvents->dwFlags |= UKWD_DEVICE_EVENTS_OVERFLOW;
+		mOverflowed = FALSE;
+	}
+	if (mSize == 0 && !mAborted)
+		ResetEvent(mEvent);
+	return TRUE;
+}
+
+void DeviceEventQueue::Abort()
+{
+	MutexLocker lock(mMutex);
+	mAborted = TRUE;
+	SetEvent(mEvent);
+}
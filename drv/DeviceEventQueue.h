@@ -0,0 +1,57 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// DeviceEventQueue.h : Queue of device attach and detach events for an open context
+#ifndef DEVICE_EVENT_QUEUE_H
+#define DEVICE_EVENT_QUEUE_H
+
+#include "ceusbkwrapper_common.h"
+
+class DeviceEventQueue {
+public:
+	DeviceEventQueue();
+	~DeviceEventQueue();
+	BOOL Init();
+
+	// Both of these are only called by UsbDeviceList with its lock held.
+	// SetGeneration() gives the generation of the device list when the
+	// queue is added to it.
+	void SetGeneration(DWORD dwGeneration);
+	void Push(const UKWD_DEVICE_EVENT& event);
+	// Waits for up to dwTimeout ms for events and copies up to dwCount
+	// of them into lpEvents. The generation is filled in even if the
+	// wait times out.
+	BOOL Wait(LPUKWD_DEVICE_EVENTS lpEvents, DWORD dwCount, DWORD dwTimeout);
+	// Causes all current and future calls to Wait() to fail
+	void Abort();
+private:
+	HANDLE mMutex;
+	// Manual reset event which is signalled whenever the queue
+	// isn't empty or has been aborted.
+	HANDLE mEvent;
+	BOOL mAborted;
+	// Set when the oldest events were dropped to make space
+	BOOL mOverflowed;
+	// Generation of the most recently pushed event
+	DWORD mGeneration;
+	UKWD_DEVICE_EVENT mEntries[UKWD_MAX_DEVICE_EVENTS];
+	DWORD mHead;
+	DWORD mSize;
+};
+
+#endif // DEVICE_EVENT_QUEUE_H
@@ -0,0 +1,212 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// DeviceHandleTable.cpp : Small integer handles to the devices opened by a context
+
+#include "StdAfx.h"
+#include "DeviceHandleTable.h"
+#include "UsbDeviceList.h"
+#include "UsbDevice.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+#include <new>
+
+// Number of slots allocated at a time
+#define SLOTS_PER_CHUNK 16
+// Slot indexes have to fit in the low word of a handle
+#define MAX_SLOTS 0xFFFF
+#define MAX_CHUNKS ((MAX_SLOTS + SLOTS_PER_CHUNK - 1) / SLOTS_PER_CHUNK)
+
+#define HANDLE_INDEX(h) (LOWORD(reinterpret_cast<DWORD>(h)) - 1)
+#define HANDLE_GENERATION(h) HIWORD(reinterpret_cast<DWORD>(h))
+#define MAKE_HANDLE(idx, gen) \
+	reinterpret_cast<UKWD_USB_DEVICE>(MAKELONG((idx) + 1, (gen)))
+
+static UsbDevice* ReadDevice(UsbDevice* volatile* lplpDevice)
+{
+	return static_cast<UsbDevice*>(InterlockedCompareExchangePointer(
+		reinterpret_cast<PVOID volatile*>(lplpDevice), NULL, NULL));
+}
+
+DeviceHandleTable::DeviceHandleTable(UsbDeviceList* lpList)
+: mMutex(NULL)
+, mList(lpList)
+, mChunks(NULL)
+, mSlotCount(0)
+{
+}
+
+DeviceHandleTable::~DeviceHandleTable()
+{
+	RemoveAll(NULL);
+	if (mChunks) {
+		for (DWORD i = 0; i < MAX_CHUNKS; ++i)
+			delete [] mChunks[i];
+		delete [] mChunks;
+	}
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL DeviceHandleTable::Init()
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!DeviceHandleTable::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	mChunks = new (std::nothrow) SLOT*[MAX_CHUNKS];
+	if (mChunks == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!DeviceHandleTable::Init() - failed to allocate chunk list\r\n")));
+		return FALSE;
+	}
+	memset(mChunks, 0, MAX_CHUNKS * sizeof(SLOT*));
+	return TRUE;
+}
+
+UsbDeviceList* DeviceHandleTable::GetDeviceList()
+{
+	return mList;
+}
+
+UKWD_USB_DEVICE DeviceHandleTable::Insert(UsbDevice* lpDevice)
+{
+	MutexLocker lock(mMutex);
+	DWORD slotCount = mSlotCount;
+	DWORD idx = 0;
+	while (idx < slotCount && Slot(idx)->lpDevice)
+		++idx;
+	if (idx == slotCount && !Grow()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!DeviceHandleTable::Insert() - failed to grow table from %d slots\r\n"),
+			mSlotCount));
+		return NULL;
+	}
+	SLOT* slot = Slot(idx);
+	// The generation was changed when the slot was last released, so
+	// lookups using older handles won't match once this is published.
+	InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&slot->lpDevice), lpDevice);
+	return MAKE_HANDLE(idx, LOWORD(slot->lGeneration));
+}
+
+BOOL DeviceHandleTable::Remove(UKWD_USB_DEVICE DeviceHandle)
+{
+	MutexLocker lock(mMutex);
+	SLOT* slot = FindSlot(DeviceHandle);
+	if (!slot)
+		return FALSE;
+	Release(slot, slot->lpDevice);
+	return TRUE;
+}
+
+UsbDevice* DeviceHandleTable::GetDevice(UKWD_USB_DEVICE DeviceHandle)
+{
+	// A zero index wraps around to a value which is out of range
+	DWORD idx = HANDLE_INDEX(DeviceHandle);
+	if (idx >= static_cast<DWORD>(InterlockedCompareExchange(&mSlotCount, 0, 0))) {
+		WARN_MSG((TEXT("USBKWrapperDrv!DeviceHandleTable::GetDevice")
+			TEXT(" - invalid device handle 0x%08x\r\n"), DeviceHandle));
+		return NULL;
+	}
+	SLOT* slot = Slot(idx);
+	// While counted as a reader the slot's reference can't be put, so
+	// the device stays alive until one of ours has been added.
+	InterlockedIncrement(&slot->lReaders);
+	UsbDevice* device = ReadDevice(&slot->lpDevice);
+	if (device &&
+		LOWORD(InterlockedCompareExchange(&slot->lGeneration, 0, 0)) == HANDLE_GENERATION(DeviceHandle))
+		mList->GetDevice(device);
+	else
+		device = NULL;
+	InterlockedDecrement(&slot->lReaders);
+	if (!device) {
+		WARN_MSG((TEXT("USBKWrapperDrv!DeviceHandleTable::GetDevice")
+			TEXT(" - invalid or stale device handle 0x%08x\r\n"), DeviceHandle));
+	}
+	return device;
+}
+
+DWORD DeviceHandleTable::RemoveAll(LPVOID Context)
+{
+	MutexLocker lock(mMutex);
+	DWORD count = 0;
+	for (DWORD i = 0; i < static_cast<DWORD>(mSlotCount); ++i) {
+		SLOT* slot = Slot(i);
+		UsbDevice* device = slot->lpDevice;
+		if (!device)
+			continue;
+		if (Context)
+			device->ReleaseAllInterfaces(Context);
+		Release(slot, device);
+		++count;
+	}
+	return count;
+}
+
+DeviceHandleTable::SLOT* DeviceHandleTable::Slot(DWORD idx)
+{
+	return &mChunks[idx / SLOTS_PER_CHUNK][idx % SLOTS_PER_CHUNK];
+}
+
+DeviceHandleTable::SLOT* DeviceHandleTable::FindSlot(UKWD_USB_DEVICE DeviceHandle)
+{
+	// A zero index wraps around to a value which is out of range
+	DWORD idx = HANDLE_INDEX(DeviceHandle);
+	if (idx >= static_cast<DWORD>(mSlotCount))
+		return NULL;
+	SLOT* slot = Slot(idx);
+	if (!slot->lpDevice ||
+		LOWORD(slot->lGeneration) != HANDLE_GENERATION(DeviceHandle))
+		return NULL;
+	return slot;
+}
+
+BOOL DeviceHandleTable::Grow()
+{
+	DWORD chunk = mSlotCount / SLOTS_PER_CHUNK;
+	if (chunk >= MAX_CHUNKS)
+		return FALSE;
+	SLOT* slots = new (std::nothrow) SLOT[SLOTS_PER_CHUNK];
+	if (!slots)
+		return FALSE;
+	for (DWORD i = 0; i < SLOTS_PER_CHUNK; ++i) {
+		slots[i].lpDevice = NULL;
+		slots[i].lGeneration = 0;
+		slots[i].lReaders = 0;
+	}
+	mChunks[chunk] = slots;
+	// The new slots must be visible before a lookup can see the new count
+	LONG count = (chunk + 1) * SLOTS_PER_CHUNK;
+	if (count > MAX_SLOTS)
+		count = MAX_SLOTS;
+	InterlockedExchange(&mSlotCount, count);
+	return TRUE;
+}
+
+void DeviceHandleTable::Release(SLOT* lpSlot, UsbDevice* lpDevice)
+{
+	// Change the generation first, so that a lookup which still sees the
+	// device afterwards rejects it.
+	InterlockedIncrement(&lpSlot->lGeneration);
+	InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&lpSlot->lpDevice), NULL);
+	// Lookups only stay in the slot for a few instructions, but they can
+	// be preempted by this thread, so sleep to let them run.
+	while (InterlockedCompareExchange(&lpSlot->lReaders, 0, 0) != 0)
+		Sleep(1);
+	mList->PutDevice(lpDevice);
+}
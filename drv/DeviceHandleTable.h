@@ -0,0 +1,85 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// DeviceHandleTable.h : Small integer handles to the devices opened by a context
+#ifndef DEVICE_HANDLE_TABLE_H
+#define DEVICE_HANDLE_TABLE_H
+
+#include "ceusbkwrapper_common.h"
+
+class UsbDevice;
+class UsbDeviceList;
+
+/*
+ * Userspace refers to devices with UKWD_USB_DEVICE handles which hold the
+ * slot index in the low word and the slot generation in the high word.
+ * The generation is changed whenever a slot is released, so a stale
+ * handle is rejected even once the slot has been reused. Each slot holds
+ * a reference to its device.
+ *
+ * GetDevice() doesn't take mMutex. Slots are allocated in chunks which
+ * never move, and a lookup counts itself as a reader of the slot while it
+ * adds its reference, which Remove() waits for before putting the slot's
+ * reference.
+ */
+class DeviceHandleTable {
+public:
+	DeviceHandleTable(UsbDeviceList* lpList);
+	~DeviceHandleTable();
+	BOOL Init();
+
+	UsbDeviceList* GetDeviceList();
+
+	// Stores a device which has already been referenced, the reference
+	// passes to the table. Returns the new handle or NULL on failure.
+	UKWD_USB_DEVICE Insert(UsbDevice* lpDevice);
+	// Removes a handle and puts the reference held by its slot
+	BOOL Remove(UKWD_USB_DEVICE DeviceHandle);
+	// Returns the device with a reference added, or NULL. This doesn't
+	// take any locks.
+	UsbDevice* GetDevice(UKWD_USB_DEVICE DeviceHandle);
+	// Releases the interfaces claimed by Context on every device still
+	// in the table and removes them all, returning how many there were.
+	DWORD RemoveAll(LPVOID Context);
+private:
+	// Only modified with interlocked operations, as GetDevice() reads
+	// slots without holding mMutex.
+	typedef struct {
+		UsbDevice* volatile lpDevice;
+		// Only the low word is used in handles
+		LONG lGeneration;
+		// Number of GetDevice() calls currently using the slot
+		LONG lReaders;
+	} SLOT;
+
+	// Returns the slot at idx, which must be below mSlotCount
+	SLOT* Slot(DWORD idx);
+	// These should be called with mMutex held
+	SLOT* FindSlot(UKWD_USB_DEVICE DeviceHandle);
+	BOOL Grow();
+	// Empties a slot holding lpDevice and puts the slot's reference
+	void Release(SLOT* lpSlot, UsbDevice* lpDevice);
+private:
+	HANDLE mMutex;
+	UsbDeviceList* mList;
+	// Chunks of slots, which are only freed with the table
+	SLOT** mChunks;
+	LONG mSlotCount;
+};
+
+#endif // DEVICE_HANDLE_TABLE_H
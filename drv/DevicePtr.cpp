@@ -21,21 +21,21 @@
 #include "StdAfx.h"	
 #include "DevicePtr.h"
 #include "UsbDeviceList.h"
+#include "DeviceHandleTable.h"
 
-DevicePtr::DevicePtr(UsbDeviceList* lpList, UKWD_USB_DEVICE DeviceIdentifier)
-: mList(lpList),
-  mDeviceIdentifier(DeviceIdentifier),
+DevicePtr::DevicePtr(DeviceHandleTable* lpHandles, UKWD_USB_DEVICE DeviceHandle)
+: mList(lpHandles->GetDeviceList()),
   mDevice(NULL)
 {
-	mDevice = mList->GetDevice(mDeviceIdentifier);
+	mDevice = lpHandles->GetDevice(DeviceHandle);
 }
 
 DevicePtr::DevicePtr(const DevicePtr& device)
 : mList(device.mList),
-  mDeviceIdentifier(device.mDeviceIdentifier),
   mDevice(NULL)
 {
-	mDevice = mList->GetDevice(device.mDevice);
+	if (device.mDevice)
+		mDevice = mList->GetDevice(device.mDevice);
 }
 
 BOOL DevicePtr::Valid() const
@@ -25,10 +25,11 @@
 
 class UsbDeviceList;
 class UsbDevice;
+class DeviceHandleTable;
 
 class DevicePtr {
 public:
-	DevicePtr(UsbDeviceList* lpList, UKWD_USB_DEVICE DeviceIdentifier);
+	DevicePtr(DeviceHandleTable* lpHandles, UKWD_USB_DEVICE DeviceHandle);
 	DevicePtr(const DevicePtr& device);
 	BOOL Valid() const;
 	UsbDevice* operator->();
@@ -36,7 +37,6 @@ public:
 	~DevicePtr();
 private:
 	UsbDeviceList* mList;
-	UKWD_USB_DEVICE mDeviceIdentifier;
 	UsbDevice* mDevice;
 };
 
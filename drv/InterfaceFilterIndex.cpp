@@ -0,0 +1,188 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// InterfaceFilterIndex.cpp : Interface filters and an index for matching them quickly
+
+#include "StdAfx.h"
+#include "InterfaceFilterIndex.h"
+#include "drvdbg.h"
+
+#include <new>
+
+// Minimum number of buckets in each hash table
+#define MIN_BUCKETS 16
+
+InterfaceFilterIndex::InterfaceFilterIndex()
+: mFilters(NULL)
+, mEntries(NULL)
+, mBucketMask(0)
+, mVendorProductBuckets(NULL)
+, mVendorBuckets(NULL)
+, mGeneric(NULL)
+{
+	memset(mClassBuckets, 0, sizeof(mClassBuckets));
+}
+
+InterfaceFilterIndex::~InterfaceFilterIndex()
+{
+	Clear();
+}
+
+void InterfaceFilterIndex::Clear()
+{
+	delete [] mEntries;
+	delete [] mVendorProductBuckets;
+	delete [] mVendorBuckets;
+	mEntries = NULL;
+	mVendorProductBuckets = NULL;
+	mVendorBuckets = NULL;
+	mBucketMask = 0;
+	memset(mClassBuckets, 0, sizeof(mClassBuckets));
+	mGeneric = NULL;
+	mFilters = NULL;
+}
+
+BOOL InterfaceFilterIndex::IsExact(LPCINTERFACE_FILTER_FIELD field)
+{
+	return field->match && field->value != USB_NO_INFO;
+}
+
+DWORD InterfaceFilterIndex::VendorProductBucket(DWORD idVendor, DWORD idProduct) const
+{
+	DWORD hash = ((idVendor << 16) | (idProduct & 0xFFFF)) * 0x9E3779B1;
+	return (hash ^ (hash >> 15)) & mBucketMask;
+}
+
+DWORD InterfaceFilterIndex::VendorBucket(DWORD idVendor) const
+{
+	DWORD hash = idVendor * 0x9E3779B1;
+	return (hash ^ (hash >> 15)) & mBucketMask;
+}
+
+BOOL InterfaceFilterIndex::Build(PFILTER_NODE lpFilters)
+{
+	Clear();
+	mFilters = lpFilters;
+
+	DWORD count = 0;
+	for (PFILTER_NODE node = lpFilters; node; node = node->next)
+		++count;
+	if (count == 0)
+		return TRUE;
+
+	DWORD buckets = MIN_BUCKETS;
+	while (buckets < count && buckets < 0x80000000)
+		buckets <<= 1;
+
+	mEntries = new (std::nothrow) INDEX_ENTRY[count];
+	mVendorProductBuckets = new (std::nothrow) PINDEX_ENTRY[buckets];
+	mVendorBuckets = new (std::nothrow) PINDEX_ENTRY[buckets];
+	if (!mEntries || !mVendorProductBuckets || !mVendorBuckets) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!InterfaceFilterIndex::Build() - Out of memory indexing %d filters\r\n"), count));
+		Clear();
+		mFilters = lpFilters;
+		return FALSE;
+	}
+	memset(mVendorProductBuckets, 0, buckets * sizeof(PINDEX_ENTRY));
+	memset(mVendorBuckets, 0, buckets * sizeof(PINDEX_ENTRY));
+	mBucketMask = buckets - 1;
+
+	DWORD rank = 0;
+	for (PFILTER_NODE node = lpFilters; node; node = node->next, ++rank) {
+		mEntries[rank].filter = &node->filter;
+		mEntries[rank].rank = rank;
+		mEntries[rank].next = NULL;
+	}
+
+	// Add the entries lowest priority first, so that each bucket ends up
+	// in list order.
+	for (DWORD i = count; i > 0; --i) {
+		PINDEX_ENTRY entry = &mEntries[i - 1];
+		LPINTERFACE_FILTER filter = entry->filter;
+		PINDEX_ENTRY* bucket;
+		if (IsExact(&filter->idVendor) && IsExact(&filter->idProduct)) {
+			bucket = &mVendorProductBuckets[VendorProductBucket(filter->idVendor.value, filter->idProduct.value)];
+		} else if (IsExact(&filter->idVendor)) {
+			bucket = &mVendorBuckets[VendorBucket(filter->idVendor.value)];
+		} else if (IsExact(&filter->bInterfaceClass) && filter->bInterfaceClass.value <= 0xFF) {
+			bucket = &mClassBuckets[filter->bInterfaceClass.value];
+		} else {
+			bucket = &mGeneric;
+		}
+		entry->next = *bucket;
+		*bucket = entry;
+	}
+	return TRUE;
+}
+
+void InterfaceFilterIndex::ScanBucket(PINDEX_ENTRY entry, LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface, PINDEX_ENTRY& best)
+{
+	// Buckets are in list order, so nothing after a better match than
+	// the best so far needs checking.
+	for (; entry && (!best || entry->rank < best->rank); entry = entry->next) {
+		if (Matches(entry->filter, lpDevice, lpInterface)) {
+			best = entry;
+			return;
+		}
+	}
+}
+
+LPINTERFACE_FILTER InterfaceFilterIndex::Find(LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface)
+{
+	if (!mEntries)
+		return FindLinear(mFilters, lpDevice, lpInterface);
+
+	DWORD idVendor = lpDevice->Descriptor.idVendor;
+	DWORD idProduct = lpDevice->Descriptor.idProduct;
+	PINDEX_ENTRY best = NULL;
+	ScanBucket(mVendorProductBuckets[VendorProductBucket(idVendor, idProduct)], lpDevice, lpInterface, best);
+	ScanBucket(mVendorBuckets[VendorBucket(idVendor)], lpDevice, lpInterface, best);
+	ScanBucket(mClassBuckets[lpInterface->Descriptor.bInterfaceClass], lpDevice, lpInterface, best);
+	ScanBucket(mGeneric, lpDevice, lpInterface, best);
+	return best ? best->filter : NULL;
+}
+
+BOOL InterfaceFilterIndex::MatchField(DWORD value, LPCINTERFACE_FILTER_FIELD field)
+{
+	if (field->value == USB_NO_INFO) {
+		return TRUE;
+	} else if (field->match) {
+		return (field->value == value);
+	} else {
+		return (field->value != value);
+	}
+}
+
+BOOL InterfaceFilterIndex::Matches(LPCINTERFACE_FILTER filter, LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface)
+{
+	return MatchField(lpInterface->Descriptor.bInterfaceClass, &filter->bInterfaceClass) &&
+		MatchField(lpInterface->Descriptor.bInterfaceSubClass, &filter->bInterfaceSubClass) &&
+		MatchField(lpInterface->Descriptor.bInterfaceProtocol, &filter->bInterfaceProtocol) &&
+		MatchField(lpDevice->Descriptor.idVendor, &filter->idVendor) &&
+		MatchField(lpDevice->Descriptor.idProduct, &filter->idProduct);
+}
+
+LPINTERFACE_FILTER InterfaceFilterIndex::FindLinear(PFILTER_NODE lpFilters, LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface)
+{
+	// Filter list is maintained in priority order
+	for (PFILTER_NODE next = lpFilters; next; next = next->next) {
+		if (Matches(&next->filter, lpDevice, lpInterface))
+			return &next->filter;
+	}
+	return NULL;
+}
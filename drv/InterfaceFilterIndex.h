@@ -0,0 +1,106 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// InterfaceFilterIndex.h : Interface filters and an index for matching them quickly
+#ifndef INTERFACE_FILTER_INDEX_H
+#define INTERFACE_FILTER_INDEX_H
+
+#include "ceusbkwrapper_common.h"
+
+// Interface filter structure
+typedef struct {
+	BOOL match;   // If true, value must match, else value must not match
+	DWORD value;  // A value or USB_NO_INFO if this field should match-all
+} INTERFACE_FILTER_FIELD, *PINTERFACE_FILTER_FIELD, *LPINTERFACE_FILTER_FIELD;
+typedef const LPINTERFACE_FILTER_FIELD LPCINTERFACE_FILTER_FIELD;
+
+typedef struct {
+	// Filter name
+	LPWSTR name;
+
+	// Filter priority (MAXDWORD means lowest / no priority)
+	DWORD priority;
+
+	// Field values
+	INTERFACE_FILTER_FIELD bInterfaceClass;
+	INTERFACE_FILTER_FIELD bInterfaceSubClass;
+	INTERFACE_FILTER_FIELD bInterfaceProtocol;
+	INTERFACE_FILTER_FIELD idVendor;
+	INTERFACE_FILTER_FIELD idProduct;
+
+	// Filter flags
+	BOOL noAttach;
+
+} INTERFACE_FILTER, *PINTERFACE_FILTER, *LPINTERFACE_FILTER;
+typedef const LPINTERFACE_FILTER LPCINTERFACE_FILTER;
+
+typedef struct FilterNode {
+	INTERFACE_FILTER filter;
+	struct FilterNode* next;
+
+} FILTER_NODE, *PFILTER_NODE, *LPFILTER_NODE;
+typedef const LPFILTER_NODE LPCFILTER_NODE;
+
+/*
+ * Index over a priority ordered list of interface filters. Filters which
+ * require a particular vendor and product, a particular vendor, or a
+ * particular interface class are placed in buckets for those values and
+ * the remaining filters are kept in a generic list. A lookup only checks
+ * the buckets which can match the interface, and each bucket is kept in
+ * list order so the first match found is the same as walking the list.
+ */
+class InterfaceFilterIndex {
+public:
+	InterfaceFilterIndex();
+	~InterfaceFilterIndex();
+
+	// Indexes lpFilters, which must not change or be freed until the
+	// index is cleared. Returns FALSE if the index couldn't be allocated,
+	// in which case Find() walks the list instead.
+	BOOL Build(PFILTER_NODE lpFilters);
+	void Clear();
+
+	// Returns the first filter in priority order which matches the
+	// interface, or NULL if there isn't one.
+	LPINTERFACE_FILTER Find(LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface);
+
+	static BOOL Matches(LPCINTERFACE_FILTER filter, LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface);
+	static LPINTERFACE_FILTER FindLinear(PFILTER_NODE lpFilters, LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface);
+private:
+	typedef struct IndexEntry {
+		LPINTERFACE_FILTER filter;
+		DWORD rank; // Position in the filter list
+		struct IndexEntry* next; // Next entry in the same bucket
+	} INDEX_ENTRY, *PINDEX_ENTRY;
+
+	static BOOL MatchField(DWORD value, LPCINTERFACE_FILTER_FIELD field);
+	static BOOL IsExact(LPCINTERFACE_FILTER_FIELD field);
+	DWORD VendorProductBucket(DWORD idVendor, DWORD idProduct) const;
+	DWORD VendorBucket(DWORD idVendor) const;
+	static void ScanBucket(PINDEX_ENTRY entry, LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface, PINDEX_ENTRY& best);
+private:
+	PFILTER_NODE mFilters;
+	PINDEX_ENTRY mEntries;
+	DWORD mBucketMask; // Bucket count minus one, always a power of two minus one
+	PINDEX_ENTRY* mVendorProductBuckets;
+	PINDEX_ENTRY* mVendorBuckets;
+	PINDEX_ENTRY mClassBuckets[256];
+	PINDEX_ENTRY mGeneric;
+};
+
+#endif // INTERFACE_FILTER_INDEX_H
@@ -0,0 +1,86 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// InterfaceFilterTable.cpp : A reference counted, immutable set of interface filters
+
+#include "StdAfx.h"
+#include "InterfaceFilterTable.h"
+#include "drvdbg.h"
+
+InterfaceFilterTable::InterfaceFilterTable(PFILTER_NODE lpFilters)
+: mRefCount(1)
+, mFilters(lpFilters)
+, mCount(0)
+{
+	for (PFILTER_NODE node = mFilters; node; node = node->next)
+		++mCount;
+}
+
+InterfaceFilterTable::~InterfaceFilterTable()
+{
+	mIndex.Clear();
+	DestroyFilters(mFilters);
+}
+
+void InterfaceFilterTable::DestroyFilters(PFILTER_NODE lpFilters)
+{
+	PFILTER_NODE next = lpFilters;
+	while (next) {
+		PFILTER_NODE del = next;
+		next = del->next;
+		delete[] del->filter.name;
+		delete del;
+	}
+}
+
+void InterfaceFilterTable::Init()
+{
+	// If this fails the index falls back to walking the list
+	mIndex.Build(mFilters);
+}
+
+void InterfaceFilterTable::IncRef()
+{
+	InterlockedIncrement(&mRefCount);
+}
+
+void InterfaceFilterTable::DecRef()
+{
+	if (InterlockedDecrement(&mRefCount) == 0)
+		delete this;
+}
+
+LPINTERFACE_FILTER InterfaceFilterTable::Find(LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface)
+{
+	return mIndex.Find(lpDevice, lpInterface);
+}
+
+BOOL InterfaceFilterTable::Empty() const
+{
+	return mFilters == NULL;
+}
+
+DWORD InterfaceFilterTable::Count() const
+{
+	return mCount;
+}
+
+PFILTER_NODE InterfaceFilterTable::Filters()
+{
+	return mFilters;
+}
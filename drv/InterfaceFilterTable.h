@@ -0,0 +1,75 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// InterfaceFilterTable.h : A reference counted, immutable set of interface filters
+
+#ifndef INTERFACE_FILTER_TABLE_H
+#define INTERFACE_FILTER_TABLE_H
+
+#include "InterfaceFilterIndex.h"
+
+/*
+ * Holds the interface filters read from the registry at one point in
+ * time. A table is never changed once created, reloading the filters
+ * creates a new table, so anyone holding a reference can keep using the
+ * filters it contains while a reload happens.
+ */
+class InterfaceFilterTable {
+public:
+	// Takes ownership of the priority ordered lpFilters list. The table
+	// starts with a single reference.
+	InterfaceFilterTable(PFILTER_NODE lpFilters);
+	void Init();
+
+	void IncRef();
+	void DecRef();
+
+	// Returns the first filter in priority order which matches the
+	// interface, or NULL if there isn't one.
+	LPINTERFACE_FILTER Find(LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface);
+	BOOL Empty() const;
+	DWORD Count() const;
+	PFILTER_NODE Filters();
+
+	// Frees a list of filters which hasn't been passed to a table
+	static void DestroyFilters(PFILTER_NODE lpFilters);
+private:
+	~InterfaceFilterTable();
+private:
+	LONG mRefCount;
+	PFILTER_NODE mFilters;
+	DWORD mCount;
+	InterfaceFilterIndex mIndex;
+};
+
+// Holds a reference to a table until it goes out of scope
+class FilterTablePtr {
+public:
+	FilterTablePtr(InterfaceFilterTable* lpTable) : mTable(lpTable) {}
+	~FilterTablePtr() { if (mTable) mTable->DecRef(); }
+	BOOL Valid() const { return mTable != NULL; }
+	InterfaceFilterTable* operator->() { return mTable; }
+private:
+	// Not copyable
+	FilterTablePtr(const FilterTablePtr&);
+	FilterTablePtr& operator=(const FilterTablePtr&);
+private:
+	InterfaceFilterTable* mTable;
+};
+
+#endif // INTERFACE_FILTER_TABLE_H
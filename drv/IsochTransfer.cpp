@@ -0,0 +1,184 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// IsochTransfer.cpp : Represents a pending isochronous transfer
+
+#include "StdAfx.h"
+#include "IsochTransfer.h"
+#include "OpenContext.h"
+#include "TransferList.h"
+#include "UserBuffer.h"
+#include "UsbDevice.h"
+#include "drvdbg.h"
+
+static DWORD AccessFlagsForFramesBuffer(DWORD dwFlags, LPOVERLAPPED lpOverlapped)
+{
+	return UBA_READ_WRITE | ((lpOverlapped || (dwFlags & USB_NO_WAIT)) ? UBA_ASYNC : 0);
+}
+
+IsochTransfer::IsochTransfer(
+	OpenContext* OpenContext,
+	DevicePtr& device,
+	DWORD dwInterface,
+	LPUKWD_ISOCH_TRANSFER_INFO lpTransferInfo)
+: Transfer(
+	OpenContext,
+	device,
+	lpTransferInfo->dwFlags,
+	lpTransferInfo->lpDataBuffer,
+	lpTransferInfo->dwDataBufferSize,
+	0,
+	0,
+	lpTransferInfo->pBytesTransferred,
+	lpTransferInfo->lpOverlapped,
+	0)
+, mInterface(dwInterface)
+, mTransferInfo(*lpTransferInfo)
+, mFramesBuffer(
+		AccessFlagsForFramesBuffer(mTransferInfo.dwFlags, mTransferInfo.lpOverlapped),
+		mTransferInfo.lpFrames,
+		mTransferInfo.dwFrames <= UKWD_MAX_ISOCH_FRAMES ?
+			mTransferInfo.dwFrames * sizeof(UKWD_ISOCH_FRAME) : 0)
+{
+	TRANSFERLIFETIME_MSG((
+		TEXT("USBKWrapperDrv!IsochTransfer:IsochTransfer() created\r\n")));
+}
+
+IsochTransfer::~IsochTransfer()
+{
+	// The transfer must not use mLengths once this has been destroyed
+	CloseTransfer();
+}
+
+BOOL IsochTransfer::ReadFrames()
+{
+	if (mTransferInfo.dwFrames == 0 || mTransferInfo.dwFrames > UKWD_MAX_ISOCH_FRAMES ||
+		!mFramesBuffer.Valid() || !mFramesBuffer.Ptr()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!IsochTransfer::ReadFrames() invalid list of %d frames\r\n"),
+			mTransferInfo.dwFrames));
+		return FALSE;
+	}
+	LPUKWD_ISOCH_FRAME lpFrames = static_cast<LPUKWD_ISOCH_FRAME>(mFramesBuffer.Ptr());
+	DWORD total = 0;
+	for (DWORD i = 0; i < mTransferInfo.dwFrames; ++i) {
+		// Copied as the caller could change the list at any time
+		mLengths[i] = lpFrames[i].dwLength;
+		mFrameBytes[i] = 0;
+		mFrameErrors[i] = USB_NO_ERROR;
+		if (total + mLengths[i] < total)
+			return FALSE;
+		total += mLengths[i];
+	}
+	if (total > DataSize()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!IsochTransfer::ReadFrames() frames of %d bytes exceed buffer\r\n"),
+			total));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void IsochTransfer::WriteFrames(BOOL bResultsValid)
+{
+	LPUKWD_ISOCH_FRAME lpFrames = static_cast<LPUKWD_ISOCH_FRAME>(mFramesBuffer.Ptr());
+	if (!bResultsValid) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!IsochTransfer::WriteFrames() failed to get frame results\r\n")));
+		for (DWORD i = 0; i < mTransferInfo.dwFrames; ++i) {
+			mFrameBytes[i] = 0;
+			mFrameErrors[i] = USB_CANCELED_ERROR;
+		}
+	}
+	for (DWORD i = 0; i < mTransferInfo.dwFrames; ++i) {
+		lpFrames[i].dwBytesTransferred = mFrameBytes[i];
+		lpFrames[i].dwError = TranslateError(mFrameErrors[i], mFrameBytes[i], Cancelled());
+	}
+	mFramesBuffer.Flush();
+}
+
+void IsochTransfer::DataTransferred(DWORD dwBytesTransferred)
+{
+	// Called from the transfer completion callback
+	WriteFrames(mDevicePtr->GetIsochResultsNoLock(TransferHandle(),
+		mTransferInfo.dwFrames, mFrameBytes, mFrameErrors));
+}
+
+BOOL IsochTransfer::Start()
+{
+	if (!Transfer::Validate()) {
+		return FALSE;
+	}
+	if (!ReadFrames()) {
+		mOverlappedBuffer.Abort();
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	if (mTransferInfo.lpOverlapped)
+		// Increment the reference count so that this stays alive
+		// until Transfer::TransferComplete() is called.
+		mOpenContext->GetTransferList()->GetTransfer(this);
+
+	USB_TRANSFER transfer = mDevicePtr->IssueIsochTransfer(
+		mTransferInfo.lpOverlapped ? this : NULL,
+		mInterface,
+		mTransferInfo.Endpoint,
+		mTransferInfo.dwFlags,
+		mTransferInfo.dwStartingFrame,
+		mTransferInfo.dwFrames,
+		mLengths,
+		DataPtr());
+
+	SetTransfer(transfer);
+
+	if (!transfer) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!IsochTransfer::Start failed to issue transfer: %i\r\n"), GetLastError()));
+		if (mTransferInfo.lpOverlapped)
+			// Decrement the reference count as Transfer::TransferComplete()
+			// will never be called
+			mOpenContext->GetTransferList()->PutTransfer(this);
+		return FALSE;
+	}
+
+	if (!mTransferInfo.lpOverlapped) {
+		DWORD bytesTransferred, transferError;
+		if (!mDevicePtr->GetTransferStatus(transfer, &bytesTransferred, &transferError)) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!IsochTransfer::Start used invalid transfer handle\r\n")));
+			SetLastError(ERROR_INVALID_HANDLE);
+			return FALSE;
+		}
+		if (transferError != USB_NO_ERROR) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!IsochTransfer::Start transfer failed with USB error %d\r\n"),
+				transferError));
+		}
+		WriteFrames(mDevicePtr->GetIsochResults(transfer,
+			mTransferInfo.dwFrames, mFrameBytes, mFrameErrors));
+		SetLastError(TranslateError(transferError, bytesTransferred, FALSE));
+		SetBytesTransferred(bytesTransferred);
+		return transferError == USB_NO_ERROR;
+	}
+	return TRUE;
+}
+
+BOOL IsochTransfer::IssuedOnEndpoint(UCHAR Endpoint)
+{
+	return mTransferInfo.Endpoint == Endpoint;
+}
+
+BOOL IsochTransfer::IssuedOnInterface(DWORD dwInterface)
+{
+	return mInterface == dwInterface;
+}
@@ -0,0 +1,64 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// IsochTransfer.h : Represents a pending isochronous transfer
+
+#ifndef ISOCH_TRANSFER_H
+#define ISOCH_TRANSFER_H
+
+#include "ceusbkwrapper_common.h"
+#include "Transfer.h"
+#include "DevicePtr.h"
+#include "UserBuffer.h"
+
+class OpenContext;
+
+class IsochTransfer : public Transfer {
+public:
+	IsochTransfer(
+		OpenContext* OpenContext,
+		DevicePtr& device,
+		DWORD dwInterface,
+		LPUKWD_ISOCH_TRANSFER_INFO lpTransferInfo);
+	virtual ~IsochTransfer();
+	BOOL Start();
+protected:
+	virtual void DataTransferred(DWORD dwBytesTransferred);
+	virtual BOOL IssuedOnEndpoint(UCHAR Endpoint);
+	virtual BOOL IssuedOnInterface(DWORD dwInterface);
+private:
+	// Copies the frame lengths out of the caller's frame list
+	BOOL ReadFrames();
+	// Copies the per-frame results into the caller's frame list
+	void WriteFrames(BOOL bResultsValid);
+private:
+	DWORD mInterface;
+	// Must stay ahead of mFramesBuffer, which is sized from the frame count
+	// in this copy rather than from the caller's structure.
+	UKWD_ISOCH_TRANSFER_INFO mTransferInfo;
+	UserBuffer<LPVOID> mFramesBuffer;
+	// The per-frame arrays are held in the transfer, which is recycled by
+	// the isochronous transfer pool, so they aren't allocated per transfer.
+	// The caller's buffers are still mapped for every transfer.
+	DWORD mLengths[UKWD_MAX_ISOCH_FRAMES];
+	DWORD mFrameBytes[UKWD_MAX_ISOCH_FRAMES];
+	DWORD mFrameErrors[UKWD_MAX_ISOCH_FRAMES];
+};
+
+
+#endif // ISOCH_TRANSFER_H
@@ -26,16 +26,57 @@
 #include "MutexLocker.h"
 #include "DevicePtr.h"
 #include "TransferList.h"
+#include "TransferPool.h"
 #include "Transfer.h"
 #include "TransferPtr.h"
+#include "CompletionQueue.h"
+#include "SharedRings.h"
+#include "RegisteredBuffers.h"
+#include "RegisteredEvents.h"
+#include "BulkStream.h"
 #include "ControlTransfer.h"
 #include "BulkTransfer.h"
+#include "IsochTransfer.h"
+#include "TimerWheel.h"
+#include "DeviceEventQueue.h"
+#include "DeviceHandleTable.h"
 #include "drvdbg.h"
 
 #include <new>
 
+// Number of ring submissions copied out and started at once
+#define RING_FETCH_CHUNK 32
+
+// Number of transfers the transfer pool is created with
+#define TRANSFER_POOL_PREALLOCATE 8
+// Control and bulk transfers should fit in a transfer pool slot
+#define LARGER_SIZE(a, b) ((a) > (b) ? (a) : (b))
+#define TRANSFER_POOL_SLOT_SIZE \
+	LARGER_SIZE(sizeof(ControlTransfer), sizeof(BulkTransfer))
+// Isochronous transfers hold their frame lists, which would make every slot
+// of the transfer pool several times larger, so they have a pool of their
+// own which only allocates once isochronous transfers are used.
+#define ISOCH_TRANSFER_POOL_PREALLOCATE 0
+
+static UKWD_USB_DEVICE BatchEntryDevice(const UKWD_BATCH_TRANSFER_ENTRY& entry)
+{
+	return entry.dwType == UKWD_BATCH_CONTROL_TRANSFER ?
+		entry.Control.lpDevice : entry.Bulk.lpDevice;
+}
+
+static LPOVERLAPPED BatchEntryOverlapped(const UKWD_BATCH_TRANSFER_ENTRY& entry)
+{
+	return entry.dwType == UKWD_BATCH_CONTROL_TRANSFER ?
+		entry.Control.lpOverlapped : entry.Bulk.lpOverlapped;
+}
+
 OpenContext::OpenContext(DeviceContext* Device)
-: mTransferList(NULL), mDevice(Device), mMutex(NULL)
+: mTransferList(NULL), mTransferPool(NULL), mIsochTransferPool(NULL), mCompletionQueue(NULL)
+, mRegisteredBuffers(NULL), mRegisteredEvents(NULL), mStreams(NULL)
+, mDeviceEvents(NULL), mDeviceHandles(NULL)
+, mDevice(Device), mMutex(NULL)
+, mRingMutex(NULL), mRings(NULL)
+, mSplitChunkSize(0), mSplitMaxChunks(0)
 {
 
 }
@@ -45,19 +86,35 @@ OpenContext::~OpenContext()
 	if (mMutex)
 		CloseHandle(mMutex);
 
+	if (mDeviceEvents) {
+		mDevice->GetDeviceList()->RemoveEventQueue(mDeviceEvents);
+		delete mDeviceEvents;
+	}
+
+	// Streams must be stopped before any leaked devices are released below
+	delete mStreams;
+	// The timer wheel must not time out transfers while they are
+	// cancelled and freed by the transfer list.
+	mDevice->GetTimerWheel()->RemoveAll(this);
 	delete mTransferList;
+	// Deleting the transfer list can complete transfers, so these
+	// must be deleted afterwards.
+	delete mTransferPool;
+	delete mIsochTransferPool;
+	delete mCompletionQueue;
+	delete mRegisteredBuffers;
+	delete mRegisteredEvents;
+	delete mRings;
+	if (mRingMutex)
+		CloseHandle(mRingMutex);
 
 	// Release any leaked devices
-	DWORD count = 0;
-	PtrArray<UsbDevice>::iterator it = mOpenDevices.begin();
-	while(it != mOpenDevices.end()) {
-		(*it)->ReleaseAllInterfaces(this);
-		mDevice->GetDeviceList()->PutDevice(*it);
-		++count;
-		++it;
-	}
-	if (count > 0) {
-		WARN_MSG((TEXT("USBKWrapperDrv!OpenContext::~OpenContext() - detected %d leaked devices\r\n"), count));
+	if (mDeviceHandles) {
+		DWORD count = mDeviceHandles->RemoveAll(this);
+		if (count > 0) {
+			WARN_MSG((TEXT("USBKWrapperDrv!OpenContext::~OpenContext() - detected %d leaked devices\r\n"), count));
+		}
+		delete mDeviceHandles;
 	}
 }
 
@@ -68,35 +125,99 @@ BOOL OpenContext::Init()
 		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create mutex\r\n")));
 		return FALSE;
 	}
+	mRingMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mRingMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create ring mutex\r\n")));
+		return FALSE;
+	}
+	mCompletionQueue = new (std::nothrow) CompletionQueue();
+	if ((!mCompletionQueue) || (!mCompletionQueue->Init())) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create completion queue\r\n")));
+		return FALSE;
+	}
+	mRegisteredBuffers = new (std::nothrow) RegisteredBufferTable();
+	if ((!mRegisteredBuffers) || (!mRegisteredBuffers->Init())) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create registered buffer table\r\n")));
+		return FALSE;
+	}
+	mRegisteredEvents = new (std::nothrow) RegisteredEventTable();
+	if ((!mRegisteredEvents) || (!mRegisteredEvents->Init())) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create registered event table\r\n")));
+		return FALSE;
+	}
+	mStreams = new (std::nothrow) BulkStreamTable();
+	if ((!mStreams) || (!mStreams->Init())) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create stream table\r\n")));
+		return FALSE;
+	}
+	mTransferPool = new (std::nothrow) TransferPool(TRANSFER_POOL_SLOT_SIZE);
+	if ((!mTransferPool) || (!mTransferPool->Init(TRANSFER_POOL_PREALLOCATE))) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create transfer pool\r\n")));
+		return FALSE;
+	}
+	mIsochTransferPool = new (std::nothrow) TransferPool(sizeof(IsochTransfer));
+	if ((!mIsochTransferPool) || (!mIsochTransferPool->Init(ISOCH_TRANSFER_POOL_PREALLOCATE))) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create isochronous transfer pool\r\n")));
+		return FALSE;
+	}
 	mTransferList = new (std::nothrow) TransferList();
 	if ((!mTransferList) || (!mTransferList->Init())) {
 		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create transfer list\r\n")));
 		return FALSE;
 	}
+	mDeviceHandles = new (std::nothrow) DeviceHandleTable(mDevice->GetDeviceList());
+	if ((!mDeviceHandles) || (!mDeviceHandles->Init())) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create device handle table\r\n")));
+		return FALSE;
+	}
+	mDeviceEvents = new (std::nothrow) DeviceEventQueue();
+	if ((!mDeviceEvents) || (!mDeviceEvents->Init()) ||
+			(!mDevice->GetDeviceList()->AddEventQueue(mDeviceEvents))) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::Init() - failed to create device event queue\r\n")));
+		return FALSE;
+	}
 	return TRUE;
 }
 
+void OpenContext::PreClose()
+{
+	// Wake up any threads blocked waiting for completions, streams
+	// or device events
+	mCompletionQueue->Abort();
+	mStreams->Abort();
+	mDeviceEvents->Abort();
+}
 
 TransferList* OpenContext::GetTransferList()
 {
 	return mTransferList;
 }
 
-// Checks that device is valid and is open
-// by this context.
+CompletionQueue* OpenContext::GetCompletionQueue()
+{
+	return mCompletionQueue;
+}
+
+RegisteredBufferTable* OpenContext::GetRegisteredBuffers()
+{
+	return mRegisteredBuffers;
+}
+
+RegisteredEventTable* OpenContext::GetRegisteredEvents()
+{
+	return mRegisteredEvents;
+}
+
+TimerWheel* OpenContext::GetTimerWheel()
+{
+	return mDevice->GetTimerWheel();
+}
+
+// Checks that device is valid, the handle table only
+// holds devices opened by this context.
 BOOL OpenContext::Validate(DevicePtr& device)
 {
-	if (!device.Valid())
-		return FALSE;
-	PtrArray<UsbDevice>::iterator it
-		= mOpenDevices.find(device.Get());
-	if (it == mOpenDevices.end()) {
-	    WARN_MSG((TEXT("USBKWrapperDrv!OpenContext::Validate")
-			TEXT(" - failed to find device in this context for identifier 0x%08x\r\n"),
-			device->GetIdentifier()));
-		return FALSE;
-	} 
-	return TRUE;
+	return device.Valid();
 }
 
 DWORD OpenContext::GetDevices(UKWD_USB_DEVICE* lpDevices, DWORD Size)
@@ -108,48 +229,100 @@ DWORD OpenContext::GetDevices(UKWD_USB_DEVICE* lpDevices, DWORD Size)
 		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
 		return -1;
 	}
-	DWORD deviceCount = mDevice->GetDeviceList()->GetAvailableDevices(devices, Size);
+	DWORD deviceCount = mDevice->GetDeviceList()->GetAvailableDevices(devices, Size, NULL);
 	DWORD i = 0;
 	
 	for(i = 0; i < deviceCount; ++i) {
-		if (!mOpenDevices.insert(devices[i])) {
-			// Failed to add a device to the list, drop the devices and remove the
+		// The handle table takes over the reference to the device
+		lpDevices[i] = mDeviceHandles->Insert(devices[i]);
+		if (!lpDevices[i]) {
+			// Drop this and the remaining devices, then remove the
 			// already added devices
 			ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::GetDevices() - failed to remember all devices, aborting\r\n")));
-			for(DWORD j = i; j >= 0; --j) {
+			for(DWORD j = i; j < deviceCount; ++j)
 				mDevice->GetDeviceList()->PutDevice(devices[j]);
-				mOpenDevices.erase(devices[i]);
-			}
+			for(DWORD j = 0; j < i; ++j)
+				mDeviceHandles->Remove(lpDevices[j]);
 			deviceCount = -1;
 			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
 			break;
 		}
-		lpDevices[i] = devices[i]->GetIdentifier();
 	}
 
 	delete[] devices;
 	return deviceCount;
 }
 
-BOOL OpenContext::PutDevices(UKWD_USB_DEVICE* lpDevices, DWORD Size)
+DWORD OpenContext::GetDevicesWithInfo(LPUKWD_USB_DEVICE_ENTRY lpEntries, DWORD Size, LPDWORD lpdwGeneration)
+{
+	MutexLocker lock(mMutex);
+	UsbDevice** devices = new (std::nothrow) UsbDevice*[Size];
+	if (!devices) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::GetDevicesWithInfo() - failed to allocate device list, aborting\r\n")));
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return -1;
+	}
+	DWORD deviceCount = mDevice->GetDeviceList()->GetAvailableDevices(devices, Size, lpdwGeneration);
+	DWORD entryCount = 0;
+
+	for(DWORD i = 0; i < deviceCount; ++i) {
+		// The devices are already referenced, so the information can be
+		// read directly rather than looking each one up again as
+		// GetDeviceInfo() has to.
+		LPUKWD_USB_DEVICE_ENTRY entry = &lpEntries[entryCount];
+		if (!devices[i]->GetDeviceDescriptor(&entry->Info.Descriptor)) {
+			// Closed since it was listed, so just leave it out
+			mDevice->GetDeviceList()->PutDevice(devices[i]);
+			continue;
+		}
+		entry->lpDevice = mDeviceHandles->Insert(devices[i]);
+		if (!entry->lpDevice) {
+			// Drop this and the remaining devices, then remove the
+			// already added devices
+			ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::GetDevicesWithInfo() - failed to remember all devices, aborting\r\n")));
+			for(DWORD j = i; j < deviceCount; ++j)
+				mDevice->GetDeviceList()->PutDevice(devices[j]);
+			for(DWORD j = 0; j < entryCount; ++j)
+				mDeviceHandles->Remove(lpEntries[j].lpDevice);
+			entryCount = -1;
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			break;
+		}
+		entry->Info.dwCount = sizeof(entry->Info);
+		entry->Info.Bus = devices[i]->Bus();
+		entry->Info.Address = devices[i]->Address();
+		entry->Info.SessionId = devices[i]->SessionId();
+		++entryCount;
+	}
+
+	delete[] devices;
+	return entryCount;
+}
+
+BOOL OpenContext::PutDevices(UKWD_USB_DEVICE* lpDevices, DWORD Size, LPDWORD lpStatus)
 {
 	MutexLocker lock(mMutex);
 	BOOL ret = TRUE;
+	// An invalid identifier doesn't stop the rest of the list being put
 	for(DWORD i = 0; i < Size; ++i) {
-		if (!PutDevice(lpDevices[i])) {
+		BOOL put = PutDevice(lpDevices[i]);
+		if (!put) {
 			ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::PutDevices() - failed to put device 0x%08x\r\n"),
 				lpDevices[i]));
-			SetLastError(ERROR_INVALID_HANDLE);
 			ret = FALSE;
 		}
+		if (lpStatus)
+			lpStatus[i] = put ? ERROR_SUCCESS : ERROR_INVALID_HANDLE;
 	}
+	if (!ret)
+		SetLastError(ERROR_INVALID_HANDLE);
 	return ret;
 }
 
 BOOL OpenContext::GetDeviceInfo(UKWD_USB_DEVICE DeviceIdentifier, LPUKWD_USB_DEVICE_INFO lpDeviceInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev(mDevice->GetDeviceList(), DeviceIdentifier);
+	DevicePtr dev (mDeviceHandles, DeviceIdentifier);
 	if (!Validate(dev)) {
 		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::GetDeviceInfo() - failed to validate device 0x%08x\r\n"),
 			DeviceIdentifier));
@@ -188,60 +361,210 @@ BOOL OpenContext::GetDeviceInfo(UKWD_USB_DEVICE DeviceIdentifier, LPUKWD_USB_DEV
 BOOL OpenContext::PutDevice(UKWD_USB_DEVICE DeviceIdentifier)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), DeviceIdentifier);
-	if (!Validate(dev)) {
+	// Puts the reference held by the handle
+	if (!mDeviceHandles->Remove(DeviceIdentifier)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
 	}
-	mOpenDevices.erase(dev.Get());
-	// Put for the reference in mOpenDevices
-	mDevice->GetDeviceList()->PutDevice(dev.Get());
 	return TRUE;
 }
 
 BOOL OpenContext::StartControlTransfer(LPUKWD_CONTROL_TRANSFER_INFO lpTransferInfo)
+{
+	// Control transfers don't need a claimed interface, so mMutex isn't
+	// needed at all. Looking up the handle doesn't take any locks, and the
+	// reference held by dev keeps the device alive for the lifetime of the
+	// transfer.
+	DevicePtr dev (mDeviceHandles, lpTransferInfo->lpDevice);
+	if (!Validate(dev)) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	return DoStartControlTransfer(dev, lpTransferInfo);
+}
+
+BOOL OpenContext::IssueInlineControlTransfer(
+	LPUKWD_INLINE_CONTROL_TRANSFER_INFO lpTransferInfo,
+	LPVOID lpData,
+	LPDWORD lpdwBytesTransferred)
+{
+	// See StartControlTransfer() for why mMutex isn't taken.
+	DevicePtr dev (mDeviceHandles, lpTransferInfo->lpDevice);
+	if (!Validate(dev)) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	// The data lives in the IOCTL buffers, which stay mapped for the
+	// duration of the call, so there's no need for a Transfer or any
+	// UserBuffer mapping.
+	return ControlTransfer::IssueInline(dev, lpTransferInfo->dwFlags,
+		&lpTransferInfo->Header, lpData, lpdwBytesTransferred);
+}
+
+BOOL OpenContext::StartBulkTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo)
+{
+	return StartEndpointTransfer(lpTransferInfo, FALSE);
+}
+
+BOOL OpenContext::StartInterruptTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo)
+{
+	return StartEndpointTransfer(lpTransferInfo, TRUE);
+}
+
+BOOL OpenContext::StartEndpointTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo, BOOL bInterrupt)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpTransferInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpTransferInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
 	}
 
-	TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!OpenContext::StartControlTransfer() with ")
-		TEXT("bmRequestType 0x%02x, bRequest 0x%02x, wValue 0x%04x, wIndex 0x%04x, wLength %d, flags 0x%08x and size %d\r\n"),
-		lpTransferInfo->Header.bmRequestType, lpTransferInfo->Header.bRequest, lpTransferInfo->Header.wValue, 
-		lpTransferInfo->Header.wIndex, lpTransferInfo->Header.wLength, lpTransferInfo->dwFlags, 
-		lpTransferInfo->dwDataBufferSize));
+	DWORD dwInterface;
+	if (!FindClaimedInterface(dev, lpTransferInfo->Endpoint, dwInterface)) {
+		return FALSE;
+	}
+	// The reference held by dev keeps the device alive for the lifetime
+	// of the transfer, so the lock only needs to cover the interface
+	// lookup. Holding it for a synchronous transfer would stall every
+	// other request on this handle until the transfer completed.
+	lock.unlock();
 
-	// Construct and start the control transfer
-	ControlTransfer* ct = new (std::nothrow) ControlTransfer(
-			this, dev, lpTransferInfo);
-	if (!ct) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::StartControlTransfer() - failed to create control transfer, aborting\r\n")));
+	return DoStartBulkTransfer(dev, dwInterface, lpTransferInfo, bInterrupt);
+}
+
+BOOL OpenContext::StartIsochTransfer(LPUKWD_ISOCH_TRANSFER_INFO lpTransferInfo)
+{
+	MutexLocker lock(mMutex);
+	DevicePtr dev (mDeviceHandles, lpTransferInfo->lpDevice);
+	if (!Validate(dev)) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	DWORD dwInterface;
+	if (!FindClaimedInterface(dev, lpTransferInfo->Endpoint, dwInterface)) {
+		return FALSE;
+	}
+	// See StartEndpointTransfer() for why the lock isn't held any longer.
+	lock.unlock();
+
+	TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!OpenContext::StartIsochTransfer() on ep %x, flag 0x%08x, size %d and %d frames\r\n"),
+		lpTransferInfo->Endpoint, lpTransferInfo->dwFlags, lpTransferInfo->dwDataBufferSize, lpTransferInfo->dwFrames));
+
+	// Construct and start the isochronous transfer
+	IsochTransfer* it = new (mIsochTransferPool) IsochTransfer(
+			this, dev, dwInterface, lpTransferInfo);
+	if (!it) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::StartIsochTransfer() - failed to create isochronous transfer, aborting\r\n")));
 		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
 		return FALSE;
 	}
-	BOOL ret = ct->Start();
-	mTransferList->PutTransfer(ct);
-	ct = NULL;
+	BOOL ret = it->Start();
+	mTransferList->PutTransfer(it);
+	it = NULL;
 	if (!ret) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::StartControlTransfer() - failed to start control transfer %d\r\n"), GetLastError()));
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::StartIsochTransfer() - failed to start isochronous transfer %d\r\n"), GetLastError()));
 		return FALSE;
 	}
-	// Ownership of ct has passed to the transfer callback
+	// Ownership of it has passed to the transfer callback
 	return TRUE;
 }
 
-BOOL OpenContext::StartBulkTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo)
+BOOL OpenContext::StartTransfers(LPUKWD_SUBMIT_BATCH_INFO lpBatchInfo, LPDWORD lpStatus)
+{
+	return DoStartTransfers(lpBatchInfo->lpDevice,
+		lpBatchInfo->Entries, lpBatchInfo->dwEntries, lpStatus, FALSE);
+}
+
+BOOL OpenContext::DoStartTransfers(
+	UKWD_USB_DEVICE DeviceIdentifier,
+	LPUKWD_BATCH_TRANSFER_ENTRY lpEntries,
+	DWORD dwEntries,
+	LPDWORD lpStatus,
+	BOOL bRequireOverlapped)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpTransferInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, DeviceIdentifier);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
 	}
+	lock.unlock();
+
+	// Interface lookups are done once for each endpoint used in the batch.
+	// The endpoint address is folded into an index of the endpoint number
+	// with the direction as the top bit.
+	DWORD interfaceForEndpoint[UKWD_MAX_ENDPOINT_INDEX];
+	BOOL interfaceFound[UKWD_MAX_ENDPOINT_INDEX];
+	memset(interfaceFound, 0, sizeof(interfaceFound));
 
+	for (DWORD i = 0; i < dwEntries; ++i) {
+		LPUKWD_BATCH_TRANSFER_ENTRY lpEntry = &lpEntries[i];
+		BOOL ret = FALSE;
+		switch (lpEntry->dwType) {
+			case UKWD_BATCH_CONTROL_TRANSFER: {
+				if (lpEntry->Control.dwCount < sizeof(UKWD_CONTROL_TRANSFER_INFO)) {
+					SetLastError(ERROR_INVALID_PARAMETER);
+					break;
+				}
+				if (lpEntry->Control.lpDevice != DeviceIdentifier) {
+					SetLastError(ERROR_INVALID_HANDLE);
+					break;
+				}
+				if (bRequireOverlapped && !lpEntry->Control.lpOverlapped) {
+					SetLastError(ERROR_INVALID_PARAMETER);
+					break;
+				}
+				ret = DoStartControlTransfer(dev, &lpEntry->Control);
+				break;
+			}
+			case UKWD_BATCH_BULK_TRANSFER: {
+				if (lpEntry->Bulk.dwCount < sizeof(UKWD_BULK_TRANSFER_INFO)) {
+					SetLastError(ERROR_INVALID_PARAMETER);
+					break;
+				}
+				if (lpEntry->Bulk.lpDevice != DeviceIdentifier) {
+					SetLastError(ERROR_INVALID_HANDLE);
+					break;
+				}
+				if (bRequireOverlapped && !lpEntry->Bulk.lpOverlapped) {
+					SetLastError(ERROR_INVALID_PARAMETER);
+					break;
+				}
+				UCHAR Endpoint = lpEntry->Bulk.Endpoint;
+				DWORD index = UKWD_ENDPOINT_INDEX(Endpoint);
+				if (!interfaceFound[index]) {
+					lock.relock();
+					interfaceFound[index] = FindClaimedInterface(
+						dev, Endpoint, interfaceForEndpoint[index]);
+					lock.unlock();
+					if (!interfaceFound[index])
+						break;
+				}
+				ret = DoStartBulkTransfer(dev, interfaceForEndpoint[index], &lpEntry->Bulk, FALSE);
+				break;
+			}
+			default: {
+				ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::DoStartTransfers() - ")
+					TEXT("unknown transfer type %d for entry %d\r\n"),
+					lpEntry->dwType, i));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+		}
+		lpStatus[i] = ret ? ERROR_SUCCESS : GetLastError();
+		if (lpStatus[i] == ERROR_SUCCESS && !ret)
+			lpStatus[i] = ERROR_GEN_FAILURE;
+	}
+	return TRUE;
+}
+
+// Should be called with mMutex held.
+BOOL OpenContext::FindClaimedInterface(DevicePtr& dev, UCHAR Endpoint, DWORD& dwInterface)
+{
 	// Interface can't be used if device has closed
 	if (dev->Closed()) {
 		SetLastError(ERROR_INVALID_HANDLE);
@@ -249,33 +572,63 @@ BOOL OpenContext::StartBulkTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo)
 	}
 
 	// Find the interface for this transfer
-	DWORD dwInterface;
-	if (!dev->FindInterface(lpTransferInfo->Endpoint, dwInterface)) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::StartBulkTransfer() - ")
+	if (!dev->FindInterface(Endpoint, dwInterface)) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::FindClaimedInterface() - ")
 			TEXT("failed to find interface for endpoint %d on device 0x%08x\r\n"),
-			lpTransferInfo->Endpoint, lpTransferInfo->lpDevice));
+			Endpoint, dev.Get()));
 		SetLastError(ERROR_INVALID_PARAMETER);
 		return FALSE;
 	}
 
 	// See if it's already been claimed
 	if (!dev->InterfaceClaimed(dwInterface, this)) {
-		WARN_MSG((TEXT("USBKWrapperDrv!OpenContext::StartBulkTransfer() - ")
+		WARN_MSG((TEXT("USBKWrapperDrv!OpenContext::FindClaimedInterface() - ")
 			TEXT("using interface %d on device 0x%08x without claiming\r\n"),
-			dwInterface, lpTransferInfo->lpDevice));
+			dwInterface, dev.Get()));
 		if (!dev->ClaimInterface(dwInterface, this)) {
 			return FALSE;
 		}
 	}
+	return TRUE;
+}
 
-	TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!OpenContext::StartBulkTransfer() on ep %x, flag 0x%08x and size %d\r\n"),
-		lpTransferInfo->Endpoint, lpTransferInfo->dwFlags, lpTransferInfo->dwDataBufferSize));
+BOOL OpenContext::DoStartControlTransfer(DevicePtr& dev, LPUKWD_CONTROL_TRANSFER_INFO lpTransferInfo)
+{
+	TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!OpenContext::DoStartControlTransfer() with ")
+		TEXT("bmRequestType 0x%02x, bRequest 0x%02x, wValue 0x%04x, wIndex 0x%04x, wLength %d, flags 0x%08x and size %d\r\n"),
+		lpTransferInfo->Header.bmRequestType, lpTransferInfo->Header.bRequest, lpTransferInfo->Header.wValue, 
+		lpTransferInfo->Header.wIndex, lpTransferInfo->Header.wLength, lpTransferInfo->dwFlags, 
+		lpTransferInfo->dwDataBufferSize));
+
+	// Construct and start the control transfer
+	ControlTransfer* ct = new (mTransferPool) ControlTransfer(
+			this, dev, lpTransferInfo);
+	if (!ct) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::DoStartControlTransfer() - failed to create control transfer, aborting\r\n")));
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	BOOL ret = ct->Start();
+	mTransferList->PutTransfer(ct);
+	ct = NULL;
+	if (!ret) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::DoStartControlTransfer() - failed to start control transfer %d\r\n"), GetLastError()));
+		return FALSE;
+	}
+	// Ownership of ct has passed to the transfer callback
+	return TRUE;
+}
+
+BOOL OpenContext::DoStartBulkTransfer(DevicePtr& dev, DWORD dwInterface, LPUKWD_BULK_TRANSFER_INFO lpTransferInfo, BOOL bInterrupt)
+{
+	TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!OpenContext::DoStartBulkTransfer() on ep %x, flag 0x%08x, size %d and interrupt %d\r\n"),
+		lpTransferInfo->Endpoint, lpTransferInfo->dwFlags, lpTransferInfo->dwDataBufferSize, bInterrupt));
 
 	// Construct and start the bulk transfer
-	BulkTransfer* bt = new (std::nothrow) BulkTransfer(
-			this, dev, dwInterface, lpTransferInfo);
+	BulkTransfer* bt = new (mTransferPool) BulkTransfer(
+			this, dev, dwInterface, lpTransferInfo, bInterrupt);
 	if (!bt) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::StartBulkTransfer() - failed to create bulk transfer, aborting\r\n")));
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::DoStartBulkTransfer() - failed to create bulk transfer, aborting\r\n")));
 		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
 		return FALSE;
 	}
@@ -283,28 +636,278 @@ BOOL OpenContext::StartBulkTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo)
 	mTransferList->PutTransfer(bt);
 	bt = NULL;
 	if (!ret) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::StartBulkTransfer() - failed to start bulk transfer %d\r\n"), GetLastError()));
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::DoStartBulkTransfer() - failed to start bulk transfer %d\r\n"), GetLastError()));
 		return FALSE;
 	}
-	// Ownership of ct has passed to the transfer callback
+	// Ownership of bt has passed to the transfer callback
 	return TRUE;
 }
 
 BOOL OpenContext::CancelTransfer(LPUKWD_CANCEL_TRANSFER_INFO lpCancelInfo)
 {
-	MutexLocker lock(mMutex);
+	// No need to take mMutex, the transfer list has its own lock and
+	// cancelling must not wait for synchronous transfers to complete.
 	TransferPtr transfer(this, lpCancelInfo->lpOverlapped);
 	if (!transfer.Valid()) {
 		TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!OpenContext::CancelTransfer() - failed to find transfer to cancel\r\n")));
 		return FALSE;
 	}
-	return transfer->Cancel(lpCancelInfo->lpDevice, lpCancelInfo->dwFlags);
+	DevicePtr dev (mDeviceHandles, lpCancelInfo->lpDevice);
+	if (!Validate(dev)) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+	return transfer->Cancel(dev.Get(), lpCancelInfo->dwFlags);
+}
+
+BOOL OpenContext::CancelAllTransfers(LPUKWD_CANCEL_ALL_INFO lpCancelInfo, LPDWORD lpdwCancelled)
+{
+	// As with CancelTransfer(), mMutex isn't needed.
+	if (lpCancelInfo->dwScope != UKWD_CANCEL_SCOPE_DEVICE &&
+		lpCancelInfo->dwScope != UKWD_CANCEL_SCOPE_INTERFACE &&
+		lpCancelInfo->dwScope != UKWD_CANCEL_SCOPE_ENDPOINT) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	DevicePtr dev (mDeviceHandles, lpCancelInfo->lpDevice);
+	if (!Validate(dev)) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+	return mTransferList->CancelAll(
+		dev.Get(),
+		lpCancelInfo->dwScope,
+		lpCancelInfo->dwInterface,
+		lpCancelInfo->Endpoint,
+		lpCancelInfo->dwFlags,
+		lpdwCancelled);
+}
+
+BOOL OpenContext::EnableCompletionQueue()
+{
+	mCompletionQueue->Enable();
+	return TRUE;
+}
+
+BOOL OpenContext::ReapCompletions(
+	LPUKWD_REAP_COMPLETIONS_INFO lpReapInfo,
+	LPUKWD_COMPLETION lpCompletions,
+	DWORD dwCount,
+	LPDWORD lpdwReaped)
+{
+	// Deliberately not taking mMutex as this can block for a long time
+	return mCompletionQueue->Reap(lpCompletions, dwCount, lpdwReaped, lpReapInfo->dwTimeout);
+}
+
+BOOL OpenContext::WaitForDeviceEvents(
+	LPUKWD_WAIT_DEVICE_EVENTS_INFO lpWaitInfo,
+	LPUKWD_DEVICE_EVENTS lpEvents,
+	DWORD dwCount)
+{
+	// Deliberately not taking mMutex as this can block for a long time
+	return mDeviceEvents->Wait(lpEvents, dwCount, lpWaitInfo->dwTimeout);
+}
+
+BOOL OpenContext::ReloadInterfaceFilters(LPDWORD lpdwCount)
+{
+	return mDevice->GetDeviceList()->ReloadInterfaceFilters(lpdwCount);
+}
+
+BOOL OpenContext::SetupRings(LPUKWD_SETUP_RINGS_INFO lpRingsInfo)
+{
+	MutexLocker ringLock(mRingMutex);
+	if (!lpRingsInfo->lpRegion) {
+		// Remove the rings, any completions from now on will go to the
+		// completion queue instead.
+		mCompletionQueue->DetachRings();
+		delete mRings;
+		mRings = NULL;
+		return TRUE;
+	}
+	if (mRings) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::SetupRings() - rings already set up\r\n")));
+		SetLastError(ERROR_ALREADY_EXISTS);
+		return FALSE;
+	}
+	SharedRings* rings = new (std::nothrow) SharedRings(
+		lpRingsInfo->lpRegion, lpRingsInfo->dwRegionSize);
+	if (!rings) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::SetupRings() - failed to create rings\r\n")));
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	if (!rings->Init()) {
+		delete rings;
+		return FALSE;
+	}
+	mRings = rings;
+	mCompletionQueue->AttachRings(mRings);
+	return TRUE;
+}
+
+BOOL OpenContext::RingDoorbell(LPUKWD_RING_DOORBELL_INFO lpDoorbellInfo, LPDWORD lpdwSubmitted)
+{
+	*lpdwSubmitted = 0;
+	{
+		MutexLocker ringLock(mRingMutex);
+		if (!mRings) {
+			SetLastError(ERROR_NOT_READY);
+			return FALSE;
+		}
+		UKWD_BATCH_TRANSFER_ENTRY entries[RING_FETCH_CHUNK];
+		DWORD status[RING_FETCH_CHUNK];
+		DWORD fetched;
+		while ((fetched = mRings->FetchSubmissions(entries, RING_FETCH_CHUNK)) > 0) {
+			*lpdwSubmitted += fetched;
+			// Start each run of entries for the same device as one batch.
+			// Only asynchronous transfers are accepted, as a synchronous
+			// transfer would block every following submission.
+			DWORD start = 0;
+			while (start < fetched) {
+				UKWD_USB_DEVICE device = BatchEntryDevice(entries[start]);
+				DWORD end = start + 1;
+				while (end < fetched && BatchEntryDevice(entries[end]) == device)
+					++end;
+				if (!DoStartTransfers(device, &entries[start], end - start, &status[start], TRUE)) {
+					DWORD error = GetLastError();
+					for (DWORD i = start; i < end; ++i)
+						status[i] = error;
+				}
+				start = end;
+			}
+			// Transfers which failed to start will never complete,
+			// so report them on the completion ring now.
+			for (DWORD i = 0; i < fetched; ++i) {
+				if (status[i] != ERROR_SUCCESS)
+					mCompletionQueue->Push(BatchEntryOverlapped(entries[i]), status[i], 0);
+			}
+		}
+	}
+	if (lpDoorbellInfo->dwMinCompletions == 0)
+		return TRUE;
+	return mCompletionQueue->WaitForRingCompletions(
+		lpDoorbellInfo->dwMinCompletions, lpDoorbellInfo->dwTimeout);
+}
+
+void OpenContext::GetTransferPoolStats(LPUKWD_TRANSFER_POOL_STATS lpStats)
+{
+	mTransferPool->GetStats(lpStats);
+}
+
+BOOL OpenContext::RegisterBuffer(LPUKWD_REGISTER_BUFFER_INFO lpBufferInfo, LPDWORD lpdwBufferId)
+{
+	return mRegisteredBuffers->Register(
+		lpBufferInfo->lpBuffer, lpBufferInfo->dwBufferSize, lpdwBufferId);
+}
+
+BOOL OpenContext::UnregisterBuffer(DWORD dwBufferId)
+{
+	return mRegisteredBuffers->Unregister(dwBufferId);
+}
+
+BOOL OpenContext::RegisterEvent(HANDLE hEvent)
+{
+	return mRegisteredEvents->Register(hEvent);
+}
+
+BOOL OpenContext::UnregisterEvent(HANDLE hEvent)
+{
+	return mRegisteredEvents->Unregister(hEvent);
+}
+
+BOOL OpenContext::StartStream(LPUKWD_START_STREAM_INFO lpStreamInfo, LPDWORD lpdwStreamId)
+{
+	MutexLocker lock(mMutex);
+	DevicePtr dev (mDeviceHandles, lpStreamInfo->lpDevice);
+	if (!Validate(dev)) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	DWORD dwInterface;
+	if (!FindClaimedInterface(dev, lpStreamInfo->Endpoint, dwInterface)) {
+		return FALSE;
+	}
+	// The stream holds its own reference to the device
+	lock.unlock();
+
+	TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!OpenContext::StartStream() on ep %x with %d transfers of %d bytes\r\n"),
+		lpStreamInfo->Endpoint, lpStreamInfo->dwTransfers, lpStreamInfo->dwTransferSize));
+
+	BulkStream* stream = new (std::nothrow) BulkStream(dev, dwInterface, lpStreamInfo);
+	if (!stream) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::StartStream() - failed to create stream, aborting\r\n")));
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	if (!stream->Init()) {
+		stream->DecRef();
+		return FALSE;
+	}
+	return mStreams->Add(stream, lpdwStreamId);
+}
+
+BOOL OpenContext::StopStream(DWORD dwStreamId)
+{
+	return mStreams->Remove(dwStreamId);
+}
+
+BOOL OpenContext::StreamRead(LPUKWD_STREAM_IO_INFO lpIoInfo, LPDWORD lpdwRead)
+{
+	BulkStream* stream = mStreams->GetStream(lpIoInfo->dwStreamId);
+	if (!stream) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	BOOL ret = stream->Read(lpIoInfo->lpBuffer, lpIoInfo->dwBufferSize, lpdwRead, lpIoInfo->dwTimeout);
+	DWORD error = GetLastError();
+	stream->DecRef();
+	SetLastError(error);
+	return ret;
+}
+
+BOOL OpenContext::StreamWrite(LPUKWD_STREAM_IO_INFO lpIoInfo, LPDWORD lpdwWritten)
+{
+	BulkStream* stream = mStreams->GetStream(lpIoInfo->dwStreamId);
+	if (!stream) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	BOOL ret = stream->Write(lpIoInfo->lpBuffer, lpIoInfo->dwBufferSize, lpdwWritten, lpIoInfo->dwTimeout);
+	DWORD error = GetLastError();
+	stream->DecRef();
+	SetLastError(error);
+	return ret;
+}
+
+BOOL OpenContext::SetTransferSplit(LPUKWD_TRANSFER_SPLIT_INFO lpSplitInfo)
+{
+	if (lpSplitInfo->dwChunkSize != 0 &&
+		(lpSplitInfo->dwChunkSize % UKWD_SPLIT_CHUNK_ALIGNMENT != 0 ||
+		 lpSplitInfo->dwMaxChunks == 0 || lpSplitInfo->dwMaxChunks > UKWD_MAX_SPLIT_CHUNKS)) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OpenContext::SetTransferSplit() - ")
+			TEXT("invalid split into %d chunks of %d bytes\r\n"),
+			lpSplitInfo->dwMaxChunks, lpSplitInfo->dwChunkSize));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	MutexLocker lock(mMutex);
+	mSplitChunkSize = lpSplitInfo->dwChunkSize;
+	mSplitMaxChunks = lpSplitInfo->dwMaxChunks;
+	return TRUE;
+}
+
+void OpenContext::GetTransferSplit(LPDWORD lpdwChunkSize, LPDWORD lpdwMaxChunks)
+{
+	MutexLocker lock(mMutex);
+	*lpdwChunkSize = mSplitChunkSize;
+	*lpdwMaxChunks = mSplitMaxChunks;
 }
 
 BOOL OpenContext::GetConfigDescriptor(LPUKWD_GET_CONFIG_DESC_INFO lpConfigInfo, LPDWORD lpSize)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpConfigInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpConfigInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -333,7 +936,7 @@ BOOL OpenContext::GetConfigDescriptor(LPUKWD_GET_CONFIG_DESC_INFO lpConfigInfo,
 BOOL OpenContext::GetActiveConfigValue(UKWD_USB_DEVICE DeviceIdentifier, PUCHAR pConfigurationValue)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), DeviceIdentifier);
+	DevicePtr dev (mDeviceHandles, DeviceIdentifier);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -344,7 +947,7 @@ BOOL OpenContext::GetActiveConfigValue(UKWD_USB_DEVICE DeviceIdentifier, PUCHAR
 BOOL OpenContext::SetActiveConfigValue(LPUKWD_SET_ACTIVE_CONFIG_VALUE_INFO lpConfigValueInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpConfigValueInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpConfigValueInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -377,7 +980,7 @@ BOOL OpenContext::SetActiveConfigValue(LPUKWD_SET_ACTIVE_CONFIG_VALUE_INFO lpCon
 BOOL OpenContext::ClaimInterface(LPUKWD_INTERFACE_INFO lpInterfaceInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpInterfaceInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpInterfaceInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -389,7 +992,7 @@ BOOL OpenContext::ClaimInterface(LPUKWD_INTERFACE_INFO lpInterfaceInfo)
 BOOL OpenContext::ReleaseInterface(LPUKWD_INTERFACE_INFO lpInterfaceInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpInterfaceInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpInterfaceInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -401,7 +1004,7 @@ BOOL OpenContext::ReleaseInterface(LPUKWD_INTERFACE_INFO lpInterfaceInfo)
 BOOL OpenContext::SetAltSetting(LPUKWD_SET_ALTSETTING_INFO lpSetAltSettingInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpSetAltSettingInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpSetAltSettingInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -428,7 +1031,7 @@ BOOL OpenContext::SetAltSetting(LPUKWD_SET_ALTSETTING_INFO lpSetAltSettingInfo)
 BOOL OpenContext::ClearHaltHost(LPUKWD_ENDPOINT_INFO lpEndpointInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpEndpointInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpEndpointInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -465,7 +1068,7 @@ BOOL OpenContext::ClearHaltHost(LPUKWD_ENDPOINT_INFO lpEndpointInfo)
 BOOL OpenContext::ClearHaltDevice(LPUKWD_ENDPOINT_INFO lpEndpointInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpEndpointInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpEndpointInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -503,7 +1106,7 @@ BOOL OpenContext::ClearHaltDevice(LPUKWD_ENDPOINT_INFO lpEndpointInfo)
 BOOL OpenContext::IsPipeHalted(LPUKWD_ENDPOINT_INFO lpEndpointInfo, LPBOOL halted)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpEndpointInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpEndpointInfo->lpDevice);
 	if (!Validate(dev) || halted == NULL) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -543,7 +1146,7 @@ BOOL OpenContext::IsPipeHalted(LPUKWD_ENDPOINT_INFO lpEndpointInfo, LPBOOL halte
 BOOL OpenContext::ResetDevice(UKWD_USB_DEVICE DeviceIdentifier)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), DeviceIdentifier);
+	DevicePtr dev (mDeviceHandles, DeviceIdentifier);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -554,7 +1157,7 @@ BOOL OpenContext::ResetDevice(UKWD_USB_DEVICE DeviceIdentifier)
 BOOL OpenContext::ReenumerateDevice(UKWD_USB_DEVICE DeviceIdentifier)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), DeviceIdentifier);
+	DevicePtr dev (mDeviceHandles, DeviceIdentifier);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -565,7 +1168,7 @@ BOOL OpenContext::ReenumerateDevice(UKWD_USB_DEVICE DeviceIdentifier)
 BOOL OpenContext::IsKernelDriverActiveForInterface(LPUKWD_INTERFACE_INFO lpInterfaceInfo, PBOOL active)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpInterfaceInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpInterfaceInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -576,7 +1179,7 @@ BOOL OpenContext::IsKernelDriverActiveForInterface(LPUKWD_INTERFACE_INFO lpInter
 BOOL OpenContext::AttachKernelDriverForInterface(LPUKWD_INTERFACE_INFO lpInterfaceInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpInterfaceInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpInterfaceInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -587,7 +1190,7 @@ BOOL OpenContext::AttachKernelDriverForInterface(LPUKWD_INTERFACE_INFO lpInterfa
 BOOL OpenContext::DetachKernelDriverForInterface(LPUKWD_INTERFACE_INFO lpInterfaceInfo)
 {
 	MutexLocker lock(mMutex);
-	DevicePtr dev (mDevice->GetDeviceList(), lpInterfaceInfo->lpDevice);
+	DevicePtr dev (mDeviceHandles, lpInterfaceInfo->lpDevice);
 	if (!Validate(dev)) {
 		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
@@ -21,27 +21,63 @@
 #define OPENCONTEXT_H
 
 #include "ceusbkwrapper_common.h"
-#include "ptrset.h"
 
 class DeviceContext;
 class DevicePtr;
 class UsbDevice;
 class TransferList;
+class TransferPool;
+class CompletionQueue;
+class SharedRings;
+class RegisteredBufferTable;
+class RegisteredEventTable;
+class BulkStreamTable;
+class TimerWheel;
+class DeviceEventQueue;
+class DeviceHandleTable;
 
 class OpenContext {
 public:
 	OpenContext(DeviceContext* Device);
 	~OpenContext();
 	BOOL Init();
+	void PreClose();
 	
 	TransferList* GetTransferList();
+	CompletionQueue* GetCompletionQueue();
+	RegisteredBufferTable* GetRegisteredBuffers();
+	RegisteredEventTable* GetRegisteredEvents();
+	TimerWheel* GetTimerWheel();
 
 	DWORD GetDevices(UKWD_USB_DEVICE* lpDevices, DWORD Size);
-	BOOL PutDevices(UKWD_USB_DEVICE* lpDevices, DWORD Size);
+	DWORD GetDevicesWithInfo(LPUKWD_USB_DEVICE_ENTRY lpEntries, DWORD Size, LPDWORD lpdwGeneration);
+	BOOL PutDevices(UKWD_USB_DEVICE* lpDevices, DWORD Size, LPDWORD lpStatus);
 	BOOL GetDeviceInfo(UKWD_USB_DEVICE DeviceIdentifier, LPUKWD_USB_DEVICE_INFO lpDeviceInfo);
+	BOOL WaitForDeviceEvents(LPUKWD_WAIT_DEVICE_EVENTS_INFO lpWaitInfo, LPUKWD_DEVICE_EVENTS lpEvents, DWORD dwCount);
+	BOOL ReloadInterfaceFilters(LPDWORD lpdwCount);
 	BOOL StartControlTransfer(LPUKWD_CONTROL_TRANSFER_INFO lpTransferInfo);
+	BOOL IssueInlineControlTransfer(LPUKWD_INLINE_CONTROL_TRANSFER_INFO lpTransferInfo, LPVOID lpData, LPDWORD lpdwBytesTransferred);
 	BOOL StartBulkTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo);
+	BOOL StartInterruptTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo);
+	BOOL StartIsochTransfer(LPUKWD_ISOCH_TRANSFER_INFO lpTransferInfo);
+	BOOL StartTransfers(LPUKWD_SUBMIT_BATCH_INFO lpBatchInfo, LPDWORD lpStatus);
 	BOOL CancelTransfer(LPUKWD_CANCEL_TRANSFER_INFO lpCancelInfo);
+	BOOL CancelAllTransfers(LPUKWD_CANCEL_ALL_INFO lpCancelInfo, LPDWORD lpdwCancelled);
+	BOOL EnableCompletionQueue();
+	BOOL ReapCompletions(LPUKWD_REAP_COMPLETIONS_INFO lpReapInfo, LPUKWD_COMPLETION lpCompletions, DWORD dwCount, LPDWORD lpdwReaped);
+	BOOL SetupRings(LPUKWD_SETUP_RINGS_INFO lpRingsInfo);
+	BOOL RingDoorbell(LPUKWD_RING_DOORBELL_INFO lpDoorbellInfo, LPDWORD lpdwSubmitted);
+	void GetTransferPoolStats(LPUKWD_TRANSFER_POOL_STATS lpStats);
+	BOOL RegisterBuffer(LPUKWD_REGISTER_BUFFER_INFO lpBufferInfo, LPDWORD lpdwBufferId);
+	BOOL UnregisterBuffer(DWORD dwBufferId);
+	BOOL RegisterEvent(HANDLE hEvent);
+	BOOL UnregisterEvent(HANDLE hEvent);
+	BOOL StartStream(LPUKWD_START_STREAM_INFO lpStreamInfo, LPDWORD lpdwStreamId);
+	BOOL StopStream(DWORD dwStreamId);
+	BOOL StreamRead(LPUKWD_STREAM_IO_INFO lpIoInfo, LPDWORD lpdwRead);
+	BOOL StreamWrite(LPUKWD_STREAM_IO_INFO lpIoInfo, LPDWORD lpdwWritten);
+	BOOL SetTransferSplit(LPUKWD_TRANSFER_SPLIT_INFO lpSplitInfo);
+	void GetTransferSplit(LPDWORD lpdwChunkSize, LPDWORD lpdwMaxChunks);
 	BOOL GetConfigDescriptor(LPUKWD_GET_CONFIG_DESC_INFO lpConfigInfo, LPDWORD lpSize);
 	BOOL GetActiveConfigValue(UKWD_USB_DEVICE DeviceIdentifier, PUCHAR pConfigurationValue);
 	BOOL SetActiveConfigValue(LPUKWD_SET_ACTIVE_CONFIG_VALUE_INFO lpConfigValueInfo);
@@ -59,11 +95,35 @@ public:
 private:
 	BOOL PutDevice(UKWD_USB_DEVICE DeviceIdentifier);
 	BOOL Validate(DevicePtr& device);
+	BOOL FindClaimedInterface(DevicePtr& dev, UCHAR Endpoint, DWORD& dwInterface);
+	BOOL DoStartControlTransfer(DevicePtr& dev, LPUKWD_CONTROL_TRANSFER_INFO lpTransferInfo);
+	BOOL StartEndpointTransfer(LPUKWD_BULK_TRANSFER_INFO lpTransferInfo, BOOL bInterrupt);
+	BOOL DoStartBulkTransfer(DevicePtr& dev, DWORD dwInterface, LPUKWD_BULK_TRANSFER_INFO lpTransferInfo, BOOL bInterrupt);
+	BOOL DoStartTransfers(
+		UKWD_USB_DEVICE DeviceIdentifier,
+		LPUKWD_BATCH_TRANSFER_ENTRY lpEntries,
+		DWORD dwEntries,
+		LPDWORD lpStatus,
+		BOOL bRequireOverlapped);
 private:
 	TransferList* mTransferList;
+	TransferPool* mTransferPool;
+	TransferPool* mIsochTransferPool;
+	CompletionQueue* mCompletionQueue;
+	RegisteredBufferTable* mRegisteredBuffers;
+	RegisteredEventTable* mRegisteredEvents;
+	BulkStreamTable* mStreams;
+	DeviceEventQueue* mDeviceEvents;
+	// Handles to the devices opened by this context
+	DeviceHandleTable* mDeviceHandles;
 	DeviceContext* mDevice;
 	HANDLE mMutex;
-	PtrArray<UsbDevice> mOpenDevices;
+	// Held while consuming submissions and when setting up or removing mRings
+	HANDLE mRingMutex;
+	SharedRings* mRings;
+	// Asynchronous bulk transfers are split into chunks if this is non-zero
+	DWORD mSplitChunkSize;
+	DWORD mSplitMaxChunks;
 };
 
 #endif // OPENCONTEXT_H
\ No newline at end of file
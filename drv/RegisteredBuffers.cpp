@@ -0,0 +1,159 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// RegisteredBuffers.cpp : User buffers mapped once and used by many transfers
+
+#include "StdAfx.h"
+#include "RegisteredBuffers.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+#include <new>
+
+RegisteredBuffer::RegisteredBuffer(LPVOID lpBuffer, DWORD dwSize)
+: mRefCount(1)
+, mBuffer(UBA_READ_WRITE | UBA_ASYNC, lpBuffer, dwSize)
+{
+}
+
+RegisteredBuffer::~RegisteredBuffer()
+{
+}
+
+BOOL RegisteredBuffer::Init()
+{
+	if (!mBuffer.Valid() || !mBuffer.Ptr()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!RegisteredBuffer::Init() - failed to map buffer\r\n")));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	if (!mBuffer.Shared()) {
+		// A duplicated buffer would only be copied when registered,
+		// so later writes by the caller would never be seen.
+		ERROR_MSG((TEXT("USBKWrapperDrv!RegisteredBuffer::Init() - buffer can't be shared with caller\r\n")));
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+LPVOID RegisteredBuffer::Range(DWORD dwOffset, DWORD dwSize)
+{
+	if (dwOffset > mBuffer.Size() || dwSize > mBuffer.Size() - dwOffset)
+		return NULL;
+	return static_cast<BYTE*>(mBuffer.Ptr()) + dwOffset;
+}
+
+void RegisteredBuffer::IncRef()
+{
+	InterlockedIncrement(&mRefCount);
+}
+
+void RegisteredBuffer::DecRef()
+{
+	if (InterlockedDecrement(&mRefCount) == 0)
+		delete this;
+}
+
+RegisteredBufferTable::RegisteredBufferTable()
+: mMutex(NULL)
+{
+	memset(mBuffers, 0, sizeof(mBuffers));
+}
+
+RegisteredBufferTable::~RegisteredBufferTable()
+{
+	for (DWORD i = 0; i < UKWD_MAX_REGISTERED_BUFFERS; ++i) {
+		if (mBuffers[i])
+			mBuffers[i]->DecRef();
+	}
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL RegisteredBufferTable::Init()
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!RegisteredBufferTable::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL RegisteredBufferTable::Register(LPVOID lpBuffer, DWORD dwSize, LPDWORD lpdwBufferId)
+{
+	if (!lpBuffer || dwSize == 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	// Must be constructed in the context of the caller
+	RegisteredBuffer* buffer = new (std::nothrow) RegisteredBuffer(lpBuffer, dwSize);
+	if (!buffer) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!RegisteredBufferTable::Register() - failed to create buffer\r\n")));
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	if (!buffer->Init()) {
+		buffer->DecRef();
+		return FALSE;
+	}
+	MutexLocker lock(mMutex);
+	for (DWORD i = 0; i < UKWD_MAX_REGISTERED_BUFFERS; ++i) {
+		if (!mBuffers[i]) {
+			mBuffers[i] = buffer;
+			*lpdwBufferId = i + 1;
+			return TRUE;
+		}
+	}
+	lock.unlock();
+	ERROR_MSG((TEXT("USBKWrapperDrv!RegisteredBufferTable::Register() - all %d buffers in use\r\n"),
+		UKWD_MAX_REGISTERED_BUFFERS));
+	buffer->DecRef();
+	SetLastError(ERROR_TOO_MANY_OPEN_FILES);
+	return FALSE;
+}
+
+BOOL RegisteredBufferTable::Unregister(DWORD dwBufferId)
+{
+	RegisteredBuffer* buffer = NULL;
+	{
+		MutexLocker lock(mMutex);
+		if (dwBufferId == 0 || dwBufferId > UKWD_MAX_REGISTERED_BUFFERS ||
+			!mBuffers[dwBufferId - 1]) {
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return FALSE;
+		}
+		buffer = mBuffers[dwBufferId - 1];
+		mBuffers[dwBufferId - 1] = NULL;
+	}
+	// Transfers still using the buffer keep it mapped until they complete
+	buffer->DecRef();
+	return TRUE;
+}
+
+RegisteredBuffer* RegisteredBufferTable::GetBuffer(DWORD dwBufferId)
+{
+	if (dwBufferId == 0 || dwBufferId > UKWD_MAX_REGISTERED_BUFFERS)
+		return NULL;
+	MutexLocker lock(mMutex);
+	RegisteredBuffer* buffer = mBuffers[dwBufferId - 1];
+	if (buffer)
+		buffer->IncRef();
+	return buffer;
+}
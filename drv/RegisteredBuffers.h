@@ -0,0 +1,60 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// RegisteredBuffers.h : User buffers mapped once and used by many transfers
+#ifndef REGISTERED_BUFFERS_H
+#define REGISTERED_BUFFERS_H
+
+#include "ceusbkwrapper_common.h"
+#include "UserBuffer.h"
+
+class RegisteredBuffer {
+public:
+	RegisteredBuffer(LPVOID lpBuffer, DWORD dwSize);
+	BOOL Init();
+
+	// Returns a pointer to dwSize bytes at dwOffset, or NULL
+	// if that range isn't inside the buffer.
+	LPVOID Range(DWORD dwOffset, DWORD dwSize);
+
+	// Transfers using the buffer hold a reference to it
+	void IncRef();
+	void DecRef();
+private:
+	~RegisteredBuffer();
+private:
+	LONG mRefCount;
+	UserBuffer<LPVOID> mBuffer;
+};
+
+class RegisteredBufferTable {
+public:
+	RegisteredBufferTable();
+	~RegisteredBufferTable();
+	BOOL Init();
+
+	BOOL Register(LPVOID lpBuffer, DWORD dwSize, LPDWORD lpdwBufferId);
+	BOOL Unregister(DWORD dwBufferId);
+	// Returns the buffer with a reference added, or NULL
+	RegisteredBuffer* GetBuffer(DWORD dwBufferId);
+private:
+	HANDLE mMutex;
+	RegisteredBuffer* mBuffers[UKWD_MAX_REGISTERED_BUFFERS];
+};
+
+#endif // REGISTERED_BUFFERS_H
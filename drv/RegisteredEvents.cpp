@@ -0,0 +1,161 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// RegisteredEvents.cpp : Caller events duplicated once and used by many transfers
+
+#include "StdAfx.h"
+#include "RegisteredEvents.h"
+#include "UserBuffer.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+#include <new>
+
+RegisteredEvent::RegisteredEvent(HANDLE hUserEvent, HANDLE hEvent)
+: mRefCount(1)
+, mUserEvent(hUserEvent)
+, mEvent(hEvent)
+{
+}
+
+RegisteredEvent::~RegisteredEvent()
+{
+	CloseHandle(mEvent);
+}
+
+HANDLE RegisteredEvent::UserHandle() const
+{
+	return mUserEvent;
+}
+
+HANDLE RegisteredEvent::Handle() const
+{
+	return mEvent;
+}
+
+void RegisteredEvent::IncRef()
+{
+	InterlockedIncrement(&mRefCount);
+}
+
+void RegisteredEvent::DecRef()
+{
+	if (InterlockedDecrement(&mRefCount) == 0)
+		delete this;
+}
+
+RegisteredEventTable::RegisteredEventTable()
+: mMutex(NULL)
+, mEventCount(0)
+{
+	memset(mEvents, 0, sizeof(mEvents));
+}
+
+RegisteredEventTable::~RegisteredEventTable()
+{
+	// Transfers still in progress keep their events open
+	for (DWORD i = 0; i < mEventCount; ++i)
+		mEvents[i]->DecRef();
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL RegisteredEventTable::Init()
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!RegisteredEventTable::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL RegisteredEventTable::Register(HANDLE hUserEvent)
+{
+	if (hUserEvent == NULL || hUserEvent == INVALID_HANDLE_VALUE) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	MutexLocker lock(mMutex);
+	if (FindIdx(hUserEvent) < mEventCount) {
+		SetLastError(ERROR_ALREADY_EXISTS);
+		return FALSE;
+	}
+	if (mEventCount >= UKWD_MAX_REGISTERED_EVENTS) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!RegisteredEventTable::Register() - all %d events in use\r\n"),
+			UKWD_MAX_REGISTERED_EVENTS));
+		SetLastError(ERROR_TOO_MANY_OPEN_FILES);
+		return FALSE;
+	}
+	// Must be duplicated in the context of the caller
+	HANDLE hEvent = OverlappedUserBuffer::DuplicateCallerEvent(hUserEvent);
+	if (hEvent == INVALID_HANDLE_VALUE) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+	RegisteredEvent* event = new (std::nothrow) RegisteredEvent(hUserEvent, hEvent);
+	if (!event) {
+		CloseHandle(hEvent);
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	mEvents[mEventCount++] = event;
+	return TRUE;
+}
+
+BOOL RegisteredEventTable::Unregister(HANDLE hUserEvent)
+{
+	RegisteredEvent* event = NULL;
+	{
+		MutexLocker lock(mMutex);
+		DWORD idx = FindIdx(hUserEvent);
+		if (idx >= mEventCount) {
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return FALSE;
+		}
+		event = mEvents[idx];
+		mEvents[idx] = mEvents[--mEventCount];
+		mEvents[mEventCount] = NULL;
+	}
+	event->DecRef();
+	return TRUE;
+}
+
+RegisteredEvent* RegisteredEventTable::GetEvent(HANDLE hUserEvent)
+{
+	// Avoid taking the lock when nothing has been registered. Racing
+	// with Register() only means the event is duplicated as before.
+	if (mEventCount == 0)
+		return NULL;
+	MutexLocker lock(mMutex);
+	DWORD idx = FindIdx(hUserEvent);
+	if (idx >= mEventCount)
+		return NULL;
+	mEvents[idx]->IncRef();
+	return mEvents[idx];
+}
+
+DWORD RegisteredEventTable::FindIdx(HANDLE hUserEvent)
+{
+	// Applications only cycle through a handful of events,
+	// so a linear search is quickest.
+	DWORD idx = 0;
+	while (idx < mEventCount && mEvents[idx]->UserHandle() != hUserEvent)
+		++idx;
+	return idx;
+}
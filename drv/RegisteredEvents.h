@@ -0,0 +1,63 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// RegisteredEvents.h : Caller events duplicated once and used by many transfers
+#ifndef REGISTERED_EVENTS_H
+#define REGISTERED_EVENTS_H
+
+#include "ceusbkwrapper_common.h"
+
+class RegisteredEvent {
+public:
+	RegisteredEvent(HANDLE hUserEvent, HANDLE hEvent);
+	HANDLE UserHandle() const;
+	// The event duplicated into the driver
+	HANDLE Handle() const;
+
+	// Transfers signalling the event hold a reference to it
+	void IncRef();
+	void DecRef();
+private:
+	~RegisteredEvent();
+private:
+	LONG mRefCount;
+	const HANDLE mUserEvent;
+	const HANDLE mEvent;
+};
+
+class RegisteredEventTable {
+public:
+	RegisteredEventTable();
+	~RegisteredEventTable();
+	BOOL Init();
+
+	BOOL Register(HANDLE hUserEvent);
+	BOOL Unregister(HANDLE hUserEvent);
+	// Returns the event with a reference added, or NULL if
+	// hUserEvent hasn't been registered.
+	RegisteredEvent* GetEvent(HANDLE hUserEvent);
+private:
+	// Should be called with mMutex held
+	DWORD FindIdx(HANDLE hUserEvent);
+private:
+	HANDLE mMutex;
+	RegisteredEvent* mEvents[UKWD_MAX_REGISTERED_EVENTS];
+	DWORD mEventCount;
+};
+
+#endif // REGISTERED_EVENTS_H
@@ -0,0 +1,103 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// SharedRingView.cpp : Index handling and validation for the shared rings
+
+#include "StdAfx.h"
+#include "SharedRingView.h"
+#include "drvdbg.h"
+
+SharedRingView::SharedRingView()
+: mHeader(NULL)
+, mSubmissions(NULL)
+, mCompletions(NULL)
+, mSubmissionEntries(0)
+, mCompletionEntries(0)
+, mSubmissionHead(0)
+, mCompletionTail(0)
+{
+}
+
+BOOL SharedRingView::Attach(LPVOID lpRegion, DWORD dwRegionSize)
+{
+	if (!lpRegion || dwRegionSize < sizeof(UKWD_RINGS_HEADER)) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!SharedRingView::Attach() - ring region too small: %d\r\n"), dwRegionSize));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	LPUKWD_RINGS_HEADER header = static_cast<LPUKWD_RINGS_HEADER>(lpRegion);
+	DWORD submissionEntries = header->dwSubmissionEntries;
+	DWORD completionEntries = header->dwCompletionEntries;
+	if (!UKWD_RING_VALID_ENTRIES(submissionEntries) ||
+		!UKWD_RING_VALID_ENTRIES(completionEntries) ||
+		dwRegionSize < UKWD_RINGS_SIZE(submissionEntries, completionEntries)) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!SharedRingView::Attach() - invalid ring sizes %d and %d for region size %d\r\n"),
+			submissionEntries, completionEntries, dwRegionSize));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	mHeader = header;
+	mSubmissionEntries = submissionEntries;
+	mCompletionEntries = completionEntries;
+	mSubmissions = reinterpret_cast<LPUKWD_BATCH_TRANSFER_ENTRY>(mHeader + 1);
+	mCompletions = reinterpret_cast<LPUKWD_COMPLETION>(mSubmissions + mSubmissionEntries);
+	mSubmissionHead = UKWD_RING_READ_INDEX(&mHeader->Submission.Head);
+	mCompletionTail = UKWD_RING_READ_INDEX(&mHeader->Completion.Tail);
+	return TRUE;
+}
+
+DWORD SharedRingView::FetchSubmissions(LPUKWD_BATCH_TRANSFER_ENTRY lpEntries, DWORD dwMax)
+{
+	LONG tail = UKWD_RING_READ_INDEX(&mHeader->Submission.Tail);
+	DWORD available = UKWD_RING_USED(tail, mSubmissionHead);
+	if (available > mSubmissionEntries) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!SharedRingView::FetchSubmissions() - ignoring invalid tail %d (head %d)\r\n"),
+			tail, mSubmissionHead));
+		return 0;
+	}
+	if (available > dwMax)
+		available = dwMax;
+	// Entries are copied out before being used, as the library
+	// could be modifying the shared memory at the same time.
+	for (DWORD i = 0; i < available; ++i) {
+		lpEntries[i] = mSubmissions[UKWD_RING_SLOT(mSubmissionHead + i, mSubmissionEntries)];
+	}
+	mSubmissionHead += available;
+	UKWD_RING_WRITE_INDEX(&mHeader->Submission.Head, mSubmissionHead);
+	return available;
+}
+
+BOOL SharedRingView::PostCompletion(const UKWD_COMPLETION& completion)
+{
+	LONG head = UKWD_RING_READ_INDEX(&mHeader->Completion.Head);
+	if (UKWD_RING_USED(mCompletionTail, head) >= mCompletionEntries) {
+		// Either full or the library has corrupted the head index
+		return FALSE;
+	}
+	mCompletions[UKWD_RING_SLOT(mCompletionTail, mCompletionEntries)] = completion;
+	++mCompletionTail;
+	UKWD_RING_WRITE_INDEX(&mHeader->Completion.Tail, mCompletionTail);
+	return TRUE;
+}
+
+DWORD SharedRingView::CompletionsPending()
+{
+	LONG head = UKWD_RING_READ_INDEX(&mHeader->Completion.Head);
+	DWORD used = UKWD_RING_USED(mCompletionTail, head);
+	return used > mCompletionEntries ? 0 : used;
+}
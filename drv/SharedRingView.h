@@ -0,0 +1,60 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// SharedRingView.h : Index handling and validation for the shared rings
+#ifndef SHARED_RING_VIEW_H
+#define SHARED_RING_VIEW_H
+
+#include "ceusbkwrapper_common.h"
+
+/*
+ * The driver's view of a ring region which has already been mapped.
+ * Everything in the region can be changed by the library at any time, so
+ * the sizes are copied out once and every index read from it is checked
+ * before use. This doesn't depend on how the region was mapped, so that
+ * it can also be built and tested on the host (see test/host).
+ */
+class SharedRingView {
+public:
+	SharedRingView();
+
+	// Checks the header at the start of lpRegion and starts using it.
+	// Fails with ERROR_INVALID_PARAMETER if the ring sizes aren't valid
+	// or don't fit in dwRegionSize.
+	BOOL Attach(LPVOID lpRegion, DWORD dwRegionSize);
+
+	// Copies up to dwMax queued submissions into lpEntries and
+	// removes them from the submission ring.
+	DWORD FetchSubmissions(LPUKWD_BATCH_TRANSFER_ENTRY lpEntries, DWORD dwMax);
+
+	// These need to be serialised by the caller.
+	BOOL PostCompletion(const UKWD_COMPLETION& completion);
+	DWORD CompletionsPending();
+private:
+	LPUKWD_RINGS_HEADER mHeader;
+	LPUKWD_BATCH_TRANSFER_ENTRY mSubmissions;
+	LPUKWD_COMPLETION mCompletions;
+	// Private copies of the values in mHeader which the driver owns,
+	// so that the library can't change them once set up.
+	DWORD mSubmissionEntries;
+	DWORD mCompletionEntries;
+	LONG mSubmissionHead;
+	LONG mCompletionTail;
+};
+
+#endif // SHARED_RING_VIEW_H
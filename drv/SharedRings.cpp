@@ -0,0 +1,64 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// SharedRings.cpp : Submission and completion rings shared with the library
+
+#include "StdAfx.h"
+#include "SharedRings.h"
+#include "drvdbg.h"
+
+SharedRings::SharedRings(LPVOID lpRegion, DWORD dwRegionSize)
+: mRegion(UBA_READ_WRITE | UBA_ASYNC, lpRegion, dwRegionSize)
+{
+}
+
+SharedRings::~SharedRings()
+{
+}
+
+BOOL SharedRings::Init()
+{
+	if (!mRegion.Valid() || !mRegion.Ptr()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!SharedRings::Init() - failed to map ring region\r\n")));
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	if (!mRegion.Shared()) {
+		// Rings only work if both sides see the same memory, which
+		// isn't the case if the buffer had to be duplicated.
+		ERROR_MSG((TEXT("USBKWrapperDrv!SharedRings::Init() - ring region can't be shared with caller\r\n")));
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return FALSE;
+	}
+	return mView.Attach(mRegion.Ptr(), mRegion.Size());
+}
+
+DWORD SharedRings::FetchSubmissions(LPUKWD_BATCH_TRANSFER_ENTRY lpEntries, DWORD dwMax)
+{
+	return mView.FetchSubmissions(lpEntries, dwMax);
+}
+
+BOOL SharedRings::PostCompletion(const UKWD_COMPLETION& completion)
+{
+	return mView.PostCompletion(completion);
+}
+
+DWORD SharedRings::CompletionsPending()
+{
+	return mView.CompletionsPending();
+}
@@ -0,0 +1,45 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// SharedRings.h : Submission and completion rings shared with the library
+#ifndef SHARED_RINGS_H
+#define SHARED_RINGS_H
+
+#include "ceusbkwrapper_common.h"
+#include "UserBuffer.h"
+#include "SharedRingView.h"
+
+class SharedRings {
+public:
+	SharedRings(LPVOID lpRegion, DWORD dwRegionSize);
+	~SharedRings();
+	BOOL Init();
+
+	// Copies up to dwMax queued submissions into lpEntries and
+	// removes them from the submission ring.
+	DWORD FetchSubmissions(LPUKWD_BATCH_TRANSFER_ENTRY lpEntries, DWORD dwMax);
+
+	// These should only be called with the CompletionQueue lock held.
+	BOOL PostCompletion(const UKWD_COMPLETION& completion);
+	DWORD CompletionsPending();
+private:
+	UserBuffer<LPVOID> mRegion;
+	SharedRingView mView;
+};
+
+#endif // SHARED_RINGS_H
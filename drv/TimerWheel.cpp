@@ -0,0 +1,228 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// TimerWheel.cpp : Times out pending transfers for all open contexts
+
+#include "StdAfx.h"
+#include "TimerWheel.h"
+#include "Transfer.h"
+#include "TransferList.h"
+#include "OpenContext.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+TimerWheel::TimerWheel()
+: mMutex(NULL)
+, mExpireMutex(NULL)
+, mWakeEvent(NULL)
+, mThread(NULL)
+, mStopping(FALSE)
+, mCount(0)
+, mTick(0)
+, mTickCount(0)
+{
+	memset(mSlots, 0, sizeof(mSlots));
+}
+
+TimerWheel::~TimerWheel()
+{
+	if (mThread) {
+		{
+			MutexLocker lock(mMutex);
+			mStopping = TRUE;
+		}
+		SetEvent(mWakeEvent);
+		WaitForSingleObject(mThread, INFINITE);
+		CloseHandle(mThread);
+	}
+	if (mCount > 0) {
+		WARN_MSG((TEXT("USBKWrapperDrv!TimerWheel::~TimerWheel() - detected %d leaked timeouts\r\n"),
+			mCount));
+	}
+	if (mWakeEvent)
+		CloseHandle(mWakeEvent);
+	if (mExpireMutex)
+		CloseHandle(mExpireMutex);
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL TimerWheel::Init()
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TimerWheel::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	mExpireMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mExpireMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TimerWheel::Init() - failed to create expire mutex\r\n")));
+		return FALSE;
+	}
+	mWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (mWakeEvent == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TimerWheel::Init() - failed to create event\r\n")));
+		return FALSE;
+	}
+	mThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	if (mThread == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TimerWheel::Init() - failed to create thread\r\n")));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Should be called with mMutex held.
+DWORD TimerWheel::CurrentTick()
+{
+	return mTick + (GetTickCount() - mTickCount) / TIMER_WHEEL_TICK_MS;
+}
+
+// Should be called with mMutex held.
+void TimerWheel::Link(Transfer* lpTransfer)
+{
+	Transfer*& head = mSlots[lpTransfer->mTimerExpiry % TIMER_WHEEL_SLOTS];
+	lpTransfer->mTimerPrev = NULL;
+	lpTransfer->mTimerNext = head;
+	if (head)
+		head->mTimerPrev = lpTransfer;
+	head = lpTransfer;
+	lpTransfer->mTimerQueued = TRUE;
+	++mCount;
+}
+
+// Should be called with mMutex held.
+void TimerWheel::Unlink(Transfer* lpTransfer)
+{
+	if (lpTransfer->mTimerPrev)
+		lpTransfer->mTimerPrev->mTimerNext = lpTransfer->mTimerNext;
+	else
+		mSlots[lpTransfer->mTimerExpiry % TIMER_WHEEL_SLOTS] = lpTransfer->mTimerNext;
+	if (lpTransfer->mTimerNext)
+		lpTransfer->mTimerNext->mTimerPrev = lpTransfer->mTimerPrev;
+	lpTransfer->mTimerNext = NULL;
+	lpTransfer->mTimerPrev = NULL;
+	lpTransfer->mTimerQueued = FALSE;
+	--mCount;
+}
+
+void TimerWheel::Add(Transfer* lpTransfer, DWORD dwTimeoutMs)
+{
+	MutexLocker lock(mMutex);
+	// Checked with the lock held, as Remove() is called once the
+	// transfer has completed.
+	if (!lpTransfer->Pending() || lpTransfer->mTimerQueued)
+		return;
+	if (mCount == 0) {
+		// The wheel isn't advanced while empty
+		mTickCount = GetTickCount();
+	}
+	// Rounded up, so the transfer is never cancelled early
+	lpTransfer->mTimerExpiry = CurrentTick() + dwTimeoutMs / TIMER_WHEEL_TICK_MS + 1;
+	Link(lpTransfer);
+	if (mCount == 1)
+		// The thread waits without a timeout while the wheel is empty
+		SetEvent(mWakeEvent);
+}
+
+void TimerWheel::Remove(Transfer* lpTransfer)
+{
+	MutexLocker lock(mMutex);
+	if (lpTransfer->mTimerQueued)
+		Unlink(lpTransfer);
+}
+
+void TimerWheel::RemoveAll(OpenContext* lpOpenContext)
+{
+	MutexLocker expireLock(mExpireMutex);
+	MutexLocker lock(mMutex);
+	for (DWORD i = 0; i < TIMER_WHEEL_SLOTS && mCount > 0; ++i) {
+		Transfer* lpTransfer = mSlots[i];
+		while (lpTransfer) {
+			Transfer* lpNext = lpTransfer->mTimerNext;
+			if (lpTransfer->mOpenContext == lpOpenContext)
+				Unlink(lpTransfer);
+			lpTransfer = lpNext;
+		}
+	}
+}
+
+DWORD WINAPI TimerWheel::ThreadProc(LPVOID lpParameter)
+{
+	static_cast<TimerWheel*>(lpParameter)->Run();
+	return 0;
+}
+
+void TimerWheel::Run()
+{
+	for (;;) {
+		DWORD dwWait;
+		{
+			MutexLocker lock(mMutex);
+			if (mStopping)
+				return;
+			dwWait = mCount > 0 ? TIMER_WHEEL_TICK_MS : INFINITE;
+		}
+		WaitForSingleObject(mWakeEvent, dwWait);
+		Expire();
+	}
+}
+
+void TimerWheel::Expire()
+{
+	// Prevents RemoveAll() returning while expired transfers are referenced
+	MutexLocker expireLock(mExpireMutex);
+	MutexLocker lock(mMutex);
+	DWORD now = CurrentTick();
+	DWORD ticks = now - mTick;
+	mTickCount += ticks * TIMER_WHEEL_TICK_MS;
+	mTick = now;
+	if (ticks > TIMER_WHEEL_SLOTS)
+		ticks = TIMER_WHEEL_SLOTS;
+
+	// Expired transfers are chained through mTimerNext once unlinked
+	Transfer* lpExpired = NULL;
+	for (DWORD tick = now - ticks + 1; tick != now + 1; ++tick) {
+		Transfer* lpTransfer = mSlots[tick % TIMER_WHEEL_SLOTS];
+		while (lpTransfer) {
+			Transfer* lpNext = lpTransfer->mTimerNext;
+			// Later expiries share the slot once the wheel has wrapped
+			if (static_cast<LONG>(lpTransfer->mTimerExpiry - now) <= 0) {
+				Unlink(lpTransfer);
+				// Keeps the transfer alive once mMutex is released
+				lpTransfer->mOpenContext->GetTransferList()->GetTransfer(lpTransfer);
+				lpTransfer->mTimerNext = lpExpired;
+				lpExpired = lpTransfer;
+			}
+			lpTransfer = lpNext;
+		}
+	}
+	lock.unlock();
+
+	// Cancelling can complete the transfer in this thread, which then
+	// calls Remove(), so this must happen without mMutex held.
+	while (lpExpired) {
+		Transfer* lpTransfer = lpExpired;
+		lpExpired = lpTransfer->mTimerNext;
+		lpTransfer->mTimerNext = NULL;
+		TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!TimerWheel::Expire() timing out transfer 0x%08x\r\n"),
+			lpTransfer));
+		lpTransfer->TimeOut();
+		lpTransfer->mOpenContext->GetTransferList()->PutTransfer(lpTransfer);
+	}
+}
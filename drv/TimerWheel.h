@@ -0,0 +1,72 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// TimerWheel.h : Times out pending transfers for all open contexts
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+class Transfer;
+class OpenContext;
+
+// Number of slots in the wheel and the time each slot covers
+#define TIMER_WHEEL_SLOTS   64
+#define TIMER_WHEEL_TICK_MS 10
+
+// Transfers with a timeout are linked into the slot of the tick they
+// expire in, so adding, removing and expiring a transfer doesn't depend
+// on how many other transfers are pending. A single thread advances the
+// wheel every tick while it isn't empty and cancels expired transfers.
+class TimerWheel {
+public:
+	TimerWheel();
+	~TimerWheel();
+	BOOL Init();
+
+	// Cancels lpTransfer after dwTimeoutMs ms unless it has completed
+	// by then. Does nothing if lpTransfer is no longer pending.
+	void Add(Transfer* lpTransfer, DWORD dwTimeoutMs);
+	// Must be called once a transfer which was added has completed
+	void Remove(Transfer* lpTransfer);
+	// Removes all transfers of lpOpenContext, waiting for any which are
+	// being expired to be released.
+	void RemoveAll(OpenContext* lpOpenContext);
+private:
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter);
+	void Run();
+	void Expire();
+	// These should be called with mMutex held
+	void Link(Transfer* lpTransfer);
+	void Unlink(Transfer* lpTransfer);
+	DWORD CurrentTick();
+private:
+	HANDLE mMutex;
+	// Held by the thread while it cancels expired transfers
+	HANDLE mExpireMutex;
+	// Auto reset event which wakes up the thread
+	HANDLE mWakeEvent;
+	HANDLE mThread;
+	BOOL mStopping;
+	Transfer* mSlots[TIMER_WHEEL_SLOTS];
+	DWORD mCount;
+	// The last tick processed and the tick count it was processed at
+	DWORD mTick;
+	DWORD mTickCount;
+};
+
+#endif // TIMER_WHEEL_H
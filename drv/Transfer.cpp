@@ -21,20 +21,37 @@
 #include "StdAfx.h"
 #include "Transfer.h"
 #include "TransferList.h"
+#include "TransferPool.h"
+#include "CompletionQueue.h"
+#include "RegisteredBuffers.h"
 #include "OpenContext.h"
 #include "UsbDevice.h"
-#include "MutexLocker.h"
+#include "TimerWheel.h"
 #include "drvdbg.h"
 
-static DWORD AccessFlagsForUserBuffer(DWORD dwFlags, LPOVERLAPPED lpOverlapped)
+// Set once the USB_TRANSFER handle for the transfer is known
+#define TRANSFER_STATE_HANDLE_SET 0x1
+// Set once the USB driver has called TransferComplete()
+#define TRANSFER_STATE_COMPLETED  0x2
+#define TRANSFER_STATE_DONE       (TRANSFER_STATE_HANDLE_SET | TRANSFER_STATE_COMPLETED)
+
+// Synchronous transfers with a timeout complete on the USB driver's
+// thread, so their user memory is accessed as for asynchronous ones.
+static BOOL CompletesAsync(DWORD dwFlags, LPOVERLAPPED lpOverlapped, DWORD dwTimeoutMs)
+{
+	return lpOverlapped || (dwFlags & USB_NO_WAIT) ||
+		(dwTimeoutMs != 0 && dwTimeoutMs != INFINITE);
+}
+
+DWORD Transfer::AccessFlagsForUserBuffer(DWORD dwFlags, LPOVERLAPPED lpOverlapped, DWORD dwTimeoutMs)
 {
 	return ((dwFlags & USB_IN_TRANSFER) ? UBA_WRITE : UBA_READ)|
-		((lpOverlapped || (dwFlags & USB_NO_WAIT)) ? UBA_ASYNC : 0);
+		(CompletesAsync(dwFlags, lpOverlapped, dwTimeoutMs) ? UBA_ASYNC : 0);
 }
 
-static DWORD AccessFlagsForBytesTransferredBuffer(DWORD dwFlags, LPOVERLAPPED lpOverlapped)
+static DWORD AccessFlagsForBytesTransferredBuffer(DWORD dwFlags, LPOVERLAPPED lpOverlapped, DWORD dwTimeoutMs)
 {
-	return UBA_WRITE | ((lpOverlapped || (dwFlags & USB_NO_WAIT)) ? UBA_ASYNC : 0);
+	return UBA_WRITE | (CompletesAsync(dwFlags, lpOverlapped, dwTimeoutMs) ? UBA_ASYNC : 0);
 }
 
 Transfer::Transfer(
@@ -43,25 +60,49 @@ Transfer::Transfer(
 	DWORD dwFlags,
 	LPVOID lpUserBuffer,
 	DWORD dwUserBufferSize,
+	DWORD dwBufferId,
+	DWORD dwBufferOffset,
 	LPDWORD lpUserBytesTransferred,
-	LPOVERLAPPED lpUserOverlapped)
-: mMutex()
-, mRefCount(1)
+	LPOVERLAPPED lpUserOverlapped,
+	DWORD dwTimeoutMs)
+: mRefCount(1)
+, mOverlappedNext(NULL)
 , mTransfer(NULL)
-, mTransferCompleted(FALSE)
+, mState(0)
 , mCancelled(FALSE)
+, mTimeoutMs(dwTimeoutMs == INFINITE ? 0 : dwTimeoutMs)
+, mTimedOut(FALSE)
+, mTimedSync(mTimeoutMs && !lpUserOverlapped && !(dwFlags & USB_NO_WAIT))
+, mCompletionEvent(NULL)
+, mCompletionError(ERROR_SUCCESS)
+, mTimerNext(NULL)
+, mTimerPrev(NULL)
+, mTimerExpiry(0)
+, mTimerQueued(FALSE)
 , mOpenContext(OpenContext)
 , mDevicePtr(device)
 , mUserBuffer(
-	AccessFlagsForUserBuffer(dwFlags, lpUserOverlapped),
-	lpUserBuffer, dwUserBufferSize)
+	AccessFlagsForUserBuffer(dwFlags, lpUserOverlapped, dwTimeoutMs),
+	dwBufferId ? NULL : lpUserBuffer,
+	dwBufferId ? 0 : dwUserBufferSize)
+, mBufferId(dwBufferId)
+, mDataSize(dwUserBufferSize)
+, mRegisteredBuffer(NULL)
+, mRegisteredPtr(NULL)
 , mBytesTransferredBuffer(
-	AccessFlagsForBytesTransferredBuffer(dwFlags, lpUserOverlapped),
+	AccessFlagsForBytesTransferredBuffer(dwFlags, lpUserOverlapped, dwTimeoutMs),
 	lpUserBytesTransferred, sizeof(DWORD))
-, mOverlappedBuffer(lpUserOverlapped)
+, mOverlappedBuffer(lpUserOverlapped, OpenContext->GetRegisteredEvents())
 {
+	if (mBufferId) {
+		// Registered buffers are already mapped, so only need looking up
+		mRegisteredBuffer = mOpenContext->GetRegisteredBuffers()->GetBuffer(mBufferId);
+		if (mRegisteredBuffer)
+			mRegisteredPtr = mRegisteredBuffer->Range(dwBufferOffset, dwUserBufferSize);
+	}
+	if (mTimedSync)
+		mCompletionEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 	mOpenContext->GetTransferList()->RegisterTransfer(this);
-	mMutex = CreateMutex(NULL, FALSE, NULL);
 }
 
 Transfer::~Transfer()
@@ -69,16 +110,38 @@ Transfer::~Transfer()
 	TRANSFERLIFETIME_MSG((
 		TEXT("USBKWrapperDrv!Transfer:~Transfer() mTransfer: %d mRefCount: %d\r\n"),
 		mTransfer, mRefCount));
+	CloseTransfer();
+	if (mRegisteredBuffer) {
+		mRegisteredBuffer->DecRef();
+		mRegisteredBuffer = NULL;
+	}
+	if (mCompletionEvent)
+		CloseHandle(mCompletionEvent);
+}
+
+void Transfer::CloseTransfer()
+{
 	if (mTransfer != NULL && mDevicePtr.Valid()) {
-		if (!mTransferCompleted)
+		if (!Completed())
 			mDevicePtr->CancelTransfer(mTransfer, 0);
 		mDevicePtr->CloseTransfer(mTransfer);
 		mTransfer = NULL;
 	}
-	if (mMutex) {
-		CloseHandle(mMutex);
-		mMutex = NULL;
-	}
+}
+
+void* Transfer::operator new(size_t size, TransferPool* lpPool) throw()
+{
+	return lpPool->Alloc(size);
+}
+
+void Transfer::operator delete(void* ptr, TransferPool* lpPool) throw()
+{
+	TransferPool::Free(ptr);
+}
+
+void Transfer::operator delete(void* ptr)
+{
+	TransferPool::Free(ptr);
 }
 
 void Transfer::IncRef()
@@ -106,14 +169,14 @@ LPVOID Transfer::OverlappedUserPtr()
 }
 
 
-BOOL Transfer::Cancel(UKWD_USB_DEVICE device, DWORD dwFlags)
+BOOL Transfer::Cancel(UsbDevice* device, DWORD dwFlags)
 {
-	if (!mTransfer || mTransferCompleted || !mDevicePtr.Valid())
+	if (!Pending() || !mDevicePtr.Valid())
 		// Device closed or transfer already completed
 		return FALSE;
-	if (mDevicePtr->GetIdentifier() != device) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!Transfer::Cancel() used unmatching device identifiers 0x%08x and 0x%08x\r\n"),
-			device, mDevicePtr->GetIdentifier()));
+	if (mDevicePtr.Get() != device) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!Transfer::Cancel() used unmatching devices 0x%08x and 0x%08x\r\n"),
+			device, mDevicePtr.Get()));
 		return FALSE;
 	}
 	return Cancel(dwFlags);
@@ -121,21 +184,93 @@ BOOL Transfer::Cancel(UKWD_USB_DEVICE device, DWORD dwFlags)
 
 BOOL Transfer::Cancel(DWORD dwFlags)
 {
-	if (!mTransfer || mTransferCompleted || !mDevicePtr.Valid())
+	if (!Pending() || !mDevicePtr.Valid())
 		// Device closed or transfer already completed
 		return FALSE;
 	mCancelled = TRUE;
+	return CancelPending(dwFlags);
+}
+
+BOOL Transfer::Pending()
+{
+	return mTransfer && !Completed();
+}
+
+BOOL Transfer::CancelPending(DWORD dwFlags)
+{
 	if (!mDevicePtr->CancelTransfer(mTransfer, dwFlags))
 		return FALSE;
 	return TRUE;
 }
 
-BOOL Transfer::Validate()
+BOOL Transfer::InScope(UsbDevice* device, DWORD dwScope, DWORD dwInterface, UCHAR Endpoint)
 {
-	if (!mMutex) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!Transfer::Validate() failed to create mutex\r\n")));
+	if (!Pending() || !mDevicePtr.Valid() || mDevicePtr.Get() != device)
+		return FALSE;
+	switch (dwScope) {
+	case UKWD_CANCEL_SCOPE_DEVICE:
+		return TRUE;
+	case UKWD_CANCEL_SCOPE_INTERFACE:
+		return IssuedOnInterface(dwInterface);
+	case UKWD_CANCEL_SCOPE_ENDPOINT:
+		return IssuedOnEndpoint(Endpoint);
+	default:
 		return FALSE;
 	}
+}
+
+BOOL Transfer::IssuedOnEndpoint(UCHAR Endpoint)
+{
+	// Control transfers use the default control pipe
+	return Endpoint == 0;
+}
+
+BOOL Transfer::IssuedOnInterface(DWORD dwInterface)
+{
+	return FALSE;
+}
+
+BOOL Transfer::Cancelled()
+{
+	return mCancelled;
+}
+
+void Transfer::StartTimeout()
+{
+	// Synchronous transfers aren't timed out
+	if (mTimeoutMs && mOverlappedBuffer.UserPtr())
+		mOpenContext->GetTimerWheel()->Add(this, mTimeoutMs);
+}
+
+void Transfer::TimeOut()
+{
+	mTimedOut = TRUE;
+	Cancel(USB_NO_WAIT);
+}
+
+DWORD Transfer::TimeoutMs()
+{
+	return mTimeoutMs;
+}
+
+BOOL Transfer::TimedSync()
+{
+	return mTimedSync;
+}
+
+BOOL Transfer::WaitForCompletion()
+{
+	if (WaitForSingleObject(mCompletionEvent, mTimeoutMs) == WAIT_TIMEOUT) {
+		TimeOut();
+		// The cancelled transfer still completes through Finish()
+		WaitForSingleObject(mCompletionEvent, INFINITE);
+	}
+	SetLastError(mCompletionError);
+	return mCompletionError == ERROR_SUCCESS;
+}
+
+BOOL Transfer::Validate()
+{
 	if (!mDevicePtr.Valid()) {
 		ERROR_MSG((TEXT("USBKWrapperDrv!Transfer::Validate() failed to find device handle\r\n")));
 		mOverlappedBuffer.Abort();
@@ -148,55 +283,79 @@ BOOL Transfer::Validate()
 		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
 		return FALSE;
 	}
+	if (mBufferId && !mRegisteredPtr) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!Transfer::Validate() invalid range of registered buffer %d\r\n"),
+			mBufferId));
+		mOverlappedBuffer.Abort();
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
 	if (!mBytesTransferredBuffer.Valid()) {
 		ERROR_MSG((TEXT("USBKWrapperDrv!Transfer::Validate() failed to map transfer size user memory\r\n")));
 		mOverlappedBuffer.Abort();
 		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
 		return FALSE;
 	}
+	if (mTimedSync && !mCompletionEvent) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!Transfer::Validate() failed to create completion event\r\n")));
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
 	return TRUE;
 }
 
+LPVOID Transfer::DataPtr()
+{
+	return mBufferId ? mRegisteredPtr : mUserBuffer.Ptr();
+}
+
+DWORD Transfer::DataSize()
+{
+	return mBufferId ? mDataSize : mUserBuffer.Size();
+}
 
 void Transfer::SetTransfer(USB_TRANSFER transfer)
 {
 	// It's possible for TransferComplete() to be called before
 	// the function call which returns the transfer has completed.
-	// To handle this situation this checks for if mTransfer is set.
-	BOOL callCompleted = FALSE;
-	{
-		// As DoTransferCompleted might delete 'this', the mMutex lock can't be hold
-		MutexLocker lock(mMutex);
-		callCompleted = mTransferCompleted && transfer;
-		mTransfer = transfer;
-	}
-	if (callCompleted)
+	// Whichever of this and TransferComplete() runs last calls
+	// DoTransferCompleted().
+	mTransfer = transfer;
+	if (!transfer)
+		// TransferComplete() will never be called
+		return;
+	// The interlocked operation also makes mTransfer visible to
+	// the thread calling TransferComplete().
+	LONG oldState = InterlockedExchangeAdd(&mState, TRANSFER_STATE_HANDLE_SET);
+	if ((oldState | TRANSFER_STATE_HANDLE_SET) == TRANSFER_STATE_DONE)
 		DoTransferCompleted();
 	// Must return immediately as 'this' might have been deleted by DoTransferCompleted.
 	return;
 }
 
+USB_TRANSFER Transfer::TransferHandle()
+{
+	return mTransfer;
+}
+
 DWORD Transfer::TransferComplete()
 {
-	// It's possible for TransferComplete() to be called before
-	// the function call which returns the transfer has completed.
-	// To handle this situation this checks for if mTransfer is set.
-	BOOL callCompleted = FALSE;
-	{
-		// As DoTransferCompleted might delete 'this', the mMutex lock can't be hold
-		MutexLocker lock(mMutex);
-		callCompleted = mTransfer != NULL;
-		mTransferCompleted = true;
-	}
-	if (callCompleted)
+	// See SetTransfer() for how this handles being called first.
+	LONG oldState = InterlockedExchangeAdd(&mState, TRANSFER_STATE_COMPLETED);
+	if ((oldState | TRANSFER_STATE_COMPLETED) == TRANSFER_STATE_DONE)
 		DoTransferCompleted();
 	// Must return immediately as 'this' might have been deleted by DoTransferCompleted.
 	return 0;
 }
 
+BOOL Transfer::Completed()
+{
+	return (InterlockedCompareExchange(&mState, 0, 0) & TRANSFER_STATE_COMPLETED) != 0;
+}
+
 void Transfer::DoTransferCompleted()
 {
-	if (!mTransfer || !mTransferCompleted)
+	if (!mTransfer || !Completed())
 		return;
 
 	DWORD bytesTransferred, transferError, translatedError;
@@ -211,14 +370,38 @@ void Transfer::DoTransferCompleted()
 	TRANSFERLIFETIME_MSG((
 		TEXT("USBKWrapperDrv!Transfer::TransferComplete() completed (error %d, transferred %d, cancelled %d)\r\n"),
 		translatedError, bytesTransferred, mCancelled));
+	Finish(translatedError, bytesTransferred);
+	// Must return immediately as 'this' might have been deleted by Finish().
+	return;
+}
+
+void Transfer::Finish(DWORD dwError, DWORD dwBytesTransferred)
+{
+	if (mTimeoutMs)
+		mOpenContext->GetTimerWheel()->Remove(this);
+	if (mTimedOut && dwError == ERROR_CANCELLED)
+		dwError = ERROR_TIMEOUT;
+	DataTransferred(dwBytesTransferred);
 	// Need to flush the IO buffer before completing the overlapped buffer
-	SetBytesTransferred(bytesTransferred);
-	mOverlappedBuffer.Complete(translatedError, bytesTransferred);
+	SetBytesTransferred(dwBytesTransferred);
+	mOverlappedBuffer.Complete(dwError, dwBytesTransferred);
+	mOpenContext->GetCompletionQueue()->Push(
+		mOverlappedBuffer.UserPtr(), dwError, dwBytesTransferred);
+	if (mCompletionEvent) {
+		// The thread in WaitForCompletion() holds a reference, so
+		// 'this' stays alive until it has seen the result.
+		mCompletionError = dwError;
+		SetEvent(mCompletionEvent);
+	}
 	mOpenContext->GetTransferList()->PutTransfer(this);
 	// Must return immediately as 'this' might have been deleted when put.
 	return;
 }
 
+void Transfer::DataTransferred(DWORD dwBytesTransferred)
+{
+}
+
 void Transfer::SetBytesTransferred(DWORD bytesTransferred)
 {
 	LPDWORD ptr = mBytesTransferredBuffer.Ptr();
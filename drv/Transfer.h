@@ -24,16 +24,28 @@
 #include "UserBuffer.h"
 
 class OpenContext;
+class TransferPool;
+class RegisteredBuffer;
 
 class Transfer {
 public:
 	static DWORD TranslateError(DWORD dwUsbError, DWORD dwBytesTransferred, BOOL Cancelled);
 
 	virtual ~Transfer();
+
+	// Transfers must be allocated from the TransferPool of their
+	// OpenContext. Deleting a transfer returns it to that pool.
+	static void* operator new(size_t size, TransferPool* lpPool) throw();
+	static void operator delete(void* ptr, TransferPool* lpPool) throw();
+	static void operator delete(void* ptr);
+
 	DWORD TransferComplete();
 	LPVOID OverlappedUserPtr();
-	BOOL Cancel(UKWD_USB_DEVICE device, DWORD dwFlags);
+	BOOL Cancel(UsbDevice* device, DWORD dwFlags);
 	BOOL Cancel(DWORD dwFlags);
+	// Returns TRUE if the transfer is pending on device and within
+	// the UKWD_CANCEL_SCOPE_* given by dwScope.
+	BOOL InScope(UsbDevice* device, DWORD dwScope, DWORD dwInterface, UCHAR Endpoint);
 
 	// The reference counting adjustment should only ever be
 	// called by the TransferList class.
@@ -41,6 +53,13 @@ public:
 	// and TransferList::PutTransfer()
 	void IncRef();
 	DWORD DecRef();
+private:
+	// TransferList chains transfers with the same OVERLAPPED hash
+	// through mOverlappedNext.
+	friend class TransferList;
+	// TimerWheel chains transfers expiring in the same slot through
+	// mTimerNext and mTimerPrev.
+	friend class TimerWheel;
 protected:
 	Transfer(
 		OpenContext* OpenContext,
@@ -48,24 +67,87 @@ protected:
 		DWORD dwFlags,
 		LPVOID lpUserBuffer,
 		DWORD dwUserBufferSize,
+		DWORD dwBufferId,
+		DWORD dwBufferOffset,
 		LPDWORD lpUserBytesTransferred,
-		LPOVERLAPPED lpUserOverlapped);
+		LPOVERLAPPED lpUserOverlapped,
+		DWORD dwTimeoutMs);
 	
+	static DWORD AccessFlagsForUserBuffer(DWORD dwFlags, LPOVERLAPPED lpOverlapped, DWORD dwTimeoutMs);
+
 	BOOL Validate();
+	// The data for the transfer, either from the user buffer
+	// or from a registered buffer.
+	LPVOID DataPtr();
+	DWORD DataSize();
+	// Called when the transfer has finished, before the bytes transferred
+	// and the OVERLAPPED are updated, for transfers which don't use the
+	// user buffer directly.
+	virtual void DataTransferred(DWORD dwBytesTransferred);
 	void SetBytesTransferred(DWORD bytesTransferred);
 	void SetTransfer(USB_TRANSFER transfer);
+	USB_TRANSFER TransferHandle();
+	// Reports the result of the transfer to the caller and drops the
+	// reference held while it was pending. 'this' might have been
+	// deleted on return.
+	void Finish(DWORD dwError, DWORD dwBytesTransferred);
+	BOOL Cancelled();
+	// Starts the timeout of a pending asynchronous transfer. Once
+	// it expires the transfer is cancelled and completes with
+	// ERROR_TIMEOUT rather than ERROR_CANCELLED.
+	void StartTimeout();
+	DWORD TimeoutMs();
+	// Synchronous transfers with a timeout are issued in the same way as
+	// asynchronous ones, then Start() blocks in WaitForCompletion() until
+	// they finish, cancelling them once the timeout expires. The result
+	// is returned and set as the last error.
+	BOOL TimedSync();
+	BOOL WaitForCompletion();
+	// Transfers which aren't issued through SetTransfer() override
+	// these to report and cancel their own pending state.
+	virtual BOOL Pending();
+	virtual BOOL CancelPending(DWORD dwFlags);
+	// Transfers on endpoints other than the default control pipe
+	// override these to report the endpoint they were issued on.
+	virtual BOOL IssuedOnEndpoint(UCHAR Endpoint);
+	virtual BOOL IssuedOnInterface(DWORD dwInterface);
+	// Cancels the transfer if it is still pending and closes it. Derived
+	// classes owning memory used by the transfer must call this before
+	// freeing it.
+	void CloseTransfer();
 private:
 	void DoTransferCompleted();
+	BOOL Completed();
+	// Called by TimerWheel once the timeout has expired
+	void TimeOut();
 private:
-	HANDLE mMutex;
 	DWORD mRefCount;
+	Transfer* mOverlappedNext;
 	USB_TRANSFER mTransfer;
-	BOOL mTransferCompleted;
+	// Combination of TRANSFER_STATE_* flags, only modified with
+	// interlocked operations.
+	LONG mState;
 	BOOL mCancelled;
+	// 0 if the transfer doesn't time out
+	const DWORD mTimeoutMs;
+	BOOL mTimedOut;
+	const BOOL mTimedSync;
+	// Set by Finish() for synchronous transfers with a timeout
+	HANDLE mCompletionEvent;
+	DWORD mCompletionError;
+	// Only accessed by TimerWheel with its lock held
+	Transfer* mTimerNext;
+	Transfer* mTimerPrev;
+	DWORD mTimerExpiry;
+	BOOL mTimerQueued;
 protected:
 	OpenContext* mOpenContext;
 	DevicePtr mDevicePtr;
 	UserBuffer<LPVOID> mUserBuffer;
+	const DWORD mBufferId;
+	const DWORD mDataSize;
+	RegisteredBuffer* mRegisteredBuffer;
+	LPVOID mRegisteredPtr;
 	UserBuffer<LPDWORD> mBytesTransferredBuffer;
 	OverlappedUserBuffer mOverlappedBuffer;
 };
@@ -24,8 +24,20 @@
 #include "MutexLocker.h"
 #include "drvdbg.h"
 
+#include <new>
+
+// Initial number of buckets in the OVERLAPPED index
+#define OVERLAPPED_INDEX_INITIAL_SIZE 32
+
+// How long CancelAll() waits for cancelled transfers to complete
+#define CANCEL_ALL_TIMEOUT 5000
+
 TransferList::TransferList()
 : mMutex(NULL)
+, mOverlappedIndex(NULL)
+, mOverlappedIndexSize(0)
+, mOverlappedIndexCount(0)
+, mCancelWaiters(NULL)
 {
 }
 
@@ -57,6 +69,7 @@ TransferList::~TransferList()
 		// the only reference.
 		DWORD refs = lpTransfer->DecRef();
 		ASSERT(refs == 0);
+		UnindexTransfer(lpTransfer);
 		mTransfers.erase(lpTransfer);
 		delete lpTransfer;
 	}
@@ -73,6 +86,7 @@ TransferList::~TransferList()
 		WARN_MSG((TEXT("USBKWrapperDrv!TransferList::~TransferList() - detected %d leaked transfers\r\n"), count));
 	}
 
+	delete[] mOverlappedIndex;
 	if (mMutex)
 		CloseHandle(mMutex);
 }
@@ -84,13 +98,23 @@ BOOL TransferList::Init()
 		ERROR_MSG((TEXT("USBKWrapperDrv!TransferList::Init() - failed to create mutex\r\n")));
 		return FALSE;
 	}
+	mOverlappedIndex = new (std::nothrow) Transfer*[OVERLAPPED_INDEX_INITIAL_SIZE];
+	if (mOverlappedIndex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TransferList::Init() - failed to create overlapped index\r\n")));
+		return FALSE;
+	}
+	memset(mOverlappedIndex, 0, OVERLAPPED_INDEX_INITIAL_SIZE * sizeof(Transfer*));
+	mOverlappedIndexSize = OVERLAPPED_INDEX_INITIAL_SIZE;
 	return TRUE;
 }
 
 BOOL TransferList::RegisterTransfer(Transfer* lpTransfer)
 {
 	MutexLocker lock(mMutex);
-	return mTransfers.insert(lpTransfer);
+	if (!mTransfers.insert(lpTransfer))
+		return FALSE;
+	IndexTransfer(lpTransfer);
+	return TRUE;
 }
 
 void TransferList::PutTransfer(Transfer* lpTransfer)
@@ -99,9 +123,13 @@ void TransferList::PutTransfer(Transfer* lpTransfer)
 	if (lpTransfer) {
 		DWORD count = lpTransfer->DecRef();
 		if (count <= 0) {
+			UnindexTransfer(lpTransfer);
 			mTransfers.erase(lpTransfer);
 			delete lpTransfer;
 		}
+		// Completing transfers put the reference held while pending
+		for (CancelWaiter* waiter = mCancelWaiters; waiter; waiter = waiter->mNext)
+			SetEvent(waiter->mEvent);
 	}
 }
 
@@ -112,28 +140,187 @@ Transfer* TransferList::GetTransfer(Transfer* lpTransfer)
 	return lpTransfer;
 }
 
+BOOL TransferList::CancelAll(
+	UsbDevice* device,
+	DWORD dwScope,
+	DWORD dwInterface,
+	UCHAR Endpoint,
+	DWORD dwFlags,
+	LPDWORD lpdwCancelled)
+{
+	*lpdwCancelled = 0;
+	MutexLocker lock(mMutex);
+	if (mTransfers.empty())
+		return TRUE;
+	Transfer** lpMatched = new (std::nothrow) Transfer*[mTransfers.size()];
+	if (!lpMatched) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	DWORD count = 0;
+	PtrArray<Transfer>::iterator it = mTransfers.begin();
+	while (it != mTransfers.end()) {
+		Transfer* lpTransfer = *it;
+		if (lpTransfer->InScope(device, dwScope, dwInterface, Endpoint)) {
+			// Keeps the transfer alive once mMutex is released
+			lpTransfer->IncRef();
+			lpMatched[count++] = lpTransfer;
+		}
+		++it;
+	}
+	// Cancelling can complete transfers in this thread
+	lock.unlock();
+
+	DWORD cancelled = 0;
+	for (DWORD i = 0; i < count; ++i) {
+		if (lpMatched[i]->Cancel(USB_NO_WAIT))
+			++cancelled;
+	}
+	BOOL completed = TRUE;
+	if (!(dwFlags & USB_NO_WAIT))
+		// They have all been aborting in parallel since above
+		completed = WaitForCancelled(lpMatched, count);
+	for (DWORD i = 0; i < count; ++i)
+		PutTransfer(lpMatched[i]);
+	delete [] lpMatched;
+	TRANSFERLIFETIME_MSG((TEXT("USBKWrapperDrv!TransferList::CancelAll() cancelled %d of %d transfers\r\n"),
+		cancelled, count));
+	*lpdwCancelled = cancelled;
+	if (!completed) {
+		// Some of the transfers can still write to their buffers, so the
+		// caller mustn't be told that they are all done with.
+		SetLastError(ERROR_TIMEOUT);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL TransferList::WaitForCancelled(Transfer** lpTransfers, DWORD dwCount)
+{
+	CancelWaiter waiter;
+	waiter.mEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!waiter.mEvent) {
+		// Fall back to waiting for each transfer in turn
+		BOOL completed = TRUE;
+		for (DWORD i = 0; i < dwCount; ++i) {
+			lpTransfers[i]->Cancel(0);
+			if (lpTransfers[i]->Pending())
+				completed = FALSE;
+		}
+		return completed;
+	}
+	MutexLocker lock(mMutex);
+	waiter.mNext = mCancelWaiters;
+	mCancelWaiters = &waiter;
+	DWORD startTime = GetTickCount();
+	DWORD pending;
+	for (;;) {
+		pending = 0;
+		for (DWORD i = 0; i < dwCount; ++i) {
+			if (lpTransfers[i]->Pending())
+				++pending;
+		}
+		if (pending == 0)
+			break;
+		DWORD elapsed = GetTickCount() - startTime;
+		if (elapsed >= CANCEL_ALL_TIMEOUT) {
+			WARN_MSG((TEXT("USBKWrapperDrv!TransferList::WaitForCancelled() - %d cancelled transfers didn't complete\r\n"),
+				pending));
+			break;
+		}
+		// A transfer stops being pending before its completion takes
+		// mMutex in PutTransfer(), so resetting here can't miss it.
+		ResetEvent(waiter.mEvent);
+		lock.unlock();
+		WaitForSingleObject(waiter.mEvent, CANCEL_ALL_TIMEOUT - elapsed);
+		lock.relock();
+	}
+	CancelWaiter** link = &mCancelWaiters;
+	while (*link != &waiter)
+		link = &(*link)->mNext;
+	*link = waiter.mNext;
+	lock.unlock();
+	CloseHandle(waiter.mEvent);
+	return pending == 0;
+}
+
 Transfer* TransferList::GetTransfer(LPOVERLAPPED lpOverlapped)
 {
 	MutexLocker lock(mMutex);
 	if (!lpOverlapped)
 		return NULL;
-	// This could be done in a way which isn't O(n) by using
-	// a map, but then there would also need to be the inverse
-	// map so that when the transfer is completed the correct map
-	// value could be removed.
-	//
-	// For now the simple linear approach is used of looking at
-	// all pending transfers.
-	PtrArray<Transfer>::iterator ret = mTransfers.begin();
-	while (ret != mTransfers.end() &&
-		((*ret == NULL) || ((*ret)->OverlappedUserPtr() != lpOverlapped)))
-		++ret;
-	if (ret == mTransfers.end()) {
+	Transfer* lpTransfer = mOverlappedIndex[OverlappedBucket(lpOverlapped)];
+	while (lpTransfer && lpTransfer->OverlappedUserPtr() != lpOverlapped)
+		lpTransfer = lpTransfer->mOverlappedNext;
+	if (!lpTransfer) {
 		// Not worth warning about as transfers might have already completed
 		// before being cancelled.
 		return NULL;
 	}
-	(*ret)->IncRef();
-	return (*ret);
+	lpTransfer->IncRef();
+	return lpTransfer;
+}
+
+DWORD TransferList::OverlappedBucket(LPVOID lpOverlapped) const
+{
+	// OVERLAPPED structures are at least 4 byte aligned, so mix the
+	// address with a multiplicative hash before masking.
+	DWORD hash = (reinterpret_cast<DWORD>(lpOverlapped) >> 2) * 2654435761UL;
+	return (hash >> 8) & (mOverlappedIndexSize - 1);
 }
 
+void TransferList::IndexTransfer(Transfer* lpTransfer)
+{
+	LPVOID lpOverlapped = lpTransfer->OverlappedUserPtr();
+	if (!lpOverlapped)
+		// Synchronous transfers can't be looked up
+		return;
+	if (mOverlappedIndexCount >= mOverlappedIndexSize)
+		GrowIndex();
+	DWORD bucket = OverlappedBucket(lpOverlapped);
+	lpTransfer->mOverlappedNext = mOverlappedIndex[bucket];
+	mOverlappedIndex[bucket] = lpTransfer;
+	++mOverlappedIndexCount;
+}
+
+void TransferList::UnindexTransfer(Transfer* lpTransfer)
+{
+	LPVOID lpOverlapped = lpTransfer->OverlappedUserPtr();
+	if (!lpOverlapped)
+		return;
+	Transfer** link = &mOverlappedIndex[OverlappedBucket(lpOverlapped)];
+	while (*link && *link != lpTransfer)
+		link = &(*link)->mOverlappedNext;
+	if (*link) {
+		*link = lpTransfer->mOverlappedNext;
+		lpTransfer->mOverlappedNext = NULL;
+		--mOverlappedIndexCount;
+	}
+}
+
+void TransferList::GrowIndex()
+{
+	DWORD newSize = mOverlappedIndexSize * 2;
+	Transfer** newIndex = new (std::nothrow) Transfer*[newSize];
+	if (!newIndex) {
+		// Lookups still work with longer chains
+		WARN_MSG((TEXT("USBKWrapperDrv!TransferList::GrowIndex() - failed to grow to %d buckets\r\n"), newSize));
+		return;
+	}
+	memset(newIndex, 0, newSize * sizeof(Transfer*));
+	Transfer** oldIndex = mOverlappedIndex;
+	DWORD oldSize = mOverlappedIndexSize;
+	mOverlappedIndex = newIndex;
+	mOverlappedIndexSize = newSize;
+	for (DWORD i = 0; i < oldSize; ++i) {
+		Transfer* lpTransfer = oldIndex[i];
+		while (lpTransfer) {
+			Transfer* next = lpTransfer->mOverlappedNext;
+			DWORD bucket = OverlappedBucket(lpTransfer->OverlappedUserPtr());
+			lpTransfer->mOverlappedNext = mOverlappedIndex[bucket];
+			mOverlappedIndex[bucket] = lpTransfer;
+			lpTransfer = next;
+		}
+	}
+	delete[] oldIndex;
+}
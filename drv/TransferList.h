@@ -20,9 +20,11 @@
 #ifndef TRANSFER_LIST_H
 #define TRANSFER_LIST_H
 
+#include "ceusbkwrapper_common.h"
 #include "ptrset.h"
 
 class Transfer;
+class UsbDevice;
 
 class TransferList {
 public:
@@ -33,9 +35,42 @@ public:
 	void PutTransfer(Transfer* lpTransfer);
 	Transfer* GetTransfer(Transfer* lpTransfer);
 	Transfer* GetTransfer(LPOVERLAPPED lpOverlapped);
+	// Cancels every transfer matching Transfer::InScope() with a single
+	// pass over the list. All of them are asked to abort before waiting
+	// for any to complete, unless USB_NO_WAIT is passed in dwFlags.
+	// Fails with ERROR_TIMEOUT if they don't all complete in time.
+	BOOL CancelAll(
+		UsbDevice* device,
+		DWORD dwScope,
+		DWORD dwInterface,
+		UCHAR Endpoint,
+		DWORD dwFlags,
+		LPDWORD lpdwCancelled);
+private:
+	// A thread in WaitForCancelled(), chained through mCancelWaiters
+	struct CancelWaiter {
+		HANDLE mEvent;
+		CancelWaiter* mNext;
+	};
+	// Waits for transfers which have already been asked to abort to
+	// complete, without aborting them again. Returns FALSE if some were
+	// still pending when the wait timed out.
+	BOOL WaitForCancelled(Transfer** lpTransfers, DWORD dwCount);
+	// These should be called with mMutex held
+	DWORD OverlappedBucket(LPVOID lpOverlapped) const;
+	void IndexTransfer(Transfer* lpTransfer);
+	void UnindexTransfer(Transfer* lpTransfer);
+	void GrowIndex();
 private:
 	HANDLE mMutex;
 	PtrArray<Transfer> mTransfers;
+	// Hash table of transfers keyed on their user OVERLAPPED pointer,
+	// chained through Transfer::mOverlappedNext.
+	Transfer** mOverlappedIndex;
+	DWORD mOverlappedIndexSize; // Always a power of two
+	DWORD mOverlappedIndexCount;
+	// Signalled by PutTransfer() when transfers complete
+	CancelWaiter* mCancelWaiters;
 };
 
 #endif // TRANSFER_LIST_H
\ No newline at end of file
@@ -0,0 +1,165 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// TransferPool.cpp : Recycles memory used by transfers
+
+#include "StdAfx.h"
+#include "TransferPool.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+#include <new>
+
+C_ASSERT(sizeof(TransferPoolSlot) % 8 == 0);
+
+static TransferPoolSlot* SlotFromPtr(void* ptr)
+{
+	return reinterpret_cast<TransferPoolSlot*>(ptr) - 1;
+}
+
+TransferPool::TransferPool(DWORD dwSlotSize)
+: mMutex(NULL)
+, mSlotSize(dwSlotSize)
+, mFree(NULL)
+, mFreeCount(0)
+, mInUse(0)
+, mHighWaterMark(0)
+, mAllocated(0)
+, mOversized(0)
+{
+}
+
+TransferPool::~TransferPool()
+{
+	// All transfers should have been deleted by the TransferList already
+	if (mInUse > 0) {
+		WARN_MSG((TEXT("USBKWrapperDrv!TransferPool::~TransferPool() - %d transfers still in use\r\n"), mInUse));
+	}
+	while (mFree) {
+		TransferPoolSlot* slot = mFree;
+		mFree = slot->mNext;
+		DestroySlot(slot);
+	}
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL TransferPool::Init(DWORD dwPreallocate)
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TransferPool::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	for (DWORD i = 0; i < dwPreallocate; ++i) {
+		TransferPoolSlot* slot = CreateSlot(this, mSlotSize);
+		if (!slot) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!TransferPool::Init() - failed to preallocate transfer %d\r\n"), i));
+			return FALSE;
+		}
+		slot->mNext = mFree;
+		mFree = slot;
+		++mFreeCount;
+		++mAllocated;
+	}
+	return TRUE;
+}
+
+void* TransferPool::Alloc(size_t dwSize)
+{
+	TransferPoolSlot* slot = NULL;
+	if (dwSize > mSlotSize) {
+		// Larger than a slot, so allocate it separately and don't recycle it
+		slot = CreateSlot(NULL, dwSize);
+		if (!slot)
+			return NULL;
+		MutexLocker lock(mMutex);
+		++mOversized;
+		return slot + 1;
+	}
+
+	{
+		MutexLocker lock(mMutex);
+		if (mFree) {
+			slot = mFree;
+			mFree = slot->mNext;
+			--mFreeCount;
+			++mInUse;
+			if (mInUse > mHighWaterMark)
+				mHighWaterMark = mInUse;
+			return slot + 1;
+		}
+	}
+
+	// The pool is empty, so grow it without holding the lock
+	slot = CreateSlot(this, mSlotSize);
+	if (!slot)
+		return NULL;
+	MutexLocker lock(mMutex);
+	++mAllocated;
+	++mInUse;
+	if (mInUse > mHighWaterMark)
+		mHighWaterMark = mInUse;
+	return slot + 1;
+}
+
+void TransferPool::Free(void* ptr)
+{
+	if (!ptr)
+		return;
+	TransferPoolSlot* slot = SlotFromPtr(ptr);
+	if (slot->mPool)
+		slot->mPool->Release(slot);
+	else
+		DestroySlot(slot);
+}
+
+void TransferPool::GetStats(LPUKWD_TRANSFER_POOL_STATS lpStats)
+{
+	MutexLocker lock(mMutex);
+	lpStats->dwInUse = mInUse;
+	lpStats->dwHighWaterMark = mHighWaterMark;
+	lpStats->dwFree = mFreeCount;
+	lpStats->dwAllocated = mAllocated;
+	lpStats->dwOversized = mOversized;
+}
+
+TransferPoolSlot* TransferPool::CreateSlot(TransferPool* lpPool, size_t dwSize)
+{
+	BYTE* mem = new (std::nothrow) BYTE[sizeof(TransferPoolSlot) + dwSize];
+	if (!mem)
+		return NULL;
+	TransferPoolSlot* slot = reinterpret_cast<TransferPoolSlot*>(mem);
+	slot->mNext = NULL;
+	slot->mPool = lpPool;
+	return slot;
+}
+
+void TransferPool::DestroySlot(TransferPoolSlot* lpSlot)
+{
+	delete[] reinterpret_cast<BYTE*>(lpSlot);
+}
+
+void TransferPool::Release(TransferPoolSlot* lpSlot)
+{
+	MutexLocker lock(mMutex);
+	lpSlot->mNext = mFree;
+	mFree = lpSlot;
+	++mFreeCount;
+	--mInUse;
+}
@@ -0,0 +1,60 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// TransferPool.h : Recycles memory used by transfers
+#ifndef TRANSFER_POOL_H
+#define TRANSFER_POOL_H
+
+#include "ceusbkwrapper_common.h"
+
+class TransferPool;
+
+// Header placed before every transfer allocated from a pool
+struct TransferPoolSlot {
+	TransferPoolSlot* mNext;
+	TransferPool* mPool; // NULL if the slot is too large to be recycled
+};
+
+class TransferPool {
+public:
+	TransferPool(DWORD dwSlotSize);
+	~TransferPool();
+	BOOL Init(DWORD dwPreallocate);
+
+	// Returns storage for a transfer of dwSize bytes, or NULL
+	void* Alloc(size_t dwSize);
+	// Returns storage obtained from Alloc() to the pool which provided it
+	static void Free(void* ptr);
+
+	void GetStats(LPUKWD_TRANSFER_POOL_STATS lpStats);
+private:
+	static TransferPoolSlot* CreateSlot(TransferPool* lpPool, size_t dwSize);
+	static void DestroySlot(TransferPoolSlot* lpSlot);
+	void Release(TransferPoolSlot* lpSlot);
+private:
+	HANDLE mMutex;
+	const DWORD mSlotSize;
+	TransferPoolSlot* mFree;
+	DWORD mFreeCount;
+	DWORD mInUse;
+	DWORD mHighWaterMark;
+	DWORD mAllocated;
+	DWORD mOversized;
+};
+
+#endif // TRANSFER_POOL_H
@@ -0,0 +1,291 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// TransferSplitter.cpp : Issues a large bulk transfer as a series of chunks
+
+#include "StdAfx.h"
+#include "TransferSplitter.h"
+#include "BulkTransfer.h"
+#include "UsbDevice.h"
+#include "MutexLocker.h"
+#include "drvdbg.h"
+
+#include <new>
+
+TransferSplitter::TransferSplitter(
+	BulkTransfer* lpOwner,
+	DevicePtr& device,
+	DWORD dwInterface,
+	UCHAR Endpoint,
+	DWORD dwFlags,
+	LPVOID lpData,
+	DWORD dwSize,
+	DWORD dwChunkSize,
+	DWORD dwMaxChunks)
+: mRefCount(1)
+, mOwner(lpOwner)
+, mDevicePtr(device)
+, mInterface(dwInterface)
+, mEndpoint(Endpoint)
+, mFlags(dwFlags)
+, mData(static_cast<LPBYTE>(lpData))
+, mSize(dwSize)
+, mChunkSize(dwChunkSize)
+, mMaxChunks(dwMaxChunks)
+, mChunks(NULL)
+, mMutex(NULL)
+, mCompletedEvent(NULL)
+, mNextOffset(0)
+, mChunksPending(0)
+, mIssuing(FALSE)
+, mStopping(FALSE)
+, mEnded(FALSE)
+, mEndOffset(0)
+, mEndUsbError(USB_NO_ERROR)
+, mEndError(ERROR_SUCCESS)
+, mCompleted(FALSE)
+{
+}
+
+TransferSplitter::~TransferSplitter()
+{
+	delete [] mChunks;
+	if (mCompletedEvent)
+		CloseHandle(mCompletedEvent);
+	if (mMutex)
+		CloseHandle(mMutex);
+}
+
+BOOL TransferSplitter::Init()
+{
+	mMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TransferSplitter::Init() - failed to create mutex\r\n")));
+		return FALSE;
+	}
+	mCompletedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (mCompletedEvent == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TransferSplitter::Init() - failed to create event\r\n")));
+		return FALSE;
+	}
+	mChunks = new (std::nothrow) TransferChunk[mMaxChunks];
+	if (!mChunks) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TransferSplitter::Init() - failed to allocate %d chunks\r\n"),
+			mMaxChunks));
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	for (DWORD i = 0; i < mMaxChunks; ++i) {
+		TransferChunk& chunk = mChunks[i];
+		chunk.mSplitter = this;
+		chunk.mTransfer = NULL;
+		chunk.mOffset = 0;
+		chunk.mSize = 0;
+		chunk.mInUse = FALSE;
+		chunk.mCompletedEarly = FALSE;
+	}
+	return TRUE;
+}
+
+BOOL TransferSplitter::Start()
+{
+	MutexLocker lock(mMutex);
+	IssueChunks(lock);
+	if (mEnded && mEndOffset == 0 && mEndError != ERROR_SUCCESS) {
+		// The first chunk couldn't be issued, so nothing is pending
+		// and the owner reports the failure itself.
+		mCompleted = TRUE;
+		SetEvent(mCompletedEvent);
+		SetLastError(mEndError);
+		return FALSE;
+	}
+	CompleteIfDone(lock);
+	return TRUE;
+}
+
+BOOL TransferSplitter::Pending()
+{
+	MutexLocker lock(mMutex);
+	return !mCompleted;
+}
+
+BOOL TransferSplitter::Cancel(DWORD dwFlags)
+{
+	// Completing the owner can drop the last reference to this
+	IncRef();
+	MutexLocker lock(mMutex);
+	if (mCompleted) {
+		lock.unlock();
+		DecRef();
+		return FALSE;
+	}
+	mStopping = TRUE;
+	// Holding the lock stops the completion callbacks from closing the
+	// transfers, so this mustn't wait for the cancellation to complete.
+	// Chunks still being issued are cancelled by IssueChunks().
+	for (DWORD i = 0; i < mMaxChunks; ++i) {
+		TransferChunk& chunk = mChunks[i];
+		if (chunk.mInUse && chunk.mTransfer)
+			mDevicePtr->CancelTransfer(chunk.mTransfer, USB_NO_WAIT);
+	}
+	CompleteIfDone(lock);
+	lock.unlock();
+	if (!(dwFlags & USB_NO_WAIT))
+		WaitForSingleObject(mCompletedEvent, INFINITE);
+	DecRef();
+	return TRUE;
+}
+
+void TransferSplitter::IncRef()
+{
+	InterlockedIncrement(&mRefCount);
+}
+
+void TransferSplitter::DecRef()
+{
+	if (InterlockedDecrement(&mRefCount) == 0)
+		delete this;
+}
+
+// Should be called with mMutex held.
+void TransferSplitter::IssueChunks(MutexLocker& lock)
+{
+	// Only one thread issues chunks at a time, so that they reach the
+	// pipe in order.
+	if (mIssuing)
+		return;
+	mIssuing = TRUE;
+	while (!mStopping && !mEnded && mNextOffset < mSize && mChunksPending < mMaxChunks) {
+		TransferChunk* chunk = mChunks;
+		while (chunk->mInUse)
+			++chunk;
+		chunk->mInUse = TRUE;
+		chunk->mTransfer = NULL;
+		chunk->mCompletedEarly = FALSE;
+		chunk->mOffset = mNextOffset;
+		chunk->mSize = min(mChunkSize, mSize - mNextOffset);
+		mNextOffset += chunk->mSize;
+		++mChunksPending;
+		// The lock isn't held while issuing, as the device won't complete
+		// transfers while this thread would be waiting for the lock.
+		lock.unlock();
+		USB_TRANSFER transfer = mDevicePtr->IssueBulkTransfer(
+			&ChunkNotifyRoutine, chunk,
+			mInterface, mEndpoint, mFlags,
+			chunk->mSize, mData + chunk->mOffset);
+		DWORD error = GetLastError();
+		lock.relock();
+		if (!transfer) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!TransferSplitter::IssueChunks() - failed to issue chunk at %d on endpoint 0x%02x: %d\r\n"),
+				chunk->mOffset, mEndpoint, error));
+			chunk->mInUse = FALSE;
+			--mChunksPending;
+			EndAt(chunk->mOffset, USB_NO_ERROR, error);
+			break;
+		}
+		chunk->mTransfer = transfer;
+		if (chunk->mCompletedEarly)
+			// The callback ran before the handle was known
+			ChunkComplete(*chunk);
+		else if (mStopping || (mEnded && chunk->mOffset >= mEndOffset))
+			// Couldn't be cancelled without the handle
+			mDevicePtr->CancelTransfer(transfer, USB_NO_WAIT);
+	}
+	mIssuing = FALSE;
+}
+
+DWORD WINAPI TransferSplitter::ChunkNotifyRoutine(LPVOID lpvNotifyParameter)
+{
+	TransferChunk* chunk = static_cast<TransferChunk*>(lpvNotifyParameter);
+	TransferSplitter* splitter = chunk->mSplitter;
+	// The owner might be completed by a nested callback while this
+	// is still using the splitter.
+	splitter->IncRef();
+	{
+		MutexLocker lock(splitter->mMutex);
+		if (!chunk->mTransfer) {
+			// IssueChunks() will complete the chunk once it has the handle
+			chunk->mCompletedEarly = TRUE;
+		} else {
+			splitter->ChunkComplete(*chunk);
+			// Replace the chunk before anything else can run
+			splitter->IssueChunks(lock);
+			splitter->CompleteIfDone(lock);
+		}
+	}
+	splitter->DecRef();
+	return 0;
+}
+
+// Should be called with mMutex held.
+void TransferSplitter::ChunkComplete(TransferChunk& chunk)
+{
+	DWORD bytesTransferred = 0, transferError = USB_NO_ERROR;
+	if (!mDevicePtr->GetTransferStatusNoLock(chunk.mTransfer, &bytesTransferred, &transferError)) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!TransferSplitter::ChunkComplete() used invalid transfer handle\r\n")));
+		transferError = USB_CANCELED_ERROR;
+		bytesTransferred = 0;
+	}
+	mDevicePtr->CloseTransfer(chunk.mTransfer);
+	chunk.mTransfer = NULL;
+	chunk.mInUse = FALSE;
+	--mChunksPending;
+
+	if (transferError != USB_NO_ERROR || bytesTransferred < chunk.mSize)
+		EndAt(chunk.mOffset + bytesTransferred, transferError, ERROR_SUCCESS);
+}
+
+// Should be called with mMutex held.
+void TransferSplitter::EndAt(DWORD dwOffset, DWORD dwUsbError, DWORD dwError)
+{
+	// Cancelled chunks can complete in any order, so only the
+	// earliest end is kept.
+	if (mEnded && dwOffset >= mEndOffset)
+		return;
+	mEnded = TRUE;
+	mEndOffset = dwOffset;
+	mEndUsbError = dwUsbError;
+	mEndError = dwError;
+	for (DWORD i = 0; i < mMaxChunks; ++i) {
+		TransferChunk& chunk = mChunks[i];
+		if (chunk.mInUse && chunk.mTransfer && chunk.mOffset >= dwOffset)
+			mDevicePtr->CancelTransfer(chunk.mTransfer, USB_NO_WAIT);
+	}
+}
+
+// Should be called with mMutex held.
+void TransferSplitter::CompleteIfDone(MutexLocker& lock)
+{
+	if (mCompleted || mChunksPending > 0)
+		return;
+	if (!mEnded && !mStopping && mNextOffset < mSize)
+		// More chunks are still to be issued
+		return;
+	mCompleted = TRUE;
+	DWORD bytesTransferred = mEnded ? mEndOffset : mNextOffset;
+	DWORD usbError = mEnded ? mEndUsbError :
+		(bytesTransferred < mSize ? USB_CANCELED_ERROR : USB_NO_ERROR);
+	DWORD error = mEnded ? mEndError : ERROR_SUCCESS;
+	// The lock isn't held while completing the owner, as deleting
+	// the owner releases its reference to this.
+	IncRef();
+	lock.unlock();
+	mOwner->SplitCompleted(usbError, error, bytesTransferred);
+	SetEvent(mCompletedEvent);
+	DecRef();
+}
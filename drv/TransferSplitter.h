@@ -0,0 +1,114 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// TransferSplitter.h : Issues a large bulk transfer as a series of chunks
+#ifndef TRANSFER_SPLITTER_H
+#define TRANSFER_SPLITTER_H
+
+#include "ceusbkwrapper_common.h"
+#include "DevicePtr.h"
+
+class BulkTransfer;
+class TransferSplitter;
+class MutexLocker;
+
+// One chunk of a split transfer
+struct TransferChunk {
+	TransferSplitter* mSplitter;
+	USB_TRANSFER mTransfer;
+	DWORD mOffset;
+	DWORD mSize;
+	BOOL mInUse;
+	// Set if the transfer completed before its handle was stored
+	BOOL mCompletedEarly;
+};
+
+// Issues a bulk transfer as consecutive chunks, keeping up to a fixed
+// number of them queued so that the endpoint isn't left idle between
+// them. Each completed chunk is replaced from the completion callback
+// and the owning transfer is completed once all chunks have finished.
+//
+// A chunk which fails or ends with a short packet ends the transfer at
+// that point. Later chunks are cancelled and any bytes they transferred
+// aren't reported.
+class TransferSplitter {
+public:
+	TransferSplitter(
+		BulkTransfer* lpOwner,
+		DevicePtr& device,
+		DWORD dwInterface,
+		UCHAR Endpoint,
+		DWORD dwFlags,
+		LPVOID lpData,
+		DWORD dwSize,
+		DWORD dwChunkSize,
+		DWORD dwMaxChunks);
+	BOOL Init();
+	// Queues the first chunks. Returns FALSE with the last error set if
+	// none could be issued, in which case the owner isn't completed.
+	BOOL Start();
+	BOOL Pending();
+	// Cancels all queued chunks. Unless dwFlags contains USB_NO_WAIT
+	// this waits for the owner to be completed.
+	BOOL Cancel(DWORD dwFlags);
+
+	void IncRef();
+	void DecRef();
+
+	// Called by the USB driver when a chunk completes
+	static DWORD WINAPI ChunkNotifyRoutine(LPVOID lpvNotifyParameter);
+private:
+	~TransferSplitter();
+	// Issues chunks until mMaxChunks are pending
+	void IssueChunks(MutexLocker& lock);
+	void ChunkComplete(TransferChunk& chunk);
+	void EndAt(DWORD dwOffset, DWORD dwUsbError, DWORD dwError);
+	// Completes the owner if no more chunks will be issued, releasing
+	// the lock to do so.
+	void CompleteIfDone(MutexLocker& lock);
+private:
+	LONG mRefCount;
+	BulkTransfer* mOwner;
+	DevicePtr mDevicePtr;
+	const DWORD mInterface;
+	const UCHAR mEndpoint;
+	const DWORD mFlags;
+	LPBYTE mData;
+	const DWORD mSize;
+	const DWORD mChunkSize;
+	const DWORD mMaxChunks;
+	TransferChunk* mChunks;
+	HANDLE mMutex;
+	// Manual reset event signalled once the owner has been completed
+	HANDLE mCompletedEvent;
+	DWORD mNextOffset;
+	DWORD mChunksPending;
+	// Set while a thread is issuing chunks without holding mMutex
+	BOOL mIssuing;
+	// Set by Cancel() to stop any more chunks being issued
+	BOOL mStopping;
+	// Set once a chunk has ended the transfer at mEndOffset
+	BOOL mEnded;
+	DWORD mEndOffset;
+	DWORD mEndUsbError;
+	// Set if the transfer ended because a chunk couldn't be issued
+	DWORD mEndError;
+	BOOL mCompleted;
+};
+
+#endif // TRANSFER_SPLITTER_H
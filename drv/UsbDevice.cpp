@@ -121,6 +121,7 @@ void UsbDevice::Close()
 
 		// Provide notification to userland that this USB device has disappeared
 		AdvertiseDevice(FALSE);
+		USB_DEVICE_DESCRIPTOR descriptor = mUsbFuncs->lpGetDeviceInfo(mDevice)->Descriptor;
 
 		mUsbFuncs->lpUnRegisterNotificationRoutine(
 			mDevice, UsbDeviceNotifyRoutine, this);
@@ -132,6 +133,13 @@ void UsbDevice::Close()
 		mRegistered = FALSE;
 		mUsbFuncs = NULL;
 		mDevice = NULL;
+
+		// Queue the detach event without the close lock held, as the
+		// device list lock must be taken before it.
+		lock.unlock();
+		UsbDeviceList* list = UsbDeviceList::Get();
+		if (list)
+			list->DeviceDetached(this, descriptor);
 	}
 }
 
@@ -209,28 +217,38 @@ BOOL UsbDevice::IsSameDevice(USB_HANDLE hDevice) {
 	return (hDevice == mDevice);
 }
 
-UKWD_USB_DEVICE UsbDevice::GetIdentifier()
-{
-	return this;
-}
-
 void UsbDevice::IncRef()
 {
-	// This is done without a lock as this should only be called by UsbDeviceList
-	++mRefCount;
+	// DeviceHandleTable adds references without holding a lock, so the
+	// count is only ever changed with interlocked operations.
+	LONG count = InterlockedIncrement(&mRefCount);
 	DEVLIFETIME_MSG((
 		TEXT("USBKWrapperDrv!UsbDevice::IncRef() mDevice: %d mBus: %d mAddress: %d mRefCount: %d\r\n"),
-		mDevice, mBus, mAddress, mRefCount));
+		mDevice, mBus, mAddress, count));
+}
+
+BOOL UsbDevice::TryIncRef()
+{
+	for (;;) {
+		LONG count = mRefCount;
+		if (count <= 0)
+			return FALSE;
+		if (InterlockedCompareExchange(&mRefCount, count + 1, count) == count) {
+			DEVLIFETIME_MSG((
+				TEXT("USBKWrapperDrv!UsbDevice::TryIncRef() mDevice: %d mBus: %d mAddress: %d mRefCount: %d\r\n"),
+				mDevice, mBus, mAddress, count + 1));
+			return TRUE;
+		}
+	}
 }
 
 DWORD UsbDevice::DecRef()
 {
-	// This is done without a lock as this should only be called by UsbDeviceList
-	--mRefCount;
+	LONG count = InterlockedDecrement(&mRefCount);
 	DEVLIFETIME_MSG((
 		TEXT("USBKWrapperDrv!UsbDevice::DecRef() mDevice: %d mBus: %d mAddress: %d mRefCount: %d\r\n"),
-		mDevice, mBus, mAddress, mRefCount));
-	return mRefCount;
+		mDevice, mBus, mAddress, count));
+	return count;
 }
 
 void UsbDevice::ReleaseAllInterfaces(LPVOID Context)
@@ -609,6 +627,20 @@ USB_TRANSFER UsbDevice::IssueBulkTransfer(
 	DWORD dwFlags,
 	DWORD dwDataBufferSize,
 	LPVOID lpvBuffer)
+{
+	return IssueBulkTransfer(
+		callback ? &StaticTransferNotifyRoutine : NULL, callback,
+		dwInterface, Endpoint, dwFlags, dwDataBufferSize, lpvBuffer);
+}
+
+USB_TRANSFER UsbDevice::IssueBulkTransfer(
+	LPTRANSFER_NOTIFY_ROUTINE lpNotify,
+	LPVOID lpvNotifyParameter,
+	DWORD dwInterface,
+	UCHAR Endpoint,
+	DWORD dwFlags,
+	DWORD dwDataBufferSize,
+	LPVOID lpvBuffer)
 {
 	ReadLocker lock(mCloseMutex);
 	if (Closed()) {
@@ -622,10 +654,97 @@ USB_TRANSFER UsbDevice::IssueBulkTransfer(
 		return NULL;
 	}
 	return mUsbFuncs->lpIssueBulkTransfer(
-		epPipe, callback ? &StaticTransferNotifyRoutine : NULL, callback,
+		epPipe, lpNotify, lpvNotifyParameter,
 		dwFlags, dwDataBufferSize, lpvBuffer, NULL);
 }
 
+USB_TRANSFER UsbDevice::IssueInterruptTransfer(
+	Transfer* callback,
+	DWORD dwInterface,
+	UCHAR Endpoint,
+	DWORD dwFlags,
+	DWORD dwDataBufferSize,
+	LPVOID lpvBuffer)
+{
+	return IssueInterruptTransfer(
+		callback ? &StaticTransferNotifyRoutine : NULL, callback,
+		dwInterface, Endpoint, dwFlags, dwDataBufferSize, lpvBuffer);
+}
+
+USB_TRANSFER UsbDevice::IssueInterruptTransfer(
+	LPTRANSFER_NOTIFY_ROUTINE lpNotify,
+	LPVOID lpvNotifyParameter,
+	DWORD dwInterface,
+	UCHAR Endpoint,
+	DWORD dwFlags,
+	DWORD dwDataBufferSize,
+	LPVOID lpvBuffer)
+{
+	ReadLocker lock(mCloseMutex);
+	if (Closed()) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return NULL;
+	}
+
+	USB_PIPE epPipe = GetPipeForEndpoint(dwInterface, Endpoint);
+	if (!epPipe) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+	return mUsbFuncs->lpIssueInterruptTransfer(
+		epPipe, lpNotify, lpvNotifyParameter,
+		dwFlags, dwDataBufferSize, lpvBuffer, NULL);
+}
+
+USB_TRANSFER UsbDevice::IssueIsochTransfer(
+	Transfer* callback,
+	DWORD dwInterface,
+	UCHAR Endpoint,
+	DWORD dwFlags,
+	DWORD dwStartingFrame,
+	DWORD dwFrames,
+	LPCDWORD lpdwLengths,
+	LPVOID lpvBuffer)
+{
+	ReadLocker lock(mCloseMutex);
+	if (Closed()) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return NULL;
+	}
+
+	USB_PIPE epPipe = GetPipeForEndpoint(dwInterface, Endpoint);
+	if (!epPipe) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+	return mUsbFuncs->lpIssueIsochTransfer(
+		epPipe, callback ? &StaticTransferNotifyRoutine : NULL, callback,
+		dwFlags, dwStartingFrame, dwFrames, lpdwLengths, lpvBuffer, NULL);
+}
+
+BOOL UsbDevice::GetIsochResults(
+	USB_TRANSFER hTransfer,
+	DWORD dwFrames,
+	LPDWORD lpdwBytesTransferred,
+	LPDWORD lpdwErrors)
+{
+	ReadLocker lock(mCloseMutex);
+	return GetIsochResultsNoLock(hTransfer, dwFrames, lpdwBytesTransferred, lpdwErrors);
+}
+
+BOOL UsbDevice::GetIsochResultsNoLock(
+	USB_TRANSFER hTransfer,
+	DWORD dwFrames,
+	LPDWORD lpdwBytesTransferred,
+	LPDWORD lpdwErrors)
+{
+	if (Closed()) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+	return mUsbFuncs->lpGetIsochResults(hTransfer, dwFrames, lpdwBytesTransferred, lpdwErrors);
+}
+
 void UsbDevice::AdvertiseDevice(BOOL isAttached)
 {
 	// Allow an additional 9 bytes with prefix: 
@@ -52,13 +52,14 @@ public:
 
 	BOOL IsSameDevice(USB_HANDLE hDevice);
 
-	UKWD_USB_DEVICE GetIdentifier();
-
 	// The reference counting adjustment should only ever be
 	// called by the UsbDeviceList class.
 	// Other code should make use of UsbDeviceList::GetDevice()
 	// and UsbDeviceList::PutDevice()
 	void IncRef();
+	// Adds a reference unless the count has already reached zero, in
+	// which case the device is about to be removed from the list.
+	BOOL TryIncRef();
 	DWORD DecRef();
 
 	void ReleaseAllInterfaces(LPVOID Context);
@@ -106,6 +107,56 @@ public:
 		DWORD dwDataBufferSize,
 		LPVOID lpvBuffer);
 
+	// As above, but calls lpNotify with lpvNotifyParameter on completion
+	// instead of completing a Transfer.
+	USB_TRANSFER IssueBulkTransfer(
+		LPTRANSFER_NOTIFY_ROUTINE lpNotify,
+		LPVOID lpvNotifyParameter,
+		DWORD dwInterface,
+		UCHAR Endpoint,
+		DWORD dwFlags,
+		DWORD dwDataBufferSize,
+		LPVOID lpvBuffer);
+
+	USB_TRANSFER IssueInterruptTransfer(
+		Transfer* callback,
+		DWORD dwInterface,
+		UCHAR Endpoint,
+		DWORD dwFlags,
+		DWORD dwDataBufferSize,
+		LPVOID lpvBuffer);
+
+	USB_TRANSFER IssueInterruptTransfer(
+		LPTRANSFER_NOTIFY_ROUTINE lpNotify,
+		LPVOID lpvNotifyParameter,
+		DWORD dwInterface,
+		UCHAR Endpoint,
+		DWORD dwFlags,
+		DWORD dwDataBufferSize,
+		LPVOID lpvBuffer);
+
+	// lpdwLengths must stay valid until the transfer has completed
+	USB_TRANSFER IssueIsochTransfer(
+		Transfer* callback,
+		DWORD dwInterface,
+		UCHAR Endpoint,
+		DWORD dwFlags,
+		DWORD dwStartingFrame,
+		DWORD dwFrames,
+		LPCDWORD lpdwLengths,
+		LPVOID lpvBuffer);
+	BOOL GetIsochResults(
+		USB_TRANSFER hTransfer,
+		DWORD dwFrames,
+		LPDWORD lpdwBytesTransferred,
+		LPDWORD lpdwErrors);
+	// See GetTransferStatusNoLock() for when this can be called
+	BOOL GetIsochResultsNoLock(
+		USB_TRANSFER hTransfer,
+		DWORD dwFrames,
+		LPDWORD lpdwBytesTransferred,
+		LPDWORD lpdwErrors);
+
 	BOOL Reset();
 	BOOL Reenumerate();
 
@@ -132,7 +183,7 @@ private:
 	void AdvertiseDevice(BOOL isAttached);
 	BOOL DoAttachKernelDriver(WriteLocker& lock, LPCUSB_INTERFACE devIf);
 private:
-	DWORD mRefCount;
+	LONG mRefCount;
 	mutable ReadWriteMutex mCloseMutex; // Mutable to allow locking inside const methods
 	USB_HANDLE mDevice;
 	LPCUSB_FUNCS mUsbFuncs;
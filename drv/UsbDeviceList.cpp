@@ -19,6 +19,7 @@
 #include "StdAfx.h"
 #include "UsbDeviceList.h"
 #include "UsbDevice.h"
+#include "DeviceEventQueue.h"
 #include "drvdbg.h"
 #include "MutexLocker.h"
 #include "ArrayAutoPtr.h"
@@ -47,8 +48,11 @@ UsbDeviceList* UsbDeviceList::Create()
 
 void UsbDeviceList::DestroySingleton()
 {
-	delete mSingleton;
+	// Clear the singleton first so that devices closed during
+	// destruction don't try to post events to the list.
+	UsbDeviceList* list = mSingleton;
 	mSingleton = NULL;
+	delete list;
 }
 
 BOOL UsbDeviceList::ParseFilterString(INTERFACE_FILTER& filter, LPCWSTR str) 
@@ -300,10 +304,10 @@ void UsbDeviceList::LogFilter(LPCWSTR message, LPCINTERFACE_FILTER filter)
 	LogFilterFlag(TEXT("NO_ATTACH"), filter->noAttach);
 }
 
-void UsbDeviceList::AddInterfaceFilter(LPCWSTR name, LPCWSTR value)
+void UsbDeviceList::AddInterfaceFilter(PFILTER_NODE& filters, LPCWSTR name, LPCWSTR value)
 {
 	// Filter name must be unique
-	PFILTER_NODE next = mInterfaceFilters;
+	PFILTER_NODE next = filters;
 	while (next) {
 		if (wcscmp(name, next->filter.name) == 0) {
 			IFACEFILTER_MSG((TEXT("USBKWrapperDrv: Ignoring duplicate interface filter %s\r\n"), name));
@@ -336,12 +340,12 @@ void UsbDeviceList::AddInterfaceFilter(LPCWSTR name, LPCWSTR value)
 	}
 
 	// Insert filter into the correct position in the list (dependent on priority)
-	if (!mInterfaceFilters || newFilter->filter.priority <= mInterfaceFilters->filter.priority) {
+	if (!filters || newFilter->filter.priority <= filters->filter.priority) {
 		// Insert at the head
-		newFilter->next = mInterfaceFilters;
-		mInterfaceFilters = newFilter;
+		newFilter->next = filters;
+		filters = newFilter;
 	} else {
-		next = mInterfaceFilters;
+		next = filters;
 		while (next) {
 			if (!next->next || newFilter->filter.priority <= next->next->filter.priority) {
 				// Insert after this element (which may be the tail)
@@ -354,44 +358,55 @@ void UsbDeviceList::AddInterfaceFilter(LPCWSTR name, LPCWSTR value)
 	}
 }
 
-void UsbDeviceList::FetchInterfaceFilters(LPCUSB_FUNCS lpUsbFuncs,
-																					LPCWSTR szUniqueDriverId)
+InterfaceFilterTable* UsbDeviceList::GetInterfaceFilters(LPCUSB_FUNCS lpUsbFuncs, LPCWSTR szUniqueDriverId)
+{
+	MutexLocker lock(mFilterMutex);
+	if (!mFilterKey) {
+		HKEY key = lpUsbFuncs->lpOpenClientRegistyKey(szUniqueDriverId);
+		if (!key) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::GetInterfaceFilters() - Failed to open client registry key\r\n")));
+			return NULL;
+		}
+		InterfaceFilterTable* table = ReadInterfaceFilters(key);
+		if (!table) {
+			// Try again on the next attach
+			RegCloseKey(key);
+			return NULL;
+		}
+		mFilterKey = key;
+		mFilterTable = table;
+		StartFilterWatch();
+	}
+	mFilterTable->IncRef();
+	return mFilterTable;
+}
+
+InterfaceFilterTable* UsbDeviceList::ReadInterfaceFilters(HKEY key)
 {
-	HKEY key;
 	LONG result;
 	DWORD numValues = 0, maxNameLen = 0, maxValueLen = 0;
 	DWORD valueType;
 	PWCHAR nameBuf;
 	PBYTE valueBuf;
-
-	// We do not support dynamic updating of the filter list
-	if (mInterfaceFilters) {
-		return;
-	}
-	
-	key = lpUsbFuncs->lpOpenClientRegistyKey(szUniqueDriverId);
-	if (!key) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::FetchInterfaceFilters() - Failed to open client registry key\r\n")));
-		return;
-	}
+	PFILTER_NODE filters = NULL;
 
 	result = RegQueryInfoKey(key, NULL, NULL, NULL, NULL, NULL, NULL, 
 		&numValues, &maxNameLen, &maxValueLen, NULL, NULL);
 	if (result != ERROR_SUCCESS) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::FetchInterfaceFilters() - Failed to query key info: error %i\r\n"), result));
-		RegCloseKey(key);
-		return;
+		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::ReadInterfaceFilters() - Failed to query key info: error %i\r\n"), result));
+		SetLastError(result);
+		return NULL;
 	}
 
 	nameBuf = new (std::nothrow) WCHAR[maxNameLen+1];
 	valueBuf = new (std::nothrow) BYTE[maxValueLen];
 
 	if (!nameBuf || !valueBuf) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::FetchInterfaceFilters() - Out of memory allocating buffers\r\n")));		
+		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::ReadInterfaceFilters() - Out of memory allocating buffers\r\n")));		
 		delete[] nameBuf;
 		delete[] valueBuf;
-		RegCloseKey(key);
-		return;
+		SetLastError(ERROR_OUTOFMEMORY);
+		return NULL;
 	}
 
 	for (DWORD index = 0; index < numValues && result == ERROR_SUCCESS; index++) {
@@ -405,69 +420,115 @@ void UsbDeviceList::FetchInterfaceFilters(LPCUSB_FUNCS lpUsbFuncs,
 			// InterfaceFilter_ prefix
 			if (nameBufSize > 16 && wcsncmp(nameBuf, TEXT("InterfaceFilter_"), 16) == 0 && 
 				valueType == REG_SZ) {
-				AddInterfaceFilter(&nameBuf[16], (LPCWSTR) valueBuf);
+				AddInterfaceFilter(filters, &nameBuf[16], (LPCWSTR) valueBuf);
 			}
 		}
 	}
 
+	delete[] nameBuf;
+	delete[] valueBuf;
+
+	InterfaceFilterTable* table = new (std::nothrow) InterfaceFilterTable(filters);
+	if (!table) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::ReadInterfaceFilters() - Out of memory allocating filter table\r\n")));
+		InterfaceFilterTable::DestroyFilters(filters);
+		SetLastError(ERROR_OUTOFMEMORY);
+		return NULL;
+	}
+	table->Init();
+
 	// Log out the interface filters we have, in priority order
-	PFILTER_NODE next = mInterfaceFilters;
+	PFILTER_NODE next = table->Filters();
 	while(next) {
 		LogFilter(TEXT("USBKWrapperDrv: Added interface filter"), &next->filter);
 		next = next->next;
 	}
+	return table;
+}
 
-	delete[] nameBuf;
-	delete[] valueBuf;
-	RegCloseKey(key);
+BOOL UsbDeviceList::ReloadInterfaceFilters(LPDWORD lpdwCount)
+{
+	MutexLocker reloadLock(mReloadMutex);
+	HKEY key;
+	{
+		MutexLocker lock(mFilterMutex);
+		key = mFilterKey;
+	}
+	if (!key) {
+		WARN_MSG((TEXT("USBKWrapperDrv: No device attached yet, not reloading interface filters\r\n")));
+		SetLastError(ERROR_NOT_READY);
+		return FALSE;
+	}
+
+	// Read outside mFilterMutex so that attaching devices aren't held up
+	InterfaceFilterTable* table = ReadInterfaceFilters(key);
+	if (!table)
+		return FALSE;
+	DWORD count = table->Count();
+
+	InterfaceFilterTable* old;
+	{
+		MutexLocker lock(mFilterMutex);
+		old = mFilterTable;
+		mFilterTable = table;
+	}
+	// Freed once any attaches using it have finished
+	old->DecRef();
+
+	IFACEFILTER_MSG((TEXT("USBKWrapperDrv: Reloaded %d interface filters\r\n"), count));
+	if (lpdwCount)
+		*lpdwCount = count;
+	return TRUE;
 }
 
-void UsbDeviceList::DestroyInterfaceFilters()
+void UsbDeviceList::StartFilterWatch()
 {
-	PFILTER_NODE next = mInterfaceFilters;
-	while (next) {
-		PFILTER_NODE del = next;
-		next = del->next;
-		delete[] del->filter.name;
-		delete del;
+	mFilterChange = CeFindFirstRegChange(mFilterKey, FALSE,
+		REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET);
+	if (mFilterChange == INVALID_HANDLE_VALUE) {
+		WARN_MSG((TEXT("USBKWrapperDrv: Unable to watch for interface filter changes: error %d\r\n"),
+			GetLastError()));
+		mFilterChange = NULL;
+		return;
+	}
+	mFilterWatchThread = CreateThread(NULL, 0, FilterWatchThreadProc, this, 0, NULL);
+	if (mFilterWatchThread == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::StartFilterWatch() - failed to create thread\r\n")));
+		CeFindCloseRegChange(mFilterChange);
+		mFilterChange = NULL;
 	}
-	mInterfaceFilters = NULL;
 }
 
-BOOL UsbDeviceList::MatchFilterField(BOOL doComparison, DWORD value, LPCINTERFACE_FILTER_FIELD field)
+void UsbDeviceList::StopFilterWatch()
 {
-	if (!doComparison) {
-		return FALSE;
-	} else if (field->value == USB_NO_INFO) {
-		return TRUE;
-	} else if (field->match) {
-		return (field->value == value);
-	} else {
-		return (field->value != value);
+	if (mFilterWatchThread) {
+		SetEvent(mFilterWatchStop);
+		WaitForSingleObject(mFilterWatchThread, INFINITE);
+		CloseHandle(mFilterWatchThread);
+		mFilterWatchThread = NULL;
+	}
+	if (mFilterChange) {
+		CeFindCloseRegChange(mFilterChange);
+		mFilterChange = NULL;
 	}
 }
 
-BOOL UsbDeviceList::FindFilterForInterface(LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface, LPINTERFACE_FILTER* filter)
+DWORD WINAPI UsbDeviceList::FilterWatchThreadProc(LPVOID lpParameter)
 {
-	// Filter list is maintained in priority order
-	PFILTER_NODE next = mInterfaceFilters;
-	while (next) {
-		BOOL match = MatchFilterField(true, lpInterface->Descriptor.bInterfaceClass, &next->filter.bInterfaceClass);
-		match &= MatchFilterField(match, lpInterface->Descriptor.bInterfaceSubClass, &next->filter.bInterfaceSubClass);
-		match &= MatchFilterField(match, lpInterface->Descriptor.bInterfaceProtocol, &next->filter.bInterfaceProtocol);
-		match &= MatchFilterField(match, lpDevice->Descriptor.idVendor, &next->filter.idVendor);
-		match &= MatchFilterField(match, lpDevice->Descriptor.idProduct, &next->filter.idProduct);
-
-		if (match) {
-			(*filter) = &next->filter;
-			return TRUE;
+	UsbDeviceList* list = reinterpret_cast<UsbDeviceList*>(lpParameter);
+	HANDLE handles[] = { list->mFilterWatchStop, list->mFilterChange };
+	for (;;) {
+		DWORD ret = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+		if (ret != WAIT_OBJECT_0 + 1)
+			break;
+		list->ReloadInterfaceFilters(NULL);
+		if (!CeFindNextRegChange(list->mFilterChange)) {
+			ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::FilterWatchThreadProc() - failed to wait for next change: %d\r\n"),
+				GetLastError()));
+			break;
 		}
-
-		next = next->next;
 	}
-
-	// No match
-	return FALSE;
+	return 0;
 }
 
 BOOL UsbDeviceList::AttachDevice(
@@ -494,15 +555,17 @@ BOOL UsbDeviceList::AttachDevice(
 
 	LPCUSB_DEVICE device = lpUsbFuncs->lpGetDeviceInfo(hDevice);
 
-	// Retrieve interface filter list from registry if not already done so
-	FetchInterfaceFilters(lpUsbFuncs, szUniqueDriverId);
+	// Retrieve interface filter list from registry if not already done so.
+	// The reference keeps the filters alive while mMutex is yielded below,
+	// even if they are reloaded in the meantime.
+	FilterTablePtr filterTable(GetInterfaceFilters(lpUsbFuncs, szUniqueDriverId));
 
 	// If we're attaching for an interface only, then refuse if the interface is
 	// in our filter list. Else, if we're attaching for a device only then refuse if
 	// we are already attached (we may be trying to find other drivers).
 	if (lpInterface) {
-		PINTERFACE_FILTER filter;
-		if (FindFilterForInterface(device, lpInterface, &filter)) {
+		PINTERFACE_FILTER filter = filterTable.Valid() ? filterTable->Find(device, lpInterface) : NULL;
+		if (filter) {
 			IFACEFILTER_MSG((TEXT("USBKWrapperDrv: Interface %i matches filter %s, not attaching\r\n"), 
 				lpInterface->Descriptor.bInterfaceNumber, filter->name));
 			(*fAcceptControl) = FALSE;
@@ -526,7 +589,7 @@ BOOL UsbDeviceList::AttachDevice(
 	// filters match, only the first shall be used.
 	BOOL filterMatches = FALSE;
 	ArrayAutoPtr<PINTERFACE_FILTER> filters;
-	if (!lpInterface && mInterfaceFilters) {
+	if (!lpInterface && filterTable.Valid() && !filterTable->Empty()) {
 		filters = new (std::nothrow) PINTERFACE_FILTER[device->lpActiveConfig->dwNumInterfaces];
 		if (!filters.Get()) {
 			ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::AttachDevice")
@@ -536,8 +599,8 @@ BOOL UsbDeviceList::AttachDevice(
 		}
 
 		for (DWORD i = 0; i < device->lpActiveConfig->dwNumInterfaces && *fAcceptControl; i++) {
-			PINTERFACE_FILTER filter;
-			if (FindFilterForInterface(device, &device->lpActiveConfig->lpInterfaces[i], &filter)) {
+			PINTERFACE_FILTER filter = filterTable->Find(device, &device->lpActiveConfig->lpInterfaces[i]);
+			if (filter) {
 				filters.Set(i, filter);
 				filterMatches = TRUE;
 
@@ -589,6 +652,7 @@ BOOL UsbDeviceList::AttachDevice(
 		*fAcceptControl = FALSE;
 		return FALSE;
 	}
+	PostDeviceEvent(UKWD_DEVICE_EVENT_ATTACHED, ptr.get(), device->Descriptor);
 
 	// Release any interfaces matching filters
 	if (filterMatches) {
@@ -650,54 +714,42 @@ BOOL UsbDeviceList::AttachDevice(
 	return TRUE;
 }
 
-UsbDevice* UsbDeviceList::GetDevice(UKWD_USB_DEVICE identifier)
-{
-	MutexLocker lock(mMutex);
-	PtrArray<UsbDevice>::iterator it
-		= mDevices.find(static_cast<UsbDevice*>(identifier));
-	if (it == mDevices.end()) {
-	    WARN_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::GetDevice")
-			TEXT(" - failed to find device for identifier 0x%08x\r\n"), identifier));
-		return NULL;
-	} else {
-		(*it)->IncRef();
-	}
-	return *it;
-}
-
 UsbDevice* UsbDeviceList::GetDevice(UsbDevice* device)
 {
-	MutexLocker lock(mMutex);
+	// The caller already holds a reference, so the count can't be zero
 	device->IncRef();
 	return device;
 }
 
 void UsbDeviceList::PutDevice(UsbDevice* device)
 {
-	MutexLocker lock(mMutex);
-	if (device) {
-		DWORD count = device->DecRef();
-		if (count <= 0) {
-			mBusAllocator.Free(
-				device->Bus(),
-				device->Address(),
-				device->SessionId());
-			mDevices.erase(device);
-			delete device;
-		}
+	// Once the count reaches zero it can't be increased again, so only
+	// the thread releasing the last reference needs to take mMutex.
+	if (device && device->DecRef() == 0) {
+		MutexLocker lock(mMutex);
+		mBusAllocator.Free(
+			device->Bus(),
+			device->Address(),
+			device->SessionId());
+		mDevices.erase(device);
+		delete device;
 	}
 }
 
 
-DWORD UsbDeviceList::GetAvailableDevices(UsbDevice** lpDevices, DWORD Size)
+DWORD UsbDeviceList::GetAvailableDevices(UsbDevice** lpDevices, DWORD Size, LPDWORD lpdwGeneration)
 {
 	MutexLocker lock(mMutex);
+	// Events are posted with mMutex held, so the list and the
+	// generation match.
+	if (lpdwGeneration)
+		*lpdwGeneration = mGeneration;
 	DWORD count = 0;
 	PtrArray<UsbDevice>::iterator it = mDevices.begin();
 	while(it != mDevices.end() && Size > 0) {
-		if (!(*it)->Closed()) {
+		// Skip devices whose last reference is being released
+		if (!(*it)->Closed() && (*it)->TryIncRef()) {
 			lpDevices[count] = *it;
-			(*it)->IncRef();
 			--Size;
 			++count;
 		}
@@ -706,9 +758,59 @@ DWORD UsbDeviceList::GetAvailableDevices(UsbDevice** lpDevices, DWORD Size)
 	return count;
 }
 
+BOOL UsbDeviceList::AddEventQueue(DeviceEventQueue* queue)
+{
+	MutexLocker lock(mMutex);
+	if (!mEventQueues.insert(queue)) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::AddEventQueue")
+			TEXT(" - failed to store event queue 0x%08x\r\n"), queue));
+		return FALSE;
+	}
+	queue->SetGeneration(mGeneration);
+	return TRUE;
+}
+
+void UsbDeviceList::RemoveEventQueue(DeviceEventQueue* queue)
+{
+	MutexLocker lock(mMutex);
+	mEventQueues.erase(queue);
+}
+
+void UsbDeviceList::DeviceDetached(UsbDevice* device, const USB_DEVICE_DESCRIPTOR& descriptor)
+{
+	MutexLocker lock(mMutex);
+	// Devices which failed to attach were never announced
+	if (mDevices.find(device) == mDevices.end())
+		return;
+	PostDeviceEvent(UKWD_DEVICE_EVENT_DETACHED, device, descriptor);
+}
+
+void UsbDeviceList::PostDeviceEvent(DWORD type, UsbDevice* device, const USB_DEVICE_DESCRIPTOR& descriptor)
+{
+	UKWD_DEVICE_EVENT event;
+	event.dwType = type;
+	event.dwGeneration = ++mGeneration;
+	event.Info.dwCount = sizeof(event.Info);
+	event.Info.Bus = device->Bus();
+	event.Info.Address = device->Address();
+	event.Info.SessionId = device->SessionId();
+	event.Info.Descriptor = descriptor;
+	for (PtrArray<DeviceEventQueue>::iterator it = mEventQueues.begin();
+			it != mEventQueues.end(); ++it) {
+		(*it)->Push(event);
+	}
+}
+
 UsbDeviceList::UsbDeviceList()
 : mMutex(NULL),
-mInterfaceFilters(NULL)
+mGeneration(0),
+mFilterMutex(NULL),
+mReloadMutex(NULL),
+mFilterKey(NULL),
+mFilterTable(NULL),
+mFilterChange(NULL),
+mFilterWatchStop(NULL),
+mFilterWatchThread(NULL)
 {
 }
 
@@ -719,6 +821,21 @@ BOOL UsbDeviceList::Init()
 		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::Init() - failed to create mutex\r\n")));
 		return FALSE;
 	}
+	mFilterMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mFilterMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::Init() - failed to create filter mutex\r\n")));
+		return FALSE;
+	}
+	mReloadMutex = CreateMutex(NULL, FALSE, NULL);
+	if (mReloadMutex == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::Init() - failed to create reload mutex\r\n")));
+		return FALSE;
+	}
+	mFilterWatchStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (mFilterWatchStop == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!UsbDeviceList::Init() - failed to create event\r\n")));
+		return FALSE;
+	}
 	return TRUE;
 }
 
@@ -730,7 +847,17 @@ UsbDeviceList::~UsbDeviceList()
 		mMutex = NULL;
 	}
 
-	DestroyInterfaceFilters();
+	StopFilterWatch();
+	if (mFilterTable)
+		mFilterTable->DecRef();
+	if (mFilterKey)
+		RegCloseKey(mFilterKey);
+	if (mFilterWatchStop)
+		CloseHandle(mFilterWatchStop);
+	if (mReloadMutex)
+		CloseHandle(mReloadMutex);
+	if (mFilterMutex)
+		CloseHandle(mFilterMutex);
 
 	PtrArray<UsbDevice>::const_iterator iter =
 		mDevices.begin();
@@ -25,43 +25,11 @@
 
 #include "BusAllocator.h"
 #include "ceusbkwrapper_common.h"
+#include "InterfaceFilterTable.h"
 
 // Forward declarations
 class UsbDevice;
-
-// Interface filter structure
-typedef struct {
-	BOOL match;   // If true, value must match, else value must not match
-	DWORD value;  // A value or USB_NO_INFO if this field should match-all
-} INTERFACE_FILTER_FIELD, *PINTERFACE_FILTER_FIELD, *LPINTERFACE_FILTER_FIELD;
-typedef const LPINTERFACE_FILTER_FIELD LPCINTERFACE_FILTER_FIELD;
-
-typedef struct {
-	// Filter name
-	LPWSTR name;
-
-	// Filter priority (MAXDWORD means lowest / no priority)
-	DWORD priority;
-
-	// Field values
-	INTERFACE_FILTER_FIELD bInterfaceClass;
-	INTERFACE_FILTER_FIELD bInterfaceSubClass;
-	INTERFACE_FILTER_FIELD bInterfaceProtocol;
-	INTERFACE_FILTER_FIELD idVendor;
-	INTERFACE_FILTER_FIELD idProduct;
-
-	// Filter flags
-	BOOL noAttach;
-
-} INTERFACE_FILTER, *PINTERFACE_FILTER, *LPINTERFACE_FILTER;
-typedef const LPINTERFACE_FILTER LPCINTERFACE_FILTER;
-
-typedef struct FilterNode {
-	INTERFACE_FILTER filter;
-	struct FilterNode* next;
-
-} FILTER_NODE, *PFILTER_NODE, *LPFILTER_NODE;
-typedef const LPFILTER_NODE LPCFILTER_NODE;
+class DeviceEventQueue;
 
 class UsbDeviceList {
 public:
@@ -82,11 +50,29 @@ public:
 		LPCUSB_DRIVER_SETTINGS lpDriverSettings,
 		DWORD dwUnused);
 	
-	UsbDevice* GetDevice(UKWD_USB_DEVICE identifier);
+	// Devices are looked up through the per-context DeviceHandleTable,
+	// which already holds a reference, so neither of these take the list
+	// lock unless the last reference is being released.
 	UsbDevice* GetDevice(UsbDevice* device);
 	void PutDevice(UsbDevice* device);
-	// Returns all available (not closed) devices
-	DWORD GetAvailableDevices(UsbDevice** lpDevices, DWORD Size);
+	// Returns all available (not closed) devices. If lpdwGeneration isn't
+	// NULL it receives the generation the list was read at, so that device
+	// events can be applied on top of it.
+	DWORD GetAvailableDevices(UsbDevice** lpDevices, DWORD Size, LPDWORD lpdwGeneration);
+
+	// Registers a queue to receive attach and detach events for all devices
+	// from now on. The queue must be removed before it is destroyed.
+	BOOL AddEventQueue(DeviceEventQueue* queue);
+	void RemoveEventQueue(DeviceEventQueue* queue);
+	// Called by UsbDevice::Close() once the device has been closed, must not
+	// be called with the device close lock held.
+	void DeviceDetached(UsbDevice* device, const USB_DEVICE_DESCRIPTOR& descriptor);
+
+	// Reads the interface filters from the registry again and swaps them in
+	// for interfaces attached from now on. Attaches already in progress keep
+	// using the filters they started with. Fails if no device has been
+	// attached yet, as the registry key isn't known until then.
+	BOOL ReloadInterfaceFilters(LPDWORD lpdwCount);
 private:
 	UsbDeviceList();
 	~UsbDeviceList();
@@ -102,14 +88,20 @@ private:
 	void LogFilterFlag(LPCWSTR name, BOOL flag);
 	void LogFilter(LPCWSTR message, LPCINTERFACE_FILTER filter);
 
-	// This should be called by destructor or with mMutex held
-	void DestroyInterfaceFilters();
+	// Returns a reference to the current interface filters, reading them
+	// from the registry if not already done so. May return NULL.
+	InterfaceFilterTable* GetInterfaceFilters(LPCUSB_FUNCS lpUsbFuncs, LPCWSTR szUniqueDriverId);
+	InterfaceFilterTable* ReadInterfaceFilters(HKEY key);
+	void AddInterfaceFilter(PFILTER_NODE& filters, LPCWSTR name, LPCWSTR value);
+
+	// Should be called with mFilterMutex held
+	void StartFilterWatch();
+	// Should only be called by the destructor
+	void StopFilterWatch();
+	static DWORD WINAPI FilterWatchThreadProc(LPVOID lpParameter);
 
 	// These should be called with mMutex held
-	void FetchInterfaceFilters(LPCUSB_FUNCS lpUsbFuncs, LPCWSTR szUniqueDriverId);
-	BOOL MatchFilterField(BOOL doComparison, DWORD value, LPCINTERFACE_FILTER_FIELD field);
-	BOOL FindFilterForInterface(LPCUSB_DEVICE lpDevice, LPCUSB_INTERFACE lpInterface, LPINTERFACE_FILTER* index);
-	void AddInterfaceFilter(LPCWSTR name, LPCWSTR value);
+	void PostDeviceEvent(DWORD type, UsbDevice* device, const USB_DEVICE_DESCRIPTOR& descriptor);
 
 private:
 	static UsbDeviceList* mSingleton;
@@ -117,7 +109,20 @@ private:
 	HANDLE mMutex;
 	PtrArray<UsbDevice> mDevices;
 	BusAllocator mBusAllocator;
-	PFILTER_NODE mInterfaceFilters;
+	PtrArray<DeviceEventQueue> mEventQueues;
+	// Incremented for every attach or detach event
+	DWORD mGeneration;
+	// Protects mFilterKey and mFilterTable, which is only ever replaced
+	// as a whole.
+	HANDLE mFilterMutex;
+	// Serialises reloading the filters, taken before mFilterMutex
+	HANDLE mReloadMutex;
+	HKEY mFilterKey;
+	InterfaceFilterTable* mFilterTable;
+	// Registry change notification for mFilterKey and the thread waiting on it
+	HANDLE mFilterChange;
+	HANDLE mFilterWatchStop;
+	HANDLE mFilterWatchThread;
 };
 
 inline void UsbDeviceList::FillInFilterField(INTERFACE_FILTER_FIELD& field,
@@ -20,6 +20,7 @@
 
 #include "StdAfx.h"
 #include "UserBuffer.h"
+#include "RegisteredEvents.h"
 #include "drvdbg.h"
 
 #include <pkfuncs.h>
@@ -104,6 +105,15 @@ BOOL UserBuffer<T>::Flush()
 	return SUCCEEDED(r);
 }
 
+template<typename T>
+BOOL UserBuffer<T>::Shared() const
+{
+	// The asynchronous buffer is an alias of the same pages
+	// unless CeOpenCallerBuffer() had to duplicate the buffer.
+	return mlpSyncMarshalled != NULL &&
+		mlpSyncMarshalled == mlpSrcUnmarshalled;
+}
+
 template<typename T>
 DWORD UserBuffer<T>::ArgDescFromAccessFlags(DWORD dwAccessFlags)
 {
@@ -144,25 +154,15 @@ DWORD UserBuffer<LPDWORD>::ArgDescFromAccessFlags(DWORD dwAccessFlags)
 	return ret;
 }
 
-OverlappedUserBuffer::OverlappedUserBuffer(LPOVERLAPPED lpOverlapped)
-: UserBuffer<LPOVERLAPPED>(UBA_WRITE | UBA_ASYNC, lpOverlapped, sizeof(OVERLAPPED))
-, mhEvent(INVALID_HANDLE_VALUE)
-, mCompleted(FALSE)
+HANDLE OverlappedUserBuffer::DuplicateCallerEvent(HANDLE hUserEvent)
 {
-	if (!Valid() || Ptr() == NULL)
-		return;
 	// Need to duplicate the handle into kernel space
-	mhEvent = CeDriverDuplicateCallerHandle(operator->().hEvent, 0, FALSE, DUPLICATE_SAME_ACCESS);
-	if (mhEvent == NULL) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!OverlappedUserBuffer::OverlappedUserBuffer failed to duplicate handle\r\n")));
-		mhEvent = INVALID_HANDLE_VALUE;
-		return;
+	HANDLE hEvent = CeDriverDuplicateCallerHandle(hUserEvent, 0, FALSE, DUPLICATE_SAME_ACCESS);
+	if (hEvent == NULL) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!OverlappedUserBuffer::DuplicateCallerEvent failed to duplicate handle\r\n")));
+		return INVALID_HANDLE_VALUE;
 	}
-	// Set the status as pending
-	operator->().Internal = STATUS_PENDING;
-	operator->().InternalHigh = 0;
-	// Write the changes back to userspace
-	Flush();
+	return hEvent;
 }
 
 #else /* _WIN32_WCE >= 0x600 */
@@ -235,34 +235,32 @@ BOOL UserBuffer<T>::Flush()
 	return ret;
 }
 
+template<typename T>
+BOOL UserBuffer<T>::Shared() const
+{
+	/* Asynchronous access is through a copy of the buffer */
+	return mlpSyncMarshalled != NULL && !mAsync;
+}
+
 template<typename T>
 DWORD UserBuffer<T>::ArgDescFromAccessFlags(DWORD dwAccessFlags)
 {
 	return GetCurrentPermissions();
 }
 
-OverlappedUserBuffer::OverlappedUserBuffer(LPOVERLAPPED lpOverlapped)
-: UserBuffer<LPOVERLAPPED>(UBA_WRITE | UBA_ASYNC, lpOverlapped, sizeof(OVERLAPPED))
-, mhEvent(INVALID_HANDLE_VALUE)
-, mCompleted(FALSE)
+HANDLE OverlappedUserBuffer::DuplicateCallerEvent(HANDLE hUserEvent)
 {
-	if (!Valid() || Ptr() == NULL)
-		return;
 	/* Need to duplicate the handle into kernel space */
+	HANDLE hEvent = INVALID_HANDLE_VALUE;
 	BOOL success = DuplicateHandle(
-		GetOwnerProcess(), operator->().hEvent,
-		GetCurrentProcess(), &mhEvent,
+		GetOwnerProcess(), hUserEvent,
+		GetCurrentProcess(), &hEvent,
 		0, FALSE, DUPLICATE_SAME_ACCESS);
 	if (!success) {
-		ERROR_MSG((TEXT("USBKWrapperDrv!OverlappedUserBuffer::OverlappedUserBuffer failed to duplicate handle\r\n")));
-		mhEvent = INVALID_HANDLE_VALUE;
-		return;
+		ERROR_MSG((TEXT("USBKWrapperDrv!OverlappedUserBuffer::DuplicateCallerEvent failed to duplicate handle\r\n")));
+		return INVALID_HANDLE_VALUE;
 	}
-	// Set the status as pending
-	operator->().Internal = STATUS_PENDING;
-	operator->().InternalHigh = 0;
-	// Write the changes back to userspace
-	Flush();
+	return hEvent;
 }
 
 
@@ -304,6 +302,33 @@ template class UserBuffer<LPVOID>;
 template class UserBuffer<LPDWORD>;
 template class UserBuffer<LPOVERLAPPED>;
 
+OverlappedUserBuffer::OverlappedUserBuffer(LPOVERLAPPED lpOverlapped, RegisteredEventTable* lpEvents)
+: UserBuffer<LPOVERLAPPED>(UBA_WRITE | UBA_ASYNC, lpOverlapped, sizeof(OVERLAPPED))
+, mhEvent(INVALID_HANDLE_VALUE)
+, mRegisteredEvent(NULL)
+, mCompleted(FALSE)
+{
+	if (!Valid() || Ptr() == NULL)
+		return;
+	// No event is needed if completions are reaped from the completion queue
+	HANDLE hUserEvent = operator->().hEvent;
+	if (hUserEvent != NULL) {
+		mRegisteredEvent = lpEvents ? lpEvents->GetEvent(hUserEvent) : NULL;
+		if (mRegisteredEvent) {
+			mhEvent = mRegisteredEvent->Handle();
+		} else {
+			mhEvent = DuplicateCallerEvent(hUserEvent);
+			if (mhEvent == INVALID_HANDLE_VALUE)
+				return;
+		}
+	}
+	// Set the status as pending
+	operator->().Internal = STATUS_PENDING;
+	operator->().InternalHigh = 0;
+	// Write the changes back to userspace
+	Flush();
+}
+
 OverlappedUserBuffer::~OverlappedUserBuffer()
 {
 	if (!Completed() && Valid()) {
@@ -331,10 +356,11 @@ void OverlappedUserBuffer::Complete(DWORD dwStatus, DWORD dwBytesTransferred)
 	operator->().InternalHigh = dwBytesTransferred;
 	// Need to flush the status before signalling the event
 	Flush();
-	SetEvent(mhEvent);
-	// No need for the handle so close it
-	CloseHandle(mhEvent);
-	mhEvent = INVALID_HANDLE_VALUE;
+	if (mhEvent != INVALID_HANDLE_VALUE) {
+		SetEvent(mhEvent);
+		// No need for the handle any longer
+		ReleaseEvent();
+	}
 	mCompleted = TRUE;
 }
 
@@ -342,7 +368,19 @@ void OverlappedUserBuffer::Abort()
 {
 	if (Completed() || !Valid() || Ptr() == NULL)
 		return;
-	CloseHandle(mhEvent);
-	mhEvent = INVALID_HANDLE_VALUE;
+	if (mhEvent != INVALID_HANDLE_VALUE)
+		ReleaseEvent();
 	mCompleted = TRUE;
+}
+
+void OverlappedUserBuffer::ReleaseEvent()
+{
+	if (mRegisteredEvent) {
+		// The registered event owns the handle
+		mRegisteredEvent->DecRef();
+		mRegisteredEvent = NULL;
+	} else {
+		CloseHandle(mhEvent);
+	}
+	mhEvent = INVALID_HANDLE_VALUE;
 }
\ No newline at end of file
@@ -45,6 +45,8 @@ public:
 	T Ptr();
 	BOOL Flush();
 	DWORD Size();
+	// Returns TRUE if Ptr() refers to the caller's memory rather than to a copy
+	BOOL Shared() const;
 private:
 	static DWORD ArgDescFromAccessFlags(DWORD dwAccessFlags);
 private:
@@ -58,16 +60,26 @@ private:
 	LPVOID mlpAsyncMarshalled;
 };
 
+class RegisteredEvent;
+class RegisteredEventTable;
+
 class OverlappedUserBuffer : public UserBuffer<LPOVERLAPPED> {
 public:
-	OverlappedUserBuffer(LPOVERLAPPED lpOverlapped);
+	// Events registered in lpEvents are used without being duplicated
+	OverlappedUserBuffer(LPOVERLAPPED lpOverlapped, RegisteredEventTable* lpEvents);
 	~OverlappedUserBuffer();
 	OVERLAPPED& operator->();
 	BOOL Completed() const;
 	void Complete(DWORD dwStatus, DWORD dwBytesTransferred);
 	void Abort();
+	// Duplicates an event handle from the calling process, returning
+	// INVALID_HANDLE_VALUE on failure.
+	static HANDLE DuplicateCallerEvent(HANDLE hUserEvent);
+private:
+	void ReleaseEvent();
 private:
 	HANDLE mhEvent;
+	RegisteredEvent* mRegisteredEvent;
 	BOOL mCompleted;
 
 };
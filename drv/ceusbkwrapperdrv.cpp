@@ -24,6 +24,7 @@
 #include "ceusbkwrapperdrv.h"
 #include "drvdbg.h"
 #include "UsbDeviceList.h"
+#include "InterfaceFilterIndex.h"
 #include "DeviceContext.h"
 #include "OpenContext.h"
 #include "ceusbkwrapper_common.h"
@@ -47,6 +48,28 @@ DBGPARAM dpCurSettings = {
 
 static HANDLE gDeviceHandle = INVALID_HANDLE_VALUE;
 
+// Copies a structure starting with a dwCount from the input buffer into info,
+// accepting any dwCount from dwMinSize up to dwLenIn. Fields the caller didn't
+// provide are zeroed, and the copy is used from then on so that the caller
+// can't change it while it is being validated and used. The caller's dwCount
+// is returned in lpdwCount, for structures which are followed by data.
+template <typename T>
+static BOOL CopyTransferInfo(PBYTE pBufIn, DWORD dwLenIn, DWORD dwMinSize, T& info, LPDWORD lpdwCount = NULL)
+{
+	if (pBufIn == NULL || dwLenIn < sizeof(DWORD))
+		return FALSE;
+	DWORD dwCount = *reinterpret_cast<LPDWORD>(pBufIn);
+	if (dwCount < dwMinSize || dwCount > dwLenIn)
+		return FALSE;
+	DWORD copy = dwCount < sizeof(T) ? dwCount : sizeof(T);
+	memset(&info, 0, sizeof(T));
+	memcpy(&info, pBufIn, copy);
+	info.dwCount = copy;
+	if (lpdwCount)
+		*lpdwCount = dwCount;
+	return TRUE;
+}
+
 BOOL APIENTRY DllMain( HANDLE hModule, 
                        DWORD  ReasonForCall, 
                        LPVOID lpReserved
@@ -138,7 +161,13 @@ DWORD Init(
 		ERROR_MSG((TEXT("USBKWrapperDrv!Init() failed to get UsbDeviceList\r\n")));
 		return 0;
 	}
-	return reinterpret_cast<DWORD>(new (std::nothrow) DeviceContext(deviceList));
+	DeviceContext* dev = new (std::nothrow) DeviceContext(deviceList);
+	if (!dev || !dev->Init()) {
+		ERROR_MSG((TEXT("USBKWrapperDrv!Init() failed to create device context\r\n")));
+		delete dev;
+		dev = NULL;
+	}
+	return reinterpret_cast<DWORD>(dev);
 }
 
 BOOL Deinit(
@@ -248,6 +277,49 @@ BOOL IOControl(
 			}
 			break;
 		}
+		case IOCTL_UKW_GET_DEVICES_WITH_INFO: {
+			LPUKWD_DEVICE_LIST list = reinterpret_cast<LPUKWD_DEVICE_LIST>(pBufOut);
+			if (dwLenOut < UKWD_DEVICE_LIST_SIZE(0) || list == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_GET_DEVICES_WITH_INFO, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			DWORD inCount = (dwLenOut - UKWD_DEVICE_LIST_SIZE(0)) / sizeof(UKWD_USB_DEVICE_ENTRY);
+			DWORD generation = 0;
+			DWORD outCount = file->GetDevicesWithInfo(list->Entries, inCount, &generation);
+			if (outCount != -1) {
+				list->dwGeneration = generation;
+				list->dwDevices = outCount;
+				if (pdwActualOut)
+					*pdwActualOut = UKWD_DEVICE_LIST_SIZE(outCount);
+				ret = TRUE;
+			}
+			break;
+		}
+		case IOCTL_UKW_WAIT_DEVICE_EVENTS: {
+			LPUKWD_WAIT_DEVICE_EVENTS_INFO wdei = reinterpret_cast<LPUKWD_WAIT_DEVICE_EVENTS_INFO>(pBufIn);
+			LPUKWD_DEVICE_EVENTS events = reinterpret_cast<LPUKWD_DEVICE_EVENTS>(pBufOut);
+			if (dwLenIn < sizeof(UKWD_WAIT_DEVICE_EVENTS_INFO) || wdei == NULL ||
+				wdei->dwCount < sizeof(UKWD_WAIT_DEVICE_EVENTS_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_WAIT_DEVICE_EVENTS, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			if (dwLenOut < UKWD_DEVICE_EVENTS_SIZE(1) || events == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_WAIT_DEVICE_EVENTS, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			DWORD count = (dwLenOut - FIELD_OFFSET(UKWD_DEVICE_EVENTS, Events)) / sizeof(UKWD_DEVICE_EVENT);
+			ret = file->WaitForDeviceEvents(wdei, events, count);
+			// The generation is valid even if the wait timed out
+			if (pdwActualOut)
+				*pdwActualOut = UKWD_DEVICE_EVENTS_SIZE(events->dwEvents);
+			break;
+		}
 		case IOCTL_UKW_PUT_DEVICES:	{
 			UKWD_USB_DEVICE* devs = reinterpret_cast<UKWD_USB_DEVICE*>(pBufIn);
 			if (dwLenIn % sizeof(UKWD_USB_DEVICE) != 0 || devs == NULL) {
@@ -257,7 +329,16 @@ BOOL IOControl(
 				break;
 			}
 			DWORD inCount = dwLenIn / sizeof(UKWD_USB_DEVICE);
-			ret = file->PutDevices(devs, inCount);
+			LPDWORD statuses = reinterpret_cast<LPDWORD>(pBufOut);
+			if (statuses != NULL && dwLenOut < inCount * sizeof(DWORD)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_PUT_DEVICES, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->PutDevices(devs, inCount, statuses);
+			if (pdwActualOut)
+				*pdwActualOut = statuses ? inCount * sizeof(DWORD) : 0;
 			break;
 		}
 		case IOCTL_UKW_GET_DEVICE_INFO:	{
@@ -282,38 +363,90 @@ BOOL IOControl(
 			break;
 		}
 		case IOCTL_UKW_ISSUE_CONTROL_TRANSFER: {
-			LPUKWD_CONTROL_TRANSFER_INFO cti = reinterpret_cast<LPUKWD_CONTROL_TRANSFER_INFO>(pBufIn);
-			if (dwLenIn < sizeof(LPUKWD_CONTROL_TRANSFER_INFO) ||
-				cti == NULL ||
-				cti->dwCount < sizeof(LPUKWD_CONTROL_TRANSFER_INFO)) {
+			UKWD_CONTROL_TRANSFER_INFO cti;
+			if (!CopyTransferInfo(pBufIn, dwLenIn, UKWD_CONTROL_TRANSFER_INFO_MIN_SIZE, cti)) {
 				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_ISSUE_CONTROL_TRANSFER, ...) ")
-					TEXT("passed invalid input len: %d, dwCount %d\r\n"),
-					hOpenContext, dwLenIn, (dwLenIn < sizeof(cti->dwCount) && cti) ? 0 : cti->dwCount));
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
 				SetLastError(ERROR_INVALID_PARAMETER);
 				break;
 			}
-			ret = file->StartControlTransfer(cti);
+			ret = file->StartControlTransfer(&cti);
+			break;
+		}
+		case IOCTL_UKW_ISSUE_INLINE_CONTROL_TRANSFER: {
+			UKWD_INLINE_CONTROL_TRANSFER_INFO icti;
+			DWORD infoLen = 0;
+			if (!CopyTransferInfo(pBufIn, dwLenIn, sizeof(UKWD_INLINE_CONTROL_TRANSFER_INFO), icti, &infoLen) ||
+				icti.Header.wLength > UKWD_MAX_INLINE_CONTROL_DATA) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_ISSUE_INLINE_CONTROL_TRANSFER, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			DWORD dataLen = icti.Header.wLength;
+			LPVOID data = NULL;
+			if (icti.dwFlags & USB_IN_TRANSFER) {
+				if (dataLen > 0 && (dwLenOut < dataLen || pBufOut == NULL)) {
+					ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_ISSUE_INLINE_CONTROL_TRANSFER, ...) ")
+						TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+					SetLastError(ERROR_INVALID_PARAMETER);
+					break;
+				}
+				data = dataLen > 0 ? pBufOut : NULL;
+			} else {
+				if (dwLenIn < infoLen + dataLen) {
+					ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_ISSUE_INLINE_CONTROL_TRANSFER, ...) ")
+						TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+					SetLastError(ERROR_INVALID_PARAMETER);
+					break;
+				}
+				// The data follows the structure in the input buffer
+				data = dataLen > 0 ? pBufIn + infoLen : NULL;
+			}
+			DWORD transferred = 0;
+			ret = file->IssueInlineControlTransfer(&icti, data, &transferred);
+			if (pdwActualOut)
+				*pdwActualOut = transferred;
 			break;
 		}
 		case IOCTL_UKW_ISSUE_BULK_TRANSFER: {
-			LPUKWD_BULK_TRANSFER_INFO bti = reinterpret_cast<LPUKWD_BULK_TRANSFER_INFO>(pBufIn);
-			if (dwLenIn < sizeof(LPUKWD_BULK_TRANSFER_INFO) ||
-				bti == NULL ||
-				bti->dwCount < sizeof(LPUKWD_BULK_TRANSFER_INFO)) {
+			UKWD_BULK_TRANSFER_INFO bti;
+			if (!CopyTransferInfo(pBufIn, dwLenIn, UKWD_BULK_TRANSFER_INFO_MIN_SIZE, bti)) {
 				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_ISSUE_BULK_TRANSFER, ...) ")
-					TEXT("passed invalid input len: %d, dwCount %d\r\n"),
-					hOpenContext, dwLenIn, (dwLenIn < sizeof(bti->dwCount) && bti) ? 0 : bti->dwCount));
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
 				SetLastError(ERROR_INVALID_PARAMETER);
 				break;
 			}
-			ret = file->StartBulkTransfer(bti);
+			ret = file->StartBulkTransfer(&bti);
+			break;
+		}
+		case IOCTL_UKW_ISSUE_INTERRUPT_TRANSFER: {
+			UKWD_BULK_TRANSFER_INFO bti;
+			if (!CopyTransferInfo(pBufIn, dwLenIn, UKWD_BULK_TRANSFER_INFO_MIN_SIZE, bti)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_ISSUE_INTERRUPT_TRANSFER, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->StartInterruptTransfer(&bti);
+			break;
+		}
+		case IOCTL_UKW_ISSUE_ISOCH_TRANSFER: {
+			UKWD_ISOCH_TRANSFER_INFO iti;
+			if (!CopyTransferInfo(pBufIn, dwLenIn, UKWD_ISOCH_TRANSFER_INFO_MIN_SIZE, iti)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_ISSUE_ISOCH_TRANSFER, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->StartIsochTransfer(&iti);
 			break;
 		}
 		case IOCTL_UKW_CANCEL_TRANSFER: {
 			LPUKWD_CANCEL_TRANSFER_INFO cti = reinterpret_cast<LPUKWD_CANCEL_TRANSFER_INFO>(pBufIn);
-			if (dwLenIn < sizeof(LPUKWD_CANCEL_TRANSFER_INFO) ||
+			if (dwLenIn < sizeof(UKWD_CANCEL_TRANSFER_INFO) ||
 				cti == NULL ||
-				cti->dwCount < sizeof(LPUKWD_CANCEL_TRANSFER_INFO)) {
+				cti->dwCount < sizeof(UKWD_CANCEL_TRANSFER_INFO)) {
 				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_CANCEL_TRANSFER, ...) ")
 					TEXT("passed invalid input len: %d, dwCount %d\r\n"),
 					hOpenContext, dwLenIn, (dwLenIn < sizeof(cti->dwCount) && cti) ? 0 : cti->dwCount));
@@ -324,6 +457,30 @@ BOOL IOControl(
 			cti->dwFlags &= USB_NO_WAIT;
 			ret = file->CancelTransfer(cti);
 			break;
+		}
+		case IOCTL_UKW_CANCEL_ALL: {
+			LPUKWD_CANCEL_ALL_INFO cai = reinterpret_cast<LPUKWD_CANCEL_ALL_INFO>(pBufIn);
+			LPDWORD cancelled = reinterpret_cast<LPDWORD>(pBufOut);
+			if (dwLenIn < sizeof(UKWD_CANCEL_ALL_INFO) ||
+				cai == NULL ||
+				cai->dwCount < sizeof(UKWD_CANCEL_ALL_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_CANCEL_ALL, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			if (dwLenOut < sizeof(DWORD) || cancelled == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_CANCEL_ALL, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			// Clear any unused flags
+			cai->dwFlags &= USB_NO_WAIT;
+			ret = file->CancelAllTransfers(cai, cancelled);
+			if (pdwActualOut)
+				*pdwActualOut = ret ? sizeof(DWORD) : 0;
+			break;
 		}								
 		case IOCTL_UKW_GET_CONFIG_DESC:	{
 			LPUKWD_GET_CONFIG_DESC_INFO gcdi = reinterpret_cast<LPUKWD_GET_CONFIG_DESC_INFO>(pBufIn);
@@ -408,7 +565,7 @@ BOOL IOControl(
 		}
 		case IOCTL_UKW_CLEAR_HALT_HOST: {
 			LPUKWD_ENDPOINT_INFO info = reinterpret_cast<LPUKWD_ENDPOINT_INFO>(pBufIn);
-			if (dwLenIn < sizeof(LPUKWD_ENDPOINT_INFO) || info == NULL) {
+			if (dwLenIn < sizeof(UKWD_ENDPOINT_INFO) || info == NULL) {
 				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_CLEAR_HALT, ...) ")
 					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
 				SetLastError(ERROR_INVALID_PARAMETER);
@@ -419,7 +576,7 @@ BOOL IOControl(
 		}
 		case IOCTL_UKW_CLEAR_HALT_DEVICE: {
 			LPUKWD_ENDPOINT_INFO info = reinterpret_cast<LPUKWD_ENDPOINT_INFO>(pBufIn);
-			if (dwLenIn < sizeof(LPUKWD_ENDPOINT_INFO) || info == NULL) {
+			if (dwLenIn < sizeof(UKWD_ENDPOINT_INFO) || info == NULL) {
 				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_CLEAR_HALT, ...) ")
 					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
 				SetLastError(ERROR_INVALID_PARAMETER);
@@ -431,7 +588,7 @@ BOOL IOControl(
 		case IOCTL_UKW_IS_PIPE_HALTED: {
 			LPUKWD_ENDPOINT_INFO info = reinterpret_cast<LPUKWD_ENDPOINT_INFO>(pBufIn);
 			LPBOOL ph = reinterpret_cast<LPBOOL>(pBufOut);
-			if (dwLenIn < sizeof(LPUKWD_ENDPOINT_INFO) || info == NULL) {
+			if (dwLenIn < sizeof(UKWD_ENDPOINT_INFO) || info == NULL) {
 				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_IS_PIPE_HALTED, ...) ")
 					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
 				SetLastError(ERROR_INVALID_PARAMETER);
@@ -515,6 +672,228 @@ BOOL IOControl(
 			ret = file->DetachKernelDriverForInterface(lpInterfaceInfo);
 			break;
 		}	
+		case IOCTL_UKW_SUBMIT_BATCH: {
+			LPUKWD_SUBMIT_BATCH_INFO sbi = reinterpret_cast<LPUKWD_SUBMIT_BATCH_INFO>(pBufIn);
+			LPDWORD statuses = reinterpret_cast<LPDWORD>(pBufOut);
+			if (dwLenIn < UKWD_SUBMIT_BATCH_INFO_SIZE(0) || sbi == NULL ||
+				sbi->dwEntries > UKWD_MAX_BATCH_ENTRIES ||
+				dwLenIn < UKWD_SUBMIT_BATCH_INFO_SIZE(sbi->dwEntries) ||
+				sbi->dwCount < UKWD_SUBMIT_BATCH_INFO_SIZE(sbi->dwEntries)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_SUBMIT_BATCH, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			if (dwLenOut < sbi->dwEntries * sizeof(DWORD) || statuses == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_SUBMIT_BATCH, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->StartTransfers(sbi, statuses);
+			if (pdwActualOut)
+				*pdwActualOut = ret ? sbi->dwEntries * sizeof(DWORD) : 0;
+			break;
+		}
+		case IOCTL_UKW_ENABLE_COMPLETION_QUEUE: {
+			ret = file->EnableCompletionQueue();
+			break;
+		}
+		case IOCTL_UKW_REAP_COMPLETIONS: {
+			LPUKWD_REAP_COMPLETIONS_INFO rci = reinterpret_cast<LPUKWD_REAP_COMPLETIONS_INFO>(pBufIn);
+			LPUKWD_COMPLETION completions = reinterpret_cast<LPUKWD_COMPLETION>(pBufOut);
+			if (dwLenIn < sizeof(UKWD_REAP_COMPLETIONS_INFO) || rci == NULL ||
+				rci->dwCount < sizeof(UKWD_REAP_COMPLETIONS_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_REAP_COMPLETIONS, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			if (dwLenOut < sizeof(UKWD_COMPLETION) || completions == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_REAP_COMPLETIONS, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			DWORD reaped = 0;
+			ret = file->ReapCompletions(rci, completions, dwLenOut / sizeof(UKWD_COMPLETION), &reaped);
+			if (pdwActualOut)
+				*pdwActualOut = reaped * sizeof(UKWD_COMPLETION);
+			break;
+		}
+		case IOCTL_UKW_SETUP_RINGS: {
+			LPUKWD_SETUP_RINGS_INFO sri = reinterpret_cast<LPUKWD_SETUP_RINGS_INFO>(pBufIn);
+			if (dwLenIn < sizeof(UKWD_SETUP_RINGS_INFO) || sri == NULL ||
+				sri->dwCount < sizeof(UKWD_SETUP_RINGS_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_SETUP_RINGS, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->SetupRings(sri);
+			break;
+		}
+		case IOCTL_UKW_RING_DOORBELL: {
+			LPUKWD_RING_DOORBELL_INFO rdi = reinterpret_cast<LPUKWD_RING_DOORBELL_INFO>(pBufIn);
+			LPDWORD submitted = reinterpret_cast<LPDWORD>(pBufOut);
+			if (dwLenIn < sizeof(UKWD_RING_DOORBELL_INFO) || rdi == NULL ||
+				rdi->dwCount < sizeof(UKWD_RING_DOORBELL_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_RING_DOORBELL, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			DWORD count = 0;
+			ret = file->RingDoorbell(rdi, &count);
+			if (submitted && dwLenOut >= sizeof(DWORD)) {
+				*submitted = count;
+				if (pdwActualOut)
+					*pdwActualOut = sizeof(DWORD);
+			}
+			break;
+		}
+		case IOCTL_UKW_GET_TRANSFER_POOL_STATS: {
+			LPUKWD_TRANSFER_POOL_STATS tps = reinterpret_cast<LPUKWD_TRANSFER_POOL_STATS>(pBufOut);
+			if (dwLenOut < sizeof(UKWD_TRANSFER_POOL_STATS) || tps == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_GET_TRANSFER_POOL_STATS, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			tps->dwCount = sizeof(UKWD_TRANSFER_POOL_STATS);
+			file->GetTransferPoolStats(tps);
+			if (pdwActualOut)
+				*pdwActualOut = sizeof(UKWD_TRANSFER_POOL_STATS);
+			ret = TRUE;
+			break;
+		}
+		case IOCTL_UKW_REGISTER_BUFFER: {
+			LPUKWD_REGISTER_BUFFER_INFO rbi = reinterpret_cast<LPUKWD_REGISTER_BUFFER_INFO>(pBufIn);
+			LPDWORD bufferId = reinterpret_cast<LPDWORD>(pBufOut);
+			if (dwLenIn < sizeof(UKWD_REGISTER_BUFFER_INFO) || rbi == NULL ||
+				rbi->dwCount < sizeof(UKWD_REGISTER_BUFFER_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_REGISTER_BUFFER, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			if (dwLenOut < sizeof(DWORD) || bufferId == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_REGISTER_BUFFER, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->RegisterBuffer(rbi, bufferId);
+			if (pdwActualOut)
+				*pdwActualOut = ret ? sizeof(DWORD) : 0;
+			break;
+		}
+		case IOCTL_UKW_UNREGISTER_BUFFER: {
+			if (dwLenIn < sizeof(DWORD) || pBufIn == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_UNREGISTER_BUFFER, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->UnregisterBuffer(*reinterpret_cast<LPDWORD>(pBufIn));
+			break;
+		}
+		case IOCTL_UKW_REGISTER_EVENT: // Deliberate fall through
+		case IOCTL_UKW_UNREGISTER_EVENT: {
+			if (dwLenIn < sizeof(HANDLE) || pBufIn == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_REGISTER/UNREGISTER_EVENT, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			HANDLE hEvent = *reinterpret_cast<HANDLE*>(pBufIn);
+			if (dwCode == IOCTL_UKW_REGISTER_EVENT)
+				ret = file->RegisterEvent(hEvent);
+			else
+				ret = file->UnregisterEvent(hEvent);
+			break;
+		}
+		case IOCTL_UKW_START_STREAM: {
+			LPUKWD_START_STREAM_INFO ssi = reinterpret_cast<LPUKWD_START_STREAM_INFO>(pBufIn);
+			LPDWORD streamId = reinterpret_cast<LPDWORD>(pBufOut);
+			if (dwLenIn < sizeof(UKWD_START_STREAM_INFO) || ssi == NULL ||
+				ssi->dwCount < sizeof(UKWD_START_STREAM_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_START_STREAM, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			if (dwLenOut < sizeof(DWORD) || streamId == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_START_STREAM, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->StartStream(ssi, streamId);
+			if (pdwActualOut)
+				*pdwActualOut = ret ? sizeof(DWORD) : 0;
+			break;
+		}
+		case IOCTL_UKW_STOP_STREAM: {
+			if (dwLenIn < sizeof(DWORD) || pBufIn == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_STOP_STREAM, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->StopStream(*reinterpret_cast<LPDWORD>(pBufIn));
+			break;
+		}
+		case IOCTL_UKW_STREAM_READ: // Deliberate fall through
+		case IOCTL_UKW_STREAM_WRITE: {
+			LPUKWD_STREAM_IO_INFO sii = reinterpret_cast<LPUKWD_STREAM_IO_INFO>(pBufIn);
+			LPDWORD transferred = reinterpret_cast<LPDWORD>(pBufOut);
+			if (dwLenIn < sizeof(UKWD_STREAM_IO_INFO) || sii == NULL ||
+				sii->dwCount < sizeof(UKWD_STREAM_IO_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_STREAM_READ/WRITE, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			if (dwLenOut < sizeof(DWORD) || transferred == NULL) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_STREAM_READ/WRITE, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			if (dwCode == IOCTL_UKW_STREAM_READ)
+				ret = file->StreamRead(sii, transferred);
+			else
+				ret = file->StreamWrite(sii, transferred);
+			if (pdwActualOut)
+				*pdwActualOut = ret ? sizeof(DWORD) : 0;
+			break;
+		}
+		case IOCTL_UKW_SET_TRANSFER_SPLIT: {
+			LPUKWD_TRANSFER_SPLIT_INFO tsi = reinterpret_cast<LPUKWD_TRANSFER_SPLIT_INFO>(pBufIn);
+			if (dwLenIn < sizeof(UKWD_TRANSFER_SPLIT_INFO) || tsi == NULL ||
+				tsi->dwCount < sizeof(UKWD_TRANSFER_SPLIT_INFO)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_SET_TRANSFER_SPLIT, ...) ")
+					TEXT("passed invalid input len: %d\r\n"), hOpenContext, dwLenIn));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->SetTransferSplit(tsi);
+			break;
+		}
+		case IOCTL_UKW_RELOAD_INTERFACE_FILTERS: {
+			LPDWORD count = reinterpret_cast<LPDWORD>(pBufOut);
+			if (count != NULL && dwLenOut < sizeof(DWORD)) {
+				ERROR_MSG((TEXT("USBKWrapperDrv!IOControl(0x%08x, IOCTL_UKW_RELOAD_INTERFACE_FILTERS, ...) ")
+					TEXT("passed invalid output len: %d\r\n"), hOpenContext, dwLenOut));
+				SetLastError(ERROR_INVALID_PARAMETER);
+				break;
+			}
+			ret = file->ReloadInterfaceFilters(count);
+			if (ret && count && pdwActualOut)
+				*pdwActualOut = sizeof(DWORD);
+			break;
+		}
 		default: {
 			SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
 			break;
@@ -547,6 +926,8 @@ BOOL PreClose(
 	ENTRYPOINT_MSG((
 		TEXT("USBKWrapperDrv!PreClose(0x%08x)\r\n"),
 		hOpenContext));
+	OpenContext* file = reinterpret_cast<OpenContext*>(hOpenContext);
+	file->PreClose();
 	return TRUE;
 }
 
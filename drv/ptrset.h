@@ -44,6 +44,7 @@ public:
 	BOOL insert(T* value);
 	void erase(T* value);
 	BOOL empty() const;
+	DWORD size() const;
 	iterator begin();
 	iterator end();
 	iterator find(T* value);
@@ -159,6 +160,12 @@ BOOL PtrArray<T>::empty() const
 	return mValuesCount == 0;
 }
 
+template <typename T>
+DWORD PtrArray<T>::size() const
+{
+	return mValuesCount;
+}
+
 template <typename T>
 typename PtrArray<T>::iterator PtrArray<T>::begin()
 {
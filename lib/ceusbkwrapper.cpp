@@ -27,6 +27,9 @@
 
 #include <memory>
 
+// Number of interrupt transfers kept queued by UkwSubscribeInterrupt()
+#define INTERRUPT_SUBSCRIPTION_TRANSFERS 2
+
 DBGPARAM dpCurSettings = {
 	TEXT("ceusbkwrapper"), {
 		TEXT("Errors"),TEXT("Warnings"),
@@ -76,26 +79,34 @@ BOOL APIENTRY DllMain( HANDLE hModule,
 
 // Driver helper functions
 
-static BOOL IoCtlReadUsbDeviceInfo(HANDLE hDriver, UKW_DEVICE_PRIV& dev)
-{
-	DWORD written = 0;
-	BOOL ret = DeviceIoControl(
-		hDriver,
-		IOCTL_UKW_GET_DEVICE_INFO,
-		&dev.dev, sizeof(dev.dev),
-		&dev.info, sizeof(dev.info), &written,
-		NULL);
-	dev.info.dwCount = written;
-	return ret;
-}
-
-static BOOL IoCtlReleaseDeviceIdentifiers(HANDLE hDriver, UKWD_USB_DEVICE* identifiers, DWORD Size)
+// If lpStatus isn't NULL it receives an error code for each identifier
+static BOOL IoCtlReleaseDeviceIdentifiers(HANDLE hDriver, UKWD_USB_DEVICE* identifiers, DWORD Size, LPDWORD lpStatus)
 {
 	return DeviceIoControl(
 		hDriver,
 		IOCTL_UKW_PUT_DEVICES, 
 		identifiers, Size * sizeof(UKWD_USB_DEVICE),
-		NULL, 0, NULL, NULL);
+		lpStatus, lpStatus ? Size * sizeof(DWORD) : 0, NULL, NULL);
+}
+
+static void CopyDeviceDescriptor(LPUKW_DEVICE_DESCRIPTOR lpDest, const USB_DEVICE_DESCRIPTOR& Src)
+{
+	// Could probably get away with a memcpy to copy between the kernel structure
+	// and the external API structure, but copying one at a time is safer.
+	lpDest->bLength = Src.bLength;
+	lpDest->bDescriptorType = Src.bDescriptorType;
+	lpDest->bcdUSB = Src.bcdUSB;
+	lpDest->bDeviceClass = Src.bDeviceClass;
+	lpDest->bDeviceSubClass = Src.bDeviceSubClass;
+	lpDest->bDeviceProtocol = Src.bDeviceProtocol;
+	lpDest->bMaxPacketSize0 = Src.bMaxPacketSize0;
+	lpDest->idVendor = Src.idVendor;
+	lpDest->idProduct = Src.idProduct;
+	lpDest->bcdDevice = Src.bcdDevice;
+	lpDest->iManufacturer = Src.iManufacturer;
+	lpDest->iProduct = Src.iProduct;
+	lpDest->iSerialNumber = Src.iSerialNumber;
+	lpDest->bNumConfigurations = Src.bNumConfigurations;
 }
 
 static DWORD ConvertUserToKernelFlags(DWORD dwFlags)
@@ -110,9 +121,110 @@ static DWORD ConvertUserToKernelFlags(DWORD dwFlags)
 	MAP_FLAG(UKW_TF_SEND_TO_INTERFACE, USB_SEND_TO_INTERFACE);
 	MAP_FLAG(UKW_TF_SEND_TO_ENDPOINT, USB_SEND_TO_ENDPOINT);
 	MAP_FLAG(UKW_TF_DONT_BLOCK_FOR_MEM, USB_DONT_BLOCK_FOR_MEM);
+	MAP_FLAG(UKW_TF_START_ISOCH_ASAP, USB_START_ISOCH_ASAP);
+	return ret;
+}
+
+static void FillControlTransferInfo(
+	UKWD_CONTROL_TRANSFER_INFO& info,
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	LPUKW_CONTROL_HEADER lpHeader,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped)
+{
+	info.dwCount = sizeof(info);
+	info.lpDevice = lpDevice->dev;
+	info.dwFlags = ConvertUserToKernelFlags(dwFlags);
+	info.Header.bmRequestType = lpHeader->bmRequestType;
+	info.Header.bRequest = lpHeader->bRequest;
+	info.Header.wIndex = lpHeader->wIndex;
+	info.Header.wLength = lpHeader->wLength;
+	info.Header.wValue = lpHeader->wValue;
+	info.lpDataBuffer = lpDataBuffer;
+	info.dwDataBufferSize = dwDataBufferSize;
+	info.pBytesTransferred = pBytesTransferred;
+	info.lpOverlapped = lpOverlapped;
+	info.dwBufferId = 0;
+	info.dwBufferOffset = 0;
+	info.dwTimeoutMs = 0;
+}
+
+// Issues a synchronous control transfer of at most UKWD_MAX_INLINE_CONTROL_DATA
+// bytes, carrying the data in the IOCTL buffers rather than having the
+// driver map lpDataBuffer.
+static BOOL IssueInlineControlTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	LPUKW_CONTROL_HEADER lpHeader,
+	LPVOID lpDataBuffer,
+	LPDWORD pBytesTransferred)
+{
+	struct {
+		UKWD_INLINE_CONTROL_TRANSFER_INFO info;
+		BYTE data[UKWD_MAX_INLINE_CONTROL_DATA];
+	} request;
+	request.info.dwCount = sizeof(request.info);
+	request.info.lpDevice = lpDevice->dev;
+	request.info.dwFlags = ConvertUserToKernelFlags(dwFlags);
+	request.info.Header.bmRequestType = lpHeader->bmRequestType;
+	request.info.Header.bRequest = lpHeader->bRequest;
+	request.info.Header.wIndex = lpHeader->wIndex;
+	request.info.Header.wLength = lpHeader->wLength;
+	request.info.Header.wValue = lpHeader->wValue;
+
+	DWORD dataLen = lpHeader->wLength;
+	DWORD transferred = 0;
+	BOOL ret;
+	if (request.info.dwFlags & USB_IN_TRANSFER) {
+		ret = DeviceIoControl(
+			lpDevice->hDriver,
+			IOCTL_UKW_ISSUE_INLINE_CONTROL_TRANSFER,
+			&request.info, sizeof(request.info),
+			lpDataBuffer, dataLen,
+			&transferred, NULL);
+	} else {
+		if (dataLen > 0)
+			memcpy(request.data, lpDataBuffer, dataLen);
+		ret = DeviceIoControl(
+			lpDevice->hDriver,
+			IOCTL_UKW_ISSUE_INLINE_CONTROL_TRANSFER,
+			&request, sizeof(request.info) + dataLen,
+			NULL, 0,
+			&transferred, NULL);
+	}
+	if (pBytesTransferred)
+		*pBytesTransferred = transferred;
 	return ret;
 }
 
+static void FillBulkTransferInfo(
+	UKWD_BULK_TRANSFER_INFO& info,
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped)
+{
+	info.dwCount = sizeof(info);
+	info.lpDevice = lpDevice->dev;
+	info.Endpoint = Endpoint;
+	info.dwFlags = ConvertUserToKernelFlags(dwFlags);
+	info.lpDataBuffer = lpDataBuffer;
+	info.dwDataBufferSize = dwDataBufferSize;
+	info.pBytesTransferred = pBytesTransferred;
+	info.lpOverlapped = lpOverlapped;
+	info.dwBufferId = 0;
+	info.dwBufferOffset = 0;
+	info.lpSegments = NULL;
+	info.dwSegments = 0;
+	info.dwTimeoutMs = 0;
+}
+
 // Driver API functions
 
 ceusbkwrapper_API const GUID* UkwDriverGUID()
@@ -176,38 +288,56 @@ ceusbkwrapper_API BOOL UkwGetDeviceList(
 	ENTRYPOINT_MSG((
 		TEXT("USBKWrapper!UkwGetDeviceList(0x%08x, ...)\r\n"),
 		hDriver));
+	return UkwGetDeviceListWithGeneration(hDriver, lpList, Size, lpActualSize, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwGetDeviceListWithGeneration(
+	HANDLE hDriver,
+	LPUKW_DEVICE lpList,
+	DWORD Size,
+	LPDWORD lpActualSize,
+	LPDWORD lpdwGeneration)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwGetDeviceListWithGeneration(0x%08x, ...)\r\n"),
+		hDriver));
 
 	BOOL ret = TRUE;
 	if (lpActualSize)
 		*lpActualSize = 0;
 	if (!lpList)
 		return FALSE;
-	// Allocate a temporary array for the IOCTL to place its data in.
-	UKWD_USB_DEVICE* identifiers = new (std::nothrow) UKWD_USB_DEVICE[Size];
-	if (!identifiers) {
-		ERROR_MSG((TEXT("USBKWrapper!UkwGetDeviceList() failed to allocate identifier list\r\n")));
+	// Allocate a temporary buffer for the IOCTL to place its data in.
+	DWORD bufferSize = UKWD_DEVICE_LIST_SIZE(Size);
+	LPUKWD_DEVICE_LIST list = reinterpret_cast<LPUKWD_DEVICE_LIST>(
+		new (std::nothrow) BYTE[bufferSize]);
+	if (!list) {
+		ERROR_MSG((TEXT("USBKWrapper!UkwGetDeviceList() failed to allocate device entry list\r\n")));
 		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
 		return FALSE;
 	}
-	// Perform the actual read from the driver
+	LPUKWD_USB_DEVICE_ENTRY entries = list->Entries;
+	// Read the identifiers and information of all devices, and the
+	// generation they were read at, in one call
 	DWORD bytesWritten = 0;
 	ret = DeviceIoControl(hDriver,
-		IOCTL_UKW_GET_DEVICES,
+		IOCTL_UKW_GET_DEVICES_WITH_INFO,
 		NULL, 0,
-		identifiers, Size * sizeof(UKWD_USB_DEVICE),
+		list, bufferSize,
 		&bytesWritten, NULL);
 	if (!ret) {
-		delete[] identifiers;
+		delete[] reinterpret_cast<BYTE*>(list);
 		return ret;
 	}
 	// Validate the returned values
-	DWORD deviceCount = bytesWritten / sizeof(UKWD_USB_DEVICE);
-	if (bytesWritten % sizeof(UKWD_USB_DEVICE) != 0 ||
-		deviceCount > Size) {
+	if (bytesWritten < UKWD_DEVICE_LIST_SIZE(0) ||
+		list->dwDevices > Size ||
+		bytesWritten != UKWD_DEVICE_LIST_SIZE(list->dwDevices)) {
 		ERROR_MSG((TEXT("USBKWrapper!UkwGetDeviceList() received bad list size: %d\r\n"), bytesWritten));
-		delete[] identifiers;
+		delete[] reinterpret_cast<BYTE*>(list);
 		return ret;
 	}
+	DWORD deviceCount = list->dwDevices;
 	// Set all the list entries to NULL to make cleanup easier
 	memset(lpList, 0, Size * sizeof(LPUKW_DEVICE));
 
@@ -219,24 +349,32 @@ ceusbkwrapper_API BOOL UkwGetDeviceList(
 			break;
 		}
 		lpList[i]->hDriver = hDriver;
-		lpList[i]->dev = identifiers[i];
-		if (!IoCtlReadUsbDeviceInfo(hDriver, *lpList[i])) {
-			ret = FALSE;
-			break;
-		}
+		lpList[i]->dev = entries[i].lpDevice;
+		lpList[i]->info = entries[i].Info;
 	}
 	
 	if (!ret) {
 		// Clear up any allocated but unused UKW_DEVICE_PRIV
 		for(DWORD i = 0; i < Size; ++i) {
-			if (lpList[i])
+			if (lpList[i]) {
 				delete lpList[i];
+				lpList[i] = NULL;
+			}
 		}
-		IoCtlReleaseDeviceIdentifiers(hDriver, identifiers, deviceCount);
+		// Release the identifiers in one call. They are packed into the
+		// start of the entry array, as allocating has already failed once.
+		C_ASSERT(sizeof(UKWD_USB_DEVICE) <= sizeof(UKWD_USB_DEVICE_ENTRY));
+		UKWD_USB_DEVICE* identifiers = reinterpret_cast<UKWD_USB_DEVICE*>(entries);
+		for(DWORD i = 0; i < deviceCount; ++i)
+			identifiers[i] = entries[i].lpDevice;
+		if (deviceCount > 0)
+			IoCtlReleaseDeviceIdentifiers(hDriver, identifiers, deviceCount, NULL);
 	}
 	if (lpActualSize && ret)
 		*lpActualSize = deviceCount;
-	delete[] identifiers;
+	if (lpdwGeneration && ret)
+		*lpdwGeneration = list->dwGeneration;
+	delete[] reinterpret_cast<BYTE*>(list);
 	return ret;
 }
 
@@ -248,16 +386,129 @@ ceusbkwrapper_API void UkwReleaseDeviceList(
 	ENTRYPOINT_MSG((
 		TEXT("USBKWrapper!UkwReleaseDeviceList(0x%08x, ...)\r\n"),
 		hDriver));
-	// Release them one at a time. Could try to allocate an array
-	// and ask for one big deallocation, but that'd complicate this
-	// function by a large amount.
+	// Gather the identifiers so that they can be released in one call
+	UKWD_USB_DEVICE* identifiers = new (std::nothrow) UKWD_USB_DEVICE[Size];
+	LPDWORD statuses = new (std::nothrow) DWORD[Size];
+	if (!identifiers || !statuses) {
+		WARN_MSG((TEXT("USBKWrapper!UkwReleaseDeviceList() failed to allocate identifier list, ")
+			TEXT("releasing devices one at a time\r\n")));
+		delete[] identifiers;
+		delete[] statuses;
+		for(DWORD i = 0; i < Size; ++i) {
+			if (!lpList[i])
+				continue;
+			IoCtlReleaseDeviceIdentifiers(hDriver, &lpList[i]->dev, 1, NULL);
+			delete lpList[i];
+			lpList[i] = NULL;
+		}
+		return;
+	}
+	DWORD count = 0;
 	for(DWORD i = 0; i < Size; ++i) {
 		if (!lpList[i])
 			continue;
-		IoCtlReleaseDeviceIdentifiers(hDriver, &lpList[i]->dev, 1);
+		// The driver doesn't fill the statuses in if the call fails early
+		statuses[count] = ERROR_SUCCESS;
+		identifiers[count++] = lpList[i]->dev;
 		delete lpList[i];
 		lpList[i] = NULL;
 	}
+	if (count > 0 &&
+		!IoCtlReleaseDeviceIdentifiers(hDriver, identifiers, count, statuses)) {
+		// The driver still releases all the valid identifiers
+		for(DWORD i = 0; i < count; ++i) {
+			if (statuses[i] != ERROR_SUCCESS) {
+				WARN_MSG((TEXT("USBKWrapper!UkwReleaseDeviceList() failed to release device 0x%08x: %d\r\n"),
+					identifiers[i], statuses[i]));
+			}
+		}
+	}
+	delete[] identifiers;
+	delete[] statuses;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwWaitForDeviceEvents(
+	HANDLE hDriver,
+	LPUKW_DEVICE_EVENT lpEvents,
+	DWORD dwCount,
+	LPDWORD lpActualCount,
+	LPDWORD lpdwGeneration,
+	LPBOOL lpOverflowed,
+	DWORD dwTimeout)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwWaitForDeviceEvents(0x%08x, 0x%08x, %d, ...)\r\n"),
+		hDriver, lpEvents, dwCount));
+
+	if (lpActualCount)
+		*lpActualCount = 0;
+	if (lpOverflowed)
+		*lpOverflowed = FALSE;
+	if (!lpEvents || dwCount == 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	DWORD eventsSize = UKWD_DEVICE_EVENTS_SIZE(dwCount);
+	LPUKWD_DEVICE_EVENTS events = reinterpret_cast<LPUKWD_DEVICE_EVENTS>(
+		new (std::nothrow) BYTE[eventsSize]);
+	if (!events) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	UKWD_WAIT_DEVICE_EVENTS_INFO info;
+	info.dwCount = sizeof(info);
+	info.dwTimeout = dwTimeout;
+	DWORD written = 0;
+	BOOL ret = DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_WAIT_DEVICE_EVENTS,
+		&info, sizeof(info),
+		events, eventsSize,
+		&written, NULL);
+	DWORD dwErr = GetLastError();
+	// The driver provides the generation even if the wait timed out
+	if ((ret || dwErr == ERROR_TIMEOUT) && lpdwGeneration)
+		*lpdwGeneration = events->dwGeneration;
+	if (ret) {
+		for (DWORD i = 0; i < events->dwEvents; ++i) {
+			const UKWD_DEVICE_EVENT& event = events->Events[i];
+			lpEvents[i].dwType = event.dwType;
+			lpEvents[i].dwGeneration = event.dwGeneration;
+			lpEvents[i].Bus = event.Info.Bus;
+			lpEvents[i].Address = event.Info.Address;
+			lpEvents[i].SessionId = event.Info.SessionId;
+			CopyDeviceDescriptor(&lpEvents[i].Descriptor, event.Info.Descriptor);
+		}
+		if (lpActualCount)
+			*lpActualCount = events->dwEvents;
+		if (lpOverflowed)
+			*lpOverflowed = (events->dwFlags & UKWD_DEVICE_EVENTS_OVERFLOW) != 0;
+	}
+	delete[] reinterpret_cast<BYTE*>(events);
+	SetLastError(dwErr);
+	return ret;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwReloadInterfaceFilters(
+	HANDLE hDriver,
+	LPDWORD lpdwCount)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwReloadInterfaceFilters(0x%08x, 0x%08x)\r\n"),
+		hDriver, lpdwCount));
+
+	DWORD count = 0;
+	DWORD written = 0;
+	BOOL ret = DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_RELOAD_INTERFACE_FILTERS,
+		NULL, 0,
+		&count, sizeof(count),
+		&written, NULL);
+	if (ret && lpdwCount)
+		*lpdwCount = count;
+	return ret;
 }
 
 ceusbkwrapper_API void UkwCloseDriver(HANDLE hDriver)
@@ -351,22 +602,7 @@ ceusbkwrapper_API BOOL UkwGetDeviceDescriptor(
 
 	if (!lpDeviceDescriptor)
 		return TRUE;
-	// Could probably get away with a memcpy to copy between the kernel structure
-	// and the external API structure, but copying one at a time is safer.
-	lpDeviceDescriptor->bLength = lpDevice->info.Descriptor.bLength;
-	lpDeviceDescriptor->bDescriptorType = lpDevice->info.Descriptor.bDescriptorType;
-	lpDeviceDescriptor->bcdUSB = lpDevice->info.Descriptor.bcdUSB;
-	lpDeviceDescriptor->bDeviceClass = lpDevice->info.Descriptor.bDeviceClass;
-	lpDeviceDescriptor->bDeviceSubClass = lpDevice->info.Descriptor.bDeviceSubClass;
-	lpDeviceDescriptor->bDeviceProtocol = lpDevice->info.Descriptor.bDeviceProtocol;
-	lpDeviceDescriptor->bMaxPacketSize0 = lpDevice->info.Descriptor.bMaxPacketSize0;
-	lpDeviceDescriptor->idVendor = lpDevice->info.Descriptor.idVendor;
-	lpDeviceDescriptor->idProduct = lpDevice->info.Descriptor.idProduct;
-	lpDeviceDescriptor->bcdDevice = lpDevice->info.Descriptor.bcdDevice;
-	lpDeviceDescriptor->iManufacturer = lpDevice->info.Descriptor.iManufacturer;
-	lpDeviceDescriptor->iProduct = lpDevice->info.Descriptor.iProduct;
-	lpDeviceDescriptor->iSerialNumber = lpDevice->info.Descriptor.iSerialNumber;
-	lpDeviceDescriptor->bNumConfigurations = lpDevice->info.Descriptor.bNumConfigurations;
+	CopyDeviceDescriptor(lpDeviceDescriptor, lpDevice->info.Descriptor);
 	return TRUE;
 }
 
@@ -545,6 +781,44 @@ ceusbkwrapper_API BOOL UkwCancelTransfer(
 		NULL, NULL, NULL, NULL);
 }
 
+ceusbkwrapper_API BOOL WINAPI UkwCancelAllTransfers(
+	UKW_DEVICE lpDevice,
+	DWORD dwScope,
+	DWORD dwInterface,
+	UCHAR Endpoint,
+	DWORD dwFlags,
+	LPDWORD lpdwCancelled
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwCancelAllTransfers(0x%08x, %d, %d, %02x, %08x)\r\n"),
+		lpDevice, dwScope, dwInterface, Endpoint, dwFlags));
+
+	// The scope is passed straight through to the driver
+	C_ASSERT(UKW_CANCEL_SCOPE_DEVICE == UKWD_CANCEL_SCOPE_DEVICE);
+	C_ASSERT(UKW_CANCEL_SCOPE_INTERFACE == UKWD_CANCEL_SCOPE_INTERFACE);
+	C_ASSERT(UKW_CANCEL_SCOPE_ENDPOINT == UKWD_CANCEL_SCOPE_ENDPOINT);
+
+	UKWD_CANCEL_ALL_INFO info;
+	info.dwCount = sizeof(info);
+	info.lpDevice = lpDevice->dev;
+	info.dwScope = dwScope;
+	info.dwInterface = dwInterface;
+	info.Endpoint = Endpoint;
+	info.dwFlags = ConvertUserToKernelFlags(dwFlags);
+
+	DWORD cancelled = 0;
+	BOOL ret = DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_CANCEL_ALL,
+		&info, sizeof(info),
+		&cancelled, sizeof(cancelled),
+		NULL, NULL);
+	if (lpdwCancelled)
+		*lpdwCancelled = ret ? cancelled : 0;
+	return ret;
+}
+
 ceusbkwrapper_API BOOL UkwIssueControlTransfer(
 	UKW_DEVICE lpDevice,
 	DWORD dwFlags,
@@ -559,19 +833,16 @@ ceusbkwrapper_API BOOL UkwIssueControlTransfer(
 		TEXT("USBKWrapper!UkwIssueControlTransfer(0x%08x, %08x, ...)\r\n"),
 		lpDevice, dwFlags));
 
+	if (!lpOverlapped && !(dwFlags & UKW_TF_NO_WAIT) &&
+		lpHeader->wLength <= UKWD_MAX_INLINE_CONTROL_DATA &&
+		lpHeader->wLength <= dwDataBufferSize) {
+		return IssueInlineControlTransfer(lpDevice, dwFlags, lpHeader,
+			lpDataBuffer, pBytesTransferred);
+	}
+
 	UKWD_CONTROL_TRANSFER_INFO info;
-	info.dwCount = sizeof(info);
-	info.lpDevice = lpDevice->dev;
-	info.dwFlags = ConvertUserToKernelFlags(dwFlags);
-	info.Header.bmRequestType = lpHeader->bmRequestType;
-	info.Header.bRequest = lpHeader->bRequest;
-	info.Header.wIndex = lpHeader->wIndex;
-	info.Header.wLength = lpHeader->wLength;
-	info.Header.wValue = lpHeader->wValue;
-	info.lpDataBuffer = lpDataBuffer;
-	info.dwDataBufferSize = dwDataBufferSize;
-	info.pBytesTransferred = pBytesTransferred;
-	info.lpOverlapped = lpOverlapped;
+	FillControlTransferInfo(info, lpDevice, dwFlags, lpHeader,
+		lpDataBuffer, dwDataBufferSize, pBytesTransferred, lpOverlapped);
 	return DeviceIoControl(
 		lpDevice->hDriver,
 		IOCTL_UKW_ISSUE_CONTROL_TRANSFER,
@@ -594,14 +865,154 @@ ceusbkwrapper_API BOOL UkwIssueBulkTransfer(
 		lpDevice, dwFlags, Endpoint));
 
 	UKWD_BULK_TRANSFER_INFO info;
+	FillBulkTransferInfo(info, lpDevice, dwFlags, Endpoint,
+		lpDataBuffer, dwDataBufferSize, pBytesTransferred, lpOverlapped);
+	return DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_ISSUE_BULK_TRANSFER,
+		&info, sizeof(info),
+		NULL, NULL, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwIssueControlTransferTimeout(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	LPUKW_CONTROL_HEADER lpHeader,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped,
+	DWORD dwTimeoutMs
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwIssueControlTransferTimeout(0x%08x, %08x, ..., %d)\r\n"),
+		lpDevice, dwFlags, dwTimeoutMs));
+
+	UKWD_CONTROL_TRANSFER_INFO info;
+	FillControlTransferInfo(info, lpDevice, dwFlags, lpHeader,
+		lpDataBuffer, dwDataBufferSize, pBytesTransferred, lpOverlapped);
+	info.dwTimeoutMs = dwTimeoutMs;
+	return DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_ISSUE_CONTROL_TRANSFER,
+		&info, sizeof(info),
+		NULL, NULL, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwIssueBulkTransferTimeout(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped,
+	DWORD dwTimeoutMs
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwIssueBulkTransferTimeout(0x%08x, %08x, %02x, ..., %d)\r\n"),
+		lpDevice, dwFlags, Endpoint, dwTimeoutMs));
+
+	UKWD_BULK_TRANSFER_INFO info;
+	FillBulkTransferInfo(info, lpDevice, dwFlags, Endpoint,
+		lpDataBuffer, dwDataBufferSize, pBytesTransferred, lpOverlapped);
+	info.dwTimeoutMs = dwTimeoutMs;
+	return DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_ISSUE_BULK_TRANSFER,
+		&info, sizeof(info),
+		NULL, NULL, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwIssueInterruptTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwIssueInterruptTransfer(0x%08x, %08x, %02x, ...)\r\n"),
+		lpDevice, dwFlags, Endpoint));
+
+	UKWD_BULK_TRANSFER_INFO info;
+	FillBulkTransferInfo(info, lpDevice, dwFlags, Endpoint,
+		lpDataBuffer, dwDataBufferSize, pBytesTransferred, lpOverlapped);
+	return DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_ISSUE_INTERRUPT_TRANSFER,
+		&info, sizeof(info),
+		NULL, NULL, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwIssueIsochTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	DWORD dwStartingFrame,
+	LPUKW_ISOCH_FRAME lpFrames,
+	DWORD dwFrames,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwIssueIsochTransfer(0x%08x, %08x, %02x, %d, 0x%08x, %d, ...)\r\n"),
+		lpDevice, dwFlags, Endpoint, dwStartingFrame, lpFrames, dwFrames));
+
+	// The driver reads and updates the user supplied array directly
+	C_ASSERT(sizeof(UKW_ISOCH_FRAME) == sizeof(UKWD_ISOCH_FRAME));
+
+	if (!lpFrames || dwFrames == 0 || dwFrames > UKWD_MAX_ISOCH_FRAMES) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	UKWD_ISOCH_TRANSFER_INFO info;
 	info.dwCount = sizeof(info);
 	info.lpDevice = lpDevice->dev;
 	info.Endpoint = Endpoint;
 	info.dwFlags = ConvertUserToKernelFlags(dwFlags);
+	info.dwStartingFrame = dwStartingFrame;
+	info.lpFrames = reinterpret_cast<LPUKWD_ISOCH_FRAME>(lpFrames);
+	info.dwFrames = dwFrames;
 	info.lpDataBuffer = lpDataBuffer;
 	info.dwDataBufferSize = dwDataBufferSize;
 	info.pBytesTransferred = pBytesTransferred;
 	info.lpOverlapped = lpOverlapped;
+	return DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_ISSUE_ISOCH_TRANSFER,
+		&info, sizeof(info),
+		NULL, NULL, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwIssueRegisteredBulkTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	DWORD dwBufferId,
+	DWORD dwBufferOffset,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwIssueRegisteredBulkTransfer(0x%08x, %08x, %02x, %d, ...)\r\n"),
+		lpDevice, dwFlags, Endpoint, dwBufferId));
+
+	UKWD_BULK_TRANSFER_INFO info;
+	FillBulkTransferInfo(info, lpDevice, dwFlags, Endpoint,
+		NULL, dwDataBufferSize, pBytesTransferred, lpOverlapped);
+	info.dwBufferId = dwBufferId;
+	info.dwBufferOffset = dwBufferOffset;
 	return DeviceIoControl(
 		lpDevice->hDriver,
 		IOCTL_UKW_ISSUE_BULK_TRANSFER,
@@ -609,6 +1020,673 @@ ceusbkwrapper_API BOOL UkwIssueBulkTransfer(
 		NULL, NULL, NULL, NULL);
 }
 
+ceusbkwrapper_API BOOL WINAPI UkwIssueVectoredBulkTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	LPUKW_BUFFER_SEGMENT lpSegments,
+	DWORD dwSegments,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwIssueVectoredBulkTransfer(0x%08x, %08x, %02x, 0x%08x, %d, ...)\r\n"),
+		lpDevice, dwFlags, Endpoint, lpSegments, dwSegments));
+
+	// The driver reads the user supplied array directly
+	C_ASSERT(sizeof(UKW_BUFFER_SEGMENT) == sizeof(UKWD_BUFFER_SEGMENT));
+
+	if (!lpSegments || dwSegments == 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	UKWD_BULK_TRANSFER_INFO info;
+	FillBulkTransferInfo(info, lpDevice, dwFlags, Endpoint,
+		NULL, 0, pBytesTransferred, lpOverlapped);
+	info.lpSegments = reinterpret_cast<LPUKWD_BUFFER_SEGMENT>(lpSegments);
+	info.dwSegments = dwSegments;
+	return DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_ISSUE_BULK_TRANSFER,
+		&info, sizeof(info),
+		NULL, NULL, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwSetTransferSplit(
+	HANDLE hDriver,
+	DWORD dwChunkSize,
+	DWORD dwMaxChunks
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwSetTransferSplit(0x%08x, %d, %d)\r\n"),
+		hDriver, dwChunkSize, dwMaxChunks));
+
+	UKWD_TRANSFER_SPLIT_INFO info;
+	info.dwCount = sizeof(info);
+	info.dwChunkSize = dwChunkSize;
+	info.dwMaxChunks = dwMaxChunks;
+	return DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_SET_TRANSFER_SPLIT,
+		&info, sizeof(info),
+		NULL, 0, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL UkwIssueTransfers(
+	UKW_DEVICE lpDevice,
+	LPUKW_TRANSFER lpTransfers,
+	DWORD dwCount
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwIssueTransfers(0x%08x, 0x%08x, %d)\r\n"),
+		lpDevice, lpTransfers, dwCount));
+
+	if (dwCount == 0)
+		return TRUE;
+	if (!lpTransfers) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	// Batches larger than the driver accepts are submitted in chunks
+	DWORD chunkSize = dwCount < UKWD_MAX_BATCH_ENTRIES ? dwCount : UKWD_MAX_BATCH_ENTRIES;
+	LPUKWD_SUBMIT_BATCH_INFO info = reinterpret_cast<LPUKWD_SUBMIT_BATCH_INFO>(
+		new (std::nothrow) BYTE[UKWD_SUBMIT_BATCH_INFO_SIZE(chunkSize)]);
+	DWORD* statuses = new (std::nothrow) DWORD[chunkSize];
+	if (!info || !statuses) {
+		ERROR_MSG((TEXT("USBKWrapper!UkwIssueTransfers() failed to allocate batch\r\n")));
+		delete[] reinterpret_cast<BYTE*>(info);
+		delete[] statuses;
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+
+	DWORD firstError = ERROR_SUCCESS;
+	for (DWORD start = 0; start < dwCount; start += chunkSize) {
+		DWORD entries = dwCount - start < chunkSize ? dwCount - start : chunkSize;
+		info->dwCount = UKWD_SUBMIT_BATCH_INFO_SIZE(entries);
+		info->lpDevice = lpDevice->dev;
+		info->dwEntries = entries;
+		for (DWORD i = 0; i < entries; ++i) {
+			UKW_TRANSFER& transfer = lpTransfers[start + i];
+			UKWD_BATCH_TRANSFER_ENTRY& entry = info->Entries[i];
+			if (transfer.dwType == UKW_TRANSFER_TYPE_CONTROL) {
+				entry.dwType = UKWD_BATCH_CONTROL_TRANSFER;
+				FillControlTransferInfo(entry.Control, lpDevice, transfer.dwFlags,
+					&transfer.Header, transfer.lpDataBuffer, transfer.dwDataBufferSize,
+					transfer.pBytesTransferred, transfer.lpOverlapped);
+				entry.Control.dwBufferId = transfer.dwBufferId;
+				entry.Control.dwBufferOffset = transfer.dwBufferOffset;
+				entry.Control.dwTimeoutMs = transfer.dwTimeoutMs;
+			} else {
+				entry.dwType = transfer.dwType == UKW_TRANSFER_TYPE_BULK ?
+					UKWD_BATCH_BULK_TRANSFER : transfer.dwType;
+				FillBulkTransferInfo(entry.Bulk, lpDevice, transfer.dwFlags,
+					transfer.Endpoint, transfer.lpDataBuffer, transfer.dwDataBufferSize,
+					transfer.pBytesTransferred, transfer.lpOverlapped);
+				entry.Bulk.dwBufferId = transfer.dwBufferId;
+				entry.Bulk.dwBufferOffset = transfer.dwBufferOffset;
+				entry.Bulk.dwTimeoutMs = transfer.dwTimeoutMs;
+			}
+		}
+		DWORD written = 0;
+		BOOL ret = DeviceIoControl(
+			lpDevice->hDriver,
+			IOCTL_UKW_SUBMIT_BATCH,
+			info, info->dwCount,
+			statuses, entries * sizeof(DWORD),
+			&written, NULL);
+		if (ret && written != entries * sizeof(DWORD)) {
+			ERROR_MSG((TEXT("USBKWrapper!UkwIssueTransfers() received bad status size: %d\r\n"), written));
+			SetLastError(ERROR_INTERNAL_ERROR);
+			ret = FALSE;
+		}
+		DWORD batchError = ret ? ERROR_SUCCESS : GetLastError();
+		for (DWORD i = 0; i < entries; ++i) {
+			DWORD error = ret ? statuses[i] : batchError;
+			lpTransfers[start + i].dwError = error;
+			if (error != ERROR_SUCCESS && firstError == ERROR_SUCCESS)
+				firstError = error;
+		}
+	}
+
+	delete[] reinterpret_cast<BYTE*>(info);
+	delete[] statuses;
+	if (firstError != ERROR_SUCCESS) {
+		SetLastError(firstError);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwEnableCompletionQueue(
+	HANDLE hDriver
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwEnableCompletionQueue(0x%08x)\r\n"),
+		hDriver));
+
+	return DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_ENABLE_COMPLETION_QUEUE,
+		NULL, 0,
+		NULL, 0, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwReapCompletions(
+	HANDLE hDriver,
+	LPUKW_COMPLETION lpCompletions,
+	DWORD dwCount,
+	LPDWORD lpActualCount,
+	DWORD dwTimeout
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwReapCompletions(0x%08x, 0x%08x, %d, ...)\r\n"),
+		hDriver, lpCompletions, dwCount));
+
+	// The driver fills in the user supplied array directly
+	C_ASSERT(sizeof(UKW_COMPLETION) == sizeof(UKWD_COMPLETION));
+
+	if (lpActualCount)
+		*lpActualCount = 0;
+	if (!lpCompletions || dwCount == 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	UKWD_REAP_COMPLETIONS_INFO info;
+	info.dwCount = sizeof(info);
+	info.dwTimeout = dwTimeout;
+	DWORD written = 0;
+	BOOL ret = DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_REAP_COMPLETIONS,
+		&info, sizeof(info),
+		lpCompletions, dwCount * sizeof(UKW_COMPLETION),
+		&written, NULL);
+	if (ret && lpActualCount)
+		*lpActualCount = written / sizeof(UKW_COMPLETION);
+	return ret;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwCreateRings(
+	HANDLE hDriver,
+	DWORD dwSubmissionEntries,
+	DWORD dwCompletionEntries,
+	LPUKW_RINGS lpRings
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwCreateRings(0x%08x, %d, %d, ...)\r\n"),
+		hDriver, dwSubmissionEntries, dwCompletionEntries));
+
+	// The driver reads and writes the shared region directly
+	C_ASSERT(sizeof(UKW_COMPLETION) == sizeof(UKWD_COMPLETION));
+
+	if (!lpRings ||
+		!UKWD_RING_VALID_ENTRIES(dwSubmissionEntries) ||
+		!UKWD_RING_VALID_ENTRIES(dwCompletionEntries)) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	*lpRings = NULL;
+
+	UKW_RINGS rings = new (std::nothrow) UKW_RINGS_PRIV;
+	if (!rings) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	rings->hDriver = hDriver;
+	rings->dwRegionSize = UKWD_RINGS_SIZE(dwSubmissionEntries, dwCompletionEntries);
+	// Use whole pages so that nothing else shares the region with the driver
+	rings->lpRegion = VirtualAlloc(NULL, rings->dwRegionSize, MEM_COMMIT, PAGE_READWRITE);
+	if (!rings->lpRegion) {
+		ERROR_MSG((TEXT("USBKWrapper!UkwCreateRings() failed to allocate %d bytes\r\n"),
+			rings->dwRegionSize));
+		delete rings;
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	rings->lpHeader = reinterpret_cast<LPUKWD_RINGS_HEADER>(rings->lpRegion);
+	rings->lpSubmissions = reinterpret_cast<LPUKWD_BATCH_TRANSFER_ENTRY>(rings->lpHeader + 1);
+	rings->lpCompletions = reinterpret_cast<LPUKWD_COMPLETION>(
+		rings->lpSubmissions + dwSubmissionEntries);
+	// VirtualAlloc() returns zeroed memory, so all indices start at 0
+	rings->lpHeader->dwSubmissionEntries = dwSubmissionEntries;
+	rings->lpHeader->dwCompletionEntries = dwCompletionEntries;
+
+	UKWD_SETUP_RINGS_INFO info;
+	info.dwCount = sizeof(info);
+	info.lpRegion = rings->lpRegion;
+	info.dwRegionSize = rings->dwRegionSize;
+	if (!DeviceIoControl(
+			hDriver,
+			IOCTL_UKW_SETUP_RINGS,
+			&info, sizeof(info),
+			NULL, 0, NULL, NULL)) {
+		DWORD error = GetLastError();
+		VirtualFree(rings->lpRegion, 0, MEM_RELEASE);
+		delete rings;
+		SetLastError(error);
+		return FALSE;
+	}
+	InitializeCriticalSection(&rings->submitLock);
+	InitializeCriticalSection(&rings->completeLock);
+	*lpRings = rings;
+	return TRUE;
+}
+
+ceusbkwrapper_API void WINAPI UkwDestroyRings(
+	UKW_RINGS Rings
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwDestroyRings(0x%08x)\r\n"),
+		Rings));
+
+	if (!Rings)
+		return;
+
+	UKWD_SETUP_RINGS_INFO info;
+	info.dwCount = sizeof(info);
+	info.lpRegion = NULL;
+	info.dwRegionSize = 0;
+	if (!DeviceIoControl(
+			Rings->hDriver,
+			IOCTL_UKW_SETUP_RINGS,
+			&info, sizeof(info),
+			NULL, 0, NULL, NULL)) {
+		// The driver might still write to the region, so leak it
+		ERROR_MSG((TEXT("USBKWrapper!UkwDestroyRings() failed to remove rings: %d\r\n"),
+			GetLastError()));
+	} else {
+		VirtualFree(Rings->lpRegion, 0, MEM_RELEASE);
+	}
+	DeleteCriticalSection(&Rings->submitLock);
+	DeleteCriticalSection(&Rings->completeLock);
+	delete Rings;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwQueueTransfer(
+	UKW_RINGS Rings,
+	UKW_DEVICE lpDevice,
+	LPUKW_TRANSFER lpTransfer
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwQueueTransfer(0x%08x, 0x%08x, 0x%08x)\r\n"),
+		Rings, lpDevice, lpTransfer));
+
+	if (!Rings || !lpDevice || !lpTransfer || !lpTransfer->lpOverlapped ||
+		lpDevice->hDriver != Rings->hDriver) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	EnterCriticalSection(&Rings->submitLock);
+	LPUKWD_RINGS_HEADER header = Rings->lpHeader;
+	LONG tail = header->Submission.Tail;
+	LONG head = UKWD_RING_READ_INDEX(&header->Submission.Head);
+	if (UKWD_RING_USED(tail, head) >= header->dwSubmissionEntries) {
+		LeaveCriticalSection(&Rings->submitLock);
+		SetLastError(ERROR_BUSY);
+		return FALSE;
+	}
+	UKWD_BATCH_TRANSFER_ENTRY& entry =
+		Rings->lpSubmissions[UKWD_RING_SLOT(tail, header->dwSubmissionEntries)];
+	if (lpTransfer->dwType == UKW_TRANSFER_TYPE_CONTROL) {
+		entry.dwType = UKWD_BATCH_CONTROL_TRANSFER;
+		FillControlTransferInfo(entry.Control, lpDevice, lpTransfer->dwFlags,
+			&lpTransfer->Header, lpTransfer->lpDataBuffer, lpTransfer->dwDataBufferSize,
+			lpTransfer->pBytesTransferred, lpTransfer->lpOverlapped);
+		entry.Control.dwBufferId = lpTransfer->dwBufferId;
+		entry.Control.dwBufferOffset = lpTransfer->dwBufferOffset;
+		entry.Control.dwTimeoutMs = lpTransfer->dwTimeoutMs;
+	} else {
+		entry.dwType = lpTransfer->dwType == UKW_TRANSFER_TYPE_BULK ?
+			UKWD_BATCH_BULK_TRANSFER : lpTransfer->dwType;
+		FillBulkTransferInfo(entry.Bulk, lpDevice, lpTransfer->dwFlags,
+			lpTransfer->Endpoint, lpTransfer->lpDataBuffer, lpTransfer->dwDataBufferSize,
+			lpTransfer->pBytesTransferred, lpTransfer->lpOverlapped);
+		entry.Bulk.dwBufferId = lpTransfer->dwBufferId;
+		entry.Bulk.dwBufferOffset = lpTransfer->dwBufferOffset;
+		entry.Bulk.dwTimeoutMs = lpTransfer->dwTimeoutMs;
+	}
+	// Publish the entry to the driver
+	UKWD_RING_WRITE_INDEX(&header->Submission.Tail, tail + 1);
+	LeaveCriticalSection(&Rings->submitLock);
+	return TRUE;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwSubmitRings(
+	UKW_RINGS Rings,
+	DWORD dwMinCompletions,
+	DWORD dwTimeout,
+	LPDWORD lpSubmitted
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwSubmitRings(0x%08x, %d, %d, ...)\r\n"),
+		Rings, dwMinCompletions, dwTimeout));
+
+	if (lpSubmitted)
+		*lpSubmitted = 0;
+	if (!Rings) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	UKWD_RING_DOORBELL_INFO info;
+	info.dwCount = sizeof(info);
+	info.dwMinCompletions = dwMinCompletions;
+	info.dwTimeout = dwTimeout;
+	DWORD submitted = 0;
+	DWORD written = 0;
+	BOOL ret = DeviceIoControl(
+		Rings->hDriver,
+		IOCTL_UKW_RING_DOORBELL,
+		&info, sizeof(info),
+		&submitted, sizeof(submitted),
+		&written, NULL);
+	if (lpSubmitted && written == sizeof(submitted))
+		*lpSubmitted = submitted;
+	return ret;
+}
+
+ceusbkwrapper_API DWORD WINAPI UkwPeekCompletions(
+	UKW_RINGS Rings,
+	LPUKW_COMPLETION lpCompletions,
+	DWORD dwCount
+	)
+{
+	if (!Rings || !lpCompletions)
+		return 0;
+
+	EnterCriticalSection(&Rings->completeLock);
+	LPUKWD_RINGS_HEADER header = Rings->lpHeader;
+	LONG head = header->Completion.Head;
+	LONG tail = UKWD_RING_READ_INDEX(&header->Completion.Tail);
+	DWORD available = UKWD_RING_USED(tail, head);
+	if (available > header->dwCompletionEntries)
+		available = 0; // Shouldn't happen, the driver owns the tail
+	DWORD count = available < dwCount ? available : dwCount;
+	for (DWORD i = 0; i < count; ++i) {
+		const UKWD_COMPLETION& completion =
+			Rings->lpCompletions[UKWD_RING_SLOT(head + i, header->dwCompletionEntries)];
+		lpCompletions[i].lpOverlapped = completion.lpOverlapped;
+		lpCompletions[i].dwError = completion.dwError;
+		lpCompletions[i].dwBytesTransferred = completion.dwBytesTransferred;
+	}
+	// Hand the consumed entries back to the driver
+	if (count > 0)
+		UKWD_RING_WRITE_INDEX(&header->Completion.Head, head + count);
+	LeaveCriticalSection(&Rings->completeLock);
+	return count;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwGetTransferPoolStats(
+	HANDLE hDriver,
+	LPUKW_TRANSFER_POOL_STATS lpStats
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwGetTransferPoolStats(0x%08x, 0x%08x)\r\n"),
+		hDriver, lpStats));
+
+	if (!lpStats) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	UKWD_TRANSFER_POOL_STATS stats;
+	DWORD written = 0;
+	BOOL ret = DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_GET_TRANSFER_POOL_STATS,
+		NULL, 0,
+		&stats, sizeof(stats),
+		&written, NULL);
+	if (!ret)
+		return FALSE;
+	if (written < sizeof(stats)) {
+		ERROR_MSG((TEXT("USBKWrapper!UkwGetTransferPoolStats() received bad size: %d\r\n"), written));
+		SetLastError(ERROR_INTERNAL_ERROR);
+		return FALSE;
+	}
+	lpStats->dwInUse = stats.dwInUse;
+	lpStats->dwHighWaterMark = stats.dwHighWaterMark;
+	lpStats->dwFree = stats.dwFree;
+	lpStats->dwAllocated = stats.dwAllocated;
+	lpStats->dwOversized = stats.dwOversized;
+	return TRUE;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwRegisterBuffer(
+	HANDLE hDriver,
+	LPVOID lpBuffer,
+	DWORD dwBufferSize,
+	LPDWORD lpBufferId
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwRegisterBuffer(0x%08x, 0x%08x, %d, ...)\r\n"),
+		hDriver, lpBuffer, dwBufferSize));
+
+	if (!lpBufferId) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	UKWD_REGISTER_BUFFER_INFO info;
+	info.dwCount = sizeof(info);
+	info.lpBuffer = lpBuffer;
+	info.dwBufferSize = dwBufferSize;
+	return DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_REGISTER_BUFFER,
+		&info, sizeof(info),
+		lpBufferId, sizeof(DWORD),
+		NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwUnregisterBuffer(
+	HANDLE hDriver,
+	DWORD dwBufferId
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwUnregisterBuffer(0x%08x, %d)\r\n"),
+		hDriver, dwBufferId));
+
+	return DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_UNREGISTER_BUFFER,
+		&dwBufferId, sizeof(dwBufferId),
+		NULL, 0, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwRegisterEvent(
+	HANDLE hDriver,
+	HANDLE hEvent
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwRegisterEvent(0x%08x, 0x%08x)\r\n"),
+		hDriver, hEvent));
+
+	return DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_REGISTER_EVENT,
+		&hEvent, sizeof(hEvent),
+		NULL, 0, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwUnregisterEvent(
+	HANDLE hDriver,
+	HANDLE hEvent
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwUnregisterEvent(0x%08x, 0x%08x)\r\n"),
+		hDriver, hEvent));
+
+	return DeviceIoControl(
+		hDriver,
+		IOCTL_UKW_UNREGISTER_EVENT,
+		&hEvent, sizeof(hEvent),
+		NULL, 0, NULL, NULL);
+}
+
+static BOOL StartStream(
+	UKW_DEVICE lpDevice,
+	UCHAR Endpoint,
+	DWORD dwTransferSize,
+	DWORD dwTransfers,
+	DWORD dwBufferSize,
+	DWORD dwFlags,
+	LPDWORD lpStreamId)
+{
+	if (!lpStreamId) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	UKWD_START_STREAM_INFO info;
+	info.dwCount = sizeof(info);
+	info.lpDevice = lpDevice->dev;
+	info.Endpoint = Endpoint;
+	info.dwTransferSize = dwTransferSize;
+	info.dwTransfers = dwTransfers;
+	info.dwBufferSize = dwBufferSize;
+	info.dwFlags = dwFlags;
+	return DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_START_STREAM,
+		&info, sizeof(info),
+		lpStreamId, sizeof(DWORD),
+		NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwStartStream(
+	UKW_DEVICE lpDevice,
+	UCHAR Endpoint,
+	DWORD dwTransferSize,
+	DWORD dwTransfers,
+	DWORD dwBufferSize,
+	LPDWORD lpStreamId
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwStartStream(0x%08x, %02x, %d, %d, %d, ...)\r\n"),
+		lpDevice, Endpoint, dwTransferSize, dwTransfers, dwBufferSize));
+
+	return StartStream(lpDevice, Endpoint, dwTransferSize, dwTransfers,
+		dwBufferSize, 0, lpStreamId);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwStopStream(
+	UKW_DEVICE lpDevice,
+	DWORD dwStreamId
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwStopStream(0x%08x, %d)\r\n"),
+		lpDevice, dwStreamId));
+
+	return DeviceIoControl(
+		lpDevice->hDriver,
+		IOCTL_UKW_STOP_STREAM,
+		&dwStreamId, sizeof(dwStreamId),
+		NULL, 0, NULL, NULL);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwSubscribeInterrupt(
+	UKW_DEVICE lpDevice,
+	UCHAR Endpoint,
+	DWORD dwReportSize,
+	DWORD dwReports,
+	LPDWORD lpSubscriptionId
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwSubscribeInterrupt(0x%08x, %02x, %d, %d, ...)\r\n"),
+		lpDevice, Endpoint, dwReportSize, dwReports));
+
+	// Each queued transfer needs a report buffer of its own
+	if (dwReports < INTERRUPT_SUBSCRIPTION_TRANSFERS) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	// Keeping a second transfer queued means the endpoint is still
+	// polled while the first one is being completed.
+	return StartStream(lpDevice, Endpoint, dwReportSize,
+		INTERRUPT_SUBSCRIPTION_TRANSFERS, dwReportSize * dwReports,
+		UKWD_STREAM_INTERRUPT, lpSubscriptionId);
+}
+
+static BOOL StreamIo(
+	UKW_DEVICE lpDevice,
+	DWORD dwIoControlCode,
+	DWORD dwStreamId,
+	LPVOID lpBuffer,
+	DWORD dwBufferSize,
+	LPDWORD pBytesTransferred,
+	DWORD dwTimeout)
+{
+	UKWD_STREAM_IO_INFO info;
+	info.dwCount = sizeof(info);
+	info.dwStreamId = dwStreamId;
+	info.lpBuffer = lpBuffer;
+	info.dwBufferSize = dwBufferSize;
+	info.dwTimeout = dwTimeout;
+	DWORD transferred = 0;
+	BOOL ret = DeviceIoControl(
+		lpDevice->hDriver,
+		dwIoControlCode,
+		&info, sizeof(info),
+		&transferred, sizeof(transferred),
+		NULL, NULL);
+	if (ret && pBytesTransferred)
+		*pBytesTransferred = transferred;
+	return ret;
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwStreamRead(
+	UKW_DEVICE lpDevice,
+	DWORD dwStreamId,
+	LPVOID lpBuffer,
+	DWORD dwBufferSize,
+	LPDWORD pBytesRead,
+	DWORD dwTimeout
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwStreamRead(0x%08x, %d, 0x%08x, %d, ..., %d)\r\n"),
+		lpDevice, dwStreamId, lpBuffer, dwBufferSize, dwTimeout));
+
+	return StreamIo(lpDevice, IOCTL_UKW_STREAM_READ, dwStreamId,
+		lpBuffer, dwBufferSize, pBytesRead, dwTimeout);
+}
+
+ceusbkwrapper_API BOOL WINAPI UkwStreamWrite(
+	UKW_DEVICE lpDevice,
+	DWORD dwStreamId,
+	LPVOID lpBuffer,
+	DWORD dwBufferSize,
+	LPDWORD pBytesWritten,
+	DWORD dwTimeout
+	)
+{
+	ENTRYPOINT_MSG((
+		TEXT("USBKWrapper!UkwStreamWrite(0x%08x, %d, 0x%08x, %d, ..., %d)\r\n"),
+		lpDevice, dwStreamId, lpBuffer, dwBufferSize, dwTimeout));
+
+	return StreamIo(lpDevice, IOCTL_UKW_STREAM_WRITE, dwStreamId,
+		lpBuffer, dwBufferSize, pBytesWritten, dwTimeout);
+}
+
 ceusbkwrapper_API BOOL WINAPI UkwResetDevice(
 	UKW_DEVICE lpDevice)
 {
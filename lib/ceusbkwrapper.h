@@ -36,6 +36,10 @@ struct UKW_DEVICE_PRIV;
 typedef struct UKW_DEVICE_PRIV *UKW_DEVICE;
 typedef UKW_DEVICE *PUKW_DEVICE, *LPUKW_DEVICE;
 
+struct UKW_RINGS_PRIV;
+typedef struct UKW_RINGS_PRIV *UKW_RINGS;
+typedef UKW_RINGS *PUKW_RINGS, *LPUKW_RINGS;
+
 /**
  * Structure containing device descriptor information
  * matching the device descriptor described in the USB
@@ -90,6 +94,121 @@ typedef struct {
 #define UKW_TF_SEND_TO_ENDPOINT   0x00040000
 /* Don't block when waiting for memory allocations */
 #define UKW_TF_DONT_BLOCK_FOR_MEM 0x00080000
+/* Start an isochronous transfer in the next available frame,
+ * rather than in the frame given to UkwIssueIsochTransfer(). */
+#define UKW_TF_START_ISOCH_ASAP   0x00000400
+
+// Scopes of the transfers cancelled by UkwCancelAllTransfers()
+/* Every transfer on the device */
+#define UKW_CANCEL_SCOPE_DEVICE    0
+/* Transfers on the endpoints of an interface */
+#define UKW_CANCEL_SCOPE_INTERFACE 1
+/* Transfers on an endpoint, or control transfers for endpoint 0 */
+#define UKW_CANCEL_SCOPE_ENDPOINT  2
+
+// Types of transfer which can be issued with UkwIssueTransfers()
+#define UKW_TRANSFER_TYPE_CONTROL 0
+#define UKW_TRANSFER_TYPE_BULK    1
+
+/**
+ * Structure describing one transfer in a call to UkwIssueTransfers().
+ *
+ * The fields match the parameters of UkwIssueControlTransfer() and
+ * UkwIssueBulkTransfer(). Endpoint is only used for bulk transfers and
+ * Header is only used for control transfers.
+ *
+ * On return from UkwIssueTransfers() dwError contains ERROR_SUCCESS if the
+ * transfer was started, or the error which prevented it from starting.
+ *
+ * If dwBufferId is not 0 then lpDataBuffer is ignored and the transfer uses
+ * dwDataBufferSize bytes at dwBufferOffset in a buffer registered with
+ * UkwRegisterBuffer().
+ *
+ * dwTimeoutMs behaves as for UkwIssueBulkTransferTimeout(), with 0
+ * meaning that the transfer doesn't time out.
+ */
+typedef struct {
+	DWORD dwType;
+	DWORD dwFlags;
+	UCHAR Endpoint;
+	UKW_CONTROL_HEADER Header;
+	LPVOID lpDataBuffer;
+	DWORD dwDataBufferSize;
+	LPDWORD pBytesTransferred;
+	LPOVERLAPPED lpOverlapped;
+	DWORD dwError;
+	DWORD dwBufferId;
+	DWORD dwBufferOffset;
+	DWORD dwTimeoutMs;
+} UKW_TRANSFER, *PUKW_TRANSFER, *LPUKW_TRANSFER;
+
+/**
+ * Structure describing one buffer of a vectored bulk transfer,
+ * as used by UkwIssueVectoredBulkTransfer().
+ */
+typedef struct {
+	LPVOID lpBuffer;
+	DWORD dwBufferSize;
+} UKW_BUFFER_SEGMENT, *PUKW_BUFFER_SEGMENT, *LPUKW_BUFFER_SEGMENT;
+
+/**
+ * Structure describing one frame of an isochronous transfer,
+ * as used by UkwIssueIsochTransfer().
+ *
+ * dwLength is the number of bytes to transfer in the frame. When the
+ * transfer completes dwBytesTransferred and dwError are set to the number
+ * of bytes actually transferred in the frame and to ERROR_SUCCESS or the
+ * error which occurred for that frame.
+ */
+typedef struct {
+	DWORD dwLength;
+	DWORD dwBytesTransferred;
+	DWORD dwError;
+} UKW_ISOCH_FRAME, *PUKW_ISOCH_FRAME, *LPUKW_ISOCH_FRAME;
+
+/**
+ * Structure describing a completed asynchronous transfer,
+ * as returned by UkwReapCompletions().
+ */
+typedef struct {
+	LPOVERLAPPED lpOverlapped;
+	DWORD dwError;
+	DWORD dwBytesTransferred;
+} UKW_COMPLETION, *PUKW_COMPLETION, *LPUKW_COMPLETION;
+
+/**
+ * Structure containing statistics about the pool of transfer
+ * objects kept by the driver for a driver handle, as returned
+ * by UkwGetTransferPoolStats().
+ */
+typedef struct {
+	DWORD dwInUse;
+	DWORD dwHighWaterMark;
+	DWORD dwFree;
+	DWORD dwAllocated;
+	DWORD dwOversized;
+} UKW_TRANSFER_POOL_STATS, *PUKW_TRANSFER_POOL_STATS, *LPUKW_TRANSFER_POOL_STATS;
+
+// Types of device event returned by UkwWaitForDeviceEvents()
+#define UKW_DEVICE_EVENT_ATTACHED 1
+#define UKW_DEVICE_EVENT_DETACHED 2
+
+/**
+ * Structure describing a device being attached or detached,
+ * as returned by UkwWaitForDeviceEvents().
+ *
+ * Bus, Address and SessionId match the values returned by
+ * UkwGetDeviceAddress() for the device. dwGeneration is the device
+ * list generation reached once this event has been applied.
+ */
+typedef struct {
+	DWORD dwType;
+	DWORD dwGeneration;
+	unsigned char Bus;
+	unsigned char Address;
+	unsigned long SessionId;
+	UKW_DEVICE_DESCRIPTOR Descriptor;
+} UKW_DEVICE_EVENT, *PUKW_DEVICE_EVENT, *LPUKW_DEVICE_EVENT;
 
 /* Value to use when dealing with configuration values, such as UkwGetConfigDescriptor, 
  * to specify the currently active configuration for the device. */
@@ -138,6 +257,29 @@ ceusbkwrapper_API BOOL WINAPI UkwGetDeviceList(
 	DWORD Size,
 	LPDWORD lpActualSize);
 
+/**
+ * Retrieves a list of devices into a pre-allocated list, along with the
+ * device list generation the list was read at.
+ *
+ * This behaves in the same way as UkwGetDeviceList(). The list and the
+ * generation are read together, so the list is brought up to date by
+ * applying the events from UkwWaitForDeviceEvents() with a dwGeneration
+ * newer than lpdwGeneration and ignoring older ones.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \param lpList [in] A pre-allocated list for devices.
+ * \param Size [in] The size of the list in lpList.
+ * \param lpActualSize [out] On success this will contain the number of entries in the list
+ * \param lpdwGeneration [out] On success this will contain the generation the list was read at. This parameter is optional.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwGetDeviceListWithGeneration(
+	HANDLE hDriver,
+	LPUKW_DEVICE lpList,
+	DWORD Size,
+	LPDWORD lpActualSize,
+	LPDWORD lpdwGeneration);
+
 /**
  * Releases a list of devices from a pre-allocated list.
  * 
@@ -150,6 +292,62 @@ ceusbkwrapper_API void WINAPI UkwReleaseDeviceList(
 	LPUKW_DEVICE lpList,
 	DWORD Size);
 
+/**
+ * Waits for devices to be attached or detached.
+ *
+ * Every driver handle queues the attach and detach events for all devices
+ * from when it was opened, and the driver keeps a device list generation
+ * which increases by one for every event. To track the connected devices
+ * without missing any, retrieve the list and its generation with
+ * UkwGetDeviceListWithGeneration(), then apply only those events returned
+ * by this with a newer dwGeneration. Events which were queued before the
+ * list was retrieved are returned as well and should be skipped.
+ * A detach event can refer to a device which had already been left out
+ * of the list.
+ *
+ * If events were dropped because they weren't retrieved quickly enough
+ * then lpOverflowed is set to TRUE and the device list should be retrieved
+ * again.
+ *
+ * If the wait times out then FALSE is returned with GetLastError() set to
+ * ERROR_TIMEOUT, but lpdwGeneration is still filled in.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \param lpEvents [out] A pre-allocated array to fill with events.
+ * \param dwCount [in] The number of entries in lpEvents.
+ * \param lpActualCount [out] On return this will contain the number of events returned.
+ * \param lpdwGeneration [out] On return this will contain the generation reached by applying the returned events. This parameter is optional.
+ * \param lpOverflowed [out] On return this will be TRUE if events have been dropped. This parameter is optional.
+ * \param dwTimeout [in] The time to wait in milliseconds, or INFINITE.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwWaitForDeviceEvents(
+	HANDLE hDriver,
+	LPUKW_DEVICE_EVENT lpEvents,
+	DWORD dwCount,
+	LPDWORD lpActualCount,
+	LPDWORD lpdwGeneration,
+	LPBOOL lpOverflowed,
+	DWORD dwTimeout);
+
+/**
+ * Makes the driver read its interface filters from the registry again,
+ * so that filters can be changed without restarting the device manager.
+ *
+ * The driver also reloads the filters by itself when the registry values
+ * change, where the platform supports registry change notifications.
+ * The new filters are only used for devices attached after the reload.
+ * This fails with ERROR_NOT_READY if no device has been attached since
+ * the driver was loaded, as the filters are first read then.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \param lpdwCount [out] On return this will contain the number of filters read. This parameter is optional.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwReloadInterfaceFilters(
+	HANDLE hDriver,
+	LPDWORD lpdwCount);
+
 /**
  * Retrieves the bus address and device address of a given device.
  *
@@ -355,6 +553,37 @@ ceusbkwrapper_API BOOL WINAPI UkwCancelTransfer(
 	DWORD dwFlags
 	);
 
+/**
+ * Cancels all pending asynchronous transfers on a device, on the endpoints
+ * of an interface or on a single endpoint.
+ *
+ * This is equivalent to calling UkwCancelTransfer() for every matching
+ * transfer started using the same driver handle, but all of the transfers
+ * are cancelled in a single request. If dwFlags is 0 then this only
+ * returns once all of the transfers have completed.
+ *
+ * If dwFlags is 0 and the transfers don't all complete within 5 seconds,
+ * this fails and GetLastError() returns ERROR_TIMEOUT. The buffers of the
+ * transfers which are still pending remain in use by the driver and must
+ * not be freed until those transfers have completed.
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param dwScope [in] One of the UKW_CANCEL_SCOPE_* values.
+ * \param dwInterface [in] The interface to cancel transfers on, when dwScope is UKW_CANCEL_SCOPE_INTERFACE.
+ * \param Endpoint [in] The endpoint to cancel transfers on, when dwScope is UKW_CANCEL_SCOPE_ENDPOINT.
+ * \param dwFlags [in] Either 0 or UKW_TF_NO_WAIT.
+ * \param lpdwCancelled [out] Optional parameter which will be set to the number of transfers cancelled.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwCancelAllTransfers(
+	UKW_DEVICE lpDevice,
+	DWORD dwScope,
+	DWORD dwInterface,
+	UCHAR Endpoint,
+	DWORD dwFlags,
+	LPDWORD lpdwCancelled
+	);
+
 /**
  * Starts a control transfer with the a USB device.
  * 
@@ -367,6 +596,9 @@ ceusbkwrapper_API BOOL WINAPI UkwCancelTransfer(
  *
  * If the UKW_TF_NO_WAIT flag is provided then pBytesTransferred will
  * be ignored.
+ *
+ * Synchronous transfers of up to 256 bytes are copied through the driver
+ * call itself, which avoids the cost of the driver mapping lpDataBuffer.
  * 
  * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
  * \param dwFlags [in] A bitwise or combination of the UKW_TF_* flags.
@@ -419,6 +651,623 @@ ceusbkwrapper_API BOOL WINAPI UkwIssueBulkTransfer(
 	LPOVERLAPPED lpOverlapped
 	);
 
+/**
+ * Starts a control transfer with the a USB device, which the driver
+ * cancels if it hasn't completed within dwTimeoutMs ms.
+ *
+ * This behaves in the same way as UkwIssueControlTransfer(). A transfer
+ * which times out before any data has been transferred completes with
+ * ERROR_TIMEOUT. As with UkwCancelTransfer(), one which times out after
+ * some data has been transferred completes successfully.
+ *
+ * If lpOverlapped is NULL and UKW_TF_NO_WAIT isn't set then the call blocks
+ * until the transfer completes or times out, without the caller needing
+ * an OVERLAPPED or an event. GetLastError() returns ERROR_TIMEOUT if it
+ * timed out.
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param dwFlags [in] A bitwise or combination of the UKW_TF_* flags.
+ * \param lpHeader [in] An 8 byte control header. See the USB specification for the format.
+ * \param lpDataBuffer [in] Pointer to a data buffer.
+ * \param dwDataBufferSize [in] Size of the provided data buffer.
+ * \param pBytesTransferred [out] Optional parameter which will be set to the number of bytes transferred on success.
+ * \param lpOverlapped [in] Optional parameter. If specified then request will be asynchronous.
+ * \param dwTimeoutMs [in] Timeout in ms, or 0 or INFINITE for no timeout.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwIssueControlTransferTimeout(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	LPUKW_CONTROL_HEADER lpHeader,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped,
+	DWORD dwTimeoutMs
+	);
+
+/**
+ * Starts a bulk transfer with the a USB device, which the driver
+ * cancels if it hasn't completed within dwTimeoutMs ms.
+ *
+ * This behaves in the same way as UkwIssueBulkTransfer(). The timeout is
+ * handled as described for UkwIssueControlTransferTimeout().
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param dwFlags [in] A bitwise or combination of the UKW_TF_* flags.
+ * \param Endpoint [in] The endpoint to send the bulk transfer to.
+ * \param lpDataBuffer [in] Pointer to a data buffer.
+ * \param dwDataBufferSize [in] Size of the provided data buffer.
+ * \param pBytesTransferred [out] Optional parameter which will be set to the number of bytes transferred on success.
+ * \param lpOverlapped [in] Optional parameter. If specified then request will be asynchronous.
+ * \param dwTimeoutMs [in] Timeout in ms, or 0 or INFINITE for no timeout.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwIssueBulkTransferTimeout(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped,
+	DWORD dwTimeoutMs
+	);
+
+/**
+ * Starts an interrupt transfer with the a USB device.
+ *
+ * This behaves in the same way as UkwIssueBulkTransfer(), but must be
+ * used with interrupt endpoints. To keep receiving reports from an
+ * interrupt IN endpoint use UkwSubscribeInterrupt() instead.
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param dwFlags [in] A bitwise or combination of the UKW_TF_* flags.
+ * \param Endpoint [in] The endpoint to send the interrupt transfer to.
+ * \param lpDataBuffer [in] Pointer to a data buffer.
+ * \param dwDataBufferSize [in] Size of the provided data buffer.
+ * \param pBytesTransferred [out] Optional parameter which will be set to the number of bytes transferred on success.
+ * \param lpOverlapped [in] Optional parameter. If specified then request will be asynchronous.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwIssueInterruptTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped
+	);
+
+/**
+ * Starts an isochronous transfer with the a USB device.
+ *
+ * The data buffer is split into consecutive frames, with the length of
+ * each frame given by the dwLength field of the matching entry in
+ * lpFrames. The lengths must not add up to more than dwDataBufferSize.
+ *
+ * When the transfer completes the dwBytesTransferred and dwError fields
+ * of every entry in lpFrames are updated, so lpFrames must stay allocated
+ * until then. pBytesTransferred is set to the total number of bytes
+ * transferred. A transfer where only some frames failed can still succeed,
+ * so the per-frame errors should be checked.
+ *
+ * The UKW_TF_NO_WAIT flag is ignored if lpOverlapped is not NULL.
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param dwFlags [in] A bitwise or combination of the UKW_TF_* flags.
+ * \param Endpoint [in] The endpoint to send the isochronous transfer to.
+ * \param dwStartingFrame [in] The frame number to start the transfer in. Ignored if UKW_TF_START_ISOCH_ASAP is set.
+ * \param lpFrames [in/out] Array describing each frame of the transfer.
+ * \param dwFrames [in] Number of entries in lpFrames, up to 64.
+ * \param lpDataBuffer [in] Pointer to a data buffer.
+ * \param dwDataBufferSize [in] Size of the provided data buffer.
+ * \param pBytesTransferred [out] Optional parameter which will be set to the number of bytes transferred on success.
+ * \param lpOverlapped [in] Optional parameter. If specified then request will be asynchronous.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwIssueIsochTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	DWORD dwStartingFrame,
+	LPUKW_ISOCH_FRAME lpFrames,
+	DWORD dwFrames,
+	LPVOID lpDataBuffer,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped
+	);
+
+/**
+ * Registers a buffer for use by many transfers.
+ *
+ * Normally the driver has to map the data buffer of every transfer into
+ * the kernel and unmap it again on completion. A registered buffer is
+ * mapped once, and transfers then refer to it by id and offset using
+ * UkwIssueRegisteredBulkTransfer() or the dwBufferId field of UKW_TRANSFER.
+ * The buffer must stay allocated until UkwUnregisterBuffer() is called
+ * and every transfer using it has completed.
+ *
+ * Registered buffers need the driver to be able to access the caller's
+ * memory directly. If that isn't possible then FALSE is returned and
+ * GetLastError() returns ERROR_NOT_SUPPORTED.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \param lpBuffer [in] Pointer to the buffer to register.
+ * \param dwBufferSize [in] Size of the buffer.
+ * \param lpBufferId [out] On success this will contain the id of the registered buffer.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwRegisterBuffer(
+	HANDLE hDriver,
+	LPVOID lpBuffer,
+	DWORD dwBufferSize,
+	LPDWORD lpBufferId
+	);
+
+/**
+ * Unregisters a buffer registered with UkwRegisterBuffer().
+ *
+ * Transfers already started using the buffer are unaffected.
+ *
+ * \param hDriver [in] The driver handle the buffer was registered with.
+ * \param dwBufferId [in] The id returned by UkwRegisterBuffer().
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwUnregisterBuffer(
+	HANDLE hDriver,
+	DWORD dwBufferId
+	);
+
+/**
+ * Registers an event used in the OVERLAPPED structures of transfers.
+ *
+ * Normally the driver has to duplicate the event of every asynchronous
+ * transfer and close it again on completion. A registered event is
+ * duplicated once and reused by every transfer on hDriver which uses it.
+ *
+ * The event must be unregistered with UkwUnregisterEvent() before it is
+ * closed, otherwise a new handle with the same value would be mistaken for
+ * it. Any events still registered are released when hDriver is closed.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \param hEvent [in] The event to register.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwRegisterEvent(
+	HANDLE hDriver,
+	HANDLE hEvent
+	);
+
+/**
+ * Unregisters an event registered with UkwRegisterEvent().
+ *
+ * Transfers already started using the event will still signal it.
+ *
+ * \param hDriver [in] The driver handle the event was registered with.
+ * \param hEvent [in] The event to unregister.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwUnregisterEvent(
+	HANDLE hDriver,
+	HANDLE hEvent
+	);
+
+/**
+ * Starts streaming data on a bulk endpoint.
+ *
+ * The driver keeps up to dwTransfers bulk transfers of dwTransferSize bytes
+ * queued on the endpoint, using a buffer of dwBufferSize bytes which it
+ * owns. Each transfer is replaced as soon as it completes, so the endpoint
+ * isn't left idle while the application handles the data.
+ *
+ * For an IN endpoint received data is read with UkwStreamRead(). Once the
+ * buffer is full of unread data no more transfers are queued. For an OUT
+ * endpoint data is sent by calling UkwStreamWrite().
+ *
+ * dwBufferSize must be at least dwTransfers * dwTransferSize. The stream
+ * stops if a transfer fails, but data already received can still be read.
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param Endpoint [in] The bulk endpoint to stream on.
+ * \param dwTransferSize [in] Size of each transfer.
+ * \param dwTransfers [in] Number of transfers to keep queued, up to 32.
+ * \param dwBufferSize [in] Size of the buffer for the stream.
+ * \param lpStreamId [out] On success this will contain the id of the stream.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwStartStream(
+	UKW_DEVICE lpDevice,
+	UCHAR Endpoint,
+	DWORD dwTransferSize,
+	DWORD dwTransfers,
+	DWORD dwBufferSize,
+	LPDWORD lpStreamId
+	);
+
+/**
+ * Stops a stream started with UkwStartStream().
+ *
+ * All queued transfers are cancelled, and any data not yet read or sent
+ * is discarded. Any streams still running are stopped when the driver
+ * handle is closed.
+ *
+ * \param lpDevice [in] The device the stream was started on.
+ * \param dwStreamId [in] The id returned by UkwStartStream().
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwStopStream(
+	UKW_DEVICE lpDevice,
+	DWORD dwStreamId
+	);
+
+/**
+ * Subscribes to the reports sent on an interrupt IN endpoint.
+ *
+ * The driver keeps an interrupt transfer of dwReportSize bytes queued on
+ * the endpoint and buffers up to dwReports received reports, so that no
+ * report is missed while the application is busy. Once dwReports reports
+ * are waiting to be read no more transfers are queued, and the device
+ * holds on to any further reports.
+ *
+ * Reports are read with UkwStreamRead(), which returns one report per
+ * call. If the buffer passed to it is smaller than the report the rest
+ * of the report is discarded. The subscription is ended by passing the
+ * id to UkwStopStream().
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param Endpoint [in] The interrupt IN endpoint to subscribe to.
+ * \param dwReportSize [in] Maximum size of a report.
+ * \param dwReports [in] Number of reports to buffer. This must be at least 2, as two
+ *                  transfers are kept queued, each with a report buffer of its own.
+ * \param lpSubscriptionId [out] On success this will contain the id of the subscription.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwSubscribeInterrupt(
+	UKW_DEVICE lpDevice,
+	UCHAR Endpoint,
+	DWORD dwReportSize,
+	DWORD dwReports,
+	LPDWORD lpSubscriptionId
+	);
+
+/**
+ * Reads data received by a stream on an IN endpoint.
+ *
+ * Waits for up to dwTimeout milliseconds for data, and then returns as much
+ * as is available, up to dwBufferSize bytes. Transfer boundaries are not
+ * preserved, except for subscriptions started with UkwSubscribeInterrupt()
+ * which return a single report.
+ *
+ * If the stream has stopped because a transfer failed then FALSE is
+ * returned with the error of that transfer once all data has been read.
+ *
+ * \param lpDevice [in] The device the stream was started on.
+ * \param dwStreamId [in] The id returned by UkwStartStream() or UkwSubscribeInterrupt().
+ * \param lpBuffer [out] Buffer to read the data into.
+ * \param dwBufferSize [in] Size of lpBuffer.
+ * \param pBytesRead [out] On success this will contain the number of bytes read.
+ * \param dwTimeout [in] Time to wait for data in milliseconds, can be INFINITE.
+ * \return TRUE on success, or FALSE on failure. GetLastError() returns
+ * ERROR_TIMEOUT if no data was received in time.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwStreamRead(
+	UKW_DEVICE lpDevice,
+	DWORD dwStreamId,
+	LPVOID lpBuffer,
+	DWORD dwBufferSize,
+	LPDWORD pBytesRead,
+	DWORD dwTimeout
+	);
+
+/**
+ * Sends data using a stream on an OUT endpoint.
+ *
+ * The data is copied into the buffer of the stream and sent in transfers
+ * of up to the transfer size of the stream. This waits for up to dwTimeout
+ * milliseconds for space in the buffer, and returns once all the data has
+ * been copied or the timeout has passed.
+ *
+ * Calling this with a dwBufferSize of 0 waits for all previously written
+ * data to be sent.
+ *
+ * \param lpDevice [in] The device the stream was started on.
+ * \param dwStreamId [in] The id returned by UkwStartStream().
+ * \param lpBuffer [in] The data to send.
+ * \param dwBufferSize [in] Size of the data.
+ * \param pBytesWritten [out] On success this will contain the number of bytes copied.
+ * \param dwTimeout [in] Time to wait for space in milliseconds, can be INFINITE.
+ * \return TRUE on success, or FALSE on failure. GetLastError() returns
+ * ERROR_TIMEOUT if none of the data could be copied in time.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwStreamWrite(
+	UKW_DEVICE lpDevice,
+	DWORD dwStreamId,
+	LPVOID lpBuffer,
+	DWORD dwBufferSize,
+	LPDWORD pBytesWritten,
+	DWORD dwTimeout
+	);
+
+/**
+ * Starts a bulk transfer with a USB device using part of a registered buffer.
+ *
+ * This behaves as UkwIssueBulkTransfer() except that the data is
+ * dwDataBufferSize bytes at dwBufferOffset in a buffer registered with
+ * UkwRegisterBuffer() on the same driver handle.
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param dwFlags [in] A bitwise or combination of the UKW_TF_* flags.
+ * \param Endpoint [in] The endpoint to send the bulk transfer to.
+ * \param dwBufferId [in] The id returned by UkwRegisterBuffer().
+ * \param dwBufferOffset [in] Offset of the data in the registered buffer.
+ * \param dwDataBufferSize [in] Size of the data.
+ * \param pBytesTransferred [out] Optional parameter which will be set to the number of bytes transferred on success.
+ * \param lpOverlapped [in] Optional parameter. If specified then request will be asynchronous.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwIssueRegisteredBulkTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	DWORD dwBufferId,
+	DWORD dwBufferOffset,
+	DWORD dwDataBufferSize,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped
+	);
+
+/**
+ * Starts a bulk transfer with a USB device using several buffers.
+ *
+ * This behaves as UkwIssueBulkTransfer() with a single buffer made up of
+ * the segments in lpSegments, in order. Data to send is gathered from the
+ * segments and received data is scattered into them, so that for example
+ * a header and a payload don't need to be copied into one buffer first.
+ * The driver issues a single transfer, so short packet handling is the
+ * same as for UkwIssueBulkTransfer().
+ *
+ * The segment list is only read during the call, but the segments must stay
+ * allocated until the transfer has completed.
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param dwFlags [in] A bitwise or combination of the UKW_TF_* flags.
+ * \param Endpoint [in] The endpoint to send the bulk transfer to.
+ * \param lpSegments [in] Array of buffers making up the data, totalling at most 1MB.
+ * \param dwSegments [in] Number of entries in lpSegments, up to 16.
+ * \param pBytesTransferred [out] Optional parameter which will be set to the total number of bytes transferred on success.
+ * \param lpOverlapped [in] Optional parameter. If specified then request will be asynchronous.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwIssueVectoredBulkTransfer(
+	UKW_DEVICE lpDevice,
+	DWORD dwFlags,
+	UCHAR Endpoint,
+	LPUKW_BUFFER_SEGMENT lpSegments,
+	DWORD dwSegments,
+	LPDWORD pBytesTransferred,
+	LPOVERLAPPED lpOverlapped
+	);
+
+/**
+ * Sets how large asynchronous bulk transfers are split by the driver.
+ *
+ * Once set, any bulk transfer started on the driver handle with an
+ * OVERLAPPED structure which is larger than dwChunkSize bytes is issued
+ * as a series of transfers of dwChunkSize bytes, with up to dwMaxChunks
+ * of them queued on the endpoint at once. The transfer still completes
+ * once, with the total number of bytes transferred.
+ *
+ * A chunk which ends with a short packet or an error ends the whole
+ * transfer. On an IN endpoint any data received by chunks already queued
+ * after that point is discarded, so devices which use short packets to
+ * separate messages should only be used with a dwMaxChunks of 1.
+ *
+ * Splitting is disabled by default, or by passing a dwChunkSize of 0.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \param dwChunkSize [in] Size of each chunk, a multiple of 1024 bytes, or 0.
+ * \param dwMaxChunks [in] Number of chunks to keep queued, up to 16.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwSetTransferSplit(
+	HANDLE hDriver,
+	DWORD dwChunkSize,
+	DWORD dwMaxChunks
+	);
+
+/**
+ * Starts a number of control and bulk transfers with a USB device.
+ *
+ * This behaves as if UkwIssueControlTransfer() or UkwIssueBulkTransfer()
+ * had been called for each entry in lpTransfers in turn, but needs far
+ * fewer calls into the driver. Transfers without an OVERLAPPED structure
+ * will complete before the following entries are started.
+ *
+ * A failure to start one transfer does not prevent the remaining transfers
+ * from being started. The dwError field of every entry is always updated.
+ *
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList()
+ * \param lpTransfers [in, out] Array of transfers to start.
+ * \param dwCount [in] Number of entries in lpTransfers.
+ * \return TRUE if all transfers were started, or FALSE if any failed. On failure
+ * GetLastError() returns the error of the first transfer which failed.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwIssueTransfers(
+	UKW_DEVICE lpDevice,
+	LPUKW_TRANSFER lpTransfers,
+	DWORD dwCount
+	);
+
+/**
+ * Enables the completion queue for a driver handle.
+ *
+ * Once enabled, every asynchronous transfer issued on any device retrieved
+ * using hDriver is added to the completion queue when it completes. The
+ * OVERLAPPED structure is still updated as normal, but the hEvent member
+ * can be set to NULL to avoid the cost of signalling an event for each
+ * transfer. Completed transfers are then retrieved with UkwReapCompletions().
+ *
+ * The completion queue can't be disabled again once enabled.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwEnableCompletionQueue(
+	HANDLE hDriver
+	);
+
+/**
+ * Retrieves completed transfers from the completion queue.
+ *
+ * Waits until at least one transfer has completed, or dwTimeout milliseconds
+ * have passed, and then retrieves as many completed transfers as are queued
+ * and fit in lpCompletions.
+ *
+ * If the timeout expires then FALSE is returned and GetLastError() returns
+ * ERROR_TIMEOUT. If the driver handle is closed while waiting then FALSE is
+ * returned and GetLastError() returns ERROR_OPERATION_ABORTED.
+ *
+ * \param hDriver [in] A driver handle with the completion queue enabled by UkwEnableCompletionQueue().
+ * \param lpCompletions [out] Array to fill with completed transfers.
+ * \param dwCount [in] Number of entries in lpCompletions.
+ * \param lpActualCount [out] On success this will contain the number of entries filled in.
+ * \param dwTimeout [in] Maximum time to wait in milliseconds, can be INFINITE.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwReapCompletions(
+	HANDLE hDriver,
+	LPUKW_COMPLETION lpCompletions,
+	DWORD dwCount,
+	LPDWORD lpActualCount,
+	DWORD dwTimeout
+	);
+
+/**
+ * Creates submission and completion rings shared between the
+ * calling process and the driver.
+ *
+ * Transfers are added to the submission ring with UkwQueueTransfer() without
+ * calling into the driver, and are started together by UkwSubmitRings().
+ * Completed transfers are written to the completion ring by the driver and
+ * retrieved with UkwPeekCompletions(), again without calling into the driver.
+ * Only asynchronous transfers, with an OVERLAPPED structure, can be queued.
+ * The hEvent member of the OVERLAPPED structures can be NULL.
+ *
+ * Creating rings enables the completion queue for hDriver, and completions
+ * for every asynchronous transfer on hDriver are delivered to the completion
+ * ring until it is destroyed. Only one set of rings can exist per driver handle.
+ *
+ * Shared rings need the driver to be able to access the caller's memory
+ * directly. If that isn't possible then FALSE is returned and GetLastError()
+ * returns ERROR_NOT_SUPPORTED; UkwIssueTransfers() and UkwReapCompletions()
+ * should be used instead.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \param dwSubmissionEntries [in] Size of the submission ring, a power of two no larger than 4096.
+ * \param dwCompletionEntries [in] Size of the completion ring, a power of two no larger than 4096.
+ * \param lpRings [out] On success this will contain the created rings.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwCreateRings(
+	HANDLE hDriver,
+	DWORD dwSubmissionEntries,
+	DWORD dwCompletionEntries,
+	LPUKW_RINGS lpRings
+	);
+
+/**
+ * Destroys rings created by UkwCreateRings().
+ *
+ * Transfers which are still in progress will be reported through
+ * UkwReapCompletions() once they complete.
+ *
+ * \param Rings [in] Rings created by UkwCreateRings().
+ */
+ceusbkwrapper_API void WINAPI UkwDestroyRings(
+	UKW_RINGS Rings
+	);
+
+/**
+ * Adds a transfer to the submission ring without starting it.
+ *
+ * The fields of lpTransfer are used as for UkwIssueTransfers(), apart from
+ * dwError which isn't updated. Any error starting the transfer is reported
+ * through the completion ring instead.
+ *
+ * If the submission ring is full then FALSE is returned and GetLastError()
+ * returns ERROR_BUSY. Calling UkwSubmitRings() will make space.
+ *
+ * \param Rings [in] Rings created by UkwCreateRings().
+ * \param lpDevice [in] A device retrieved using UkwGetDeviceList() on the same driver handle.
+ * \param lpTransfer [in] The transfer to queue. lpOverlapped must not be NULL.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwQueueTransfer(
+	UKW_RINGS Rings,
+	UKW_DEVICE lpDevice,
+	LPUKW_TRANSFER lpTransfer
+	);
+
+/**
+ * Starts all transfers in the submission ring, optionally waiting for
+ * completions to become available.
+ *
+ * If dwMinCompletions is non-zero then this waits until at least that many
+ * completions are in the completion ring, the completion ring is full, or
+ * dwTimeout milliseconds have passed. If the timeout expires then FALSE is
+ * returned and GetLastError() returns ERROR_TIMEOUT, although the queued
+ * transfers will still have been started.
+ *
+ * \param Rings [in] Rings created by UkwCreateRings().
+ * \param dwMinCompletions [in] Number of completions to wait for, can be 0.
+ * \param dwTimeout [in] Maximum time to wait in milliseconds, can be INFINITE.
+ * \param lpSubmitted [out] Optional parameter which will be set to the number of transfers started.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwSubmitRings(
+	UKW_RINGS Rings,
+	DWORD dwMinCompletions,
+	DWORD dwTimeout,
+	LPDWORD lpSubmitted
+	);
+
+/**
+ * Retrieves completed transfers from the completion ring without waiting.
+ *
+ * \param Rings [in] Rings created by UkwCreateRings().
+ * \param lpCompletions [out] Array to fill with completed transfers.
+ * \param dwCount [in] Number of entries in lpCompletions.
+ * \return The number of entries filled in, which can be 0.
+ */
+ceusbkwrapper_API DWORD WINAPI UkwPeekCompletions(
+	UKW_RINGS Rings,
+	LPUKW_COMPLETION lpCompletions,
+	DWORD dwCount
+	);
+
+/**
+ * Retrieves statistics about the transfer pool for a driver handle.
+ *
+ * The driver reuses transfer objects to avoid allocating them for every
+ * transfer. dwInUse is the number of transfers currently in progress and
+ * dwHighWaterMark is the largest that value has been since the handle was
+ * opened. dwFree is the number of transfer objects ready for reuse and
+ * dwAllocated is the total number which have been created. dwOversized
+ * counts transfers which were too large to be taken from the pool.
+ * Isochronous transfers are recycled separately and aren't included.
+ *
+ * \param hDriver [in] A driver handle opened by calling UkwOpenDriver().
+ * \param lpStats [out] Pointer to the structure to fill in.
+ * \return TRUE on success, or FALSE on failure.
+ */
+ceusbkwrapper_API BOOL WINAPI UkwGetTransferPoolStats(
+	HANDLE hDriver,
+	LPUKW_TRANSFER_POOL_STATS lpStats
+	);
+
 /**
  * Resets a USB device.
  *
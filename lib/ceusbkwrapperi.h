@@ -37,4 +37,17 @@ struct UKW_DEVICE_PRIV {
 	UKWD_USB_DEVICE_INFO info;
 };
 
+// Holds the shared submission and completion rings for a driver handle.
+struct UKW_RINGS_PRIV {
+	HANDLE hDriver;
+	LPVOID lpRegion;
+	DWORD dwRegionSize;
+	LPUKWD_RINGS_HEADER lpHeader;
+	LPUKWD_BATCH_TRANSFER_ENTRY lpSubmissions;
+	LPUKWD_COMPLETION lpCompletions;
+	// Serialises queueing submissions and peeking completions
+	CRITICAL_SECTION submitLock;
+	CRITICAL_SECTION completeLock;
+};
+
 #endif // CEUSBKWRAPPERI_H
\ No newline at end of file
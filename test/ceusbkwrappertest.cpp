@@ -32,6 +32,46 @@
 #define MAX_CONFIG_BUFFER 2048
 // Number of bytes per row when printing hex buffers
 #define BYTES_PER_ROW 8
+// Size of each transfer issued by the bulk benchmark
+#define BENCHMARK_TRANSFER_SIZE 16384
+// Maximum number of threads used by the bulk benchmark
+#define BENCHMARK_MAX_THREADS 8
+// Default number of transfers each benchmark thread issues
+#define BENCHMARK_DEFAULT_ITERATIONS 100
+// Maximum number of reads queued by the batched read command
+#define MAX_BATCH_TRANSFERS 32
+// Size of each read queued by the batched read command
+#define BATCH_TRANSFER_SIZE 512
+// Maximum number of reads queued by the cancel latency benchmark
+#define CANCEL_BENCHMARK_MAX_DEPTH 256
+// Size of each transfer kept queued by the streaming read command
+#define STREAM_TRANSFER_SIZE 16384
+// Number of transfers kept queued by the streaming read command
+#define STREAM_TRANSFERS 8
+// Size of the driver buffer used by the streaming read command
+#define STREAM_BUFFER_SIZE (STREAM_TRANSFER_SIZE * STREAM_TRANSFERS * 4)
+// Default number of bytes read by the streaming read command
+#define STREAM_DEFAULT_BYTES (4 * 1024 * 1024)
+// Size of the header buffer used by the vectored read command
+#define VECTORED_HEADER_SIZE 6
+// Size of the single read issued by the split read command
+#define SPLIT_READ_SIZE (1024 * 1024)
+// Chunk size and number of chunks queued by the split read command
+#define SPLIT_CHUNK_SIZE 65536
+#define SPLIT_CHUNKS 4
+// Default timeout used by the timed read command
+#define TIMED_READ_TIMEOUT 100
+// Maximum size of a report read by the interrupt commands
+#define INTERRUPT_REPORT_SIZE 64
+// Number of reports buffered by the interrupt subscription command
+#define INTERRUPT_REPORTS 16
+// Default number of reports printed by the interrupt subscription command
+#define INTERRUPT_DEFAULT_REPORTS 10
+// Number of frames and bytes per frame read by the isochronous command
+#define ISOCH_FRAMES 8
+#define ISOCH_FRAME_SIZE 192
+// Time the device event command waits for devices to be attached or detached
+#define DEVICE_EVENT_TIMEOUT 10000
 
 static HANDLE gDeviceHandle = INVALID_HANDLE_VALUE;
 static UKW_DEVICE gDeviceList[MAX_DEVICE_COUNT];
@@ -67,6 +107,16 @@ static void printMenu()
 			printf("a ) request AAP mode from device\n");
 			printf("br) read bulk transfer from AAP device\n");
 			printf("bw) write bulk transfer to AAP device\n");
+			printf("bv) read bulk transfer from AAP device into a header and payload buffer\n");
+			printf("bt) benchmark concurrent bulk transfers on AAP device\n");
+			printf("bg) benchmark concurrent bulk transfers using registered buffers\n");
+			printf("bq) queue a batch of bulk reads from AAP device\n");
+			printf("bc) queue bulk reads from AAP device and reap completions\n");
+			printf("bs) queue bulk reads from AAP device using shared rings\n");
+			printf("bl) benchmark cancel latency against queue depth on AAP device, one at a time and all at once\n");
+			printf("bd) stream bulk reads from AAP device and measure throughput\n");
+			printf("bx) compare a large bulk read from AAP device with and without splitting\n");
+			printf("bo) read bulk transfer from AAP device, timed out by the driver, asynchronously then synchronously\n");
 			printf("c ) read a configuration descriptor\n");
 			printf("o ) get active configuration value\n");
 			printf("s ) set active configuration value\n");
@@ -80,9 +130,14 @@ static void printMenu()
 			printf("hq ) test if an endpoint is halted");
 			printf("hc ) clear stall/halt (host) on an endpoint\n");
 			printf("hs ) clear stall/halt (device) on an endpoint\n");
+			printf("nr ) read an interrupt transfer from an endpoint\n");
+			printf("ns ) subscribe to an interrupt endpoint and print reports\n");
+			printf("x ) read isochronous frames from an endpoint\n");
 		} else {
 			printf("g ) get USB device list\n");
 		}
+		printf("e ) wait for devices to be attached or detached\n");
+		printf("fr) reload the interface filters from the registry\n");
 		printf("c ) close device\n");
 	}
 	printf("q ) quit\n");
@@ -109,13 +164,14 @@ static void closeDriver()
 static void getDeviceList()
 {
 	gDeviceListSize = 0;
-	if (UkwGetDeviceList(gDeviceHandle,
+	DWORD generation = 0;
+	if (UkwGetDeviceListWithGeneration(gDeviceHandle,
 			gDeviceList, sizeof(gDeviceList)/sizeof(gDeviceList[0]),
-			&gDeviceListSize))
-		printf("UkwGetDeviceList() succeeded with a list size of %d\n",
-			gDeviceListSize);
+			&gDeviceListSize, &generation))
+		printf("UkwGetDeviceListWithGeneration() succeeded with a list size of %d at generation %d\n",
+			gDeviceListSize, generation);
 	else
-		printf("UkwGetDeviceList() failed with error %d\n", GetLastError());
+		printf("UkwGetDeviceListWithGeneration() failed with error %d\n", GetLastError());
 }
 
 static void releaseDeviceList()
@@ -125,6 +181,43 @@ static void releaseDeviceList()
 	gDeviceListSize = 0;
 }
 
+static void waitForDeviceEvents()
+{
+	UKW_DEVICE_EVENT events[8];
+	DWORD count = 0;
+	DWORD generation = 0;
+	BOOL overflowed = FALSE;
+	printf("Waiting up to %d ms for device events\n", DEVICE_EVENT_TIMEOUT);
+	if (!UkwWaitForDeviceEvents(gDeviceHandle, events, sizeof(events) / sizeof(events[0]),
+			&count, &generation, &overflowed, DEVICE_EVENT_TIMEOUT)) {
+		if (GetLastError() == ERROR_TIMEOUT)
+			printf("No device events, device list generation %d\n", generation);
+		else
+			printf("Failed to wait for device events: %d\n", GetLastError());
+		return;
+	}
+	if (overflowed)
+		printf("Device events were dropped, the device list needs retrieving again\n");
+	for (DWORD i = 0; i < count; ++i) {
+		printf("Generation %d: device %s bus %d address %d session %d, vid: 0x%04x pid: 0x%04x\n",
+			events[i].dwGeneration,
+			events[i].dwType == UKW_DEVICE_EVENT_ATTACHED ? "attached" : "detached",
+			events[i].Bus, events[i].Address, events[i].SessionId,
+			events[i].Descriptor.idVendor, events[i].Descriptor.idProduct);
+	}
+	printf("Device list generation %d\n", generation);
+}
+
+static void reloadInterfaceFilters()
+{
+	DWORD count = 0;
+	if (!UkwReloadInterfaceFilters(gDeviceHandle, &count)) {
+		printf("Failed to reload interface filters: %d\n", GetLastError());
+		return;
+	}
+	printf("Reloaded %d interface filters\n", count);
+}
+
 static void printDeviceList()
 {
 	printf("\n%d available devices:\n", gDeviceListSize);
@@ -720,6 +813,546 @@ static BOOL findAAPEndpoints(UKW_DEVICE& device, UCHAR& epin, UCHAR& epout)
 	return TRUE;
 }
 
+struct BenchmarkThreadInfo {
+	UKW_DEVICE device;
+	DWORD flags;
+	UCHAR endpoint;
+	DWORD iterations;
+	BOOL registered;
+	DWORD bytesTransferred;
+	DWORD failures;
+};
+
+static DWORD WINAPI benchmarkThread(LPVOID lpParameter)
+{
+	BenchmarkThreadInfo* info = static_cast<BenchmarkThreadInfo*>(lpParameter);
+	UCHAR* buf = new UCHAR[BENCHMARK_TRANSFER_SIZE];
+	memset(buf, 0, BENCHMARK_TRANSFER_SIZE);
+	DWORD bufferId = 0;
+	if (info->registered &&
+		!UkwRegisterBuffer(gDeviceHandle, buf, BENCHMARK_TRANSFER_SIZE, &bufferId)) {
+		printf("Failed to register benchmark buffer: %d\n", GetLastError());
+		info->failures = info->iterations;
+		delete [] buf;
+		return 0;
+	}
+	for (DWORD i = 0; i < info->iterations; ++i) {
+		DWORD transferred = 0;
+		BOOL ret;
+		// Synchronous transfers, so each thread has one transfer outstanding
+		if (bufferId)
+			ret = UkwIssueRegisteredBulkTransfer(info->device, info->flags, info->endpoint,
+				bufferId, 0, BENCHMARK_TRANSFER_SIZE, &transferred, NULL);
+		else
+			ret = UkwIssueBulkTransfer(info->device, info->flags, info->endpoint,
+				buf, BENCHMARK_TRANSFER_SIZE, &transferred, NULL);
+		if (ret)
+			info->bytesTransferred += transferred;
+		else
+			++info->failures;
+	}
+	if (bufferId)
+		UkwUnregisterBuffer(gDeviceHandle, bufferId);
+	delete [] buf;
+	return 0;
+}
+
+// Issues synchronous bulk transfers from an increasing number of threads
+// sharing the one driver handle and reports the aggregate throughput.
+// Even numbered threads read from the IN endpoint and odd numbered threads
+// write to the OUT endpoint, so the accessory application on the device
+// needs to be reading and writing data for the benchmark to complete.
+static void benchmarkAAPBulkTransfers(UKW_DEVICE device, UCHAR epin, UCHAR epout, char* linePtr, BOOL registered)
+{
+	DWORD maxThreads = BENCHMARK_MAX_THREADS;
+	linePtr = parseNumber(linePtr, maxThreads);
+	if (maxThreads == 0 || maxThreads > BENCHMARK_MAX_THREADS) {
+		printf("Invalid thread count provided, the maximum is %d\n", BENCHMARK_MAX_THREADS);
+		return;
+	}
+	DWORD iterations = BENCHMARK_DEFAULT_ITERATIONS;
+	if (linePtr)
+		parseNumber(linePtr, iterations);
+
+	BenchmarkThreadInfo info[BENCHMARK_MAX_THREADS];
+	HANDLE threads[BENCHMARK_MAX_THREADS];
+	for (DWORD threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+		DWORD started = 0;
+		DWORD startTime = GetTickCount();
+		for (; started < threadCount; ++started) {
+			info[started].device = device;
+			if (started % 2 == 0) {
+				info[started].flags = UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK;
+				info[started].endpoint = epin;
+			} else {
+				info[started].flags = UKW_TF_OUT_TRANSFER;
+				info[started].endpoint = epout;
+			}
+			info[started].iterations = iterations;
+			info[started].registered = registered;
+			info[started].bytesTransferred = 0;
+			info[started].failures = 0;
+			threads[started] = CreateThread(NULL, 0, benchmarkThread, &info[started], 0, NULL);
+			if (threads[started] == NULL) {
+				printf("Failed to create benchmark thread: %d\n", GetLastError());
+				break;
+			}
+		}
+		if (started > 0)
+			WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+		DWORD elapsed = GetTickCount() - startTime;
+		DWORD totalBytes = 0;
+		DWORD totalFailures = 0;
+		for (DWORD i = 0; i < started; ++i) {
+			CloseHandle(threads[i]);
+			totalBytes += info[i].bytesTransferred;
+			totalFailures += info[i].failures;
+		}
+		if (started != threadCount)
+			return;
+		if (elapsed == 0)
+			elapsed = 1;
+		printf("%d thread(s): %d bytes in %d ms (%d KB/s), %d failed transfers\n",
+			threadCount, totalBytes, elapsed, (totalBytes / elapsed) * 1000 / 1024,
+			totalFailures);
+	}
+
+	UKW_TRANSFER_POOL_STATS stats;
+	if (UkwGetTransferPoolStats(gDeviceHandle, &stats)) {
+		printf("Transfer pool: %d in use, high water mark %d, %d free, %d allocated, %d oversized\n",
+			stats.dwInUse, stats.dwHighWaterMark, stats.dwFree, stats.dwAllocated, stats.dwOversized);
+	} else {
+		printf("Failed to get transfer pool stats: %d\n", GetLastError());
+	}
+}
+
+// Queues a number of asynchronous reads with a single call to
+// UkwIssueTransfers() and then waits for each of them in turn.
+static void queueAAPBulkReads(UKW_DEVICE device, UCHAR epin, char* linePtr)
+{
+	DWORD count = MAX_BATCH_TRANSFERS;
+	parseNumber(linePtr, count);
+	if (count == 0 || count > MAX_BATCH_TRANSFERS) {
+		printf("Invalid transfer count provided, the maximum is %d\n", MAX_BATCH_TRANSFERS);
+		return;
+	}
+
+	UKW_TRANSFER transfers[MAX_BATCH_TRANSFERS];
+	OVERLAPPED overlapped[MAX_BATCH_TRANSFERS];
+	DWORD bytesTransferred[MAX_BATCH_TRANSFERS];
+	UCHAR* buf = new UCHAR[count * BATCH_TRANSFER_SIZE];
+	DWORD i;
+	memset(transfers, 0, sizeof(transfers));
+	memset(overlapped, 0, sizeof(overlapped));
+	for (i = 0; i < count; ++i) {
+		overlapped[i].hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (overlapped[i].hEvent == NULL) {
+			printf("Failed to create event for asynchronous request.\n");
+			goto out;
+		}
+		transfers[i].dwType = UKW_TRANSFER_TYPE_BULK;
+		transfers[i].dwFlags = UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK;
+		transfers[i].Endpoint = epin;
+		transfers[i].lpDataBuffer = buf + i * BATCH_TRANSFER_SIZE;
+		transfers[i].dwDataBufferSize = BATCH_TRANSFER_SIZE;
+		transfers[i].pBytesTransferred = &bytesTransferred[i];
+		transfers[i].lpOverlapped = &overlapped[i];
+	}
+
+	if (!UkwIssueTransfers(device, transfers, count))
+		printf("UkwIssueTransfers() failed for at least one transfer: %d\n", GetLastError());
+
+	for (i = 0; i < count; ++i) {
+		if (transfers[i].dwError != ERROR_SUCCESS) {
+			printf("Transfer %d failed to start with %d\n", i, transfers[i].dwError);
+			continue;
+		}
+		if (waitForOverlapped(overlapped[i])) {
+			printf("Transfer %d read %d bytes\n", i, bytesTransferred[i]);
+			continue;
+		}
+		if (!UkwCancelTransfer(device, &overlapped[i], 0)) {
+			printf("Attempt to cancel timed out transfer %d failed with %d\n", i, GetLastError());
+			continue;
+		}
+		if (!waitForOverlapped(overlapped[i]))
+			printf("Timeout out waiting for cancel of transfer %d to complete\n", i);
+		else
+			printf("Transfer %d cancelled with Internal: %d\n", i, overlapped[i].Internal);
+	}
+out:
+	for (i = 0; i < count; ++i) {
+		if (overlapped[i].hEvent)
+			CloseHandle(overlapped[i].hEvent);
+	}
+	delete [] buf;
+}
+
+// Enables the completion queue and queues a number of reads without
+// events, then reaps the completions until all have finished.
+static void reapAAPBulkReads(UKW_DEVICE device, UCHAR epin, char* linePtr)
+{
+	DWORD count = MAX_BATCH_TRANSFERS;
+	parseNumber(linePtr, count);
+	if (count == 0 || count > MAX_BATCH_TRANSFERS) {
+		printf("Invalid transfer count provided, the maximum is %d\n", MAX_BATCH_TRANSFERS);
+		return;
+	}
+	if (!UkwEnableCompletionQueue(gDeviceHandle)) {
+		printf("Failed to enable completion queue: %d\n", GetLastError());
+		return;
+	}
+
+	UKW_TRANSFER transfers[MAX_BATCH_TRANSFERS];
+	OVERLAPPED overlapped[MAX_BATCH_TRANSFERS];
+	UCHAR* buf = new UCHAR[count * BATCH_TRANSFER_SIZE];
+	DWORD i;
+	memset(transfers, 0, sizeof(transfers));
+	memset(overlapped, 0, sizeof(overlapped));
+	for (i = 0; i < count; ++i) {
+		transfers[i].dwType = UKW_TRANSFER_TYPE_BULK;
+		transfers[i].dwFlags = UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK;
+		transfers[i].Endpoint = epin;
+		transfers[i].lpDataBuffer = buf + i * BATCH_TRANSFER_SIZE;
+		transfers[i].dwDataBufferSize = BATCH_TRANSFER_SIZE;
+		transfers[i].lpOverlapped = &overlapped[i];
+	}
+	UkwIssueTransfers(device, transfers, count);
+	DWORD outstanding = 0;
+	for (i = 0; i < count; ++i) {
+		if (transfers[i].dwError == ERROR_SUCCESS)
+			++outstanding;
+		else
+			printf("Transfer %d failed to start with %d\n", i, transfers[i].dwError);
+	}
+
+	BOOL cancelled = FALSE;
+	UKW_COMPLETION completions[MAX_BATCH_TRANSFERS];
+	while (outstanding > 0) {
+		DWORD reaped = 0;
+		if (!UkwReapCompletions(gDeviceHandle, completions, MAX_BATCH_TRANSFERS, &reaped, ASYNC_TIMEOUT)) {
+			if (GetLastError() != ERROR_TIMEOUT || cancelled) {
+				printf("Failed to reap completions: %d\n", GetLastError());
+				break;
+			}
+			printf("Timed out waiting for completions, cancelling %d transfers\n", outstanding);
+			for (i = 0; i < count; ++i) {
+				if (transfers[i].dwError == ERROR_SUCCESS)
+					UkwCancelTransfer(device, &overlapped[i], UKW_TF_NO_WAIT);
+			}
+			cancelled = TRUE;
+			continue;
+		}
+		printf("Reaped %d completions:\n", reaped);
+		for (i = 0; i < reaped; ++i) {
+			DWORD index = completions[i].lpOverlapped - overlapped;
+			printf("  Transfer %d completed with %d, %d bytes\n",
+				index, completions[i].dwError, completions[i].dwBytesTransferred);
+		}
+		outstanding -= reaped;
+	}
+	delete [] buf;
+}
+
+static void ringAAPBulkReads(UKW_DEVICE device, UCHAR epin, char* linePtr)
+{
+	DWORD count = MAX_BATCH_TRANSFERS;
+	parseNumber(linePtr, count);
+	if (count == 0 || count > MAX_BATCH_TRANSFERS) {
+		printf("Invalid transfer count provided, the maximum is %d\n", MAX_BATCH_TRANSFERS);
+		return;
+	}
+	UKW_RINGS rings = NULL;
+	if (!UkwCreateRings(gDeviceHandle, MAX_BATCH_TRANSFERS, MAX_BATCH_TRANSFERS, &rings)) {
+		printf("Failed to create shared rings: %d\n", GetLastError());
+		return;
+	}
+
+	UKW_TRANSFER transfer;
+	OVERLAPPED overlapped[MAX_BATCH_TRANSFERS];
+	UCHAR* buf = new UCHAR[count * BATCH_TRANSFER_SIZE];
+	DWORD i;
+	memset(&transfer, 0, sizeof(transfer));
+	memset(overlapped, 0, sizeof(overlapped));
+	transfer.dwType = UKW_TRANSFER_TYPE_BULK;
+	transfer.dwFlags = UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK;
+	transfer.Endpoint = epin;
+	transfer.dwDataBufferSize = BATCH_TRANSFER_SIZE;
+	for (i = 0; i < count; ++i) {
+		transfer.lpDataBuffer = buf + i * BATCH_TRANSFER_SIZE;
+		transfer.lpOverlapped = &overlapped[i];
+		if (!UkwQueueTransfer(rings, device, &transfer)) {
+			printf("Failed to queue transfer %d: %d\n", i, GetLastError());
+			count = i;
+			break;
+		}
+	}
+
+	DWORD submitted = 0;
+	BOOL cancelled = FALSE;
+	DWORD outstanding = count;
+	UKW_COMPLETION completions[MAX_BATCH_TRANSFERS];
+	while (outstanding > 0) {
+		DWORD started = 0;
+		if (!UkwSubmitRings(rings, 1, ASYNC_TIMEOUT, &started)) {
+			if (GetLastError() != ERROR_TIMEOUT) {
+				printf("Failed to wait for completions: %d\n", GetLastError());
+				break;
+			}
+			if (cancelled) {
+				printf("Timed out waiting for cancelled transfers\n");
+				break;
+			}
+			printf("Timed out waiting for completions, cancelling %d transfers\n", outstanding);
+			for (i = 0; i < count; ++i)
+				UkwCancelTransfer(device, &overlapped[i], UKW_TF_NO_WAIT);
+			cancelled = TRUE;
+		}
+		submitted += started;
+		DWORD reaped = UkwPeekCompletions(rings, completions, MAX_BATCH_TRANSFERS);
+		if (reaped == 0)
+			continue;
+		printf("Peeked %d completions:\n", reaped);
+		for (i = 0; i < reaped; ++i) {
+			DWORD index = completions[i].lpOverlapped - overlapped;
+			printf("  Transfer %d completed with %d, %d bytes\n",
+				index, completions[i].dwError, completions[i].dwBytesTransferred);
+		}
+		outstanding -= reaped;
+	}
+	printf("Submitted %d transfers using shared rings\n", submitted);
+	if (outstanding > 0) {
+		// Transfers still in progress would write into buf and overlapped
+		// once they have been freed, so wait for each of them to finish.
+		// Any still queued in the submission ring are never started once
+		// the rings are destroyed.
+		for (i = 0; i < count; ++i)
+			UkwCancelTransfer(device, &overlapped[i], 0);
+	}
+	UkwDestroyRings(rings);
+	delete [] buf;
+}
+
+// Reads data from a stream until the requested number of bytes has
+// been received, reporting the throughput achieved.
+static void streamAAPBulkReads(UKW_DEVICE device, UCHAR epin, char* linePtr)
+{
+	DWORD total = STREAM_DEFAULT_BYTES;
+	parseNumber(linePtr, total);
+	if (total == 0) {
+		printf("Invalid byte count provided\n");
+		return;
+	}
+	DWORD streamId = 0;
+	if (!UkwStartStream(device, epin, STREAM_TRANSFER_SIZE, STREAM_TRANSFERS, STREAM_BUFFER_SIZE, &streamId)) {
+		printf("Failed to start stream on endpoint %d: %d\n", epin, GetLastError());
+		return;
+	}
+	UCHAR* buf = new UCHAR[STREAM_TRANSFER_SIZE];
+	DWORD received = 0;
+	DWORD reads = 0;
+	DWORD startTime = GetTickCount();
+	while (received < total) {
+		DWORD bytesRead = 0;
+		if (!UkwStreamRead(device, streamId, buf, STREAM_TRANSFER_SIZE, &bytesRead, ASYNC_TIMEOUT)) {
+			printf("Stream read failed after %d bytes: %d\n", received, GetLastError());
+			break;
+		}
+		received += bytesRead;
+		++reads;
+	}
+	DWORD elapsed = GetTickCount() - startTime;
+	printf("Read %d bytes in %d reads in %d ms", received, reads, elapsed);
+	if (elapsed > 0)
+		printf(" (%d KB/s)", (received / 1024) * 1000 / elapsed);
+	printf("\n");
+	if (!UkwStopStream(device, streamId))
+		printf("Failed to stop stream: %d\n", GetLastError());
+	delete [] buf;
+}
+
+// Issues the same large read with splitting disabled and then
+// enabled, reporting how long each took to complete.
+static void splitAAPBulkRead(UKW_DEVICE device, UCHAR epin, char* linePtr)
+{
+	DWORD chunks = SPLIT_CHUNKS;
+	parseNumber(linePtr, chunks);
+	if (chunks == 0) {
+		printf("Invalid chunk count provided\n");
+		return;
+	}
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (overlapped.hEvent == NULL) {
+		printf("Failed to create event for asynchronous request.\n");
+		return;
+	}
+	UCHAR* buf = new UCHAR[SPLIT_READ_SIZE];
+	for (int split = 0; split < 2; ++split) {
+		if (!UkwSetTransferSplit(gDeviceHandle, split ? SPLIT_CHUNK_SIZE : 0, chunks)) {
+			printf("Failed to set transfer split: %d\n", GetLastError());
+			break;
+		}
+		DWORD bytesTransferred = 0;
+		DWORD startTime = GetTickCount();
+		if (!UkwIssueBulkTransfer(device, UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK, epin,
+				buf, SPLIT_READ_SIZE, &bytesTransferred, &overlapped)) {
+			printf("Failed to read bulk transfer from endpoint %d: error %d\n", epin, GetLastError());
+			break;
+		}
+		if (!waitForOverlapped(overlapped)) {
+			UkwCancelTransfer(device, &overlapped, 0);
+			printf("Cancelled transfer due to timeout\n");
+			waitForOverlapped(overlapped);
+		}
+		DWORD elapsed = GetTickCount() - startTime;
+		printf("%s: read %d bytes in %d ms (error %d)\n",
+			split ? "Split" : "Unsplit", bytesTransferred, elapsed, overlapped.Internal);
+	}
+	UkwSetTransferSplit(gDeviceHandle, 0, 0);
+	delete [] buf;
+	CloseHandle(overlapped.hEvent);
+}
+
+// Reads with a timeout handled by the driver, so the transfer
+// should complete with ERROR_TIMEOUT if the device sends nothing.
+static void timedAAPBulkRead(UKW_DEVICE device, UCHAR epin, char* linePtr)
+{
+	DWORD timeout = TIMED_READ_TIMEOUT;
+	parseNumber(linePtr, timeout);
+	if (timeout == 0 || timeout >= ASYNC_TIMEOUT) {
+		printf("Invalid timeout provided, it must be less than %d ms\n", ASYNC_TIMEOUT);
+		return;
+	}
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (overlapped.hEvent == NULL) {
+		printf("Failed to create event for asynchronous request.\n");
+		return;
+	}
+	UCHAR buf[BATCH_TRANSFER_SIZE];
+	DWORD bytesTransferred = 0;
+	DWORD startTime = GetTickCount();
+	if (!UkwIssueBulkTransferTimeout(device, UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK, epin,
+			buf, sizeof(buf), &bytesTransferred, &overlapped, timeout)) {
+		printf("Failed to read bulk transfer from endpoint %d: error %d\n", epin, GetLastError());
+	} else if (waitForOverlapped(overlapped)) {
+		DWORD elapsed = GetTickCount() - startTime;
+		if (overlapped.Internal == ERROR_TIMEOUT)
+			printf("Timed out after %d ms\n", elapsed);
+		else
+			printf("Read %d bytes in %d ms (error %d)\n", bytesTransferred, elapsed, overlapped.Internal);
+	} else {
+		UkwCancelTransfer(device, &overlapped, 0);
+		printf("Driver failed to time out transfer, cancelled it\n");
+		waitForOverlapped(overlapped);
+	}
+	CloseHandle(overlapped.hEvent);
+
+	// The same again, with the driver blocking until the timeout
+	bytesTransferred = 0;
+	startTime = GetTickCount();
+	if (UkwIssueBulkTransferTimeout(device, UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK, epin,
+			buf, sizeof(buf), &bytesTransferred, NULL, timeout)) {
+		printf("Synchronously read %d bytes in %d ms\n", bytesTransferred, GetTickCount() - startTime);
+	} else if (GetLastError() == ERROR_TIMEOUT) {
+		printf("Synchronous read timed out after %d ms\n", GetTickCount() - startTime);
+	} else {
+		printf("Synchronous read failed with %d\n", GetLastError());
+	}
+}
+
+// Queues increasing numbers of reads and measures how long it
+// takes to cancel all of them, which should grow linearly when
+// cancelled one at a time. Each depth is then repeated cancelling
+// the whole endpoint with a single request.
+static void benchmarkAAPCancelLatency(UKW_DEVICE device, UCHAR epin, char* linePtr)
+{
+	DWORD maxDepth = CANCEL_BENCHMARK_MAX_DEPTH;
+	parseNumber(linePtr, maxDepth);
+	if (maxDepth == 0 || maxDepth > CANCEL_BENCHMARK_MAX_DEPTH) {
+		printf("Invalid queue depth provided, the maximum is %d\n", CANCEL_BENCHMARK_MAX_DEPTH);
+		return;
+	}
+	LARGE_INTEGER frequency;
+	if (!QueryPerformanceFrequency(&frequency) || frequency.QuadPart == 0) {
+		printf("No performance counter available\n");
+		return;
+	}
+
+	UKW_TRANSFER* transfers = new UKW_TRANSFER[maxDepth];
+	OVERLAPPED* overlapped = new OVERLAPPED[maxDepth];
+	UCHAR* buf = new UCHAR[maxDepth * BATCH_TRANSFER_SIZE];
+	DWORD i;
+	memset(overlapped, 0, maxDepth * sizeof(OVERLAPPED));
+	for (i = 0; i < maxDepth; ++i) {
+		overlapped[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (overlapped[i].hEvent == NULL) {
+			printf("Failed to create event: %d\n", GetLastError());
+			maxDepth = i;
+			break;
+		}
+		// The same events are used at every depth, so avoid
+		// the driver duplicating them for every transfer.
+		if (!UkwRegisterEvent(gDeviceHandle, overlapped[i].hEvent))
+			printf("Failed to register event %d: %d\n", i, GetLastError());
+	}
+
+	for (DWORD depth = 1; depth <= maxDepth; depth *= 2) {
+		for (int cancelAll = 0; cancelAll < 2; ++cancelAll) {
+			memset(transfers, 0, depth * sizeof(UKW_TRANSFER));
+			for (i = 0; i < depth; ++i) {
+				ResetEvent(overlapped[i].hEvent);
+				transfers[i].dwType = UKW_TRANSFER_TYPE_BULK;
+				transfers[i].dwFlags = UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK;
+				transfers[i].Endpoint = epin;
+				transfers[i].lpDataBuffer = buf + i * BATCH_TRANSFER_SIZE;
+				transfers[i].dwDataBufferSize = BATCH_TRANSFER_SIZE;
+				transfers[i].lpOverlapped = &overlapped[i];
+			}
+			if (!UkwIssueTransfers(device, transfers, depth))
+				printf("Some transfers failed to start, first error %d\n", GetLastError());
+
+			LARGE_INTEGER start, end;
+			DWORD cancelled = 0;
+			QueryPerformanceCounter(&start);
+			if (cancelAll) {
+				// Waits for all of the reads to complete as well
+				if (!UkwCancelAllTransfers(device, UKW_CANCEL_SCOPE_ENDPOINT, 0, epin, 0, &cancelled))
+					printf("Failed to cancel all transfers: %d\n", GetLastError());
+			} else {
+				// Cancel the most recently queued reads first, as a
+				// stream would when tearing down its queue.
+				for (i = depth; i > 0; --i) {
+					if (transfers[i - 1].dwError == ERROR_SUCCESS &&
+						UkwCancelTransfer(device, &overlapped[i - 1], UKW_TF_NO_WAIT))
+						++cancelled;
+				}
+			}
+			QueryPerformanceCounter(&end);
+			for (i = 0; i < depth; ++i) {
+				if (transfers[i].dwError == ERROR_SUCCESS)
+					waitForOverlapped(overlapped[i]);
+			}
+			DWORD elapsedUs = static_cast<DWORD>(
+				(end.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart);
+			printf("Depth %d: %s %d transfers in %d us (%d us per cancel)\n",
+				depth, cancelAll ? "cancelled all" : "cancelled", cancelled, elapsedUs,
+				cancelled ? elapsedUs / cancelled : 0);
+		}
+	}
+
+	for (i = 0; i < maxDepth; ++i) {
+		UkwUnregisterEvent(gDeviceHandle, overlapped[i].hEvent);
+		CloseHandle(overlapped[i].hEvent);
+	}
+	delete [] buf;
+	delete [] overlapped;
+	delete [] transfers;
+}
+
 static void startAAPBulkTransfer(char line[])
 {
 	char* linePtr = line + 1;
@@ -818,6 +1451,79 @@ static void startAAPBulkTransfer(char line[])
 				}
 				break;
 			}
+		case 'v':
+			{
+				// Read a transfer, splitting off the first bytes as a header
+				UCHAR header[VECTORED_HEADER_SIZE];
+				UKW_BUFFER_SEGMENT segments[2];
+				segments[0].lpBuffer = header;
+				segments[0].dwBufferSize = sizeof(header);
+				segments[1].lpBuffer = buf;
+				segments[1].dwBufferSize = sizeof(buf);
+				if (!UkwIssueVectoredBulkTransfer(device, UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK, epin,
+						segments, 2, &bytesTransferred, &overlapped)) {
+					printf("Failed to read vectored bulk transfer from endpoint %d on device %d: error %d\n", epin, devIdx, GetLastError());
+				} else if (waitForOverlapped(overlapped)) {
+					printf("Read %d bytes\n", bytesTransferred);
+					DWORD headerBytes = min(bytesTransferred, sizeof(header));
+					printf("Header:\n");
+					printHexDump(header, headerBytes);
+					if (bytesTransferred > headerBytes) {
+						printf("Payload:\n");
+						printHexDump(buf, bytesTransferred - headerBytes);
+					}
+				} else {
+					UkwCancelTransfer(device, &overlapped, 0);
+					printf("Cancelled transfer due to timeout\n");
+					waitForOverlapped(overlapped);
+				}
+				break;
+			}
+		case 't':
+			{
+				benchmarkAAPBulkTransfers(device, epin, epout, linePtr, FALSE);
+				break;
+			}
+		case 'g':
+			{
+				benchmarkAAPBulkTransfers(device, epin, epout, linePtr, TRUE);
+				break;
+			}
+		case 'q':
+			{
+				queueAAPBulkReads(device, epin, linePtr);
+				break;
+			}
+		case 'c':
+			{
+				reapAAPBulkReads(device, epin, linePtr);
+				break;
+			}
+		case 's':
+			{
+				ringAAPBulkReads(device, epin, linePtr);
+				break;
+			}
+		case 'l':
+			{
+				benchmarkAAPCancelLatency(device, epin, linePtr);
+				break;
+			}
+		case 'd':
+			{
+				streamAAPBulkReads(device, epin, linePtr);
+				break;
+			}
+		case 'x':
+			{
+				splitAAPBulkRead(device, epin, linePtr);
+				break;
+			}
+		case 'o':
+			{
+				timedAAPBulkRead(device, epin, linePtr);
+				break;
+			}
 		default: 
 			{
 				printf("Don't know bulk transfer operation '%c', doing nothing\n", line[0]);
@@ -892,6 +1598,149 @@ static void performHaltOperation(char line[])
 	}
 }
 
+static void performInterruptOperation(char line[])
+{
+	char* linePtr = line + 1;
+
+	// Parse the device index
+	DWORD devIdx = 0;
+	linePtr = parseNumber(linePtr, devIdx);
+	if (!linePtr) {
+		printf("Please provide a decimal device number following the command\n");
+		return;
+	}
+	DWORD endpoint = 0;
+	linePtr = parseNumber(linePtr, endpoint);
+	if (!linePtr) {
+		printf("Please provide a decimal endpoint number following the command\n");
+		return;
+	}
+	if (devIdx >= gDeviceListSize || devIdx < 0) {
+		printf("Invalid device index '%d' provided\n", devIdx);
+		return;
+	}
+	if (endpoint >= UCHAR_MAX || endpoint < 0) {
+		printf("Invalid endpoint '%d' provided\n", endpoint);
+		return;
+	}
+	UKW_DEVICE device = gDeviceList[devIdx];
+	UCHAR ep = static_cast<UCHAR>(endpoint);
+	UCHAR buf[INTERRUPT_REPORT_SIZE];
+	switch (line[0]) {
+	case 'r':
+		{
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (overlapped.hEvent == NULL) {
+			printf("Failed to create event for asynchronous request.\n");
+			return;
+		}
+		DWORD bytesTransferred = 0;
+		if (!UkwIssueInterruptTransfer(device, UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK, ep,
+				buf, sizeof(buf), &bytesTransferred, &overlapped)) {
+			printf("Failed to read interrupt transfer from endpoint %d on device %d: %d\n", ep, devIdx, GetLastError());
+		} else if (waitForOverlapped(overlapped)) {
+			printf("Read %d bytes\n", bytesTransferred);
+			printHexDump(buf, bytesTransferred);
+		} else {
+			UkwCancelTransfer(device, &overlapped, 0);
+			printf("Cancelled transfer due to timeout\n");
+			waitForOverlapped(overlapped);
+		}
+		CloseHandle(overlapped.hEvent);
+		break;
+		}
+	case 's':
+		{
+		DWORD count = INTERRUPT_DEFAULT_REPORTS;
+		parseNumber(linePtr, count);
+		DWORD subscriptionId = 0;
+		if (!UkwSubscribeInterrupt(device, ep, INTERRUPT_REPORT_SIZE, INTERRUPT_REPORTS, &subscriptionId)) {
+			printf("Failed to subscribe to endpoint %d on device %d: %d\n", ep, devIdx, GetLastError());
+			break;
+		}
+		for (DWORD i = 0; i < count; ++i) {
+			DWORD bytesRead = 0;
+			if (!UkwStreamRead(device, subscriptionId, buf, sizeof(buf), &bytesRead, ASYNC_TIMEOUT)) {
+				printf("Failed to read report %d: %d\n", i, GetLastError());
+				break;
+			}
+			printf("Report %d, %d bytes\n", i, bytesRead);
+			printHexDump(buf, bytesRead);
+		}
+		if (!UkwStopStream(device, subscriptionId))
+			printf("Failed to unsubscribe: %d\n", GetLastError());
+		break;
+		}
+	default:
+		printf("Unknown interrupt operation provided\n");
+		break;
+	}
+}
+
+static void readIsochFrames(char line[])
+{
+	char* linePtr = line;
+
+	// Parse the device index
+	DWORD devIdx = 0;
+	linePtr = parseNumber(linePtr, devIdx);
+	if (!linePtr) {
+		printf("Please provide a decimal device number following the command\n");
+		return;
+	}
+	DWORD endpoint = 0;
+	linePtr = parseNumber(linePtr, endpoint);
+	if (!linePtr) {
+		printf("Please provide a decimal endpoint number following the command\n");
+		return;
+	}
+	if (devIdx >= gDeviceListSize || devIdx < 0) {
+		printf("Invalid device index '%d' provided\n", devIdx);
+		return;
+	}
+	if (endpoint >= UCHAR_MAX || endpoint < 0) {
+		printf("Invalid endpoint '%d' provided\n", endpoint);
+		return;
+	}
+	UKW_DEVICE device = gDeviceList[devIdx];
+	UCHAR ep = static_cast<UCHAR>(endpoint);
+	UCHAR buf[ISOCH_FRAMES * ISOCH_FRAME_SIZE];
+	UKW_ISOCH_FRAME frames[ISOCH_FRAMES];
+	for (DWORD i = 0; i < ISOCH_FRAMES; ++i) {
+		frames[i].dwLength = ISOCH_FRAME_SIZE;
+		frames[i].dwBytesTransferred = 0;
+		frames[i].dwError = ERROR_SUCCESS;
+	}
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (overlapped.hEvent == NULL) {
+		printf("Failed to create event for asynchronous request.\n");
+		return;
+	}
+	DWORD bytesTransferred = 0;
+	if (!UkwIssueIsochTransfer(device,
+			UKW_TF_IN_TRANSFER | UKW_TF_SHORT_TRANSFER_OK | UKW_TF_START_ISOCH_ASAP, ep,
+			0, frames, ISOCH_FRAMES, buf, sizeof(buf), &bytesTransferred, &overlapped)) {
+		printf("Failed to read isochronous transfer from endpoint %d on device %d: %d\n", ep, devIdx, GetLastError());
+	} else if (waitForOverlapped(overlapped)) {
+		printf("Read %d bytes\n", bytesTransferred);
+		UCHAR* frameData = buf;
+		for (DWORD i = 0; i < ISOCH_FRAMES; ++i) {
+			printf("Frame %d, %d bytes, error %d\n", i, frames[i].dwBytesTransferred, frames[i].dwError);
+			printHexDump(frameData, frames[i].dwBytesTransferred);
+			frameData += frames[i].dwLength;
+		}
+	} else {
+		UkwCancelTransfer(device, &overlapped, 0);
+		printf("Cancelled transfer due to timeout\n");
+		waitForOverlapped(overlapped);
+	}
+	CloseHandle(overlapped.hEvent);
+}
+
 static BOOL handleCommand(char line[])
 {
 	BOOL ret = TRUE;
@@ -911,6 +1760,12 @@ static BOOL handleCommand(char line[])
 		gDeviceHandle != INVALID_HANDLE_VALUE &&
 		gDeviceListSize > 0)
 		printDeviceList();
+	else if (strcmp(line, "e") == 0 &&
+		gDeviceHandle != INVALID_HANDLE_VALUE)
+		waitForDeviceEvents();
+	else if (strcmp(line, "fr") == 0 &&
+		gDeviceHandle != INVALID_HANDLE_VALUE)
+		reloadInterfaceFilters();
 	else if (strcmp(line, "r") == 0 &&
 		gDeviceHandle != INVALID_HANDLE_VALUE &&
 		gDeviceListSize > 0)
@@ -955,6 +1810,14 @@ static BOOL handleCommand(char line[])
 		gDeviceHandle != INVALID_HANDLE_VALUE &&
 		gDeviceListSize > 0)
 		performHaltOperation(line + 1);
+	else if (line[0] == 'n' &&
+		gDeviceHandle != INVALID_HANDLE_VALUE &&
+		gDeviceListSize > 0)
+		performInterruptOperation(line + 1);
+	else if (line[0] == 'x' &&
+		gDeviceHandle != INVALID_HANDLE_VALUE &&
+		gDeviceListSize > 0)
+		readIsochFrames(line + 1);
 	else
 		printf("Unknown command '%s'\n", line);
 	return ret;
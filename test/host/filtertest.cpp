@@ -0,0 +1,177 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+// filtertest.cpp : Host-side tests for the interface filter index, checking
+// it finds the same filter as walking the list and timing the two.
+
+#include "StdAfx.h"
+#include "InterfaceFilterIndex.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// Number of interfaces looked up for each filter count
+#define FILTER_LOOKUPS 10000
+
+static DWORD gLastError;
+static int gFailures;
+
+void SetLastError(DWORD dwError)
+{
+	gLastError = dwError;
+}
+
+DWORD GetLastError()
+{
+	return gLastError;
+}
+
+// Small deterministic generator so that every run uses the same filters
+// and lookups.
+static DWORD NextRandom(DWORD& seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void SetField(INTERFACE_FILTER_FIELD& field, DWORD value, BOOL match)
+{
+	field.match = match;
+	field.value = value;
+}
+
+// Mostly vendor and product filters, as used to keep particular devices
+// away from other drivers, with a mix of the other kinds.
+static void MakeFilters(PFILTER_NODE nodes, DWORD dwFilters)
+{
+	DWORD seed = 1;
+	for (DWORD i = 0; i < dwFilters; ++i) {
+		INTERFACE_FILTER& filter = nodes[i].filter;
+		DWORD r = NextRandom(seed);
+		filter.name = NULL;
+		filter.priority = i;
+		filter.noAttach = FALSE;
+		SetField(filter.bInterfaceClass, USB_NO_INFO, TRUE);
+		SetField(filter.bInterfaceSubClass, USB_NO_INFO, TRUE);
+		SetField(filter.bInterfaceProtocol, USB_NO_INFO, TRUE);
+		SetField(filter.idVendor, USB_NO_INFO, TRUE);
+		SetField(filter.idProduct, USB_NO_INFO, TRUE);
+		switch (r & 0xF) {
+			case 0: case 1:
+				SetField(filter.idVendor, 0x1000 + ((r >> 4) & 0x3F), TRUE);
+				SetField(filter.bInterfaceClass, (r >> 10) & 0x1F, TRUE);
+				break;
+			case 2: case 3:
+				SetField(filter.bInterfaceClass, (r >> 4) & 0x1F, TRUE);
+				SetField(filter.bInterfaceSubClass, (r >> 9) & 0x7, TRUE);
+				SetField(filter.bInterfaceProtocol, (r >> 12) & 0xFF, TRUE);
+				break;
+			case 4:
+				SetField(filter.idVendor, 0x1000 + ((r >> 4) & 0x3F), FALSE);
+				SetField(filter.bInterfaceProtocol, (r >> 10) & 0xFF, TRUE);
+				SetField(filter.bInterfaceSubClass, (r >> 18) & 0x7, TRUE);
+				break;
+			default:
+				SetField(filter.idVendor, 0x1000 + ((r >> 4) & 0x3F), TRUE);
+				SetField(filter.idProduct, (r >> 10) & 0x3FF, TRUE);
+				break;
+		}
+		nodes[i].next = (i + 1 < dwFilters) ? &nodes[i + 1] : NULL;
+	}
+}
+
+static void MakeLookup(DWORD& seed, USB_DEVICE& device, USB_INTERFACE& iface)
+{
+	DWORD r = NextRandom(seed);
+	device.Descriptor.idVendor = static_cast<USHORT>(0x1000 + (r & 0x3F));
+	device.Descriptor.idProduct = static_cast<USHORT>((r >> 6) & 0x3FF);
+	r = NextRandom(seed);
+	iface.Descriptor.bInterfaceClass = static_cast<UCHAR>(r & 0x1F);
+	iface.Descriptor.bInterfaceSubClass = static_cast<UCHAR>((r >> 5) & 0x7);
+	iface.Descriptor.bInterfaceProtocol = static_cast<UCHAR>((r >> 8) & 0xFF);
+}
+
+static double Seconds(const struct timespec& start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void TestFilters(DWORD dwFilters)
+{
+	PFILTER_NODE nodes = new FILTER_NODE[dwFilters];
+	LPINTERFACE_FILTER* expected = new LPINTERFACE_FILTER[FILTER_LOOKUPS];
+	MakeFilters(nodes, dwFilters);
+
+	InterfaceFilterIndex index;
+	if (!index.Build(nodes)) {
+		printf("Failed to index %d filters\n", dwFilters);
+		++gFailures;
+	}
+
+	USB_DEVICE device;
+	USB_INTERFACE iface;
+	memset(&device, 0, sizeof(device));
+	memset(&iface, 0, sizeof(iface));
+
+	DWORD seed = 2;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (DWORD i = 0; i < FILTER_LOOKUPS; ++i) {
+		MakeLookup(seed, device, iface);
+		expected[i] = InterfaceFilterIndex::FindLinear(nodes, &device, &iface);
+	}
+	double linear = Seconds(start);
+
+	seed = 2;
+	DWORD mismatches = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (DWORD i = 0; i < FILTER_LOOKUPS; ++i) {
+		MakeLookup(seed, device, iface);
+		if (index.Find(&device, &iface) != expected[i])
+			++mismatches;
+	}
+	double indexed = Seconds(start);
+
+	if (mismatches) {
+		printf("%d filters: %d lookups found a different filter to the list\n", dwFilters, mismatches);
+		++gFailures;
+	}
+	printf("%8d %10.2f %10.2f\n", dwFilters, linear * 1000, indexed * 1000);
+
+	index.Clear();
+	delete [] expected;
+	delete [] nodes;
+}
+
+int main()
+{
+	static const DWORD filterCounts[] = { 1, 16, 256, 1024, 4096, 16384 };
+	printf("Timing %d interface filter lookups\n", FILTER_LOOKUPS);
+	printf("%8s %10s %10s\n", "filters", "linear ms", "index ms");
+	for (DWORD i = 0; i < sizeof(filterCounts) / sizeof(filterCounts[0]); ++i)
+		TestFilters(filterCounts[i]);
+	if (gFailures) {
+		printf("%d checks failed\n", gFailures);
+		return 1;
+	}
+	printf("All filter checks passed\n");
+	return 0;
+}
@@ -0,0 +1 @@
+// devload.h : Nothing from devload.h is needed on the host
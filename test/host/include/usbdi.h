@@ -0,0 +1,60 @@
+// usbdi.h : Minimal stand-in for the USB types used by the common header
+// and the interface filters
+
+#ifndef HOST_USBDI_H
+#define HOST_USBDI_H
+
+#include <windows.h>
+
+#define USB_NO_INFO 0xFFFFFFFF
+
+typedef struct {
+	UCHAR bLength;
+	UCHAR bDescriptorType;
+	USHORT bcdUSB;
+	UCHAR bDeviceClass;
+	UCHAR bDeviceSubClass;
+	UCHAR bDeviceProtocol;
+	UCHAR bMaxPacketSize0;
+	USHORT idVendor;
+	USHORT idProduct;
+	USHORT bcdDevice;
+	UCHAR iManufacturer;
+	UCHAR iProduct;
+	UCHAR iSerialNumber;
+	UCHAR bNumConfigurations;
+} USB_DEVICE_DESCRIPTOR;
+
+typedef struct {
+	UCHAR bmRequestType;
+	UCHAR bRequest;
+	USHORT wValue;
+	USHORT wIndex;
+	USHORT wLength;
+} USB_DEVICE_REQUEST;
+
+typedef struct {
+	UCHAR bLength;
+	UCHAR bDescriptorType;
+	UCHAR bInterfaceNumber;
+	UCHAR bAlternateSetting;
+	UCHAR bNumEndpoints;
+	UCHAR bInterfaceClass;
+	UCHAR bInterfaceSubClass;
+	UCHAR bInterfaceProtocol;
+	UCHAR iInterface;
+} USB_INTERFACE_DESCRIPTOR;
+
+typedef struct {
+	DWORD dwCount;
+	USB_DEVICE_DESCRIPTOR Descriptor;
+} USB_DEVICE, *LPUSB_DEVICE;
+typedef const USB_DEVICE* LPCUSB_DEVICE;
+
+typedef struct {
+	DWORD dwCount;
+	USB_INTERFACE_DESCRIPTOR Descriptor;
+} USB_INTERFACE, *LPUSB_INTERFACE;
+typedef const USB_INTERFACE* LPCUSB_INTERFACE;
+
+#endif // HOST_USBDI_H
@@ -0,0 +1,2 @@
+// windev.h : Nothing from windev.h is needed on the host
+#include <windows.h>
@@ -0,0 +1,72 @@
+// windows.h : Minimal stand-in for the Windows CE headers, just enough to
+// build driver code which doesn't talk to USBD on the host.
+
+#ifndef HOST_WINDOWS_H
+#define HOST_WINDOWS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint32_t DWORD, *LPDWORD;
+typedef int32_t LONG;
+typedef int BOOL, *LPBOOL;
+typedef uint8_t UCHAR, BYTE;
+typedef uint16_t USHORT, WORD;
+typedef void* LPVOID;
+typedef void* HANDLE;
+typedef wchar_t WCHAR, *LPWSTR;
+
+#define TRUE 1
+#define FALSE 0
+#define INFINITE 0xFFFFFFFF
+#define MAXDWORD 0xFFFFFFFF
+#define TEXT(s) L##s
+
+#define ERROR_SUCCESS              0
+#define ERROR_INVALID_HANDLE       6
+#define ERROR_NOT_ENOUGH_MEMORY    8
+#define ERROR_INVALID_PARAMETER    87
+#define ERROR_NOT_SUPPORTED        50
+
+typedef struct {
+	DWORD Data1;
+	WORD Data2;
+	WORD Data3;
+	BYTE Data4[8];
+} GUID;
+
+typedef struct {
+	DWORD Internal;
+	DWORD InternalHigh;
+	DWORD Offset;
+	DWORD OffsetHigh;
+	HANDLE hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+#define METHOD_BUFFERED 0
+#define FILE_ANY_ACCESS 0
+#define CTL_CODE(t, f, m, a) (((t) << 16) | ((a) << 14) | ((f) << 2) | (m))
+#define FIELD_OFFSET(type, field) ((LONG) offsetof(type, field))
+
+// Debug output is discarded
+#define DEBUGZONE(n) 0
+#define RETAILMSG(cond, msg) ((void) 0)
+#define DEBUGMSG(cond, msg) ((void) 0)
+typedef struct { int unused; } DBGPARAM;
+
+void SetLastError(DWORD dwError);
+DWORD GetLastError();
+
+inline LONG InterlockedCompareExchange(LONG volatile* p, LONG exchange, LONG comparand)
+{
+	return __sync_val_compare_and_swap(p, comparand, exchange);
+}
+
+inline LONG InterlockedExchange(LONG volatile* p, LONG value)
+{
+	__sync_synchronize();
+	return __sync_lock_test_and_set(p, value);
+}
+
+#endif // HOST_WINDOWS_H
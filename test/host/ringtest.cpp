@@ -0,0 +1,355 @@
+/* CE USB KWrapper - a USB kernel driver and user-space library
+ * Copyright (C) 2012-2013 RealVNC Ltd.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// ringtest.cpp : Host-side tests for the shared ring index handling, run
+// against the driver's SharedRingView without Windows CE or a device.
+
+#include "StdAfx.h"
+#include "SharedRingView.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Number of transfers passed through the rings by the throughput tests
+#define THROUGHPUT_TRANSFERS 20000000
+#define THROUGHPUT_ENTRIES 256
+
+static DWORD gLastError;
+static int gFailures;
+
+void SetLastError(DWORD dwError)
+{
+	gLastError = dwError;
+}
+
+DWORD GetLastError()
+{
+	return gLastError;
+}
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++gFailures; \
+		} \
+	} while (0)
+
+// A ring region laid out the way UkwCreateRings() does it
+struct Region {
+	Region(DWORD dwSubmissionEntries, DWORD dwCompletionEntries)
+	: size(UKWD_RINGS_SIZE(dwSubmissionEntries, dwCompletionEntries))
+	{
+		mem = static_cast<BYTE*>(calloc(1, size));
+		header = reinterpret_cast<LPUKWD_RINGS_HEADER>(mem);
+		header->dwSubmissionEntries = dwSubmissionEntries;
+		header->dwCompletionEntries = dwCompletionEntries;
+		submissions = reinterpret_cast<LPUKWD_BATCH_TRANSFER_ENTRY>(header + 1);
+		completions = reinterpret_cast<LPUKWD_COMPLETION>(submissions + dwSubmissionEntries);
+	}
+	~Region()
+	{
+		free(mem);
+	}
+
+	// Library side, as in UkwQueueTransfer()
+	BOOL Queue(DWORD dwTag)
+	{
+		LONG tail = header->Submission.Tail;
+		LONG head = UKWD_RING_READ_INDEX(&header->Submission.Head);
+		if (UKWD_RING_USED(tail, head) >= header->dwSubmissionEntries)
+			return FALSE;
+		UKWD_BATCH_TRANSFER_ENTRY& entry = submissions[UKWD_RING_SLOT(tail, header->dwSubmissionEntries)];
+		entry.dwType = UKWD_BATCH_BULK_TRANSFER;
+		entry.Bulk.dwDataBufferSize = dwTag;
+		UKWD_RING_WRITE_INDEX(&header->Submission.Tail, tail + 1);
+		return TRUE;
+	}
+
+	// Library side, as in UkwPeekCompletions()
+	DWORD Peek(LPUKWD_COMPLETION lpCompletions, DWORD dwCount)
+	{
+		LONG head = header->Completion.Head;
+		LONG tail = UKWD_RING_READ_INDEX(&header->Completion.Tail);
+		DWORD available = UKWD_RING_USED(tail, head);
+		if (available > header->dwCompletionEntries)
+			available = 0;
+		DWORD count = available < dwCount ? available : dwCount;
+		for (DWORD i = 0; i < count; ++i)
+			lpCompletions[i] = completions[UKWD_RING_SLOT(head + i, header->dwCompletionEntries)];
+		if (count > 0)
+			UKWD_RING_WRITE_INDEX(&header->Completion.Head, head + count);
+		return count;
+	}
+
+	BYTE* mem;
+	DWORD size;
+	LPUKWD_RINGS_HEADER header;
+	LPUKWD_BATCH_TRANSFER_ENTRY submissions;
+	LPUKWD_COMPLETION completions;
+};
+
+static UKWD_COMPLETION MakeCompletion(DWORD dwTag)
+{
+	UKWD_COMPLETION completion;
+	completion.lpOverlapped = NULL;
+	completion.dwError = ERROR_SUCCESS;
+	completion.dwBytesTransferred = dwTag;
+	return completion;
+}
+
+static void TestAttach()
+{
+	SharedRingView view;
+	{
+		Region region(8, 16);
+		CHECK(view.Attach(region.mem, region.size));
+		CHECK(!view.Attach(region.mem, region.size - 1));
+		CHECK(GetLastError() == ERROR_INVALID_PARAMETER);
+		CHECK(!view.Attach(region.mem, sizeof(UKWD_RINGS_HEADER) - 1));
+		CHECK(!view.Attach(NULL, region.size));
+	}
+	DWORD invalid[] = { 0, 3, 12, UKWD_MAX_RING_ENTRIES * 2, 0x80000000 };
+	for (DWORD i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+		Region region(8, 8);
+		region.header->dwSubmissionEntries = invalid[i];
+		CHECK(!view.Attach(region.mem, region.size));
+		region.header->dwSubmissionEntries = 8;
+		region.header->dwCompletionEntries = invalid[i];
+		CHECK(!view.Attach(region.mem, region.size));
+	}
+	{
+		// Sizes which are valid but larger than the region
+		Region region(8, 8);
+		region.header->dwCompletionEntries = 16;
+		CHECK(!view.Attach(region.mem, region.size));
+	}
+}
+
+// Passes transfers through both rings in order, starting at indices
+// which wrap part way through.
+static void TestRoundTrip(LONG start)
+{
+	Region region(8, 4);
+	region.header->Submission.Head = region.header->Submission.Tail = start;
+	region.header->Completion.Head = region.header->Completion.Tail = start;
+	SharedRingView view;
+	CHECK(view.Attach(region.mem, region.size));
+
+	DWORD queued = 0, fetched = 0, completed = 0;
+	UKWD_BATCH_TRANSFER_ENTRY entries[8];
+	UKWD_COMPLETION completions[8];
+	for (int round = 0; round < 64; ++round) {
+		while (region.Queue(queued))
+			++queued;
+		CHECK(queued - fetched == 8);
+		DWORD count = view.FetchSubmissions(entries, 3);
+		CHECK(count == 3);
+		for (DWORD i = 0; i < count; ++i) {
+			CHECK(entries[i].Bulk.dwDataBufferSize == fetched + i);
+			CHECK(view.PostCompletion(MakeCompletion(fetched + i)));
+		}
+		fetched += count;
+		CHECK(view.CompletionsPending() == 3);
+		count = region.Peek(completions, 8);
+		CHECK(count == 3);
+		for (DWORD i = 0; i < count; ++i)
+			CHECK(completions[i].dwBytesTransferred == completed + i);
+		completed += count;
+		CHECK(view.CompletionsPending() == 0);
+	}
+}
+
+static void TestFullCompletionRing()
+{
+	Region region(4, 4);
+	SharedRingView view;
+	CHECK(view.Attach(region.mem, region.size));
+	for (DWORD i = 0; i < 4; ++i)
+		CHECK(view.PostCompletion(MakeCompletion(i)));
+	CHECK(!view.PostCompletion(MakeCompletion(4)));
+	CHECK(view.CompletionsPending() == 4);
+	UKWD_COMPLETION completion;
+	CHECK(region.Peek(&completion, 1) == 1);
+	CHECK(completion.dwBytesTransferred == 0);
+	CHECK(view.PostCompletion(MakeCompletion(4)));
+}
+
+// The library can write anything to the indices it owns
+static void TestCorruptIndices()
+{
+	Region region(4, 4);
+	SharedRingView view;
+	CHECK(view.Attach(region.mem, region.size));
+	UKWD_BATCH_TRANSFER_ENTRY entries[4];
+
+	region.header->Submission.Tail = 5;
+	CHECK(view.FetchSubmissions(entries, 4) == 0);
+	region.header->Submission.Tail = -1;
+	CHECK(view.FetchSubmissions(entries, 4) == 0);
+	region.header->Submission.Tail = 4;
+	CHECK(view.FetchSubmissions(entries, 4) == 4);
+	CHECK(region.header->Submission.Head == 4);
+
+	// A completion head ahead of the tail looks like a full ring
+	region.header->Completion.Head = 1;
+	CHECK(!view.PostCompletion(MakeCompletion(0)));
+	CHECK(view.CompletionsPending() == 0);
+	region.header->Completion.Head = -100;
+	CHECK(!view.PostCompletion(MakeCompletion(0)));
+	CHECK(view.CompletionsPending() == 0);
+	region.header->Completion.Head = 0;
+	CHECK(view.PostCompletion(MakeCompletion(0)));
+	CHECK(view.CompletionsPending() == 1);
+
+	// Changing the sizes after attaching doesn't affect the driver
+	region.header->dwSubmissionEntries = 0x10000;
+	region.header->Submission.Tail = 4 + 0x1000;
+	CHECK(view.FetchSubmissions(entries, 4) == 0);
+}
+
+static double Seconds(const struct timespec& start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void TestThroughputSingleThread()
+{
+	Region region(THROUGHPUT_ENTRIES, THROUGHPUT_ENTRIES);
+	SharedRingView view;
+	CHECK(view.Attach(region.mem, region.size));
+	UKWD_BATCH_TRANSFER_ENTRY entries[THROUGHPUT_ENTRIES];
+	UKWD_COMPLETION completions[THROUGHPUT_ENTRIES];
+	DWORD queued = 0, completed = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (completed < THROUGHPUT_TRANSFERS) {
+		while (queued < THROUGHPUT_TRANSFERS && region.Queue(queued))
+			++queued;
+		DWORD count = view.FetchSubmissions(entries, THROUGHPUT_ENTRIES);
+		for (DWORD i = 0; i < count; ++i)
+			view.PostCompletion(MakeCompletion(entries[i].Bulk.dwDataBufferSize));
+		count = region.Peek(completions, THROUGHPUT_ENTRIES);
+		for (DWORD i = 0; i < count; ++i) {
+			if (completions[i].dwBytesTransferred != completed + i) {
+				CHECK(completions[i].dwBytesTransferred == completed + i);
+				return;
+			}
+		}
+		completed += count;
+	}
+	double seconds = Seconds(start);
+	printf("Single thread: %d transfers in %.2fs, %.1f million per second\n",
+		THROUGHPUT_TRANSFERS, seconds, THROUGHPUT_TRANSFERS / seconds / 1e6);
+}
+
+struct ThreadedRings {
+	Region* region;
+	SharedRingView* view;
+	volatile LONG stop;
+};
+
+// Plays the part of the driver, fetching submissions and posting them
+// straight back as completions.
+static void* DriverThread(void* lpParameter)
+{
+	ThreadedRings* rings = static_cast<ThreadedRings*>(lpParameter);
+	UKWD_BATCH_TRANSFER_ENTRY entries[THROUGHPUT_ENTRIES];
+	while (!rings->stop) {
+		// Only fetch what can be completed, as the driver would block
+		// submissions rather than lose completions.
+		DWORD space = THROUGHPUT_ENTRIES - rings->view->CompletionsPending();
+		DWORD count = rings->view->FetchSubmissions(entries, space);
+		if (count == 0)
+			// Let the other side run if there's only one processor
+			sched_yield();
+		for (DWORD i = 0; i < count; ++i) {
+			if (!rings->view->PostCompletion(MakeCompletion(entries[i].Bulk.dwDataBufferSize))) {
+				printf("Completion ring unexpectedly full\n");
+				++gFailures;
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void TestThroughputThreaded()
+{
+	Region region(THROUGHPUT_ENTRIES, THROUGHPUT_ENTRIES);
+	SharedRingView view;
+	CHECK(view.Attach(region.mem, region.size));
+	ThreadedRings rings = { &region, &view, 0 };
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, DriverThread, &rings) != 0) {
+		printf("Failed to create driver thread\n");
+		++gFailures;
+		return;
+	}
+	UKWD_COMPLETION completions[THROUGHPUT_ENTRIES];
+	DWORD queued = 0, completed = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (completed < THROUGHPUT_TRANSFERS) {
+		// Keep no more in flight than the completion ring can hold
+		while (queued < THROUGHPUT_TRANSFERS && queued - completed < THROUGHPUT_ENTRIES &&
+				region.Queue(queued))
+			++queued;
+		DWORD count = region.Peek(completions, THROUGHPUT_ENTRIES);
+		if (count == 0)
+			sched_yield();
+		for (DWORD i = 0; i < count; ++i) {
+			if (completions[i].dwBytesTransferred != completed + i) {
+				CHECK(completions[i].dwBytesTransferred == completed + i);
+				completed = THROUGHPUT_TRANSFERS;
+				break;
+			}
+		}
+		completed += count;
+	}
+	double seconds = Seconds(start);
+	rings.stop = 1;
+	pthread_join(thread, NULL);
+	printf("Two threads: %d transfers in %.2fs, %.1f million per second\n",
+		THROUGHPUT_TRANSFERS, seconds, THROUGHPUT_TRANSFERS / seconds / 1e6);
+}
+
+int main()
+{
+	TestAttach();
+	TestRoundTrip(0);
+	TestRoundTrip(0x7FFFFFF0);
+	TestRoundTrip(-5);
+	TestFullCompletionRing();
+	TestCorruptIndices();
+	if (gFailures == 0) {
+		TestThroughputSingleThread();
+		TestThroughputThreaded();
+	}
+	if (gFailures) {
+		printf("%d checks failed\n", gFailures);
+		return 1;
+	}
+	printf("All ring checks passed\n");
+	return 0;
+}